@@ -0,0 +1,470 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "animation.h"
+
+#define EASING_TABLE_SIZE 256
+
+#define container_of(ptr, type, member) ({\
+	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+static float easing_table[EASING_COUNT][EASING_TABLE_SIZE + 1];
+static bool easing_table_ready;
+
+static const char *easing_names[EASING_COUNT] = {
+	[EASING_LINEAR] = "linear",
+	[EASING_SINE] = "sine",
+	[EASING_EASE_OUT] = "ease-out",
+	[EASING_EASE_IN_OUT] = "ease-in-out",
+	[EASING_SPRING] = "spring"
+};
+
+static double easing_compute(enum shell_easing easing, double t)
+{
+	/* spring: ζ = 0.5, settled to within 0.3% at t = 1 */
+	const double zeta = 0.5, omega = 12.0;
+	double wd;
+
+	switch (easing) {
+	case EASING_SINE:
+		return sin(t * M_PI_2);
+	case EASING_EASE_OUT:
+		return 1.0 - (1.0 - t) * (1.0 - t) * (1.0 - t);
+	case EASING_EASE_IN_OUT:
+		if (t < 0.5)
+			return 4.0 * t * t * t;
+		return 1.0 - pow(-2.0 * t + 2.0, 3) / 2.0;
+	case EASING_SPRING:
+		wd = omega * sqrt(1.0 - zeta * zeta);
+		return 1.0 - exp(-zeta * omega * t) *
+			(cos(wd * t) + zeta * omega / wd * sin(wd * t));
+	case EASING_LINEAR:
+	default:
+		return t;
+	}
+}
+
+static void easing_table_init(void)
+{
+	int e, i;
+
+	if (easing_table_ready)
+		return;
+
+	for (e = 0; e < EASING_COUNT; e++) {
+		for (i = 0; i <= EASING_TABLE_SIZE; i++)
+			easing_table[e][i] =
+				easing_compute(e, (double) i / EASING_TABLE_SIZE);
+		/* make sure every curve lands exactly on its target */
+		easing_table[e][0] = 0.0f;
+		easing_table[e][EASING_TABLE_SIZE] = 1.0f;
+	}
+
+	easing_table_ready = true;
+}
+
+double shell_easing_eval(enum shell_easing easing, double t)
+{
+	double pos, frac;
+	int i;
+
+	if (t <= 0.0)
+		return 0.0;
+	if (t >= 1.0)
+		return 1.0;
+
+	pos = t * EASING_TABLE_SIZE;
+	i = (int) pos;
+	frac = pos - i;
+
+	return easing_table[easing][i] +
+		(easing_table[easing][i + 1] - easing_table[easing][i]) * frac;
+}
+
+enum shell_easing shell_easing_from_string(const char *name,
+					   enum shell_easing fallback)
+{
+	int i;
+
+	if (!name)
+		return fallback;
+
+	for (i = 0; i < EASING_COUNT; i++)
+		if (!strcmp(easing_names[i], name))
+			return i;
+
+	weston_log("unknown animation curve '%s'\n", name);
+	return fallback;
+}
+
+static uint64_t timespec_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void timeline_report(struct shell_timeline *timeline)
+{
+	if (timeline->report && timeline->stats.frames > 0)
+		weston_log("animation: %u anims over %u frames, "
+			   "avg %.1f us, max %.1f us per frame\n",
+			   timeline->stats.anims, timeline->stats.frames,
+			   timeline->stats.total_ns / 1000.0 /
+			   timeline->stats.frames,
+			   timeline->stats.max_ns / 1000.0);
+
+	memset(&timeline->stats, 0, sizeof timeline->stats);
+}
+
+static void timeline_frame(struct shell_timeline *timeline,
+			   struct weston_output *output, double time);
+
+static double clock_update(struct shell_frame_clock *clock, uint32_t msecs)
+{
+	struct weston_mode *mode = clock->output->current_mode;
+	double period = 0.0, vblank, estimate, n;
+
+	if (clock->predicted != 0.0 && msecs == clock->frame_time)
+		return clock->predicted;
+
+	if (mode && mode->refresh > 0)
+		period = 1000000.0 / mode->refresh;
+
+	/* As long as the stamps stay on the refresh cadence, carry the
+	 * previous estimate forward, pulled back into the millisecond the
+	 * stamp says. Anything else, a missed frame or a variable rate,
+	 * starts over from the stamp. */
+	vblank = msecs + 0.5;
+	if (period > 0.0 && clock->vblank != 0.0) {
+		n = round((vblank - clock->vblank) / period);
+		estimate = clock->vblank + n * period;
+		if (n >= 1.0 && fabs(estimate - vblank) < 1.0)
+			vblank = fmin(fmax(estimate, msecs), msecs + 1.0);
+	}
+
+	/* The hooks run once the output submitted its frame, so what they
+	 * set up is in the one after, a refresh after the next vblank. */
+	clock->frame_time = msecs;
+	clock->vblank = vblank;
+	clock->period = period;
+	clock->predicted = vblank + 2.0 * period;
+
+	return clock->predicted;
+}
+
+/* The animation state is shared, and what the hooks of one output set is
+ * drawn by whichever output repaints next, each right after its vblank.
+ * So sample at the time the frame of that output will be on screen; an
+ * output that missed its last two vblanks is not repainting. */
+static double clock_sample_time(struct shell_frame_clock *clock)
+{
+	struct shell_frame_clock *c, *next = clock;
+
+	wl_list_for_each(c, &clock->timeline->clocks, link) {
+		if (c == clock || wl_list_empty(&c->animation.link) ||
+		    c->period == 0.0 ||
+		    c->vblank + 2.0 * c->period < clock->vblank)
+			continue;
+
+		if (c->vblank + c->period < next->vblank + next->period)
+			next = c;
+	}
+
+	return next->predicted;
+}
+
+static void clock_frame(struct weston_animation *animation,
+			struct weston_output *output, uint32_t msecs)
+{
+	struct shell_frame_clock *clock =
+		container_of(animation, struct shell_frame_clock, animation);
+
+	clock_update(clock, msecs);
+	timeline_frame(clock->timeline, output, clock_sample_time(clock));
+}
+
+static struct shell_frame_clock *
+timeline_clock(struct shell_timeline *timeline, struct weston_output *output)
+{
+	struct shell_frame_clock *clock;
+
+	wl_list_for_each(clock, &timeline->clocks, link)
+		if (clock->output == output)
+			return clock;
+
+	clock = zalloc(sizeof *clock);
+	if (clock == NULL)
+		return NULL;
+
+	clock->timeline = timeline;
+	clock->output = output;
+	clock->animation.frame = clock_frame;
+	wl_list_init(&clock->animation.link);
+	wl_list_insert(&timeline->clocks, &clock->link);
+
+	return clock;
+}
+
+static void clock_destroy(struct shell_frame_clock *clock)
+{
+	wl_list_remove(&clock->animation.link);
+	wl_list_remove(&clock->link);
+	free(clock);
+}
+
+static void timeline_detach(struct shell_timeline *timeline)
+{
+	struct shell_frame_clock *clock;
+
+	wl_list_for_each(clock, &timeline->clocks, link) {
+		wl_list_remove(&clock->animation.link);
+		wl_list_init(&clock->animation.link);
+	}
+}
+
+static void timeline_schedule(struct shell_timeline *timeline)
+{
+	struct shell_frame_clock *clock;
+	struct weston_output *output;
+
+	wl_list_for_each(output, &timeline->compositor->output_list, link) {
+		clock = timeline_clock(timeline, output);
+		if (clock == NULL)
+			continue;
+
+		if (wl_list_empty(&clock->animation.link))
+			wl_list_insert(&output->animation_list,
+				       &clock->animation.link);
+		weston_output_schedule_repaint(output);
+	}
+}
+
+static double anim_value_at(struct shell_anim *anim, double progress)
+{
+	return anim->from + (anim->to - anim->from) *
+		shell_easing_eval(anim->easing, progress);
+}
+
+/* Returns true once the animation reached the end it is heading for.
+ * Outputs at different rates take turns and sample times need not come in
+ * order, so the progress is worked out from the start each time rather
+ * than stepped from the last sample. */
+static bool anim_advance(struct shell_anim *anim, double time)
+{
+	if (anim->base_time == 0.0 || anim->duration == 0) {
+		anim->base_time = time;
+		anim->base = anim->progress;
+		if (anim->duration == 0)
+			anim->progress = anim->dir > 0 ? 1.0 : 0.0;
+	} else {
+		anim->progress = anim->base + anim->dir *
+			(time - anim->base_time) / anim->duration;
+	}
+	anim->timestamp = time;
+
+	if (anim->progress >= 1.0) {
+		anim->progress = 1.0;
+		return anim->dir > 0;
+	} else if (anim->progress <= 0.0) {
+		anim->progress = 0.0;
+		return anim->dir < 0;
+	}
+
+	return false;
+}
+
+static void timeline_frame(struct shell_timeline *timeline,
+			   struct weston_output *output, double time)
+{
+	struct shell_anim *anim, *next;
+	struct wl_list finished;
+	struct timespec start, end;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	wl_list_init(&finished);
+	wl_list_for_each_safe(anim, next, &timeline->active, link) {
+		bool done = anim_advance(anim, time);
+
+		anim->frame(anim, anim_value_at(anim, anim->progress));
+
+		/* the frame callback stopped it */
+		if (wl_list_empty(&anim->link))
+			continue;
+
+		if (done) {
+			wl_list_remove(&anim->link);
+			wl_list_insert(finished.prev, &anim->link);
+		}
+	}
+
+	/* Completion callbacks may start, chain or stop other animations,
+	 * so only run them once the batch is through. */
+	while (!wl_list_empty(&finished)) {
+		anim = container_of(finished.next, struct shell_anim, link);
+		wl_list_remove(&anim->link);
+		wl_list_init(&anim->link);
+
+		if (anim->chain && anim->dir > 0) {
+			next = anim->chain;
+			anim->chain = NULL;
+			shell_anim_start(next, next->from, next->to);
+		}
+
+		if (anim->done)
+			anim->done(anim);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = timespec_to_nsec(&end) - timespec_to_nsec(&start);
+	timeline->stats.frames++;
+	timeline->stats.total_ns += ns;
+	if (ns > timeline->stats.max_ns)
+		timeline->stats.max_ns = ns;
+
+	/* the last values still have to reach every output */
+	if (wl_list_empty(&timeline->active)) {
+		timeline_detach(timeline);
+		timeline_report(timeline);
+		weston_compositor_schedule_repaint(timeline->compositor);
+	} else {
+		weston_output_schedule_repaint(output);
+	}
+}
+
+void shell_timeline_init(struct shell_timeline *timeline,
+			 struct weston_compositor *compositor)
+{
+	easing_table_init();
+
+	memset(timeline, 0, sizeof *timeline);
+	timeline->compositor = compositor;
+	wl_list_init(&timeline->clocks);
+	wl_list_init(&timeline->active);
+}
+
+void shell_timeline_release(struct shell_timeline *timeline)
+{
+	struct shell_frame_clock *clock, *tmp;
+	struct shell_anim *anim, *next;
+
+	wl_list_for_each_safe(anim, next, &timeline->active, link) {
+		wl_list_remove(&anim->link);
+		wl_list_init(&anim->link);
+	}
+
+	wl_list_for_each_safe(clock, tmp, &timeline->clocks, link)
+		clock_destroy(clock);
+}
+
+void shell_timeline_output_destroyed(struct shell_timeline *timeline,
+				     struct weston_output *output)
+{
+	struct shell_frame_clock *clock;
+
+	wl_list_for_each(clock, &timeline->clocks, link) {
+		if (clock->output == output) {
+			clock_destroy(clock);
+			return;
+		}
+	}
+}
+
+double shell_timeline_frame_time(struct shell_timeline *timeline,
+				 struct weston_output *output, uint32_t msecs)
+{
+	struct shell_frame_clock *clock = timeline_clock(timeline, output);
+
+	if (clock == NULL)
+		return msecs;
+
+	return clock_update(clock, msecs);
+}
+
+void shell_anim_init(struct shell_anim *anim, struct shell_timeline *timeline,
+		     const struct shell_anim_config *config,
+		     shell_anim_frame_func_t frame,
+		     shell_anim_done_func_t done)
+{
+	memset(anim, 0, sizeof *anim);
+	anim->timeline = timeline;
+	anim->duration = config->duration;
+	anim->easing = config->easing;
+	anim->frame = frame;
+	anim->done = done;
+	anim->dir = 1;
+	wl_list_init(&anim->link);
+}
+
+void shell_anim_start(struct shell_anim *anim, double from, double to)
+{
+	struct shell_timeline *timeline = anim->timeline;
+
+	anim->from = from;
+	anim->to = to;
+	anim->progress = 0.0;
+	anim->dir = 1;
+	anim->base_time = 0.0;
+
+	if (wl_list_empty(&anim->link)) {
+		wl_list_insert(timeline->active.prev, &anim->link);
+		timeline->stats.anims++;
+	}
+
+	timeline_schedule(timeline);
+}
+
+/* Interrupt a running animation and head for a new target from wherever it
+ * currently is, without a jump. */
+void shell_anim_retarget(struct shell_anim *anim, double to)
+{
+	shell_anim_start(anim, shell_anim_value(anim), to);
+}
+
+/* Play the animation back towards its start along the same curve. */
+void shell_anim_reverse(struct shell_anim *anim)
+{
+	anim->dir = -anim->dir;
+
+	/* turn around where the last frame left it */
+	if (anim->base_time != 0.0) {
+		anim->base = anim->progress;
+		anim->base_time = anim->timestamp;
+	}
+
+	if (wl_list_empty(&anim->link)) {
+		wl_list_insert(anim->timeline->active.prev, &anim->link);
+		anim->timeline->stats.anims++;
+		anim->base_time = 0.0;
+	}
+
+	timeline_schedule(anim->timeline);
+}
+
+void shell_anim_stop(struct shell_anim *anim)
+{
+	wl_list_remove(&anim->link);
+	wl_list_init(&anim->link);
+	anim->chain = NULL;
+}
+
+void shell_anim_chain(struct shell_anim *anim, struct shell_anim *next,
+		      double from, double to)
+{
+	next->from = from;
+	next->to = to;
+	anim->chain = next;
+}
+
+bool shell_anim_is_running(struct shell_anim *anim)
+{
+	return !wl_list_empty(&anim->link);
+}
+
+double shell_anim_value(struct shell_anim *anim)
+{
+	return anim_value_at(anim, anim->progress);
+}
@@ -0,0 +1,123 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <weston/compositor.h>
+
+enum shell_easing {
+	EASING_LINEAR,
+	EASING_SINE,		/* sin(x * π/2), the classic workspace slide */
+	EASING_EASE_OUT,
+	EASING_EASE_IN_OUT,
+	EASING_SPRING,		/* under-damped, overshoots slightly */
+
+	EASING_COUNT
+};
+
+struct shell_anim;
+struct shell_timeline;
+
+typedef void (*shell_anim_frame_func_t)(struct shell_anim *anim, double value);
+typedef void (*shell_anim_done_func_t)(struct shell_anim *anim);
+
+/* One animated scalar. Embed it in whatever owns the animation and recover
+ * the owner with container_of() in the callbacks. */
+struct shell_anim {
+	struct shell_timeline *timeline;
+	struct wl_list link;		/* shell_timeline::active */
+
+	enum shell_easing easing;
+	uint32_t duration;		/* milliseconds */
+	shell_anim_frame_func_t frame;
+	shell_anim_done_func_t done;
+
+	double from, to;
+	double progress;		/* linear time, 0 to 1, at timestamp */
+	int dir;			/* 1 forward, -1 reversed */
+	double timestamp;		/* ms of the last sample */
+	double base, base_time;		/* progress at base_time, which is
+					 * 0 until the first frame */
+
+	struct shell_anim *chain;	/* started when this one completes */
+};
+
+/* Follows when the frames of one output reach the screen. weston only
+ * hands out the last presentation time truncated to the millisecond, so
+ * the clock keeps its own estimate locked to the refresh cadence. */
+struct shell_frame_clock {
+	struct shell_timeline *timeline;
+	struct weston_output *output;
+	struct weston_animation animation;
+	struct wl_list link;		/* shell_timeline::clocks */
+
+	uint32_t frame_time;		/* as weston last passed it */
+	double vblank;			/* the same, on the cadence */
+	double period;
+	double predicted;
+};
+
+/* Drives every running shell_anim from the repaint of each output, so all
+ * shell animations advance in one batch per output frame. The values set
+ * are for the time the frame of whichever output repaints next will be on
+ * screen. Every output repaints while anything runs, so frame callbacks
+ * need not schedule repaints themselves. */
+struct shell_timeline {
+	struct weston_compositor *compositor;
+	struct wl_list clocks;		/* shell_frame_clock::link */
+	struct wl_list active;
+
+	bool report;
+	struct {
+		uint32_t frames;
+		uint32_t anims;
+		uint64_t total_ns;
+		uint64_t max_ns;
+	} stats;
+};
+
+struct shell_anim_config {
+	uint32_t duration;
+	enum shell_easing easing;
+};
+
+void shell_timeline_init(struct shell_timeline *timeline,
+			 struct weston_compositor *compositor);
+
+void shell_timeline_release(struct shell_timeline *timeline);
+
+void shell_timeline_output_destroyed(struct shell_timeline *timeline,
+				     struct weston_output *output);
+
+/* When what an animation hook of the output draws now will be on screen,
+ * in milliseconds on the clock of msecs. */
+double shell_timeline_frame_time(struct shell_timeline *timeline,
+				 struct weston_output *output, uint32_t msecs);
+
+void shell_anim_init(struct shell_anim *anim, struct shell_timeline *timeline,
+		     const struct shell_anim_config *config,
+		     shell_anim_frame_func_t frame,
+		     shell_anim_done_func_t done);
+
+void shell_anim_start(struct shell_anim *anim, double from, double to);
+
+void shell_anim_retarget(struct shell_anim *anim, double to);
+
+void shell_anim_reverse(struct shell_anim *anim);
+
+void shell_anim_stop(struct shell_anim *anim);
+
+void shell_anim_chain(struct shell_anim *anim, struct shell_anim *next,
+		      double from, double to);
+
+bool shell_anim_is_running(struct shell_anim *anim);
+
+double shell_anim_value(struct shell_anim *anim);
+
+double shell_easing_eval(enum shell_easing easing, double t);
+
+enum shell_easing shell_easing_from_string(const char *name,
+					   enum shell_easing fallback);
+
+#endif
@@ -0,0 +1,323 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <weston/compositor.h>
+
+#include "dump.h"
+
+#define DUMP_CHUNK 65536
+
+struct dump_file {
+	struct shell_dump *dump;
+	struct wl_list link;
+	char *path;
+	int fd;
+	char *data;
+	size_t len, offset;
+	struct wl_event_source *timer;
+};
+
+void shell_json_init(struct shell_json *json)
+{
+	memset(json, 0, sizeof *json);
+}
+
+void shell_json_release(struct shell_json *json)
+{
+	free(json->data);
+	shell_json_init(json);
+}
+
+static void json_reserve(struct shell_json *json, size_t len)
+{
+	size_t alloc;
+	char *data;
+
+	if (json->failed || json->len + len <= json->alloc)
+		return;
+
+	alloc = json->alloc ? json->alloc : 4096;
+	while (alloc < json->len + len)
+		alloc *= 2;
+
+	data = realloc(json->data, alloc);
+	if (data == NULL) {
+		json->failed = true;
+		return;
+	}
+
+	json->data = data;
+	json->alloc = alloc;
+}
+
+static void json_append(struct shell_json *json, const char *s, size_t len)
+{
+	json_reserve(json, len);
+	if (json->failed)
+		return;
+
+	memcpy(json->data + json->len, s, len);
+	json->len += len;
+}
+
+static void json_printf(struct shell_json *json, const char *fmt, ...)
+	WL_PRINTF(2, 3);
+
+static void json_printf(struct shell_json *json, const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+
+	if (len > 0)
+		json_append(json, buf, (size_t) len < sizeof buf ?
+			    (size_t) len : sizeof buf - 1);
+}
+
+static void json_quote(struct shell_json *json, const char *s)
+{
+	const unsigned char *p;
+	size_t run;
+
+	json_append(json, "\"", 1);
+	for (p = (const unsigned char *) s; *p; p += run) {
+		run = strcspn((const char *) p, "\"\\\b\f\n\r\t"
+			      "\x01\x02\x03\x04\x05\x06\x07\x0b\x0e\x0f"
+			      "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19"
+			      "\x1a\x1b\x1c\x1d\x1e\x1f");
+		json_append(json, (const char *) p, run);
+		if (p[run] == '\0')
+			break;
+
+		switch (p[run]) {
+		case '"':
+		case '\\':
+			json_printf(json, "\\%c", p[run]);
+			break;
+		case '\n':
+			json_append(json, "\\n", 2);
+			break;
+		case '\t':
+			json_append(json, "\\t", 2);
+			break;
+		default:
+			json_printf(json, "\\u%04x", p[run]);
+			break;
+		}
+		run++;
+	}
+	json_append(json, "\"", 1);
+}
+
+/* the separator and key every value starts with */
+static void json_member(struct shell_json *json, const char *key)
+{
+	uint32_t bit = 1u << json->depth;
+
+	if (json->has_members & bit)
+		json_append(json, ",", 1);
+	json->has_members |= bit;
+
+	if (key) {
+		json_quote(json, key);
+		json_append(json, ":", 1);
+	}
+}
+
+static void json_open(struct shell_json *json, const char *key, char c)
+{
+	if (json->depth + 1 >= SHELL_JSON_MAX_DEPTH) {
+		json->failed = true;
+		return;
+	}
+
+	json_member(json, key);
+	json_append(json, &c, 1);
+	json->depth++;
+	json->has_members &= ~(1u << json->depth);
+}
+
+static void json_close(struct shell_json *json, char c)
+{
+	if (json->depth == 0) {
+		json->failed = true;
+		return;
+	}
+
+	json->depth--;
+	json_append(json, &c, 1);
+}
+
+void shell_json_begin_object(struct shell_json *json, const char *key)
+{
+	json_open(json, key, '{');
+}
+
+void shell_json_end_object(struct shell_json *json)
+{
+	json_close(json, '}');
+}
+
+void shell_json_begin_array(struct shell_json *json, const char *key)
+{
+	json_open(json, key, '[');
+}
+
+void shell_json_end_array(struct shell_json *json)
+{
+	json_close(json, ']');
+}
+
+void shell_json_string(struct shell_json *json, const char *key,
+		       const char *value)
+{
+	json_member(json, key);
+	if (value)
+		json_quote(json, value);
+	else
+		json_append(json, "null", 4);
+}
+
+void shell_json_int(struct shell_json *json, const char *key, int64_t value)
+{
+	json_member(json, key);
+	json_printf(json, "%lld", (long long) value);
+}
+
+void shell_json_double(struct shell_json *json, const char *key, double value)
+{
+	json_member(json, key);
+	if (isnan(value) || isinf(value))
+		json_append(json, "null", 4);
+	else
+		json_printf(json, "%.6g", value);
+}
+
+void shell_json_bool(struct shell_json *json, const char *key, bool value)
+{
+	json_member(json, key);
+	if (value)
+		json_append(json, "true", 4);
+	else
+		json_append(json, "false", 5);
+}
+
+static void dump_file_destroy(struct dump_file *file)
+{
+	wl_list_remove(&file->link);
+	if (file->timer)
+		wl_event_source_remove(file->timer);
+	close(file->fd);
+	free(file->data);
+	free(file->path);
+	free(file);
+}
+
+/* Returns whether there is more to write. */
+static bool dump_file_write(struct dump_file *file, size_t max)
+{
+	size_t len = file->len - file->offset;
+	ssize_t ret;
+
+	if (len > max)
+		len = max;
+
+	ret = write(file->fd, file->data + file->offset, len);
+	if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+		weston_log("dump: writing %s: %m\n", file->path);
+		return false;
+	}
+
+	if (ret > 0)
+		file->offset += ret;
+
+	return file->offset < file->len;
+}
+
+static int dump_file_timer(void *data)
+{
+	struct dump_file *file = data;
+
+	if (dump_file_write(file, DUMP_CHUNK)) {
+		wl_event_source_timer_update(file->timer, 1);
+		return 0;
+	}
+
+	if (file->offset == file->len)
+		weston_log("dump: wrote %s\n", file->path);
+	dump_file_destroy(file);
+	return 0;
+}
+
+void shell_dump_init(struct shell_dump *dump, struct wl_event_loop *loop)
+{
+	dump->loop = loop;
+	wl_list_init(&dump->pending);
+}
+
+void shell_dump_release(struct shell_dump *dump)
+{
+	struct dump_file *file, *next;
+
+	wl_list_for_each_safe(file, next, &dump->pending, link) {
+		while (dump_file_write(file, file->len))
+			;
+		dump_file_destroy(file);
+	}
+}
+
+int shell_dump_save(struct shell_dump *dump, struct shell_json *json,
+		    const char *path)
+{
+	struct dump_file *file;
+
+	if (json->failed || json->depth != 0) {
+		weston_log("dump: document for %s incomplete\n", path);
+		shell_json_release(json);
+		return -1;
+	}
+
+	file = zalloc(sizeof *file);
+	if (file == NULL) {
+		shell_json_release(json);
+		return -1;
+	}
+
+	file->dump = dump;
+	file->path = strdup(path);
+	file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+			O_NONBLOCK, 0600);
+	file->timer = wl_event_loop_add_timer(dump->loop, dump_file_timer,
+					      file);
+	if (file->path == NULL || file->fd < 0 || file->timer == NULL) {
+		weston_log("dump: cannot write %s: %m\n", path);
+		if (file->fd >= 0)
+			close(file->fd);
+		if (file->timer)
+			wl_event_source_remove(file->timer);
+		free(file->path);
+		free(file);
+		shell_json_release(json);
+		return -1;
+	}
+
+	/* the document moves to the file */
+	file->data = json->data;
+	file->len = json->len;
+	shell_json_init(json);
+
+	wl_list_insert(&dump->pending, &file->link);
+	wl_event_source_timer_update(file->timer, 1);
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-server.h>
+
+#define SHELL_JSON_MAX_DEPTH 32
+
+/* Builds a JSON document in memory. Members of objects take a key,
+ * elements of arrays NULL; once anything failed the document is dropped
+ * and every further call does nothing. */
+struct shell_json {
+	char *data;
+	size_t len, alloc;
+	unsigned int depth;
+	uint32_t has_members;	/* bit per depth */
+	bool failed;
+};
+
+void shell_json_init(struct shell_json *json);
+
+void shell_json_release(struct shell_json *json);
+
+void shell_json_begin_object(struct shell_json *json, const char *key);
+
+void shell_json_end_object(struct shell_json *json);
+
+void shell_json_begin_array(struct shell_json *json, const char *key);
+
+void shell_json_end_array(struct shell_json *json);
+
+void shell_json_string(struct shell_json *json, const char *key,
+		       const char *value);
+
+void shell_json_int(struct shell_json *json, const char *key, int64_t value);
+
+void shell_json_double(struct shell_json *json, const char *key, double value);
+
+void shell_json_bool(struct shell_json *json, const char *key, bool value);
+
+/* Writes finished documents to files a chunk per event loop iteration,
+ * so even a large one never holds up a frame. */
+struct shell_dump {
+	struct wl_event_loop *loop;
+	struct wl_list pending;		/* struct dump_file */
+};
+
+void shell_dump_init(struct shell_dump *dump, struct wl_event_loop *loop);
+
+/* finishes whatever is still being written */
+void shell_dump_release(struct shell_dump *dump);
+
+/* Takes over the document, which is left empty. */
+int shell_dump_save(struct shell_dump *dump, struct shell_json *json,
+		    const char *path);
+
+#endif
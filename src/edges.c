@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "edges.h"
+
+static unsigned int edge_lower_bound(const struct shell_edge_list *list,
+				     int32_t pos)
+{
+	unsigned int lo = 0, hi = list->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (list->edges[mid].pos < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool edge_list_insert(struct shell_edge_list *list,
+			     const struct shell_edge *edge)
+{
+	struct shell_edge *edges;
+	unsigned int i, alloc;
+
+	if (list->count == list->alloc) {
+		alloc = list->alloc ? list->alloc * 2 : 32;
+		edges = realloc(list->edges, alloc * sizeof *edges);
+		if (!edges)
+			return false;
+
+		list->edges = edges;
+		list->alloc = alloc;
+	}
+
+	i = edge_lower_bound(list, edge->pos);
+	memmove(&list->edges[i + 1], &list->edges[i],
+		(list->count - i) * sizeof *list->edges);
+	list->edges[i] = *edge;
+	list->count++;
+
+	return true;
+}
+
+static void edge_list_remove(struct shell_edge_list *list,
+			     const struct shell_edge *edge)
+{
+	unsigned int i;
+
+	for (i = edge_lower_bound(list, edge->pos);
+	     i < list->count && list->edges[i].pos == edge->pos; i++) {
+		if (list->edges[i].owner != edge->owner ||
+		    list->edges[i].start != edge->start ||
+		    list->edges[i].end != edge->end)
+			continue;
+
+		memmove(&list->edges[i], &list->edges[i + 1],
+			(list->count - i - 1) * sizeof *list->edges);
+		list->count--;
+		return;
+	}
+}
+
+/* Distance from pos to the closest edge within threshold whose span
+ * comes within threshold of [start, end]. */
+static bool edge_list_nearest(const struct shell_edge_list *list,
+			      int32_t pos, int32_t start, int32_t end,
+			      int32_t threshold, const void *owner,
+			      int32_t *delta)
+{
+	const struct shell_edge *edge;
+	unsigned int i;
+	int32_t d;
+	bool found = false;
+
+	for (i = edge_lower_bound(list, pos - threshold);
+	     i < list->count && list->edges[i].pos <= pos + threshold; i++) {
+		edge = &list->edges[i];
+		if ((owner && edge->owner == owner) ||
+		    edge->start > end + threshold ||
+		    edge->end < start - threshold)
+			continue;
+
+		d = edge->pos - pos;
+		if (!found || abs(d) < abs(*delta)) {
+			*delta = d;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+static void box_edges(const pixman_box32_t *box, const void *owner,
+		      struct shell_edge x[2], struct shell_edge y[2])
+{
+	x[0] = (struct shell_edge) { box->x1, box->y1, box->y2, owner };
+	x[1] = (struct shell_edge) { box->x2, box->y1, box->y2, owner };
+	y[0] = (struct shell_edge) { box->y1, box->x1, box->x2, owner };
+	y[1] = (struct shell_edge) { box->y2, box->x1, box->x2, owner };
+}
+
+void shell_edges_init(struct shell_edges *edges)
+{
+	memset(edges, 0, sizeof *edges);
+}
+
+void shell_edges_release(struct shell_edges *edges)
+{
+	free(edges->x.edges);
+	free(edges->y.edges);
+	memset(edges, 0, sizeof *edges);
+}
+
+void shell_edges_reset(struct shell_edges *edges, const pixman_box32_t *area)
+{
+	edges->x.count = 0;
+	edges->y.count = 0;
+	edges->area = *area;
+	edges->valid = true;
+
+	shell_edges_add(edges, area, NULL);
+}
+
+void shell_edges_invalidate(struct shell_edges *edges)
+{
+	edges->valid = false;
+}
+
+void shell_edges_add(struct shell_edges *edges, const pixman_box32_t *box,
+		     const void *owner)
+{
+	struct shell_edge x[2], y[2];
+	int i;
+
+	if (!edges->valid ||
+	    box->x1 >= edges->area.x2 || box->x2 <= edges->area.x1 ||
+	    box->y1 >= edges->area.y2 || box->y2 <= edges->area.y1)
+		return;
+
+	box_edges(box, owner, x, y);
+	for (i = 0; i < 2; i++) {
+		if (!edge_list_insert(&edges->x, &x[i]) ||
+		    !edge_list_insert(&edges->y, &y[i])) {
+			edges->valid = false;
+			return;
+		}
+	}
+}
+
+void shell_edges_remove(struct shell_edges *edges, const pixman_box32_t *box,
+			const void *owner)
+{
+	struct shell_edge x[2], y[2];
+	int i;
+
+	if (!edges->valid)
+		return;
+
+	box_edges(box, owner, x, y);
+	for (i = 0; i < 2; i++) {
+		edge_list_remove(&edges->x, &x[i]);
+		edge_list_remove(&edges->y, &y[i]);
+	}
+}
+
+/* How far box has to move for one of its sides to line up with the
+ * closest edge not belonging to owner, per axis. */
+bool shell_edges_snap(struct shell_edges *edges, const pixman_box32_t *box,
+		      int32_t threshold, const void *owner,
+		      int32_t *dx, int32_t *dy)
+{
+	int32_t d1, d2;
+	bool found1, found2;
+
+	*dx = *dy = 0;
+
+	found1 = edge_list_nearest(&edges->x, box->x1, box->y1, box->y2,
+				   threshold, owner, &d1);
+	found2 = edge_list_nearest(&edges->x, box->x2, box->y1, box->y2,
+				   threshold, owner, &d2);
+	if (found1 && (!found2 || abs(d1) <= abs(d2)))
+		*dx = d1;
+	else if (found2)
+		*dx = d2;
+
+	found1 = edge_list_nearest(&edges->y, box->y1, box->x1, box->x2,
+				   threshold, owner, &d1);
+	found2 = edge_list_nearest(&edges->y, box->y2, box->x1, box->x2,
+				   threshold, owner, &d2);
+	if (found1 && (!found2 || abs(d1) <= abs(d2)))
+		*dy = d1;
+	else if (found2)
+		*dy = d2;
+
+	return *dx != 0 || *dy != 0;
+}
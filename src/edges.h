@@ -0,0 +1,49 @@
+#ifndef EDGES_H
+#define EDGES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pixman.h>
+
+/* One side of a window or output: a segment at pos spanning
+ * [start, end] along the other axis. */
+struct shell_edge {
+	int32_t pos, start, end;
+	const void *owner;	/* NULL for the output's own edges */
+};
+
+struct shell_edge_list {
+	struct shell_edge *edges;	/* sorted by pos */
+	unsigned int count, alloc;
+};
+
+/* The edges on one output, vertical ones in x and horizontal ones in y.
+ * Windows that come, go, move or resize add, remove or replace their own
+ * edges in place; anything else makes the owner invalidate the set and
+ * rebuild it from scratch the next time it is needed. */
+struct shell_edges {
+	struct shell_edge_list x, y;
+	pixman_box32_t area;
+	bool valid;
+};
+
+void shell_edges_init(struct shell_edges *edges);
+
+void shell_edges_release(struct shell_edges *edges);
+
+void shell_edges_reset(struct shell_edges *edges, const pixman_box32_t *area);
+
+void shell_edges_invalidate(struct shell_edges *edges);
+
+void shell_edges_add(struct shell_edges *edges, const pixman_box32_t *box,
+		     const void *owner);
+
+void shell_edges_remove(struct shell_edges *edges, const pixman_box32_t *box,
+			const void *owner);
+
+bool shell_edges_snap(struct shell_edges *edges, const pixman_box32_t *box,
+		      int32_t threshold, const void *owner,
+		      int32_t *dx, int32_t *dy);
+
+#endif
@@ -0,0 +1,634 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <weston/compositor.h>
+
+#include "ipc.h"
+
+#define IPC_MAX_CLIENTS 32
+#define IPC_MAX_LINE 4096
+#define IPC_MAX_ARGS 32
+/* a client this far behind gets no events and no more commands run until
+ * it catches up */
+#define IPC_MAX_OUTPUT 65536
+#define IPC_MAX_QUEUED 256
+
+#define container_of(ptr, type, member) ({\
+	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+struct ipc_event {
+	struct wl_list link;
+	enum shell_ipc_event_type type;
+	uint32_t id;
+	uint32_t field;
+	char *text;
+};
+
+struct shell_ipc_client {
+	struct shell_ipc *ipc;
+	struct wl_list link;
+	int fd;
+	struct wl_event_source *source;
+	bool writable;		/* waiting for the socket to take more */
+	bool readable;		/* caught up, taking commands */
+	bool dead;		/* destroyed once out of its handler */
+
+	char in[IPC_MAX_LINE];
+	size_t in_len;
+
+	char *out;
+	size_t out_len, out_alloc;
+
+	/* subscriptions */
+	uint32_t mask;		/* 1 << enum shell_ipc_event_type */
+	char *app_id;		/* only windows matching this, if set */
+
+	struct wl_list events;	/* struct ipc_event, oldest first */
+	unsigned int event_count;
+	bool overflow;		/* events were dropped, tell it */
+};
+
+static const char *event_names[SHELL_IPC_EVENT_COUNT] = {
+	[SHELL_IPC_EVENT_WORKSPACE] = "workspace",
+	[SHELL_IPC_EVENT_WINDOW] = "window",
+};
+
+static void event_destroy(struct shell_ipc_client *client,
+			  struct ipc_event *event)
+{
+	wl_list_remove(&event->link);
+	free(event->text);
+	free(event);
+	client->event_count--;
+}
+
+static void client_drop_events(struct shell_ipc_client *client)
+{
+	struct ipc_event *event, *next;
+
+	wl_list_for_each_safe(event, next, &client->events, link)
+		event_destroy(client, event);
+}
+
+static void client_destroy(struct shell_ipc_client *client)
+{
+	client_drop_events(client);
+	wl_event_source_remove(client->source);
+	close(client->fd);
+	wl_list_remove(&client->link);
+	client->ipc->client_count--;
+	free(client->app_id);
+	free(client->out);
+	free(client);
+}
+
+/* Appends to the output buffer unless that would grow it past limit. */
+static bool client_write_buffer(struct shell_ipc_client *client,
+				const char *data, size_t len, size_t limit)
+{
+	size_t alloc;
+	char *out;
+
+	if (client->out_len + len > limit)
+		return false;
+
+	if (client->out_len + len > client->out_alloc) {
+		alloc = client->out_alloc ? client->out_alloc : 4096;
+		while (alloc < client->out_len + len)
+			alloc *= 2;
+
+		out = realloc(client->out, alloc);
+		if (!out)
+			return false;
+		client->out = out;
+		client->out_alloc = alloc;
+	}
+
+	memcpy(client->out + client->out_len, data, len);
+	client->out_len += len;
+	return true;
+}
+
+static bool client_is_behind(struct shell_ipc_client *client)
+{
+	return client->out_len >= IPC_MAX_OUTPUT;
+}
+
+/* A client behind on its output is not read from until it caught up, so
+ * its commands wait in the socket rather than in our memory. */
+static void client_update_mask(struct shell_ipc_client *client)
+{
+	bool writable = client->out_len > 0;
+	bool readable = !client_is_behind(client);
+	uint32_t mask = 0;
+
+	if (client->writable == writable && client->readable == readable)
+		return;
+
+	client->writable = writable;
+	client->readable = readable;
+	if (readable)
+		mask |= WL_EVENT_READABLE;
+	if (writable)
+		mask |= WL_EVENT_WRITABLE;
+	wl_event_source_fd_update(client->source, mask);
+}
+
+/* Writes what the socket takes of the buffer. */
+static void client_send(struct shell_ipc_client *client)
+{
+	ssize_t written;
+
+	while (!client->dead && client->out_len > 0) {
+		written = send(client->fd, client->out, client->out_len,
+			       MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				client->dead = true;
+			return;
+		}
+
+		memmove(client->out, client->out + written,
+			client->out_len - written);
+		client->out_len -= written;
+	}
+}
+
+/* Writes what the socket takes, topping the buffer up with queued events
+ * as it empties. Events only go in below the limit; replies always do. */
+static void client_flush(struct shell_ipc_client *client)
+{
+	struct ipc_event *event;
+	char line[IPC_MAX_LINE + 16];
+	size_t before;
+	int len;
+
+	while (!client->dead) {
+		if (client->overflow &&
+		    client_write_buffer(client, "event overflow\n", 15,
+					IPC_MAX_OUTPUT))
+			client->overflow = false;
+
+		while (!client->overflow && !wl_list_empty(&client->events)) {
+			event = container_of(client->events.next,
+					     struct ipc_event, link);
+			len = snprintf(line, sizeof line, "event %s %s\n",
+				       event_names[event->type], event->text);
+			if (len >= (int) sizeof line)
+				len = sizeof line - 1;
+			if (!client_write_buffer(client, line, len,
+						 IPC_MAX_OUTPUT))
+				break;
+			event_destroy(client, event);
+		}
+
+		before = client->out_len;
+		client_send(client);
+		if (client->out_len == before ||
+		    (client->out_len == 0 && wl_list_empty(&client->events)))
+			break;
+	}
+
+	client_update_mask(client);
+}
+
+static void flush_idle(void *data)
+{
+	struct shell_ipc *ipc = data;
+	struct shell_ipc_client *client, *next;
+
+	ipc->idle = NULL;
+	wl_list_for_each_safe(client, next, &ipc->client_list, link) {
+		client_flush(client);
+		if (client->dead)
+			client_destroy(client);
+	}
+}
+
+/* Everything emitted during one dispatch goes out together. */
+static void ipc_schedule_flush(struct shell_ipc *ipc)
+{
+	if (ipc->idle)
+		return;
+
+	ipc->idle = wl_event_loop_add_idle(ipc->loop, flush_idle, ipc);
+}
+
+/* Titles and app_ids come from clients; a newline in one would start a
+ * line of its own. */
+static void strip_control(char *s)
+{
+	for (; *s; s++)
+		if ((unsigned char) *s < 0x20 || *s == 0x7f)
+			*s = ' ';
+}
+
+/* A long reply, like the tree of a large session, goes out as it is
+ * built rather than all at once. */
+void shell_ipc_reply(struct shell_ipc_client *client, const char *fmt, ...)
+{
+	char line[IPC_MAX_LINE];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof line - 1, fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+	if (len > (int) sizeof line - 2)
+		len = sizeof line - 2;
+	line[len] = '\0';
+	strip_control(line);
+	line[len++] = '\n';
+
+	if (client_is_behind(client))
+		client_send(client);
+
+	if (!client_write_buffer(client, line, len, SIZE_MAX))
+		client->dead = true;
+}
+
+static void client_queue_event(struct shell_ipc_client *client,
+			       enum shell_ipc_event_type type, uint32_t id,
+			       uint32_t field, const char *text)
+{
+	struct ipc_event *event, *next;
+	char *copy;
+
+	if (field == SHELL_IPC_REMOVED) {
+		wl_list_for_each_safe(event, next, &client->events, link) {
+			if (event->type != type || event->id != id)
+				continue;
+
+			/* never told, never needs to know */
+			if (event->field == SHELL_IPC_ADDED)
+				field = SHELL_IPC_ADDED;
+			event_destroy(client, event);
+		}
+
+		if (field == SHELL_IPC_ADDED)
+			return;
+	} else if (field != SHELL_IPC_ADDED) {
+		wl_list_for_each(event, &client->events, link) {
+			if (event->type != type || event->id != id ||
+			    event->field != field)
+				continue;
+
+			copy = strdup(text);
+			if (!copy)
+				return;
+			free(event->text);
+			event->text = copy;
+			return;
+		}
+	}
+
+	if (client->overflow)
+		return;
+
+	if (client->event_count >= IPC_MAX_QUEUED) {
+		client_drop_events(client);
+		client->overflow = true;
+		return;
+	}
+
+	event = zalloc(sizeof *event);
+	if (!event)
+		return;
+
+	event->text = strdup(text);
+	if (!event->text) {
+		free(event);
+		return;
+	}
+
+	event->type = type;
+	event->id = id;
+	event->field = field;
+	wl_list_insert(client->events.prev, &event->link);
+	client->event_count++;
+}
+
+void shell_ipc_emit(struct shell_ipc *ipc, enum shell_ipc_event_type type,
+		    uint32_t id, uint32_t field, const char *app_id,
+		    const char *fmt, ...)
+{
+	struct shell_ipc_client *client;
+	char text[IPC_MAX_LINE];
+	va_list args;
+	bool queued = false;
+
+	if (wl_list_empty(&ipc->client_list))
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(text, sizeof text, fmt, args);
+	va_end(args);
+	strip_control(text);
+
+	wl_list_for_each(client, &ipc->client_list, link) {
+		if (!(client->mask & (1 << type)))
+			continue;
+		if (client->app_id &&
+		    (!app_id || fnmatch(client->app_id, app_id, 0) != 0))
+			continue;
+
+		client_queue_event(client, type, id, field, text);
+		queued = true;
+	}
+
+	if (queued)
+		ipc_schedule_flush(ipc);
+}
+
+static int event_type_from_string(const char *name)
+{
+	int i;
+
+	for (i = 0; i < SHELL_IPC_EVENT_COUNT; i++)
+		if (strcmp(event_names[i], name) == 0)
+			return i;
+
+	return -1;
+}
+
+/* subscribe [app_id=PATTERN] TYPE...  where TYPE may also be "all" */
+static const char *client_subscribe(struct shell_ipc_client *client,
+				    int argc, char **argv, bool subscribe)
+{
+	uint32_t mask = 0;
+	char *app_id = NULL;
+	int i, type;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "app_id=", 7) == 0) {
+			free(app_id);
+			app_id = strdup(argv[i] + 7);
+			continue;
+		}
+
+		if (strcmp(argv[i], "all") == 0) {
+			mask = (1 << SHELL_IPC_EVENT_COUNT) - 1;
+			continue;
+		}
+
+		type = event_type_from_string(argv[i]);
+		if (type < 0) {
+			free(app_id);
+			return "unknown event type";
+		}
+		mask |= 1 << type;
+	}
+
+	if (subscribe) {
+		client->mask |= mask;
+		if (app_id) {
+			free(client->app_id);
+			client->app_id = app_id;
+		}
+	} else {
+		client->mask &= ~mask;
+		if (app_id || client->mask == 0) {
+			free(client->app_id);
+			client->app_id = NULL;
+		}
+		free(app_id);
+	}
+
+	return NULL;
+}
+
+static void client_run_line(struct shell_ipc_client *client, char *line)
+{
+	struct shell_ipc *ipc = client->ipc;
+	char *argv[IPC_MAX_ARGS + 1];
+	const char *error;
+	char *saveptr;
+	int argc = 0;
+
+	for (argv[argc] = strtok_r(line, " \t", &saveptr);
+	     argv[argc] && argc < IPC_MAX_ARGS;
+	     argv[++argc] = strtok_r(NULL, " \t", &saveptr))
+		;
+	argv[argc] = NULL;
+
+	if (argc == 0)
+		return;
+
+	if (strcmp(argv[0], "subscribe") == 0)
+		error = client_subscribe(client, argc, argv, true);
+	else if (strcmp(argv[0], "unsubscribe") == 0)
+		error = client_subscribe(client, argc, argv, false);
+	else
+		error = ipc->command(ipc->data, client, argc, argv);
+
+	if (error)
+		shell_ipc_reply(client, "error %s", error);
+	else
+		shell_ipc_reply(client, "ok");
+}
+
+/* Runs the complete lines read so far, as long as the client keeps up
+ * with the replies. */
+static void client_run_lines(struct shell_ipc_client *client)
+{
+	char *line = client->in, *end;
+
+	while (!client->dead && !client_is_behind(client) &&
+	       (end = memchr(line, '\n', client->in + client->in_len - line))) {
+		*end = '\0';
+		client_run_line(client, line);
+		line = end + 1;
+	}
+
+	client->in_len -= line - client->in;
+	memmove(client->in, line, client->in_len);
+}
+
+static void client_read(struct shell_ipc_client *client)
+{
+	ssize_t len;
+
+	for (;;) {
+		client_run_lines(client);
+		if (client->dead || client_is_behind(client))
+			return;
+
+		if (client->in_len == sizeof client->in) {
+			shell_ipc_reply(client, "error line too long");
+			client->dead = true;
+			return;
+		}
+
+		len = recv(client->fd, client->in + client->in_len,
+			   sizeof client->in - client->in_len, MSG_DONTWAIT);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				client->dead = true;
+			return;
+		}
+		if (len == 0) {
+			client->dead = true;
+			return;
+		}
+		client->in_len += len;
+	}
+}
+
+static int client_data(int fd, uint32_t mask, void *data)
+{
+	struct shell_ipc_client *client = data;
+
+	/* once caught up, the commands it sent meanwhile are run */
+	if (mask & WL_EVENT_WRITABLE)
+		client_flush(client);
+	if (mask & (WL_EVENT_READABLE | WL_EVENT_WRITABLE))
+		client_read(client);
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR))
+		client->dead = true;
+
+	/* replies go out right away, try to say goodbye too */
+	client_flush(client);
+
+	if (client->dead)
+		client_destroy(client);
+
+	return 0;
+}
+
+static int ipc_accept(int fd, uint32_t mask, void *data)
+{
+	struct shell_ipc *ipc = data;
+	struct shell_ipc_client *client;
+	int client_fd;
+
+	/* every send() and recv() is MSG_DONTWAIT already */
+	client_fd = accept(fd, NULL, NULL);
+	if (client_fd < 0)
+		return 0;
+	fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+	if (ipc->client_count >= IPC_MAX_CLIENTS) {
+		weston_log("ipc: too many clients\n");
+		close(client_fd);
+		return 0;
+	}
+
+	client = zalloc(sizeof *client);
+	if (!client) {
+		close(client_fd);
+		return 0;
+	}
+
+	client->ipc = ipc;
+	client->fd = client_fd;
+	client->readable = true;
+	wl_list_init(&client->events);
+	client->source = wl_event_loop_add_fd(ipc->loop, client_fd,
+					      WL_EVENT_READABLE,
+					      client_data, client);
+	if (!client->source) {
+		close(client_fd);
+		free(client);
+		return 0;
+	}
+
+	wl_list_insert(ipc->client_list.prev, &client->link);
+	ipc->client_count++;
+
+	return 0;
+}
+
+int shell_ipc_init(struct shell_ipc *ipc, struct wl_event_loop *loop,
+		   const char *path, shell_ipc_command_func_t command,
+		   void *data)
+{
+	struct sockaddr_un addr;
+
+	memset(ipc, 0, sizeof *ipc);
+	ipc->loop = loop;
+	ipc->fd = -1;
+	ipc->command = command;
+	ipc->data = data;
+	wl_list_init(&ipc->client_list);
+
+	/* nothing to listen on, events go nowhere */
+	if (!path)
+		return 0;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		weston_log("ipc: socket path '%s' too long\n", path);
+		return -1;
+	}
+
+	ipc->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ipc->fd < 0) {
+		weston_log("ipc: socket failed: %m\n");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* left over from a compositor that did not exit cleanly */
+	unlink(path);
+
+	if (bind(ipc->fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+	    listen(ipc->fd, 8) < 0) {
+		weston_log("ipc: cannot listen on '%s': %m\n", path);
+		close(ipc->fd);
+		ipc->fd = -1;
+		return -1;
+	}
+
+	ipc->path = strdup(path);
+	ipc->source = wl_event_loop_add_fd(loop, ipc->fd, WL_EVENT_READABLE,
+					   ipc_accept, ipc);
+	if (!ipc->path || !ipc->source) {
+		shell_ipc_release(ipc);
+		return -1;
+	}
+
+	return 0;
+}
+
+void shell_ipc_release(struct shell_ipc *ipc)
+{
+	struct shell_ipc_client *client, *next;
+
+	wl_list_for_each_safe(client, next, &ipc->client_list, link)
+		client_destroy(client);
+
+	if (ipc->idle)
+		wl_event_source_remove(ipc->idle);
+	if (ipc->source)
+		wl_event_source_remove(ipc->source);
+	if (ipc->fd >= 0) {
+		close(ipc->fd);
+		if (ipc->path)
+			unlink(ipc->path);
+	}
+	free(ipc->path);
+
+	ipc->idle = NULL;
+	ipc->source = NULL;
+	ipc->path = NULL;
+	ipc->fd = -1;
+}
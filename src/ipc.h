@@ -0,0 +1,67 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stdint.h>
+
+#include <wayland-server.h>
+
+/* What clients can subscribe to. */
+enum shell_ipc_event_type {
+	SHELL_IPC_EVENT_WORKSPACE,
+	SHELL_IPC_EVENT_WINDOW,
+
+	SHELL_IPC_EVENT_COUNT
+};
+
+/* What an event says about its object. Queued events about the same
+ * field of the same object are coalesced into the latest one; an object
+ * going away drops everything still queued about it. */
+enum shell_ipc_field {
+	SHELL_IPC_ADDED,
+	SHELL_IPC_REMOVED,
+	SHELL_IPC_FIELD,	/* first of the object's own fields */
+};
+
+struct shell_ipc_client;
+
+/* Runs one command split into words, argv[0] being the command. Extra
+ * output goes through shell_ipc_reply(); returns NULL on success or a
+ * message saying what went wrong. */
+typedef const char *(*shell_ipc_command_func_t)(void *data,
+						struct shell_ipc_client *client,
+						int argc, char **argv);
+
+/* Line based control socket in the compositor's event loop. Nothing
+ * ever blocks on a client: output is written as far as the socket takes
+ * it and the rest waits in a buffer. A client too far behind on it has
+ * no more commands run until it caught up, and its events pile up in a
+ * bounded per-client queue until there is room again. */
+struct shell_ipc {
+	struct wl_event_loop *loop;
+	char *path;
+	int fd;
+	struct wl_event_source *source;
+	struct wl_event_source *idle;	/* pending flush of all clients */
+
+	struct wl_list client_list;	/* struct shell_ipc_client */
+	unsigned int client_count;
+
+	shell_ipc_command_func_t command;
+	void *data;
+};
+
+int shell_ipc_init(struct shell_ipc *ipc, struct wl_event_loop *loop,
+		   const char *path, shell_ipc_command_func_t command,
+		   void *data);
+
+void shell_ipc_release(struct shell_ipc *ipc);
+
+void shell_ipc_reply(struct shell_ipc_client *client, const char *fmt, ...)
+	WL_PRINTF(2, 3);
+
+void shell_ipc_emit(struct shell_ipc *ipc, enum shell_ipc_event_type type,
+		    uint32_t id, uint32_t field, const char *app_id,
+		    const char *fmt, ...)
+	WL_PRINTF(6, 7);
+
+#endif
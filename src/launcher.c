@@ -0,0 +1,646 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/input.h>
+
+#include <weston/config-parser.h>
+
+#include "launcher.h"
+
+#define LAUNCHER_MAX_ARGS 32
+#define LAUNCHER_MAX_REQUEST 4096
+/* launches that never map a window are forgotten after this long */
+#define LAUNCHER_PENDING_TIMEOUT 30
+#define LAUNCHER_MAX_PENDING 32
+
+#define container_of(ptr, type, member) ({\
+	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+extern char **environ;
+
+struct launcher_entry {
+	struct shell_launcher *launcher;
+	char *command;
+	uint32_t key;
+	struct wl_list link;
+};
+
+struct launcher_path {
+	char *name;
+	char *path;
+	struct wl_list link;
+};
+
+struct launcher_pending {
+	char *name;
+	uint32_t serial;
+	pid_t pid;		/* 0 until the helper has answered */
+	struct timespec start;
+	struct wl_list link;
+};
+
+/* helper requests are a serial followed by the resolved path and the
+ * argument vector, all NUL terminated; the reply echoes the serial */
+struct launcher_reply {
+	uint32_t serial;
+	int32_t pid;		/* negative errno on failure */
+};
+
+static const struct {
+	const char *name;
+	uint32_t key;
+} launcher_keys[] = {
+	{ "enter", KEY_ENTER }, { "return", KEY_ENTER },
+	{ "space", KEY_SPACE }, { "tab", KEY_TAB },
+	{ "grave", KEY_GRAVE }, { "minus", KEY_MINUS }, { "equal", KEY_EQUAL },
+	{ "a", KEY_A }, { "b", KEY_B }, { "c", KEY_C }, { "d", KEY_D },
+	{ "e", KEY_E }, { "f", KEY_F }, { "g", KEY_G }, { "h", KEY_H },
+	{ "i", KEY_I }, { "j", KEY_J }, { "k", KEY_K }, { "l", KEY_L },
+	{ "m", KEY_M }, { "n", KEY_N }, { "o", KEY_O }, { "p", KEY_P },
+	{ "q", KEY_Q }, { "r", KEY_R }, { "s", KEY_S }, { "t", KEY_T },
+	{ "u", KEY_U }, { "v", KEY_V }, { "w", KEY_W }, { "x", KEY_X },
+	{ "y", KEY_Y }, { "z", KEY_Z },
+	{ "0", KEY_0 }, { "1", KEY_1 }, { "2", KEY_2 }, { "3", KEY_3 },
+	{ "4", KEY_4 }, { "5", KEY_5 }, { "6", KEY_6 }, { "7", KEY_7 },
+	{ "8", KEY_8 }, { "9", KEY_9 },
+	{ "f1", KEY_F1 }, { "f2", KEY_F2 }, { "f3", KEY_F3 },
+	{ "f4", KEY_F4 }, { "f5", KEY_F5 }, { "f6", KEY_F6 },
+	{ "f7", KEY_F7 }, { "f8", KEY_F8 }, { "f9", KEY_F9 },
+	{ "f10", KEY_F10 }, { "f11", KEY_F11 }, { "f12", KEY_F12 },
+};
+
+uint32_t shell_launcher_key_from_string(const char *name)
+{
+	unsigned int i;
+	char *end;
+	unsigned long key;
+
+	for (i = 0; i < sizeof launcher_keys / sizeof launcher_keys[0]; i++)
+		if (!strcasecmp(launcher_keys[i].name, name))
+			return launcher_keys[i].key;
+
+	/* anything else can be given as a raw evdev key code */
+	key = strtoul(name, &end, 0);
+	if (*end == '\0' && key > 0 && key < KEY_CNT)
+		return key;
+
+	weston_log("launcher: unknown key '%s'\n", name);
+	return 0;
+}
+
+/* Splits a command line on whitespace in place, no quoting. */
+static int launcher_split_args(char *command, char **argv)
+{
+	int argc = 0;
+	char *p = command;
+
+	while (argc < LAUNCHER_MAX_ARGS) {
+		p += strspn(p, " \t");
+		if (*p == '\0')
+			break;
+
+		argv[argc++] = p;
+		p += strcspn(p, " \t");
+		if (*p == '\0')
+			break;
+		*p++ = '\0';
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+static void launcher_split_path(struct shell_launcher *launcher)
+{
+	const char *path = getenv("PATH");
+	char *copy, *dir, *saveptr;
+	int n = 1;
+	const char *p;
+
+	if (!path || !*path)
+		path = "/usr/local/bin:/usr/bin:/bin";
+
+	for (p = path; *p; p++)
+		if (*p == ':')
+			n++;
+
+	launcher->path_dirs = calloc(n + 1, sizeof *launcher->path_dirs);
+	copy = strdup(path);
+	if (!launcher->path_dirs || !copy) {
+		free(copy);
+		return;
+	}
+
+	n = 0;
+	for (dir = strtok_r(copy, ":", &saveptr); dir;
+	     dir = strtok_r(NULL, ":", &saveptr))
+		launcher->path_dirs[n++] = strdup(dir);
+
+	free(copy);
+}
+
+/* Resolves a program name against $PATH once; later launches of the same
+ * program reuse the result. Misses are not cached so newly installed
+ * programs are still found. */
+static const char *launcher_resolve(struct shell_launcher *launcher,
+				    const char *name)
+{
+	struct launcher_path *entry;
+	char buf[4096];
+	char **dir;
+
+	wl_list_for_each(entry, &launcher->path_cache, link)
+		if (!strcmp(entry->name, name))
+			return entry->path;
+
+	if (strchr(name, '/')) {
+		if (access(name, X_OK) < 0)
+			return NULL;
+		snprintf(buf, sizeof buf, "%s", name);
+	} else {
+		if (!launcher->path_dirs)
+			return NULL;
+
+		for (dir = launcher->path_dirs; *dir; dir++) {
+			snprintf(buf, sizeof buf, "%s/%s", *dir, name);
+			if (access(buf, X_OK) == 0)
+				break;
+		}
+		if (*dir == NULL)
+			return NULL;
+	}
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return NULL;
+
+	entry->name = strdup(name);
+	entry->path = strdup(buf);
+	wl_list_insert(&launcher->path_cache, &entry->link);
+
+	return entry->path;
+}
+
+static void launcher_spawnattr_init(posix_spawnattr_t *attr)
+{
+	sigset_t mask;
+
+	posix_spawnattr_init(attr);
+
+	/* the compositor blocks and ignores signals that the launched
+	 * program should get with their default behaviour */
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(attr, &mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(attr, &mask);
+
+	posix_spawnattr_setpgroup(attr, 0);
+	posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGMASK |
+				       POSIX_SPAWN_SETSIGDEF |
+				       POSIX_SPAWN_SETPGROUP);
+}
+
+static void launcher_helper_run(int fd)
+{
+	char buf[LAUNCHER_MAX_REQUEST + 1];
+	char *argv[LAUNCHER_MAX_ARGS + 1];
+	struct launcher_reply reply;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	const char *path;
+	ssize_t len;
+	char *p, *end;
+	int argc, err;
+	long fd_max, i;
+
+	/* don't hand the compositor's descriptors on to every client */
+	fd_max = sysconf(_SC_OPEN_MAX);
+	if (fd_max < 0 || fd_max > 65536)
+		fd_max = 65536;
+	for (i = 3; i < fd_max; i++)
+		if (i != fd)
+			close(i);
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	/* let the kernel reap whatever we spawn */
+	signal(SIGCHLD, SIG_IGN);
+
+	launcher_spawnattr_init(&attr);
+
+	while ((len = recv(fd, buf, LAUNCHER_MAX_REQUEST, 0)) > 0) {
+		if ((size_t) len < sizeof reply.serial + 2)
+			continue;
+
+		buf[len] = '\0';
+		memcpy(&reply.serial, buf, sizeof reply.serial);
+
+		p = buf + sizeof reply.serial;
+		end = buf + len;
+		path = p;
+		p += strlen(p) + 1;
+
+		for (argc = 0; p < end && argc < LAUNCHER_MAX_ARGS; argc++) {
+			argv[argc] = p;
+			p += strlen(p) + 1;
+		}
+		argv[argc] = NULL;
+
+		if (argc == 0) {
+			reply.pid = -EINVAL;
+		} else {
+			err = posix_spawn(&reply.pid, path, NULL, &attr,
+					  argv, environ);
+			if (err)
+				reply.pid = -err;
+		}
+
+		if (send(fd, &reply, sizeof reply, MSG_NOSIGNAL) < 0)
+			break;
+	}
+
+	_exit(0);
+}
+
+static void launcher_pending_destroy(struct shell_launcher *launcher,
+				     struct launcher_pending *pending)
+{
+	wl_list_remove(&pending->link);
+	launcher->pending_count--;
+	free(pending->name);
+	free(pending);
+}
+
+static struct launcher_pending *
+launcher_pending_create(struct shell_launcher *launcher, const char *name)
+{
+	struct launcher_pending *pending, *next;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* forget launches that forked off and never showed up */
+	wl_list_for_each_safe(pending, next, &launcher->pending, link) {
+		if (now.tv_sec - pending->start.tv_sec <
+		    LAUNCHER_PENDING_TIMEOUT &&
+		    launcher->pending_count < LAUNCHER_MAX_PENDING)
+			break;
+		launcher_pending_destroy(launcher, pending);
+	}
+
+	pending = zalloc(sizeof *pending);
+	if (!pending)
+		return NULL;
+
+	pending->name = strdup(name);
+	pending->serial = ++launcher->serial;
+	pending->start = now;
+	wl_list_insert(launcher->pending.prev, &pending->link);
+	launcher->pending_count++;
+
+	return pending;
+}
+
+static void launcher_helper_close(struct shell_launcher *launcher)
+{
+	if (launcher->helper_source)
+		wl_event_source_remove(launcher->helper_source);
+	launcher->helper_source = NULL;
+
+	if (launcher->helper_fd >= 0)
+		close(launcher->helper_fd);
+	launcher->helper_fd = -1;
+}
+
+static int launcher_helper_data(int fd, uint32_t mask, void *data)
+{
+	struct shell_launcher *launcher = data;
+	struct launcher_pending *pending;
+	struct launcher_reply reply;
+
+	while (recv(fd, &reply, sizeof reply, MSG_DONTWAIT) == sizeof reply) {
+		wl_list_for_each(pending, &launcher->pending, link)
+			if (pending->serial == reply.serial)
+				break;
+
+		if (&pending->link == &launcher->pending)
+			continue;
+
+		if (reply.pid < 0) {
+			weston_log("launcher: failed to launch '%s': %s\n",
+				   pending->name, strerror(-reply.pid));
+			launcher_pending_destroy(launcher, pending);
+		} else {
+			pending->pid = reply.pid;
+		}
+	}
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		weston_log("launcher: helper process went away, "
+			   "spawning directly from now on\n");
+		launcher_helper_close(launcher);
+	}
+
+	return 0;
+}
+
+static int launcher_helper_request(struct shell_launcher *launcher,
+				   struct launcher_pending *pending,
+				   const char *path, char **argv)
+{
+	char buf[LAUNCHER_MAX_REQUEST];
+	size_t len, size;
+	char **arg;
+
+	memcpy(buf, &pending->serial, sizeof pending->serial);
+	len = sizeof pending->serial;
+
+	size = strlen(path) + 1;
+	if (len + size > sizeof buf)
+		return -1;
+	memcpy(buf + len, path, size);
+	len += size;
+
+	for (arg = argv; *arg; arg++) {
+		size = strlen(*arg) + 1;
+		if (len + size > sizeof buf)
+			return -1;
+		memcpy(buf + len, *arg, size);
+		len += size;
+	}
+
+	if (send(launcher->helper_fd, buf, len,
+		 MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		weston_log("launcher: helper request failed: %m\n");
+		launcher_helper_close(launcher);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Used when the helper is not available. posix_spawn() does not copy the
+ * compositor's address space either, it is merely slower to set up from
+ * here than from the small helper. */
+static int launcher_spawn_direct(struct launcher_pending *pending,
+				 const char *path, char **argv)
+{
+	posix_spawnattr_t attr;
+	int err;
+
+	launcher_spawnattr_init(&attr);
+	err = posix_spawn(&pending->pid, path, NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+
+	if (err) {
+		weston_log("launcher: failed to launch '%s': %s\n",
+			   pending->name, strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns the serial identifying this launch, 0 on failure. */
+uint32_t shell_launcher_spawn(struct shell_launcher *launcher,
+			      const char *command)
+{
+	struct launcher_pending *pending;
+	char *argv[LAUNCHER_MAX_ARGS + 1];
+	const char *path;
+	char *copy;
+	uint32_t serial = 0;
+	int ret;
+
+	copy = strdup(command);
+	if (!copy)
+		return 0;
+
+	if (launcher_split_args(copy, argv) == 0)
+		goto out;
+
+	path = launcher_resolve(launcher, argv[0]);
+	if (!path) {
+		weston_log("launcher: '%s' not found\n", argv[0]);
+		goto out;
+	}
+
+	pending = launcher_pending_create(launcher, argv[0]);
+	if (!pending)
+		goto out;
+
+	if (launcher->helper_fd >= 0 &&
+	    launcher_helper_request(launcher, pending, path, argv) == 0)
+		ret = 0;
+	else
+		ret = launcher_spawn_direct(pending, path, argv);
+
+	if (ret < 0)
+		launcher_pending_destroy(launcher, pending);
+	else
+		serial = pending->serial;
+
+out:
+	free(copy);
+	return serial;
+}
+
+/* Returns the serial of the launch that produced this client, if any. */
+uint32_t shell_launcher_client_mapped(struct shell_launcher *launcher,
+				      pid_t pid)
+{
+	struct launcher_pending *pending;
+	struct timespec now;
+	uint32_t serial;
+	double ms;
+
+	if (pid <= 0)
+		return 0;
+
+	wl_list_for_each(pending, &launcher->pending, link) {
+		if (pending->pid != pid)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - pending->start.tv_sec) * 1000.0 +
+			(now.tv_nsec - pending->start.tv_nsec) / 1000000.0;
+		weston_log("launcher: '%s' (pid %d) first commit after "
+			   "%.1f ms\n", pending->name, pid, ms);
+
+		serial = pending->serial;
+		launcher_pending_destroy(launcher, pending);
+		return serial;
+	}
+
+	return 0;
+}
+
+static void launcher_binding(struct weston_keyboard *keyboard, uint32_t time,
+			     uint32_t key, void *data)
+{
+	struct launcher_entry *entry = data;
+
+	shell_launcher_spawn(entry->launcher, entry->command);
+}
+
+static struct launcher_entry *
+launcher_entry_create(struct shell_launcher *launcher, const char *command,
+		      uint32_t key)
+{
+	struct launcher_entry *entry;
+	char *argv[LAUNCHER_MAX_ARGS + 1];
+	char *copy;
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return NULL;
+
+	entry->launcher = launcher;
+	entry->command = strdup(command);
+	entry->key = key;
+	wl_list_insert(launcher->entries.prev, &entry->link);
+
+	/* resolve now so the first launch doesn't walk $PATH */
+	copy = strdup(command);
+	if (copy && launcher_split_args(copy, argv) > 0 &&
+	    !launcher_resolve(launcher, argv[0]))
+		weston_log("launcher: '%s' not found\n", argv[0]);
+	free(copy);
+
+	return entry;
+}
+
+void shell_launcher_configure(struct shell_launcher *launcher,
+			      struct weston_config *config)
+{
+	struct weston_config_section *section = NULL;
+	const char *name;
+	char *command, *key;
+
+	while (weston_config_next_section(config, &section, &name)) {
+		if (strcmp(name, "launcher"))
+			continue;
+
+		weston_config_section_get_string(section, "path",
+						 &command, NULL);
+		weston_config_section_get_string(section, "key", &key, NULL);
+
+		if (command)
+			launcher_entry_create(launcher, command,
+					      key ? shell_launcher_key_from_string(key) : 0);
+
+		free(command);
+		free(key);
+	}
+}
+
+void shell_launcher_add_bindings(struct shell_launcher *launcher,
+				 uint32_t modifier)
+{
+	struct launcher_entry *entry;
+	bool have_enter = false;
+
+	wl_list_for_each(entry, &launcher->entries, link)
+		if (entry->key == KEY_ENTER)
+			have_enter = true;
+
+	/* the terminal binding everyone expects */
+	if (!have_enter)
+		launcher_entry_create(launcher, "weston-terminal", KEY_ENTER);
+
+	wl_list_for_each(entry, &launcher->entries, link) {
+		if (entry->key == 0)
+			continue;
+
+		weston_compositor_add_key_binding(launcher->compositor,
+						  entry->key, modifier,
+						  launcher_binding, entry);
+	}
+}
+
+int shell_launcher_init(struct shell_launcher *launcher,
+			struct weston_compositor *compositor)
+{
+	struct wl_event_loop *loop;
+	int sv[2];
+	pid_t pid;
+
+	memset(launcher, 0, sizeof *launcher);
+	launcher->compositor = compositor;
+	launcher->helper_fd = -1;
+	wl_list_init(&launcher->path_cache);
+	wl_list_init(&launcher->entries);
+	wl_list_init(&launcher->pending);
+
+	launcher_split_path(launcher);
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		weston_log("launcher: socketpair failed: %m\n");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		weston_log("launcher: fork failed: %m\n");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		launcher_helper_run(sv[1]);
+	}
+
+	close(sv[1]);
+	launcher->helper_fd = sv[0];
+	launcher->helper_pid = pid;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	launcher->helper_source =
+		wl_event_loop_add_fd(loop, sv[0], WL_EVENT_READABLE,
+				     launcher_helper_data, launcher);
+
+	return 0;
+}
+
+void shell_launcher_release(struct shell_launcher *launcher)
+{
+	struct launcher_entry *entry, *entry_next;
+	struct launcher_path *path, *path_next;
+	struct launcher_pending *pending, *pending_next;
+	char **dir;
+
+	/* the helper exits once it sees the socket close */
+	launcher_helper_close(launcher);
+
+	wl_list_for_each_safe(entry, entry_next, &launcher->entries, link) {
+		wl_list_remove(&entry->link);
+		free(entry->command);
+		free(entry);
+	}
+
+	wl_list_for_each_safe(path, path_next, &launcher->path_cache, link) {
+		wl_list_remove(&path->link);
+		free(path->name);
+		free(path->path);
+		free(path);
+	}
+
+	wl_list_for_each_safe(pending, pending_next, &launcher->pending, link)
+		launcher_pending_destroy(launcher, pending);
+
+	if (launcher->path_dirs) {
+		for (dir = launcher->path_dirs; *dir; dir++)
+			free(*dir);
+		free(launcher->path_dirs);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <weston/compositor.h>
+
+/* Launches go through a helper process forked once at startup, while the
+ * compositor is still small; the helper posix_spawn()s every program so
+ * the compositor itself is never forked again. */
+struct shell_launcher {
+	struct weston_compositor *compositor;
+
+	int helper_fd;
+	pid_t helper_pid;
+	struct wl_event_source *helper_source;
+	uint32_t serial;
+
+	char **path_dirs;		/* $PATH, split once */
+	struct wl_list path_cache;	/* struct launcher_path */
+
+	struct wl_list entries;		/* struct launcher_entry */
+
+	/* launches waiting for their first commit */
+	struct wl_list pending;		/* struct launcher_pending */
+	unsigned int pending_count;
+};
+
+int shell_launcher_init(struct shell_launcher *launcher,
+			struct weston_compositor *compositor);
+
+void shell_launcher_release(struct shell_launcher *launcher);
+
+void shell_launcher_configure(struct shell_launcher *launcher,
+			      struct weston_config *config);
+
+void shell_launcher_add_bindings(struct shell_launcher *launcher,
+				 uint32_t modifier);
+
+uint32_t shell_launcher_spawn(struct shell_launcher *launcher,
+			      const char *command);
+
+uint32_t shell_launcher_client_mapped(struct shell_launcher *launcher,
+				      pid_t pid);
+
+uint32_t shell_launcher_key_from_string(const char *name);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <weston/compositor.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE 256	/* power of two */
+#define LOG_MESSAGE_MAX 160
+
+struct log_entry {
+	uint8_t category;
+	uint8_t level;
+	char message[LOG_MESSAGE_MAX];
+};
+
+/* Single producer, single consumer: the writer only moves head and the
+ * flush only moves tail, so neither needs a lock. A full ring drops new
+ * messages and says how many once there is room. */
+static struct {
+	struct log_entry ring[LOG_RING_SIZE];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+
+	struct wl_event_loop *loop;
+	struct wl_event_source *idle;
+} shell_log_state;
+
+uint8_t shell_log_levels[SHELL_LOG_CATEGORY_COUNT] = {
+	[0 ... SHELL_LOG_CATEGORY_COUNT - 1] = SHELL_LOG_WARNING
+};
+
+static const char * const category_names[SHELL_LOG_CATEGORY_COUNT] = {
+	[SHELL_LOG_SHELL] = "shell",
+	[SHELL_LOG_BACKGROUND] = "background",
+	[SHELL_LOG_MENU] = "menu",
+};
+
+static const char * const level_names[] = {
+	[SHELL_LOG_ERROR] = "error",
+	[SHELL_LOG_WARNING] = "warning",
+	[SHELL_LOG_INFO] = "info",
+	[SHELL_LOG_DEBUG] = "debug",
+};
+
+static void log_emit(unsigned int category, unsigned int level,
+		     const char *message)
+{
+	weston_log("%s %s: %s\n", category_names[category],
+		   level_names[level], message);
+}
+
+static void log_flush(void *data)
+{
+	uint32_t head, tail, dropped;
+	struct log_entry *entry;
+
+	shell_log_state.idle = NULL;
+
+	head = __atomic_load_n(&shell_log_state.head, __ATOMIC_ACQUIRE);
+	tail = shell_log_state.tail;
+
+	for (; tail != head; tail++) {
+		entry = &shell_log_state.ring[tail & (LOG_RING_SIZE - 1)];
+		log_emit(entry->category, entry->level, entry->message);
+	}
+	__atomic_store_n(&shell_log_state.tail, tail, __ATOMIC_RELEASE);
+
+	dropped = __atomic_exchange_n(&shell_log_state.dropped, 0,
+				      __ATOMIC_RELAXED);
+	if (dropped)
+		weston_log("log: %u messages dropped\n", dropped);
+}
+
+void shell_log_write(enum shell_log_category category,
+		     enum shell_log_level level, const char *fmt, ...)
+{
+	struct log_entry *entry;
+	uint32_t head, tail;
+	va_list ap;
+
+	head = shell_log_state.head;
+	tail = __atomic_load_n(&shell_log_state.tail, __ATOMIC_ACQUIRE);
+	if (head - tail == LOG_RING_SIZE) {
+		__atomic_add_fetch(&shell_log_state.dropped, 1,
+				   __ATOMIC_RELAXED);
+		return;
+	}
+
+	entry = &shell_log_state.ring[head & (LOG_RING_SIZE - 1)];
+	entry->category = category;
+	entry->level = level;
+	va_start(ap, fmt);
+	vsnprintf(entry->message, sizeof entry->message, fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&shell_log_state.head, head + 1, __ATOMIC_RELEASE);
+
+	if (shell_log_state.loop == NULL)
+		log_flush(NULL);
+	else if (shell_log_state.idle == NULL)
+		shell_log_state.idle =
+			wl_event_loop_add_idle(shell_log_state.loop,
+					       log_flush, NULL);
+}
+
+static int log_level_from_string(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof level_names / sizeof level_names[0]; i++)
+		if (strcasecmp(name, level_names[i]) == 0)
+			return i;
+
+	weston_log("log: unknown level '%s'\n", name);
+	return -1;
+}
+
+/* [shell] log-level= sets every category, log-<category>= one of them. */
+void shell_log_init(struct wl_event_loop *loop, struct weston_config *config)
+{
+	struct weston_config_section *section;
+	char key[32], *s;
+	int level, i;
+
+	section = weston_config_get_section(config, "shell", NULL, NULL);
+
+	weston_config_section_get_string(section, "log-level", &s, NULL);
+	if (s && (level = log_level_from_string(s)) >= 0)
+		memset(shell_log_levels, level, sizeof shell_log_levels);
+	free(s);
+
+	for (i = 0; i < SHELL_LOG_CATEGORY_COUNT; i++) {
+		snprintf(key, sizeof key, "log-%s", category_names[i]);
+		weston_config_section_get_string(section, key, &s, NULL);
+		if (s && (level = log_level_from_string(s)) >= 0)
+			shell_log_levels[i] = level;
+		free(s);
+	}
+
+	shell_log_state.loop = loop;
+}
+
+void shell_log_release(void)
+{
+	if (shell_log_state.idle)
+		wl_event_source_remove(shell_log_state.idle);
+
+	log_flush(NULL);
+	shell_log_state.loop = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#include <wayland-server.h>
+#include <weston/config-parser.h>
+
+enum shell_log_level {
+	SHELL_LOG_ERROR,
+	SHELL_LOG_WARNING,
+	SHELL_LOG_INFO,
+	SHELL_LOG_DEBUG,
+};
+
+enum shell_log_category {
+	SHELL_LOG_SHELL,
+	SHELL_LOG_BACKGROUND,
+	SHELL_LOG_MENU,
+
+	SHELL_LOG_CATEGORY_COUNT
+};
+
+/* Anything above this is compiled out. */
+#ifndef SHELL_LOG_MAX_LEVEL
+#ifdef DEBUG
+#define SHELL_LOG_MAX_LEVEL SHELL_LOG_DEBUG
+#else
+#define SHELL_LOG_MAX_LEVEL SHELL_LOG_INFO
+#endif
+#endif
+
+/* runtime level of each category, set from the config */
+extern uint8_t shell_log_levels[SHELL_LOG_CATEGORY_COUNT];
+
+/* A message that is not wanted costs one compare; one that is only gets
+ * formatted into a ring buffer, which goes out through weston_log once
+ * the event loop is idle. */
+#define shell_log(category, level, ...) do {				\
+	if ((level) <= SHELL_LOG_MAX_LEVEL &&				\
+	    (level) <= shell_log_levels[category])			\
+		shell_log_write(category, level, __VA_ARGS__);		\
+} while (0)
+
+void shell_log_init(struct wl_event_loop *loop, struct weston_config *config);
+
+void shell_log_release(void);
+
+void shell_log_write(enum shell_log_category category,
+		     enum shell_log_level level, const char *fmt, ...)
+	WL_PRINTF(3, 4);
+
+#endif
@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "placement.h"
+
+#define PLACEMENT_CASCADE_STEP 32
+
+static int64_t box_area(const pixman_box32_t *box)
+{
+	return (int64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static bool box_contains(const pixman_box32_t *outer,
+			 const pixman_box32_t *inner)
+{
+	return inner->x1 >= outer->x1 && inner->x2 <= outer->x2 &&
+		inner->y1 >= outer->y1 && inner->y2 <= outer->y2;
+}
+
+static bool box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+		a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/* The up to four parts of f left, right, above and below box. */
+static unsigned int box_split(const pixman_box32_t *f,
+			      const pixman_box32_t *box,
+			      pixman_box32_t parts[4])
+{
+	unsigned int n = 0;
+
+	if (box->x1 > f->x1)
+		parts[n++] = (pixman_box32_t) { f->x1, f->y1, box->x1, f->y2 };
+	if (box->x2 < f->x2)
+		parts[n++] = (pixman_box32_t) { box->x2, f->y1, f->x2, f->y2 };
+	if (box->y1 > f->y1)
+		parts[n++] = (pixman_box32_t) { f->x1, f->y1, f->x2, box->y1 };
+	if (box->y2 < f->y2)
+		parts[n++] = (pixman_box32_t) { f->x1, box->y2, f->x2, f->y2 };
+
+	return n;
+}
+
+static bool array_reserve(void **data, unsigned int *alloc,
+			  unsigned int count, size_t size)
+{
+	unsigned int n;
+	void *p;
+
+	if (count <= *alloc)
+		return true;
+
+	n = *alloc ? *alloc * 2 : 16;
+	while (n < count)
+		n *= 2;
+
+	p = realloc(*data, n * size);
+	if (!p)
+		return false;
+
+	*data = p;
+	*alloc = n;
+	return true;
+}
+
+/* A list of boxes none of which contains another. */
+struct box_set {
+	pixman_box32_t *boxes;
+	unsigned int count, alloc;
+};
+
+static bool box_set_add(struct box_set *set, const pixman_box32_t *box)
+{
+	if (!array_reserve((void **) &set->boxes, &set->alloc,
+			   set->count + 1, sizeof *set->boxes))
+		return false;
+
+	set->boxes[set->count++] = *box;
+	return true;
+}
+
+/* Drops the boxes contained in another one, of two equal ones the later. */
+static void box_set_prune(struct box_set *set)
+{
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < set->count; i++) {
+		for (j = 0; j < set->count; j++) {
+			if (i == j ||
+			    !box_contains(&set->boxes[j], &set->boxes[i]))
+				continue;
+			if (j > i && box_contains(&set->boxes[i],
+						  &set->boxes[j]))
+				continue;
+			break;
+		}
+
+		if (j == set->count)
+			set->boxes[n++] = set->boxes[i];
+	}
+
+	set->count = n;
+}
+
+/* Index of the first free rectangle smaller than area, the list being
+ * sorted largest first. */
+static unsigned int free_lower_bound(const struct shell_placement *placement,
+				     int64_t area)
+{
+	unsigned int lo = 0, hi = placement->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (box_area(&placement->free[mid]) >= area)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Only a rectangle at least as large can contain box. */
+static bool free_contains(const struct shell_placement *placement,
+			  const pixman_box32_t *box)
+{
+	unsigned int i, end = free_lower_bound(placement, box_area(box));
+
+	for (i = 0; i < end; i++)
+		if (box_contains(&placement->free[i], box))
+			return true;
+
+	return false;
+}
+
+static bool free_insert(struct shell_placement *placement,
+			const pixman_box32_t *box)
+{
+	unsigned int i;
+
+	if (!array_reserve((void **) &placement->free, &placement->alloc,
+			   placement->count + 1, sizeof *placement->free))
+		return false;
+
+	i = free_lower_bound(placement, box_area(box));
+	memmove(&placement->free[i + 1], &placement->free[i],
+		(placement->count - i) * sizeof *placement->free);
+	placement->free[i] = *box;
+	placement->count++;
+	return true;
+}
+
+/* Keeps the free rectangles keep() says yes to, in their order. */
+static void free_filter(struct shell_placement *placement,
+			bool (*keep)(const pixman_box32_t *f,
+				     const struct box_set *set),
+			const struct box_set *set)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < placement->count; i++)
+		if (keep(&placement->free[i], set))
+			placement->free[n++] = placement->free[i];
+
+	placement->count = n;
+}
+
+static bool keep_clear_of(const pixman_box32_t *f, const struct box_set *set)
+{
+	return !box_overlaps(f, &set->boxes[0]);
+}
+
+static bool keep_uncontained(const pixman_box32_t *f,
+			     const struct box_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++)
+		if (box_contains(&set->boxes[i], f))
+			return false;
+
+	return true;
+}
+
+/* Adds the rectangles to the free space unless they are in a free
+ * rectangle already, then drops the old ones they contain. */
+static bool placement_merge(struct shell_placement *placement,
+			    struct box_set *added)
+{
+	unsigned int i, n = 0;
+
+	box_set_prune(added);
+	for (i = 0; i < added->count; i++)
+		if (!free_contains(placement, &added->boxes[i]))
+			added->boxes[n++] = added->boxes[i];
+	added->count = n;
+
+	free_filter(placement, keep_uncontained, added);
+
+	for (i = 0; i < added->count; i++)
+		if (!free_insert(placement, &added->boxes[i]))
+			return false;
+
+	return true;
+}
+
+/* Splits every free rectangle the box overlaps into the parts around
+ * it. A part can only be contained in a rectangle at least as large as
+ * itself, and no remaining rectangle in a part, so the rest of the list
+ * is left alone. */
+static bool placement_split(struct shell_placement *placement,
+			    const pixman_box32_t *box)
+{
+	struct box_set added = { NULL, 0, 0 }, cut = { NULL, 0, 0 };
+	pixman_box32_t parts[4];
+	unsigned int i, j, n;
+	bool ok = box_set_add(&cut, box);
+
+	for (i = 0; ok && i < placement->count; i++) {
+		if (!box_overlaps(&placement->free[i], box))
+			continue;
+
+		n = box_split(&placement->free[i], box, parts);
+		for (j = 0; ok && j < n; j++)
+			ok = box_set_add(&added, &parts[j]);
+	}
+
+	if (ok) {
+		free_filter(placement, keep_clear_of, &cut);
+		ok = placement_merge(placement, &added);
+	}
+
+	free(added.boxes);
+	free(cut.boxes);
+	return ok;
+}
+
+/* The maximal empty rectangles that reach into box, from the obstacles
+ * left: the usual construction from the whole area, except candidates
+ * clear of box are dropped right away, as nothing split off them could
+ * reach into it again. */
+static bool placement_fill(struct shell_placement *placement,
+			   const pixman_box32_t *box)
+{
+	struct box_set candidates = { NULL, 0, 0 }, next = { NULL, 0, 0 };
+	const pixman_box32_t *o;
+	pixman_box32_t parts[4], *c;
+	unsigned int i, j, k, n;
+	struct box_set swap;
+	bool ok = box_set_add(&candidates, &placement->area);
+
+	for (i = 0; ok && i < placement->obstacle_count; i++) {
+		o = &placement->obstacles[i].box;
+		next.count = 0;
+
+		for (j = 0; ok && j < candidates.count; j++) {
+			c = &candidates.boxes[j];
+			if (!box_overlaps(c, o)) {
+				ok = box_set_add(&next, c);
+				continue;
+			}
+
+			n = box_split(c, o, parts);
+			for (k = 0; ok && k < n; k++)
+				if (box_overlaps(&parts[k], box))
+					ok = box_set_add(&next, &parts[k]);
+		}
+
+		box_set_prune(&next);
+		swap = candidates;
+		candidates = next;
+		next = swap;
+	}
+
+	if (ok)
+		ok = placement_merge(placement, &candidates);
+
+	free(candidates.boxes);
+	free(next.boxes);
+	return ok;
+}
+
+static int placement_find_obstacle(const struct shell_placement *placement,
+				   const void *owner)
+{
+	unsigned int i;
+
+	for (i = 0; i < placement->obstacle_count; i++)
+		if (placement->obstacles[i].owner == owner)
+			return i;
+
+	return -1;
+}
+
+void shell_placement_init(struct shell_placement *placement)
+{
+	memset(placement, 0, sizeof *placement);
+}
+
+void shell_placement_release(struct shell_placement *placement)
+{
+	free(placement->free);
+	free(placement->obstacles);
+	memset(placement, 0, sizeof *placement);
+}
+
+void shell_placement_reset(struct shell_placement *placement,
+			   const pixman_box32_t *area)
+{
+	placement->area = *area;
+	placement->count = 0;
+	placement->obstacle_count = 0;
+	placement->valid = array_reserve((void **) &placement->free,
+					 &placement->alloc, 1,
+					 sizeof *placement->free);
+
+	if (placement->valid && box_area(area) > 0)
+		placement->free[placement->count++] = *area;
+}
+
+void shell_placement_invalidate(struct shell_placement *placement)
+{
+	placement->valid = false;
+}
+
+void shell_placement_occupy(struct shell_placement *placement,
+			    const pixman_box32_t *box, const void *owner)
+{
+	struct shell_placement_obstacle *obstacle;
+	int i;
+
+	if (!placement->valid)
+		return;
+
+	i = placement_find_obstacle(placement, owner);
+	if (i >= 0 && memcmp(&placement->obstacles[i].box, box,
+			     sizeof *box) == 0)
+		return;
+	if (i >= 0)
+		shell_placement_vacate(placement, owner);
+
+	if (!placement->valid || !box_overlaps(box, &placement->area))
+		return;
+
+	if (!array_reserve((void **) &placement->obstacles,
+			   &placement->obstacle_alloc,
+			   placement->obstacle_count + 1,
+			   sizeof *placement->obstacles)) {
+		placement->valid = false;
+		return;
+	}
+
+	obstacle = &placement->obstacles[placement->obstacle_count++];
+	obstacle->box = *box;
+	obstacle->owner = owner;
+
+	if (!placement_split(placement, box))
+		placement->valid = false;
+}
+
+void shell_placement_vacate(struct shell_placement *placement,
+			    const void *owner)
+{
+	pixman_box32_t box;
+	int i;
+
+	if (!placement->valid)
+		return;
+
+	i = placement_find_obstacle(placement, owner);
+	if (i < 0)
+		return;
+
+	box = placement->obstacles[i].box;
+	placement->obstacles[i] =
+		placement->obstacles[--placement->obstacle_count];
+
+	if (!placement_fill(placement, &box))
+		placement->valid = false;
+}
+
+/* Centres the window in the largest free rectangle it fits in. Only the
+ * rectangles with at least the window's area can take it, and the first
+ * of those, the largest one, nearly always does. */
+bool shell_placement_find(struct shell_placement *placement,
+			  int32_t width, int32_t height,
+			  int32_t *x, int32_t *y)
+{
+	const pixman_box32_t *f;
+	unsigned int i, end;
+
+	end = free_lower_bound(placement, (int64_t) width * height);
+	for (i = 0; i < end; i++) {
+		f = &placement->free[i];
+		if (f->x2 - f->x1 < width || f->y2 - f->y1 < height)
+			continue;
+
+		*x = f->x1 + (f->x2 - f->x1 - width) / 2;
+		*y = f->y1 + (f->y2 - f->y1 - height) / 2;
+		return true;
+	}
+
+	return false;
+}
+
+void shell_placement_cascade(struct shell_placement *placement,
+			     int32_t width, int32_t height,
+			     int32_t *x, int32_t *y)
+{
+	const pixman_box32_t *area = &placement->area;
+
+	placement->cascade += PLACEMENT_CASCADE_STEP;
+	if (area->x1 + placement->cascade + width > area->x2 ||
+	    area->y1 + placement->cascade + height > area->y2)
+		placement->cascade = 0;
+
+	*x = area->x1 + placement->cascade;
+	*y = area->y1 + placement->cascade;
+}
@@ -0,0 +1,55 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pixman.h>
+
+struct shell_placement_obstacle {
+	pixman_box32_t box;
+	const void *owner;
+};
+
+/* The free space of one output as the set of its maximal empty
+ * rectangles, largest first, along with the windows taking up the rest.
+ * A window coming, going, moving or resizing only redoes the rectangles
+ * it overlaps or frees; anything else marks the set invalid and the
+ * owner rebuilds it from the windows on screen the next time a window is
+ * placed. */
+struct shell_placement {
+	pixman_box32_t area;
+	pixman_box32_t *free;
+	unsigned int count, alloc;
+	struct shell_placement_obstacle *obstacles;
+	unsigned int obstacle_count, obstacle_alloc;
+	bool valid;
+
+	int32_t cascade;	/* offset of the next cascaded window */
+};
+
+void shell_placement_init(struct shell_placement *placement);
+
+void shell_placement_release(struct shell_placement *placement);
+
+void shell_placement_reset(struct shell_placement *placement,
+			   const pixman_box32_t *area);
+
+void shell_placement_invalidate(struct shell_placement *placement);
+
+/* Puts the owner's window at box, wherever it was before. */
+void shell_placement_occupy(struct shell_placement *placement,
+			    const pixman_box32_t *box, const void *owner);
+
+void shell_placement_vacate(struct shell_placement *placement,
+			    const void *owner);
+
+bool shell_placement_find(struct shell_placement *placement,
+			  int32_t width, int32_t height,
+			  int32_t *x, int32_t *y);
+
+void shell_placement_cascade(struct shell_placement *placement,
+			     int32_t width, int32_t height,
+			     int32_t *x, int32_t *y);
+
+#endif
@@ -0,0 +1,625 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include <weston/config-parser.h>
+
+#include "mayhem-window-list-server.h"
+#include "launcher.h"
+#include "policy.h"
+
+#define POLICY_DEFAULT_BUDGET 100000
+#define POLICY_DEFAULT_MEMORY 4096	/* KiB */
+
+#define container_of(ptr, type, member) ({\
+	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+struct policy_op {
+	enum shell_window_op_type type;
+	uint32_t id;
+	uint32_t workspace;
+};
+
+struct policy_binding {
+	struct shell_policy *policy;
+	uint32_t key;
+	int ref;
+	struct weston_binding *binding;
+	struct wl_list link;
+};
+
+static const char * const hook_names[] = {
+	[SHELL_POLICY_MAP] = "map",
+	[SHELL_POLICY_ACTIVATE] = "activate",
+	[SHELL_POLICY_WORKSPACE] = "workspace",
+	[SHELL_POLICY_BINDING] = NULL,	/* ends the list for luaL_checkoption */
+};
+
+static struct shell_policy *get_policy(lua_State *L)
+{
+	return lua_touserdata(L, lua_upvalueindex(1));
+}
+
+/* Counts the state's memory against its limit; Lua copes with a failed
+ * allocation by raising an error in the script. */
+static void *policy_alloc(void *data, void *ptr, size_t osize, size_t nsize)
+{
+	struct shell_policy *policy = data;
+	void *p;
+
+	if (ptr == NULL)
+		osize = 0;
+
+	if (nsize == 0) {
+		free(ptr);
+		policy->memory -= osize;
+		return NULL;
+	}
+
+	if (nsize > osize &&
+	    policy->memory + (nsize - osize) > policy->memory_limit)
+		return NULL;
+
+	p = realloc(ptr, nsize);
+	if (p)
+		policy->memory += nsize - osize;
+
+	return p;
+}
+
+/* Once spent, the budget stays spent: the hook fires on every further
+ * instruction, so a script catching the error with pcall gets no further
+ * than its next one. */
+static void budget_hook(lua_State *L, lua_Debug *ar)
+{
+	struct shell_policy *policy;
+
+	lua_getallocf(L, (void **) &policy);
+	if (!policy->overrun)
+		lua_sethook(L, budget_hook, LUA_MASKCOUNT, 1);
+	policy->overrun = true;
+	luaL_error(L, "instruction budget of %d exceeded", (int) policy->budget);
+}
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* Calls the function under its arguments on the stack with the budget
+ * armed, leaving nresults on the stack when it returns true. */
+static bool policy_pcall(struct shell_policy *policy,
+			 struct shell_policy_stats *stats, const char *what,
+			 int nargs, int nresults)
+{
+	lua_State *L = policy->state;
+	struct timespec start, end;
+	uint64_t ns;
+	int ret;
+
+	policy->overrun = false;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lua_sethook(L, budget_hook, LUA_MASKCOUNT, policy->budget);
+	ret = lua_pcall(L, nargs, nresults, 0);
+	lua_sethook(L, NULL, 0, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = timespec_ns(&end) - timespec_ns(&start);
+	stats->calls++;
+	stats->total_ns += ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+
+	if (ret == LUA_OK)
+		return true;
+
+	stats->errors++;
+	if (policy->overrun)
+		stats->overruns++;
+	weston_log("policy: %s: %s\n", what, lua_tostring(L, -1));
+	lua_pop(L, 1);
+	return false;
+}
+
+static bool policy_call(struct shell_policy *policy,
+			enum shell_policy_hook hook, int nargs, int nresults)
+{
+	return policy_pcall(policy, &policy->stats[hook],
+			    hook < SHELL_POLICY_BINDING ?
+			    hook_names[hook] : "binding", nargs, nresults);
+}
+
+static void policy_run_pending(void *data)
+{
+	struct shell_policy *policy = data;
+	struct weston_seat *seat = NULL;
+	struct shell_window_op *ops = NULL;
+	struct policy_op *op;
+	unsigned int count = 0;
+	int32_t workspace;
+	char **command;
+
+	policy->idle = NULL;
+
+	if (!wl_list_empty(&policy->compositor->seat_list))
+		seat = container_of(policy->compositor->seat_list.next,
+				    struct weston_seat, link);
+
+	/* windows may have gone away since the script asked */
+	if (policy->ops.size)
+		ops = malloc(policy->ops.size / sizeof *op * sizeof *ops);
+	if (ops) {
+		wl_array_for_each(op, &policy->ops) {
+			ops[count].window =
+				shell_window_list_find(policy->windows, op->id);
+			if (ops[count].window == NULL ||
+			    (op->type == SHELL_WINDOW_ACTIVATE && seat == NULL))
+				continue;
+			ops[count].type = op->type;
+			ops[count].seat = seat;
+			ops[count].workspace = op->workspace;
+			count++;
+		}
+	}
+	policy->ops.size = 0;
+
+	workspace = policy->workspace;
+	policy->workspace = -1;
+
+	if (workspace >= 0)
+		policy->interface->workspace(policy->data, workspace);
+	if (count)
+		policy->interface->commit(policy->data, ops, count);
+	free(ops);
+
+	wl_array_for_each(command, &policy->launches) {
+		policy->interface->launch(policy->data, *command);
+		free(*command);
+	}
+	policy->launches.size = 0;
+}
+
+static void policy_schedule(struct shell_policy *policy)
+{
+	struct wl_event_loop *loop;
+
+	if (policy->idle)
+		return;
+
+	loop = wl_display_get_event_loop(policy->compositor->wl_display);
+	policy->idle = wl_event_loop_add_idle(loop, policy_run_pending, policy);
+}
+
+static void push_window(lua_State *L, const struct shell_policy_window *window)
+{
+	lua_createtable(L, 0, 8);
+	lua_pushinteger(L, window->id);
+	lua_setfield(L, -2, "id");
+	lua_pushstring(L, window->app_id);
+	lua_setfield(L, -2, "app_id");
+	lua_pushstring(L, window->title);
+	lua_setfield(L, -2, "title");
+	lua_pushinteger(L, window->workspace);
+	lua_setfield(L, -2, "workspace");
+	lua_pushinteger(L, window->x);
+	lua_setfield(L, -2, "x");
+	lua_pushinteger(L, window->y);
+	lua_setfield(L, -2, "y");
+	lua_pushinteger(L, window->width);
+	lua_setfield(L, -2, "width");
+	lua_pushinteger(L, window->height);
+	lua_setfield(L, -2, "height");
+}
+
+static int api_on(lua_State *L)
+{
+	struct shell_policy *policy = get_policy(L);
+	int hook = luaL_checkoption(L, 1, NULL, hook_names);
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+	luaL_unref(L, LUA_REGISTRYINDEX, policy->hooks[hook]);
+	policy->hooks[hook] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	return 0;
+}
+
+/* Only while the script loads; the bindings are made afterwards. */
+static int api_bind(lua_State *L)
+{
+	struct shell_policy *policy = get_policy(L);
+	struct policy_binding *binding;
+	uint32_t key;
+
+	key = shell_launcher_key_from_string(luaL_checkstring(L, 1));
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (key == 0)
+		return luaL_argerror(L, 1, "unknown key");
+
+	binding = zalloc(sizeof *binding);
+	if (binding == NULL)
+		return luaL_error(L, "out of memory");
+
+	lua_settop(L, 2);
+	binding->policy = policy;
+	binding->key = key;
+	binding->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	wl_list_insert(policy->binding_list.prev, &binding->link);
+
+	return 0;
+}
+
+static int api_windows(lua_State *L)
+{
+	struct shell_policy *policy = get_policy(L);
+	struct shell_window *window;
+	int i = 0;
+
+	lua_newtable(L);
+	wl_list_for_each(window, &policy->windows->window_list, link) {
+		if (window->dirty & WINDOW_REMOVED)
+			continue;
+
+		lua_createtable(L, 0, 6);
+		lua_pushinteger(L, window->id);
+		lua_setfield(L, -2, "id");
+		lua_pushstring(L, window->app_id);
+		lua_setfield(L, -2, "app_id");
+		lua_pushstring(L, window->title);
+		lua_setfield(L, -2, "title");
+		lua_pushinteger(L, window->workspace);
+		lua_setfield(L, -2, "workspace");
+		lua_pushboolean(L, window->state &
+				   MS_WINDOW_LIST_STATE_MINIMIZED);
+		lua_setfield(L, -2, "minimized");
+		lua_pushboolean(L, window->state &
+				   MS_WINDOW_LIST_STATE_FOCUSED);
+		lua_setfield(L, -2, "focused");
+		lua_rawseti(L, -2, ++i);
+	}
+
+	return 1;
+}
+
+static int queue_op(lua_State *L, enum shell_window_op_type type)
+{
+	struct shell_policy *policy = get_policy(L);
+	struct policy_op *op;
+	uint32_t id, workspace;
+
+	id = luaL_checkinteger(L, 1);
+	workspace = type == SHELL_WINDOW_MOVE ? luaL_checkinteger(L, 2) : 0;
+
+	op = wl_array_add(&policy->ops, sizeof *op);
+	if (op == NULL)
+		return luaL_error(L, "out of memory");
+
+	op->type = type;
+	op->id = id;
+	op->workspace = workspace;
+	policy_schedule(policy);
+
+	return 0;
+}
+
+static int api_activate(lua_State *L)
+{
+	return queue_op(L, SHELL_WINDOW_ACTIVATE);
+}
+
+static int api_minimize(lua_State *L)
+{
+	return queue_op(L, SHELL_WINDOW_MINIMIZE);
+}
+
+static int api_close(lua_State *L)
+{
+	return queue_op(L, SHELL_WINDOW_CLOSE);
+}
+
+static int api_move(lua_State *L)
+{
+	return queue_op(L, SHELL_WINDOW_MOVE);
+}
+
+static int api_workspace(lua_State *L)
+{
+	struct shell_policy *policy = get_policy(L);
+
+	policy->workspace = luaL_checkinteger(L, 1);
+	policy_schedule(policy);
+
+	return 0;
+}
+
+static int api_launch(lua_State *L)
+{
+	struct shell_policy *policy = get_policy(L);
+	const char *command = luaL_checkstring(L, 1);
+	char **p;
+
+	p = wl_array_add(&policy->launches, sizeof *p);
+	if (p == NULL || (*p = strdup(command)) == NULL) {
+		if (p)
+			policy->launches.size -= sizeof *p;
+		return luaL_error(L, "out of memory");
+	}
+	policy_schedule(policy);
+
+	return 0;
+}
+
+static int api_print(lua_State *L)
+{
+	luaL_Buffer b;
+	int i, n = lua_gettop(L);
+
+	luaL_buffinit(L, &b);
+	for (i = 1; i <= n; i++) {
+		luaL_tolstring(L, i, NULL);
+		luaL_addvalue(&b);
+		if (i < n)
+			luaL_addchar(&b, '\t');
+	}
+	luaL_pushresult(&b);
+	weston_log("policy: %s\n", lua_tostring(L, -1));
+
+	return 0;
+}
+
+static const luaL_Reg api_mayhem[] = {
+	{ "on", api_on },
+	{ "bind", api_bind },
+	{ "windows", api_windows },
+	{ "activate", api_activate },
+	{ "minimize", api_minimize },
+	{ "close", api_close },
+	{ "move", api_move },
+	{ "workspace", api_workspace },
+	{ "launch", api_launch },
+	{ NULL, NULL }
+};
+
+/* nothing that loads code or touches the outside world */
+static const char * const sandbox_removed[] = {
+	"dofile", "loadfile", "load", "loadstring", "require",
+	"collectgarbage", NULL
+};
+
+static void policy_open_sandbox(struct shell_policy *policy)
+{
+	lua_State *L = policy->state;
+	int i;
+
+	luaL_requiref(L, "_G", luaopen_base, 1);
+	luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
+	luaL_requiref(L, LUA_TABLIBNAME, luaopen_table, 1);
+	luaL_requiref(L, LUA_MATHLIBNAME, luaopen_math, 1);
+	lua_pop(L, 4);
+
+	for (i = 0; sandbox_removed[i]; i++) {
+		lua_pushnil(L);
+		lua_setglobal(L, sandbox_removed[i]);
+	}
+
+	lua_getglobal(L, LUA_STRLIBNAME);
+	lua_pushnil(L);
+	lua_setfield(L, -2, "dump");
+	lua_pop(L, 1);
+
+	lua_pushlightuserdata(L, policy);
+	lua_pushcclosure(L, api_print, 1);
+	lua_setglobal(L, "print");
+
+	lua_newtable(L);
+	lua_pushlightuserdata(L, policy);
+	luaL_setfuncs(L, api_mayhem, 1);
+	lua_setglobal(L, "mayhem");
+}
+
+void shell_policy_init(struct shell_policy *policy,
+		       struct weston_compositor *compositor,
+		       struct shell_window_list *windows,
+		       const struct shell_policy_interface *interface,
+		       void *data)
+{
+	unsigned int i;
+
+	memset(policy, 0, sizeof *policy);
+	policy->compositor = compositor;
+	policy->windows = windows;
+	policy->interface = interface;
+	policy->data = data;
+	policy->workspace = -1;
+
+	for (i = 0; i < SHELL_POLICY_BINDING; i++)
+		policy->hooks[i] = LUA_NOREF;
+	wl_list_init(&policy->binding_list);
+	wl_array_init(&policy->ops);
+	wl_array_init(&policy->launches);
+}
+
+static void policy_close(struct shell_policy *policy)
+{
+	struct policy_binding *binding, *next;
+	unsigned int i;
+
+	wl_list_for_each_safe(binding, next, &policy->binding_list, link) {
+		if (binding->binding)
+			weston_binding_destroy(binding->binding);
+		wl_list_remove(&binding->link);
+		free(binding);
+	}
+
+	if (policy->state)
+		lua_close(policy->state);
+	policy->state = NULL;
+
+	for (i = 0; i < SHELL_POLICY_BINDING; i++)
+		policy->hooks[i] = LUA_NOREF;
+}
+
+void shell_policy_release(struct shell_policy *policy)
+{
+	char **command;
+
+	policy_close(policy);
+
+	if (policy->idle)
+		wl_event_source_remove(policy->idle);
+	policy->idle = NULL;
+
+	wl_array_release(&policy->ops);
+	wl_array_for_each(command, &policy->launches)
+		free(*command);
+	wl_array_release(&policy->launches);
+}
+
+/* [policy] script=, with budget= instructions per call and memory= KiB
+ * for the whole state. The script runs once under the same budget and
+ * registers its hooks and bindings. */
+void shell_policy_configure(struct shell_policy *policy,
+			    struct weston_config *config)
+{
+	struct weston_config_section *section;
+	struct shell_policy_stats stats = { 0 };
+	char *script;
+	uint32_t budget, memory;
+
+	section = weston_config_get_section(config, "policy", NULL, NULL);
+	weston_config_section_get_string(section, "script", &script, NULL);
+	weston_config_section_get_uint(section, "budget", &budget,
+				       POLICY_DEFAULT_BUDGET);
+	weston_config_section_get_uint(section, "memory", &memory,
+				       POLICY_DEFAULT_MEMORY);
+
+	if (script == NULL)
+		return;
+
+	policy->budget = budget > 0 ? budget : POLICY_DEFAULT_BUDGET;
+	policy->memory_limit = (size_t) memory * 1024;
+
+	policy->state = lua_newstate(policy_alloc, policy);
+	if (policy->state == NULL) {
+		weston_log("policy: cannot create a Lua state\n");
+		free(script);
+		return;
+	}
+
+	policy_open_sandbox(policy);
+
+	/* text only, precompiled chunks can break out of the sandbox */
+	if (luaL_loadfilex(policy->state, script, "t") != LUA_OK) {
+		weston_log("policy: %s\n", lua_tostring(policy->state, -1));
+		policy_close(policy);
+	} else if (!policy_pcall(policy, &stats, script, 0, 0)) {
+		policy_close(policy);
+	}
+
+	free(script);
+}
+
+static void policy_binding(struct weston_keyboard *keyboard, uint32_t time,
+			   uint32_t key, void *data)
+{
+	struct policy_binding *binding = data;
+	struct shell_policy *policy = binding->policy;
+
+	lua_rawgeti(policy->state, LUA_REGISTRYINDEX, binding->ref);
+	policy_call(policy, SHELL_POLICY_BINDING, 0, 0);
+}
+
+void shell_policy_add_bindings(struct shell_policy *policy, uint32_t modifier)
+{
+	struct policy_binding *binding;
+
+	wl_list_for_each(binding, &policy->binding_list, link)
+		binding->binding =
+			weston_compositor_add_key_binding(policy->compositor,
+							  binding->key,
+							  modifier,
+							  policy_binding,
+							  binding);
+}
+
+static bool policy_push_hook(struct shell_policy *policy,
+			     enum shell_policy_hook hook)
+{
+	if (policy->state == NULL || policy->hooks[hook] == LUA_NOREF)
+		return false;
+
+	lua_rawgeti(policy->state, LUA_REGISTRYINDEX, policy->hooks[hook]);
+	return true;
+}
+
+/* Runs from map(), before the first frame with the window in it, so
+ * whatever the script decides is what that frame shows. The hook returns
+ * nothing or a table with any of x, y, workspace and focus. */
+bool shell_policy_map(struct shell_policy *policy,
+		      const struct shell_policy_window *window,
+		      struct shell_policy_placement *placement)
+{
+	lua_State *L = policy->state;
+	bool ret = false;
+
+	placement->position = false;
+	placement->workspace = -1;
+	placement->no_focus = false;
+
+	if (!policy_push_hook(policy, SHELL_POLICY_MAP))
+		return false;
+
+	push_window(L, window);
+	if (!policy_call(policy, SHELL_POLICY_MAP, 1, 1))
+		return false;
+
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "x");
+		lua_getfield(L, -2, "y");
+		if (lua_isnumber(L, -2) && lua_isnumber(L, -1)) {
+			placement->position = true;
+			placement->x = lua_tointeger(L, -2);
+			placement->y = lua_tointeger(L, -1);
+		}
+		lua_pop(L, 2);
+
+		lua_getfield(L, -1, "workspace");
+		if (lua_isnumber(L, -1))
+			placement->workspace = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, -1, "focus");
+		placement->no_focus = !lua_isnil(L, -1) && !lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		ret = true;
+	}
+	lua_pop(L, 1);
+
+	return ret;
+}
+
+void shell_policy_activate(struct shell_policy *policy,
+			   const struct shell_policy_window *window)
+{
+	if (!policy_push_hook(policy, SHELL_POLICY_ACTIVATE))
+		return;
+
+	push_window(policy->state, window);
+	policy_call(policy, SHELL_POLICY_ACTIVATE, 1, 0);
+}
+
+void shell_policy_workspace(struct shell_policy *policy, uint32_t index)
+{
+	if (!policy_push_hook(policy, SHELL_POLICY_WORKSPACE))
+		return;
+
+	lua_pushinteger(policy->state, index);
+	policy_call(policy, SHELL_POLICY_WORKSPACE, 1, 0);
+}
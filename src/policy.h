@@ -0,0 +1,155 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <weston/compositor.h>
+
+#include "window-list.h"
+
+struct lua_State;
+
+enum shell_policy_hook {
+	SHELL_POLICY_MAP,
+	SHELL_POLICY_ACTIVATE,
+	SHELL_POLICY_WORKSPACE,
+	SHELL_POLICY_BINDING,	/* all bindings together */
+
+	SHELL_POLICY_HOOK_COUNT
+};
+
+struct shell_policy_stats {
+	uint32_t calls;
+	uint32_t errors;
+	uint32_t overruns;	/* calls stopped by the instruction budget */
+	uint64_t total_ns, max_ns;
+};
+
+/* What the hooks are told about a window. */
+struct shell_policy_window {
+	uint32_t id;
+	const char *app_id, *title;
+	uint32_t workspace;
+	int32_t x, y, width, height;
+};
+
+/* What the map hook returned. */
+struct shell_policy_placement {
+	bool position;
+	int32_t x, y;
+	int32_t workspace;	/* -1 to leave alone */
+	bool no_focus;
+};
+
+/* What a script may ask the shell for. Requests made by a hook are queued
+ * and carried out from an idle callback once it returned, so a script
+ * never changes anything under the code that called it. */
+struct shell_policy_interface {
+	void (*commit)(void *data, struct shell_window_op *ops,
+		       unsigned int count);
+	void (*workspace)(void *data, uint32_t index);
+	uint32_t (*launch)(void *data, const char *command);
+};
+
+/* A Lua state inside the compositor running the [policy] script. It only
+ * gets the base, string, table and math libraries without any way to
+ * load code or reach the file system; each call has an instruction budget
+ * and the whole state a memory limit. */
+struct shell_policy {
+	struct weston_compositor *compositor;
+	struct shell_window_list *windows;
+	const struct shell_policy_interface *interface;
+	void *data;
+
+	struct lua_State *state;	/* NULL without a script */
+	uint32_t budget;		/* instructions per call */
+	size_t memory, memory_limit;
+	bool overrun;
+
+	int hooks[SHELL_POLICY_BINDING];	/* registry references */
+	struct wl_list binding_list;		/* struct policy_binding */
+
+	struct wl_array ops;		/* struct policy_op, queued */
+	int32_t workspace;		/* queued switch, -1 for none */
+	struct wl_array launches;	/* char *, queued */
+	struct wl_event_source *idle;
+
+	struct shell_policy_stats stats[SHELL_POLICY_HOOK_COUNT];
+};
+
+#ifdef SHELL_LUA
+
+void shell_policy_init(struct shell_policy *policy,
+		       struct weston_compositor *compositor,
+		       struct shell_window_list *windows,
+		       const struct shell_policy_interface *interface,
+		       void *data);
+
+void shell_policy_release(struct shell_policy *policy);
+
+void shell_policy_configure(struct shell_policy *policy,
+			    struct weston_config *config);
+
+void shell_policy_add_bindings(struct shell_policy *policy,
+			       uint32_t modifier);
+
+bool shell_policy_map(struct shell_policy *policy,
+		      const struct shell_policy_window *window,
+		      struct shell_policy_placement *placement);
+
+void shell_policy_activate(struct shell_policy *policy,
+			   const struct shell_policy_window *window);
+
+void shell_policy_workspace(struct shell_policy *policy, uint32_t index);
+
+#else
+
+/* without Lua the hooks compile away */
+static inline void
+shell_policy_init(struct shell_policy *policy,
+		  struct weston_compositor *compositor,
+		  struct shell_window_list *windows,
+		  const struct shell_policy_interface *interface, void *data)
+{
+	policy->state = NULL;
+}
+
+static inline void
+shell_policy_release(struct shell_policy *policy)
+{
+}
+
+static inline void
+shell_policy_configure(struct shell_policy *policy,
+		       struct weston_config *config)
+{
+}
+
+static inline void
+shell_policy_add_bindings(struct shell_policy *policy, uint32_t modifier)
+{
+}
+
+static inline bool
+shell_policy_map(struct shell_policy *policy,
+		 const struct shell_policy_window *window,
+		 struct shell_policy_placement *placement)
+{
+	return false;
+}
+
+static inline void
+shell_policy_activate(struct shell_policy *policy,
+		      const struct shell_policy_window *window)
+{
+}
+
+static inline void
+shell_policy_workspace(struct shell_policy *policy, uint32_t index)
+{
+}
+
+#endif
+
+#endif
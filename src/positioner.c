@@ -0,0 +1,131 @@
+#include <stdbool.h>
+
+#include "positioner.h"
+
+/* One axis of the problem, so x and y share the code. A side is -1 for
+ * the top or left edge, 1 for the bottom or right one and 0 for the
+ * middle. */
+struct axis {
+	int32_t rect_pos, rect_size;
+	int anchor, gravity;
+	int32_t offset;
+	int32_t min, max;	/* the bounds, relative to the parent */
+	bool flip, slide, resize;
+};
+
+static int edge_side(uint32_t edges, uint32_t start, uint32_t end)
+{
+	if (edges & start)
+		return -1;
+	if (edges & end)
+		return 1;
+	return 0;
+}
+
+static int32_t axis_place(const struct axis *axis, int anchor, int gravity,
+			  int32_t offset, int32_t size)
+{
+	int32_t pos = axis->rect_pos + offset;
+
+	if (anchor > 0)
+		pos += axis->rect_size;
+	else if (anchor == 0)
+		pos += axis->rect_size / 2;
+
+	if (gravity < 0)
+		pos -= size;
+	else if (gravity == 0)
+		pos -= size / 2;
+
+	return pos;
+}
+
+static bool axis_fits(const struct axis *axis, int32_t pos, int32_t size)
+{
+	return pos >= axis->min && pos + size <= axis->max;
+}
+
+static void axis_solve(const struct axis *axis, int32_t *pos, int32_t *size)
+{
+	int32_t p, flipped, start, end;
+
+	p = axis_place(axis, axis->anchor, axis->gravity, axis->offset, *size);
+	if (axis_fits(axis, p, *size))
+		goto out;
+
+	/* the mirror image only if that one fits, otherwise it is no
+	 * better a start for sliding than the original */
+	if (axis->flip) {
+		flipped = axis_place(axis, -axis->anchor, -axis->gravity,
+				     -axis->offset, *size);
+		if (axis_fits(axis, flipped, *size)) {
+			p = flipped;
+			goto out;
+		}
+	}
+
+	/* too big either way, the top or left edge stays on screen */
+	if (axis->slide) {
+		if (p + *size > axis->max)
+			p = axis->max - *size;
+		if (p < axis->min)
+			p = axis->min;
+	}
+
+	if (axis->resize) {
+		start = p > axis->min ? p : axis->min;
+		end = p + *size < axis->max ? p + *size : axis->max;
+		if (end > start) {
+			p = start;
+			*size = end - start;
+		}
+	}
+
+out:
+	*pos = p;
+}
+
+void shell_positioner_place(const struct shell_positioner *positioner,
+			    int32_t parent_x, int32_t parent_y,
+			    const pixman_box32_t *bounds,
+			    struct shell_positioner_box *box)
+{
+	uint32_t adjustment = positioner->adjustment;
+	struct axis x = {
+		.rect_pos = positioner->anchor_rect.x,
+		.rect_size = positioner->anchor_rect.width,
+		.anchor = edge_side(positioner->anchor,
+				    SHELL_POSITIONER_EDGE_LEFT,
+				    SHELL_POSITIONER_EDGE_RIGHT),
+		.gravity = edge_side(positioner->gravity,
+				     SHELL_POSITIONER_EDGE_LEFT,
+				     SHELL_POSITIONER_EDGE_RIGHT),
+		.offset = positioner->offset_x,
+		.min = bounds->x1 - parent_x,
+		.max = bounds->x2 - parent_x,
+		.flip = adjustment & SHELL_POSITIONER_FLIP_X,
+		.slide = adjustment & SHELL_POSITIONER_SLIDE_X,
+		.resize = adjustment & SHELL_POSITIONER_RESIZE_X,
+	};
+	struct axis y = {
+		.rect_pos = positioner->anchor_rect.y,
+		.rect_size = positioner->anchor_rect.height,
+		.anchor = edge_side(positioner->anchor,
+				    SHELL_POSITIONER_EDGE_TOP,
+				    SHELL_POSITIONER_EDGE_BOTTOM),
+		.gravity = edge_side(positioner->gravity,
+				     SHELL_POSITIONER_EDGE_TOP,
+				     SHELL_POSITIONER_EDGE_BOTTOM),
+		.offset = positioner->offset_y,
+		.min = bounds->y1 - parent_y,
+		.max = bounds->y2 - parent_y,
+		.flip = adjustment & SHELL_POSITIONER_FLIP_Y,
+		.slide = adjustment & SHELL_POSITIONER_SLIDE_Y,
+		.resize = adjustment & SHELL_POSITIONER_RESIZE_Y,
+	};
+
+	box->width = positioner->width;
+	box->height = positioner->height;
+	axis_solve(&x, &box->x, &box->width);
+	axis_solve(&y, &box->y, &box->height);
+}
@@ -0,0 +1,51 @@
+#ifndef POSITIONER_H
+#define POSITIONER_H
+
+#include <stdint.h>
+
+#include <pixman.h>
+
+enum shell_positioner_edge {
+	SHELL_POSITIONER_EDGE_TOP = 1,
+	SHELL_POSITIONER_EDGE_BOTTOM = 2,
+	SHELL_POSITIONER_EDGE_LEFT = 4,
+	SHELL_POSITIONER_EDGE_RIGHT = 8,
+};
+
+/* the same bits as xdg_positioner.constraint_adjustment */
+enum shell_positioner_adjustment {
+	SHELL_POSITIONER_SLIDE_X = 1,
+	SHELL_POSITIONER_SLIDE_Y = 2,
+	SHELL_POSITIONER_FLIP_X = 4,
+	SHELL_POSITIONER_FLIP_Y = 8,
+	SHELL_POSITIONER_RESIZE_X = 16,
+	SHELL_POSITIONER_RESIZE_Y = 32,
+};
+
+struct shell_positioner_box {
+	int32_t x, y, width, height;
+};
+
+/* Where a popup goes: a box of the given size put next to the anchor
+ * rectangle on its parent, which side given by the anchor and gravity
+ * edges. Everything is relative to the window geometry of the parent. */
+struct shell_positioner {
+	int32_t width, height;
+	struct shell_positioner_box anchor_rect;
+	uint32_t anchor, gravity;	/* shell_positioner_edge */
+	uint32_t adjustment;		/* shell_positioner_adjustment */
+	int32_t offset_x, offset_y;
+};
+
+/* Places the popup for a parent whose window geometry is at parent_x,
+ * parent_y on screen, then flips, slides and shrinks it, in that order
+ * and as far as the adjustment allows, until it is inside bounds. The
+ * result is relative to the parent again, so a popup on a popup can be
+ * placed from the result for its parent before either of them is on
+ * screen. */
+void shell_positioner_place(const struct shell_positioner *positioner,
+			    int32_t parent_x, int32_t parent_y,
+			    const pixman_box32_t *bounds,
+			    struct shell_positioner_box *box);
+
+#endif
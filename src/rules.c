@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <weston/compositor.h>
+
+#include "rules.h"
+
+static uint32_t rule_hash(const char *key)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*key) {
+		hash ^= (unsigned char) *key++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void rule_actions_init(struct shell_rule_actions *actions)
+{
+	actions->workspace = -1;
+	actions->width = 0;
+	actions->height = 0;
+	actions->maximized = 0;
+	actions->no_focus = 0;
+}
+
+/* A /pattern/ is compiled, anything else kept as the literal. */
+static bool rule_compile(const char *value, char **literal, regex_t *re,
+			 bool *is_re)
+{
+	size_t len = strlen(value);
+	char *pattern;
+	int ret;
+
+	if (len < 2 || value[0] != '/' || value[len - 1] != '/') {
+		*literal = strdup(value);
+		return *literal != NULL;
+	}
+
+	pattern = strndup(value + 1, len - 2);
+	if (!pattern)
+		return false;
+
+	ret = regcomp(re, pattern, REG_EXTENDED | REG_NOSUB);
+	free(pattern);
+	if (ret != 0) {
+		weston_log("rules: invalid pattern %s\n", value);
+		return false;
+	}
+
+	*is_re = true;
+	return true;
+}
+
+static void rule_release(struct shell_rule *rule)
+{
+	free(rule->app_id);
+	free(rule->title);
+	if (rule->app_id_is_re)
+		regfree(&rule->app_id_re);
+	if (rule->title_is_re)
+		regfree(&rule->title_re);
+}
+
+static bool rule_parse(struct shell_rule *rule,
+		       struct weston_config_section *section)
+{
+	char *app_id, *title, *size;
+	int32_t workspace;
+	int maximized, focus;
+	bool ok = true;
+
+	memset(rule, 0, sizeof *rule);
+	rule_actions_init(&rule->actions);
+
+	/* class is what wl_shell and X call the app-id */
+	weston_config_section_get_string(section, "app-id", &app_id, NULL);
+	if (!app_id)
+		weston_config_section_get_string(section, "class",
+						 &app_id, NULL);
+	weston_config_section_get_string(section, "title", &title, NULL);
+
+	if (!app_id && !title) {
+		weston_log("rules: rule without app-id or title ignored\n");
+		return false;
+	}
+
+	if (app_id)
+		ok = rule_compile(app_id, &rule->app_id, &rule->app_id_re,
+				  &rule->app_id_is_re);
+	if (ok && title)
+		ok = rule_compile(title, &rule->title, &rule->title_re,
+				  &rule->title_is_re);
+	free(app_id);
+	free(title);
+
+	if (!ok) {
+		rule_release(rule);
+		return false;
+	}
+
+	weston_config_section_get_int(section, "workspace", &workspace, -1);
+	rule->actions.workspace = workspace;
+
+	weston_config_section_get_string(section, "size", &size, NULL);
+	if (size && sscanf(size, "%dx%d", &rule->actions.width,
+			   &rule->actions.height) != 2) {
+		weston_log("rules: invalid size '%s'\n", size);
+		rule->actions.width = rule->actions.height = 0;
+	}
+	free(size);
+
+	weston_config_section_get_bool(section, "maximized", &maximized, -1);
+	rule->actions.maximized = maximized;
+	weston_config_section_get_bool(section, "focus", &focus, -1);
+	rule->actions.no_focus = focus < 0 ? -1 : !focus;
+
+	return true;
+}
+
+static void rules_table_insert(struct shell_rules *rules, unsigned int index)
+{
+	uint32_t hash = rule_hash(rules->rules[index].app_id);
+	unsigned int mask = rules->table_size - 1;
+	unsigned int i;
+
+	/* rules with the same app-id end up in file order along the probe */
+	for (i = hash & mask; rules->table[i].rule >= 0; i = (i + 1) & mask)
+		;
+
+	rules->table[i].hash = hash;
+	rules->table[i].rule = index;
+}
+
+void shell_rules_load(struct shell_rules *rules, struct weston_config *config)
+{
+	struct weston_config_section *section = NULL;
+	struct shell_rule *rule;
+	const char *name;
+	unsigned int i, alloc = 0, literal = 0;
+
+	memset(rules, 0, sizeof *rules);
+
+	while (weston_config_next_section(config, &section, &name)) {
+		if (strcmp(name, "rule"))
+			continue;
+
+		if (rules->count == alloc) {
+			alloc = alloc ? alloc * 2 : 8;
+			rule = realloc(rules->rules, alloc * sizeof *rule);
+			if (!rule)
+				break;
+			rules->rules = rule;
+		}
+
+		rule = &rules->rules[rules->count];
+		if (!rule_parse(rule, section))
+			continue;
+
+		if (rule->app_id && !rule->app_id_is_re)
+			literal++;
+		rules->count++;
+	}
+
+	if (rules->count == 0)
+		return;
+
+	rules->table_size = 16;
+	while (rules->table_size < literal * 2)
+		rules->table_size *= 2;
+
+	rules->table = malloc(rules->table_size * sizeof *rules->table);
+	rules->generic = malloc(rules->count * sizeof *rules->generic);
+	if (!rules->table || !rules->generic) {
+		weston_log("rules: out of memory, rules disabled\n");
+		shell_rules_release(rules);
+		return;
+	}
+
+	for (i = 0; i < rules->table_size; i++)
+		rules->table[i].rule = -1;
+
+	for (i = 0; i < rules->count; i++) {
+		rule = &rules->rules[i];
+		if (rule->app_id && !rule->app_id_is_re)
+			rules_table_insert(rules, i);
+		else
+			rules->generic[rules->generic_count++] = i;
+	}
+}
+
+void shell_rules_release(struct shell_rules *rules)
+{
+	unsigned int i;
+
+	for (i = 0; i < rules->count; i++)
+		rule_release(&rules->rules[i]);
+
+	free(rules->rules);
+	free(rules->table);
+	free(rules->generic);
+	memset(rules, 0, sizeof *rules);
+}
+
+static bool rule_field_matches(const char *literal, const regex_t *re,
+			       bool is_re, const char *value)
+{
+	if (is_re)
+		return value && regexec(re, value, 0, NULL, 0) == 0;
+	if (literal)
+		return value && strcmp(literal, value) == 0;
+
+	return true;
+}
+
+static void rule_apply(const struct shell_rule *rule, const char *app_id,
+		       const char *title, struct shell_rule_actions *actions,
+		       bool *matched)
+{
+	if (!rule_field_matches(rule->app_id, &rule->app_id_re,
+				rule->app_id_is_re, app_id) ||
+	    !rule_field_matches(rule->title, &rule->title_re,
+				rule->title_is_re, title))
+		return;
+
+	if (rule->actions.workspace >= 0)
+		actions->workspace = rule->actions.workspace;
+	if (rule->actions.width > 0 && rule->actions.height > 0) {
+		actions->width = rule->actions.width;
+		actions->height = rule->actions.height;
+	}
+	if (rule->actions.maximized >= 0)
+		actions->maximized = rule->actions.maximized;
+	if (rule->actions.no_focus >= 0)
+		actions->no_focus = rule->actions.no_focus;
+	*matched = true;
+}
+
+/* Fills actions from every rule matching, in the order they were
+ * written, so a later rule overrides an earlier one; returns whether any
+ * did. */
+bool shell_rules_match(struct shell_rules *rules, const char *app_id,
+		       const char *title, struct shell_rule_actions *actions)
+{
+	unsigned int mask = rules->table_size - 1;
+	unsigned int slot = 0, generic = 0, next_literal, next_generic;
+	uint32_t hash = 0;
+	bool matched = false;
+
+	rule_actions_init(actions);
+
+	if (rules->count == 0)
+		return false;
+
+	if (app_id) {
+		hash = rule_hash(app_id);
+		slot = hash & mask;
+	}
+
+	/* merge the hash hits with the generic rules by file order */
+	for (;;) {
+		next_literal = rules->count;
+		while (app_id && rules->table[slot].rule >= 0) {
+			if (rules->table[slot].hash == hash &&
+			    strcmp(rules->rules[rules->table[slot].rule].app_id,
+				   app_id) == 0) {
+				next_literal = rules->table[slot].rule;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+
+		next_generic = generic < rules->generic_count ?
+			rules->generic[generic] : rules->count;
+
+		if (next_literal == rules->count &&
+		    next_generic == rules->count)
+			break;
+
+		if (next_literal < next_generic) {
+			rule_apply(&rules->rules[next_literal], app_id, title,
+				   actions, &matched);
+			slot = (slot + 1) & mask;
+		} else {
+			rule_apply(&rules->rules[next_generic], app_id, title,
+				   actions, &matched);
+			generic++;
+		}
+	}
+
+	return matched;
+}
@@ -0,0 +1,53 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <regex.h>
+
+#include <weston/config-parser.h>
+
+/* What matching rules ask for. Later rules override earlier ones. */
+struct shell_rule_actions {
+	int32_t workspace;	/* -1 to leave alone */
+	int32_t width, height;	/* 0 to leave alone */
+	int maximized;		/* in a rule, -1 to leave alone */
+	int no_focus;		/* not activated when it maps; the same */
+};
+
+/* One [rule] section. app-id and title are either matched literally or,
+ * written as /pattern/, as extended regular expressions. */
+struct shell_rule {
+	char *app_id, *title;
+	regex_t app_id_re, title_re;
+	bool app_id_is_re, title_is_re;
+
+	struct shell_rule_actions actions;
+};
+
+struct shell_rule_slot {
+	uint32_t hash;
+	int rule;		/* -1 for an empty slot */
+};
+
+/* The rules compiled at startup. Rules naming a literal app-id are found
+ * through a hash of it, only the others are tried one by one. */
+struct shell_rules {
+	struct shell_rule *rules;
+	unsigned int count;
+
+	struct shell_rule_slot *table;	/* open addressing, power of two */
+	unsigned int table_size;
+
+	unsigned int *generic;		/* rules without a literal app-id */
+	unsigned int generic_count;
+};
+
+void shell_rules_load(struct shell_rules *rules, struct weston_config *config);
+
+void shell_rules_release(struct shell_rules *rules);
+
+bool shell_rules_match(struct shell_rules *rules, const char *app_id,
+		       const char *title, struct shell_rule_actions *actions);
+
+#endif
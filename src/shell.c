@@ -29,30 +29,39 @@
 #include <linux/input.h>
 #include <assert.h>
 #include <signal.h>
+#include <limits.h>
 #include <math.h>
 #include <sys/types.h>
 
 #include "shell.h"
 #include <weston/config-parser.h>
 #include "xdg-shell-server.h"
+#include "mayhem-window-list-server.h"
 
 #define DEFAULT_NUM_WORKSPACES 7
 #define DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH 200
-
-#ifndef static_assert
-#define static_assert(cond, msg)
-#endif
+/* Natural frequency (rad/s) of the critically damped zoom spring */
+#define ZOOM_SPRING_OMEGA 18.0
+#define WORKSPACE_SPRING_OMEGA 14.0
+#define WORKSPACE_GESTURE_RELEASE_MS 150
+/* configures go out this late at most when no output repaints */
+#define XDG_CONFIGURE_TIMEOUT 16
+/* Closing windows animated at once; any beyond that just disappear */
+#define MAX_CLOSING_WINDOWS 16
 
 #define container_of(ptr, type, member) ({\
 	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
 	(type *)( (char *)__mptr - offsetof(type,member) );})
 
+/* Owned by the shell_seat, which finds it by workspace index; the
+ * surface_destroy_listener doubles as the index by surface, see
+ * surface_focus_state(). */
 struct focus_state {
 	struct weston_seat *seat;
+	struct shell_seat *shseat;
 	struct workspace *ws;
 	struct weston_surface *keyboard_focus;
 	struct wl_list link;
-	struct wl_listener seat_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 };
 
@@ -67,30 +76,82 @@ enum shell_surface_type {
 struct shell_client;
 
 struct shell_surface {
+	/* Read on every commit, move and repaint; kept together so they
+	 * share the first couple of cache lines. */
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct mayhem_shell *shell;
+	enum shell_surface_type type;
+	int32_t last_width, last_height;
+	int unresponsive, grabbed;
+	uint32_t resize_edges;
+
+	struct surface_state {
+		bool maximized;
+		bool fullscreen;
+		bool relative;
+	} state, next_state, requested_state; /* surface states */
+	bool state_changed;
+	bool state_requested;
+	bool has_set_geometry, has_next_geometry;
+
+	struct {
+		int32_t x, y, width, height;
+	} geometry, next_geometry;
+
+	struct weston_output *output;
+	const struct weston_shell_client *client;
+
+	/* window geometry in the free space and edges of every output, see
+	 * shell_surface_track_placement() */
+	struct {
+		pixman_box32_t box;
+		bool tracked;
+		uint32_t generation;	/* stale once the shell's moved on */
+	} placement;
+
+	/* everything below is only touched on state changes */
 	struct wl_resource *resource;
 	struct wl_signal destroy_signal;
 	struct shell_client *owner;
+	struct wl_list owner_link;	/* shell_client::surface_list */
+
+	struct {
+		uint64_t buffer_bytes;
+		uint32_t configures_pending;
+		uint32_t last_configure_serial;
+		bool configure_deferred;
+	} usage;
+
+	/* xdg_wm_base surfaces: the xdg_surface under the role object in
+	 * resource, and where its configure sequence is at */
+	struct {
+		struct wl_resource *resource;
+		struct wl_list configure_link;	/* a configure is pending */
+		int32_t width, height;		/* what the toplevel gets */
+		uint32_t serial;		/* of the last configure */
+		uint32_t state_serial;		/* the one with requested_state */
+		bool state_sent;
+		bool has_role;
+		bool committed;		/* the initial commit is in */
+		bool acked;		/* buffers may be attached */
+		bool has_buffer;
+	} xdg;
 
-	struct weston_surface *surface;
-	struct weston_view *view;
-	int32_t last_width, last_height;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener resource_destroy_listener;
 
 	struct weston_surface *parent;
 	struct wl_list children_list;  /* child surfaces of this one */
 	struct wl_list children_link;  /* sibling surfaces of this one */
-	struct mayhem_shell *shell;
 
-	enum shell_surface_type type;
 	char *title, *class;
+	pid_t pid;
 	int32_t saved_x, saved_y;
 	int32_t saved_width, saved_height;
 	bool saved_position_valid;
 	bool saved_size_valid;
 	bool saved_rotation_valid;
-	int unresponsive, grabbed;
-	uint32_t resize_edges;
 
 	struct {
 		struct weston_transform transform;
@@ -99,7 +160,8 @@ struct shell_surface {
 
 	struct {
 		struct wl_list grab_link;
-		int32_t x, y;
+		int32_t x, y;	/* xdg: relative to both window geometries */
+		int32_t width, height;	/* xdg: as solved by the positioner */
 		struct shell_seat *shseat;
 		uint32_t serial;
 	} popup;
@@ -113,30 +175,30 @@ struct shell_surface {
 		enum wl_shell_surface_fullscreen_method type;
 		struct weston_transform transform; /* matrix from x, y */
 		uint32_t framerate;
+		struct weston_view *black_view;	/* bars around a scaled one */
+		struct weston_transform black_transform; /* its workspace slide */
+		bool lowered;	/* another window was activated over it */
 	} fullscreen;
 
 	struct weston_transform workspace_transform;
 
+	struct {
+		struct shell_anim anim;
+		struct weston_transform transform;
+		enum animation_type type;
+	} effect;
+
 	struct weston_output *fullscreen_output;
-	struct weston_output *output;
 	struct wl_list link;
 
-	const struct weston_shell_client *client;
-
-	struct surface_state {
-		bool maximized;
-		bool fullscreen;
-		bool relative;
-	} state, next_state, requested_state; /* surface states */
-	bool state_changed;
-	bool state_requested;
+	int focus_count;
 
-	struct {
-		int32_t x, y, width, height;
-	} geometry, next_geometry;
-	bool has_set_geometry, has_next_geometry;
+	struct shell_window *window;	/* entry in the window list */
 
-	int focus_count;
+	/* what the [rule] sections want for it, looked up again until it
+	 * maps as the title and app-id come in */
+	struct shell_rule_actions rules;
+	bool rules_maximized_sent, rules_size_sent;
 };
 
 struct shell_grab {
@@ -160,15 +222,63 @@ struct rotate_grab {
 	} center;
 };
 
+struct shell_touch_grab {
+	struct weston_touch_grab grab;
+	struct shell_surface *shsurf;
+	struct wl_listener shsurf_destroy_listener;
+	const char *name;
+
+	wl_fixed_t x, y;	/* the finger that started the grab */
+	bool dirty;		/* it moved since the last touch frame */
+
+	struct {
+		uint32_t event_time;	/* oldest motion not on screen, or 0 */
+		struct wl_listener frame_listener;
+		struct wl_listener output_destroy_listener;
+		uint32_t samples, total, max;
+	} latency;
+};
+
+struct weston_touch_move_grab {
+	struct shell_touch_grab base;
+	wl_fixed_t dx, dy;
+};
+
+struct weston_touch_resize_grab {
+	struct shell_touch_grab base;
+	uint32_t edges;
+	int32_t width, height;
+};
+
+#define SWIPE_MAX_POINTS 10
+
+/* Watches touch sequences on windows and takes them over from the client
+ * once enough fingers are down for a workspace swipe. */
+struct touch_swipe_grab {
+	struct weston_touch_grab grab;
+	struct mayhem_shell *shell;
+	bool swiping;
+
+	struct {
+		int id;
+		wl_fixed_t x, y;
+	} points[SWIPE_MAX_POINTS];
+	int count;
+};
+
 struct shell_seat {
 	struct weston_seat *seat;
 	struct wl_listener seat_destroy_listener;
 	struct weston_surface *focused_surface;
+	struct weston_output *pointer_output;	/* cache, may be stale */
 
 	struct wl_listener caps_changed_listener;
 	struct wl_listener pointer_focus_listener;
 	struct wl_listener keyboard_focus_listener;
 
+	/* struct focus_state *, by workspace index */
+	struct wl_array focus_states;
+
 	struct {
 		struct weston_pointer_grab grab;
 		struct wl_list surfaces_list;
@@ -176,16 +286,38 @@ struct shell_seat {
 		int32_t initial_up;
 		enum { POINTER, TOUCH } type;
 	} popup_grab;
+
+	struct weston_keyboard_grab lock_grab;
+};
+
+/* What all shell bindings of one wl_client use together, which is what
+ * the limits are checked against. Looked up by its destroy listener. */
+struct shell_client_usage {
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list shell_clients;	/* shell_client::link */
+
+	uint32_t surfaces;
+	uint64_t buffer_bytes;
+	uint32_t commits;	/* in the current one second window */
+	uint32_t commit_rate;	/* commits in the last full window */
+	uint32_t window_start;
+	uint32_t configure_backlog;
+	uint32_t warned;	/* 1 << shell_client_limit */
 };
 
+/* One binding of wl_shell, xdg_wm_base or ms_menu. */
 struct shell_client {
 	struct wl_resource *resource;
 	struct wl_client *client;
 	struct mayhem_shell *shell;
-	struct wl_listener destroy_listener;
+	struct shell_client_usage *usage;
+	struct wl_list link;		/* shell_client_usage::shell_clients */
 	struct wl_event_source *ping_timer;
 	uint32_t ping_serial;
 	int unresponsive;
+
+	struct wl_list surface_list;	/* shell_surface::owner_link */
 };
 
 static void
@@ -197,14 +329,33 @@ shell_fade_startup(struct mayhem_shell *shell);
 static struct shell_seat *
 get_shell_seat(struct weston_seat *seat);
 
+static bool
+shell_surface_stack_run(struct shell_surface *shsurf,
+			struct weston_layer_entry *above);
+
+static struct shell_surface *
+shell_surface_get_root(struct shell_surface *shsurf);
+
+static void
+shell_surface_update_window(struct shell_surface *shsurf);
+
+static void
+shell_surface_match_rules(struct shell_surface *shsurf);
+
 static void
-shell_surface_update_child_surface_layers(struct shell_surface *shsurf);
+activate_from(struct mayhem_shell *shell, struct weston_surface *es,
+	      struct weston_seat *seat, struct focus_state *state,
+	      struct weston_surface *old_es, bool configure);
+
+static int
+shell_dump_to(struct mayhem_shell *shell, const char *path,
+	      char *buf, size_t len);
 
 static bool
 shell_surface_is_wl_shell_surface(struct shell_surface *shsurf);
 
 static bool
-shell_surface_is_xdg_surface(struct shell_surface *shsurf);
+shell_surface_is_xdg_toplevel(struct shell_surface *shsurf);
 
 static bool
 shell_surface_is_xdg_popup(struct shell_surface *shsurf);
@@ -239,24 +390,7 @@ shell_surface_get_label(struct weston_surface *surface, char *buf, size_t len)
 		c ? " of " : "", c ?: "");
 }
 
-static bool shell_surface_is_top_fullscreen(struct shell_surface *shsurf)
-{
-	return true;
-/*
-	struct mayhem_shell *shell;
-	struct weston_view *top_fs_ev;
-
-	shell = shsurf->shell;
-
-	if (wl_list_empty(&shell->fullscreen_layer.view_list.link))
-		return false;
-
-	top_fs_ev = container_of(shell->fullscreen_layer.view_list.link.next,
-			         struct weston_view,
-				 layer_link.link);
-	return (shsurf == get_shell_surface(top_fs_ev->surface));
-*/
-}
+static bool shell_surface_is_top_fullscreen(struct shell_surface *shsurf);
 
 static void destroy_shell_grab_shsurf(struct wl_listener *listener, void *data)
 {
@@ -341,7 +475,7 @@ static void send_configure_for_surface(struct shell_surface *shsurf)
 
 static void shell_surface_state_changed(struct shell_surface *shsurf)
 {
-	if (shell_surface_is_xdg_surface(shsurf))
+	if (shell_surface_is_xdg_toplevel(shsurf))
 		send_configure_for_surface(shsurf);
 }
 
@@ -360,6 +494,14 @@ static void shell_grab_end(struct shell_grab *grab)
 	weston_pointer_end_grab(grab->grab.pointer);
 }
 
+static void shell_grab_free(struct shell_grab *grab)
+{
+	struct mayhem_shell *shell =
+		grab->grab.pointer->seat->compositor->shell_interface.shell;
+
+	shell_slab_free(&shell->grab_slab, grab);
+}
+
 static void center_on_output(struct weston_view *view,
 			     struct weston_output *output);
 
@@ -393,11 +535,197 @@ static enum animation_type get_animation_type(char *animation)
 		return ANIMATION_NONE;
 }
 
+static const struct {
+	const char *name;
+	uint32_t duration;
+	enum shell_easing easing;
+} anim_defaults[SHELL_ANIM_KIND_COUNT] = {
+	[SHELL_ANIM_WINDOW] = { "window", 250, EASING_EASE_OUT },
+	[SHELL_ANIM_WORKSPACE] = { "workspace",
+				   DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH,
+				   EASING_SINE },
+	[SHELL_ANIM_FOCUS] = { "focus", 300, EASING_EASE_OUT },
+	[SHELL_ANIM_FADE] = { "fade", 300, EASING_EASE_OUT },
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+} client_limit_names[CLIENT_LIMIT_COUNT] = {
+	[CLIENT_LIMIT_SURFACES] = { "surfaces", "surfaces" },
+	[CLIENT_LIMIT_BUFFER_MB] = { "buffer-mb", "MiB of buffers" },
+	[CLIENT_LIMIT_COMMIT_RATE] = { "commit-rate", "commits/s" },
+	[CLIENT_LIMIT_CONFIGURE_BACKLOG] = { "configure-backlog",
+					     "unacked configures" },
+};
+
+/* Returns false when the client went over the hard limit and is being
+ * disconnected. */
+static bool shell_client_check_limit(struct shell_client *sc,
+				     enum shell_client_limit limit,
+				     uint64_t value)
+{
+	const struct shell_client_limits *l = &sc->shell->client_limits[limit];
+	uint32_t bit = 1 << limit;
+	pid_t pid;
+
+	if (l->hard && value > l->hard) {
+		wl_client_get_credentials(sc->client, &pid, NULL, NULL);
+		weston_log("client %d went over its hard limit of %u %s, "
+			   "disconnecting\n", pid, l->hard,
+			   client_limit_names[limit].unit);
+		wl_client_post_no_memory(sc->client);
+		return false;
+	}
+
+	if (l->soft && value > l->soft) {
+		if (!(sc->usage->warned & bit)) {
+			wl_client_get_credentials(sc->client, &pid, NULL, NULL);
+			weston_log("client %d is using %llu %s, soft limit "
+				   "is %u\n", pid, (unsigned long long) value,
+				   client_limit_names[limit].unit, l->soft);
+			sc->usage->warned |= bit;
+		}
+	} else {
+		sc->usage->warned &= ~bit;
+	}
+
+	return true;
+}
+
+static bool shell_client_over_soft_limit(struct shell_client *sc,
+					 enum shell_client_limit limit)
+{
+	return sc->usage->warned & (1 << limit);
+}
+
+static uint64_t surface_buffer_bytes(struct weston_surface *surface)
+{
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct wl_shm_buffer *shm;
+
+	if (!buffer)
+		return 0;
+
+	shm = wl_shm_buffer_get(buffer->resource);
+	if (shm)
+		return (uint64_t) wl_shm_buffer_get_stride(shm) *
+			wl_shm_buffer_get_height(shm);
+
+	/* no cheap way to ask, assume 32 bpp */
+	return (uint64_t) buffer->width * buffer->height * 4;
+}
+
+/* Called for every commit, so only counts and compares. */
+static void shell_client_account_commit(struct shell_surface *shsurf)
+{
+	struct shell_client *sc = shsurf->owner;
+	uint32_t now, rate;
+	uint64_t bytes;
+
+	if (!sc)
+		return;
+
+	now = weston_compositor_get_time();
+	if (now - sc->usage->window_start >= 1000) {
+		sc->usage->commit_rate = sc->usage->commits;
+		sc->usage->commits = 0;
+		sc->usage->window_start = now;
+	}
+
+	/* the running window counts too so a burst is caught before
+	 * the second is over */
+	rate = ++sc->usage->commits;
+	if (rate < sc->usage->commit_rate)
+		rate = sc->usage->commit_rate;
+	if (!shell_client_check_limit(sc, CLIENT_LIMIT_COMMIT_RATE, rate))
+		return;
+
+	bytes = surface_buffer_bytes(shsurf->surface);
+	if (bytes != shsurf->usage.buffer_bytes) {
+		sc->usage->buffer_bytes += bytes - shsurf->usage.buffer_bytes;
+		shsurf->usage.buffer_bytes = bytes;
+		shell_client_check_limit(sc, CLIENT_LIMIT_BUFFER_MB,
+					 sc->usage->buffer_bytes >> 20);
+	}
+}
+
+static void shell_client_account_configure(struct shell_surface *shsurf,
+					   uint32_t serial)
+{
+	struct shell_client *sc = shsurf->owner;
+
+	shsurf->usage.last_configure_serial = serial;
+	shsurf->usage.configures_pending++;
+
+	if (!sc)
+		return;
+
+	sc->usage->configure_backlog++;
+	shell_client_check_limit(sc, CLIENT_LIMIT_CONFIGURE_BACKLOG,
+				 sc->usage->configure_backlog);
+}
+
+static void shell_client_account_ack(struct shell_surface *shsurf,
+				     uint32_t serial)
+{
+	struct shell_client *sc = shsurf->owner;
+	uint32_t acked;
+
+	/* acking the latest configure acks all the earlier ones too */
+	if (serial == shsurf->usage.last_configure_serial)
+		acked = shsurf->usage.configures_pending;
+	else
+		acked = shsurf->usage.configures_pending > 0 ? 1 : 0;
+
+	shsurf->usage.configures_pending -= acked;
+
+	if (!sc)
+		return;
+
+	sc->usage->configure_backlog -= acked;
+	shell_client_check_limit(sc, CLIENT_LIMIT_CONFIGURE_BACKLOG,
+				 sc->usage->configure_backlog);
+}
+
+static void shell_client_add_surface(struct shell_client *sc,
+				     struct shell_surface *shsurf)
+{
+	wl_list_insert(&sc->surface_list, &shsurf->owner_link);
+	sc->usage->surfaces++;
+}
+
+static void shell_client_remove_surface(struct shell_surface *shsurf)
+{
+	struct shell_client *sc = shsurf->owner;
+
+	wl_list_remove(&shsurf->owner_link);
+	wl_list_init(&shsurf->owner_link);
+
+	if (!sc)
+		return;
+
+	sc->usage->surfaces--;
+	sc->usage->buffer_bytes -= shsurf->usage.buffer_bytes;
+	sc->usage->configure_backlog -= shsurf->usage.configures_pending;
+	shsurf->owner = NULL;
+}
+
+static const struct shell_client_limits
+client_limit_defaults[CLIENT_LIMIT_COUNT] = {
+	[CLIENT_LIMIT_SURFACES] = { 512, 4096 },
+	[CLIENT_LIMIT_BUFFER_MB] = { 512, 2048 },
+	[CLIENT_LIMIT_COMMIT_RATE] = { 1000, 0 },
+	[CLIENT_LIMIT_CONFIGURE_BACKLOG] = { 16, 0 },
+};
+
 static void shell_configuration(struct mayhem_shell *shell)
 {
 	struct weston_config_section *section;
 	char *s, *client;
 	const char *libexec_dir;
+	char key[64];
+	int i, report, locking, snap_tiling;
 
 	section = weston_config_get_section(shell->compositor->config,
 					    "shell", NULL, NULL);
@@ -434,9 +762,58 @@ static void shell_configuration(struct mayhem_shell *shell)
 	weston_config_section_get_string(section, "focus-animation", &s, "none");
 	shell->focus_animation_type = get_animation_type(s);
 	free(s);
+	weston_config_section_get_string(section, "placement", &s, "smart");
+	shell->smart_placement = strcmp(s, "pointer") != 0;
+	free(s);
+	weston_config_section_get_int(section, "snap-threshold",
+				      &shell->snap_threshold, 12);
+	weston_config_section_get_bool(section, "snap-tiling", &snap_tiling, 1);
+	shell->snap_tiling = snap_tiling;
+	weston_config_section_get_uint(section, "swipe-fingers",
+				       &shell->swipe_fingers, 3);
+	weston_config_section_get_string(section, "ipc-socket",
+					 &shell->ipc_socket, NULL);
 	weston_config_section_get_uint(section, "num-workspaces",
 				       &shell->workspaces.num,
 				       DEFAULT_NUM_WORKSPACES);
+	weston_config_section_get_bool(section, "locking", &locking, 0);
+	shell->lock.enabled = locking;
+	weston_config_section_get_uint(section, "lock-color",
+				       &shell->lock.color, 0xff000000);
+
+	for (i = 0; i < SHELL_ANIM_KIND_COUNT; i++) {
+		struct shell_anim_config *config = &shell->anim_config[i];
+
+		snprintf(key, sizeof key, "%s-animation-duration",
+			 anim_defaults[i].name);
+		weston_config_section_get_uint(section, key, &config->duration,
+					       anim_defaults[i].duration);
+
+		snprintf(key, sizeof key, "%s-animation-curve",
+			 anim_defaults[i].name);
+		weston_config_section_get_string(section, key, &s, NULL);
+		config->easing = shell_easing_from_string(s,
+							  anim_defaults[i].easing);
+		free(s);
+	}
+	weston_config_section_get_bool(section, "animation-report",
+				       &report, 0);
+	shell->timeline.report = report;
+
+	for (i = 0; i < CLIENT_LIMIT_COUNT; i++) {
+		struct shell_client_limits *limits = &shell->client_limits[i];
+
+		snprintf(key, sizeof key, "client-%s-soft-limit",
+			 client_limit_names[i].name);
+		weston_config_section_get_uint(section, key, &limits->soft,
+					       client_limit_defaults[i].soft);
+		snprintf(key, sizeof key, "client-%s-hard-limit",
+			 client_limit_names[i].name);
+		weston_config_section_get_uint(section, key, &limits->hard,
+					       client_limit_defaults[i].hard);
+	}
+
+	shell_rules_load(&shell->rules, shell->compositor->config);
 }
 
 struct weston_output *get_default_output(struct weston_compositor *compositor)
@@ -526,29 +903,87 @@ static void focus_surface_destroy(struct focus_surface *fsurf)
 	free(fsurf);
 }
 
-static void focus_animation_done(struct weston_view_animation *animation,
-				 void *data)
+/* With focus_stable set, the back view takes over whatever dimming the front
+ * view has not reached yet so the total dimming stays constant while the
+ * highlight moves between windows. */
+static void focus_animation_frame(struct shell_anim *anim, double value)
 {
-	struct workspace *ws = data;
+	struct workspace *ws = container_of(anim, struct workspace,
+					    focus_animation);
+	struct weston_view *front = ws->fsurf_front->view;
+	struct weston_view *back = ws->fsurf_back->view;
+
+	front->alpha = value;
+	weston_view_geometry_dirty(front);
 
-	ws->focus_animation = NULL;
+	if (ws->focus_stable) {
+		if (value < 1.0)
+			back->alpha = (anim->to - value) / (1.0 - value);
+		else
+			back->alpha = 0.0;
+		weston_view_geometry_dirty(back);
+	}
 }
 
-static void focus_state_destroy(struct focus_state *state)
+static struct focus_state **
+shell_seat_focus_slot(struct shell_seat *shseat, struct workspace *ws,
+		      bool create)
 {
-	wl_list_remove(&state->seat_destroy_listener.link);
-	wl_list_remove(&state->surface_destroy_listener.link);
-	free(state);
+	size_t size = (ws->index + 1) * sizeof(struct focus_state *);
+	size_t old_size = shseat->focus_states.size;
+
+	if (old_size < size) {
+		if (!create ||
+		    !wl_array_add(&shseat->focus_states, size - old_size))
+			return NULL;
+		memset((char *) shseat->focus_states.data + old_size, 0,
+		       size - old_size);
+	}
+
+	return (struct focus_state **) shseat->focus_states.data + ws->index;
 }
 
-static void focus_state_seat_destroy(struct wl_listener *listener, void *data)
+static struct focus_state *
+shell_seat_focus_state(struct shell_seat *shseat, struct workspace *ws)
 {
-	struct focus_state *state = container_of(listener,
-						 struct focus_state,
-						 seat_destroy_listener);
+	struct focus_state **slot = shell_seat_focus_slot(shseat, ws, false);
+
+	return slot ? *slot : NULL;
+}
+
+static void focus_state_surface_destroy(struct wl_listener *listener,
+					void *data);
+
+/* The next focus state on ws (any workspace if NULL) holding surface. */
+static struct focus_state *
+surface_focus_state(struct weston_surface *surface, struct workspace *ws)
+{
+	struct wl_listener *listener;
+	struct focus_state *state;
+
+	wl_list_for_each(listener, &surface->destroy_signal.listener_list,
+			 link) {
+		if (listener->notify != focus_state_surface_destroy)
+			continue;
+
+		state = container_of(listener, struct focus_state,
+				     surface_destroy_listener);
+		if (!ws || state->ws == ws)
+			return state;
+	}
+
+	return NULL;
+}
 
+static void focus_state_destroy(struct focus_state *state)
+{
+	struct mayhem_shell *shell =
+		state->seat->compositor->shell_interface.shell;
+
+	*shell_seat_focus_slot(state->shseat, state->ws, false) = NULL;
 	wl_list_remove(&state->link);
-	focus_state_destroy(state);
+	wl_list_remove(&state->surface_destroy_listener.link);
+	shell_slab_free(&shell->focus_slab, state);
 }
 
 static void focus_state_surface_destroy(struct wl_listener *listener, void *data)
@@ -583,39 +1018,42 @@ static void focus_state_surface_destroy(struct wl_listener *listener, void *data
 		state->keyboard_focus = NULL;
 		activate(shell, next, state->seat, true);
 	} else {
-		if (shell->focus_animation_type == ANIMATION_DIM_LAYER) {
-			if (state->ws->focus_animation)
-				weston_view_animation_destroy(state->ws->focus_animation);
-
-			state->ws->focus_animation = weston_fade_run(
-				state->ws->fsurf_front->view,
-				state->ws->fsurf_front->view->alpha, 0.0, 300,
-				focus_animation_done, state->ws);
+		if (shell->focus_animation_type == ANIMATION_DIM_LAYER &&
+		    state->ws->fsurf_front) {
+			state->ws->focus_stable = false;
+			shell_anim_start(&state->ws->focus_animation,
+					 state->ws->fsurf_front->view->alpha,
+					 0.0);
 		}
 
-		wl_list_remove(&state->link);
 		focus_state_destroy(state);
 	}
 }
 
-static struct focus_state *focus_state_create(struct weston_seat *seat,
+static struct focus_state *focus_state_create(struct shell_seat *shseat,
 					      struct workspace *ws)
 {
+	struct weston_seat *seat = shseat->seat;
+	struct mayhem_shell *shell = seat->compositor->shell_interface.shell;
+	struct focus_state **slot;
 	struct focus_state *state;
 
-	state = malloc(sizeof *state);
+	slot = shell_seat_focus_slot(shseat, ws, true);
+	if (slot == NULL)
+		return NULL;
+
+	state = shell_slab_zalloc(&shell->focus_slab);
 	if (state == NULL)
 		return NULL;
 
 	state->keyboard_focus = NULL;
 	state->ws = ws;
 	state->seat = seat;
+	state->shseat = shseat;
 	wl_list_insert(&ws->focus_list, &state->link);
+	*slot = state;
 
-	state->seat_destroy_listener.notify = focus_state_seat_destroy;
 	state->surface_destroy_listener.notify = focus_state_surface_destroy;
-	wl_signal_add(&seat->destroy_signal,
-		      &state->seat_destroy_listener);
 	wl_list_init(&state->surface_destroy_listener.link);
 
 	return state;
@@ -625,14 +1063,12 @@ static struct focus_state *ensure_focus_state(struct mayhem_shell *shell,
 					      struct weston_seat *seat)
 {
 	struct workspace *ws = get_current_workspace(shell);
+	struct shell_seat *shseat = get_shell_seat(seat);
 	struct focus_state *state;
 
-	wl_list_for_each(state, &ws->focus_list, link)
-		if (state->seat == seat)
-			break;
-
-	if (&state->link == &ws->focus_list)
-		state = focus_state_create(seat, ws);
+	state = shell_seat_focus_state(shseat, ws);
+	if (state == NULL)
+		state = focus_state_create(shseat, ws);
 
 	return state;
 }
@@ -651,47 +1087,27 @@ static void focus_state_set_focus(struct focus_state *state,
 			      &state->surface_destroy_listener);
 }
 
+/* Gives every seat the keyboard focus it had on ws, or none. Seats
+ * whose focus stays the same are left alone. */
 static void restore_focus_state(struct mayhem_shell *shell,
 				struct workspace *ws)
 {
-	struct focus_state *state, *next;
+	struct focus_state *state;
 	struct weston_surface *surface;
-	struct wl_list pending_seat_list;
-	struct weston_seat *seat, *next_seat;
-
-	/* Temporarily steal the list of seats so that we can keep
-	 * track of the seats we've already processed */
-	wl_list_init(&pending_seat_list);
-	wl_list_insert_list(&pending_seat_list, &shell->compositor->seat_list);
-	wl_list_init(&shell->compositor->seat_list);
-
-	wl_list_for_each_safe(state, next, &ws->focus_list, link) {
-		struct weston_keyboard *keyboard =
-			weston_seat_get_keyboard(state->seat);
-		wl_list_remove(&state->seat->link);
-		wl_list_insert(&shell->compositor->seat_list,
-			       &state->seat->link);
-
-		if (!keyboard)
-			continue;
-
-		surface = state->keyboard_focus;
-
-		weston_keyboard_set_focus(keyboard, surface);
-	}
+	struct weston_seat *seat;
 
-	/* For any remaining seats that we don't have a focus state
-	 * for we'll reset the keyboard focus to NULL */
-	wl_list_for_each_safe(seat, next_seat, &pending_seat_list, link) {
+	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
 		struct weston_keyboard *keyboard =
 			weston_seat_get_keyboard(seat);
 
-		wl_list_insert(&shell->compositor->seat_list, &seat->link);
-
 		if (!keyboard)
 			continue;
 
-		weston_keyboard_set_focus(keyboard, NULL);
+		state = shell_seat_focus_state(get_shell_seat(seat), ws);
+		surface = state ? state->keyboard_focus : NULL;
+
+		if (keyboard->focus != surface)
+			weston_keyboard_set_focus(keyboard, surface);
 	}
 }
 
@@ -701,12 +1117,9 @@ static void replace_focus_state(struct mayhem_shell *shell,
 	struct focus_state *state;
 	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
 
-	wl_list_for_each(state, &ws->focus_list, link) {
-		if (state->seat == seat) {
-			focus_state_set_focus(state, keyboard->focus);
-			return;
-		}
-	}
+	state = shell_seat_focus_state(get_shell_seat(seat), ws);
+	if (state)
+		focus_state_set_focus(state, keyboard->focus);
 }
 
 static void drop_focus_state(struct mayhem_shell *shell, struct workspace *ws,
@@ -714,9 +1127,9 @@ static void drop_focus_state(struct mayhem_shell *shell, struct workspace *ws,
 {
 	struct focus_state *state;
 
-	wl_list_for_each(state, &ws->focus_list, link)
-		if (state->keyboard_focus == surface)
-			focus_state_set_focus(state, NULL);
+	/* clearing the focus takes the state off the surface */
+	while ((state = surface_focus_state(surface, ws)))
+		focus_state_set_focus(state, NULL);
 }
 
 static void animate_focus_change(struct mayhem_shell *shell,
@@ -750,10 +1163,7 @@ static void animate_focus_change(struct mayhem_shell *shell,
 		weston_layer_entry_remove(&ws->fsurf_back->view->layer_link);
 	}
 
-	if (ws->focus_animation) {
-		weston_view_animation_destroy(ws->focus_animation);
-		ws->focus_animation = NULL;
-	}
+	shell_anim_stop(&ws->focus_animation);
 
 	if (to)
 		weston_layer_entry_insert(&to->layer_link,
@@ -763,24 +1173,21 @@ static void animate_focus_change(struct mayhem_shell *shell,
 					  &ws->fsurf_front->view->layer_link);
 
 	if (focus_surface_created) {
-		ws->focus_animation = weston_fade_run(
-			ws->fsurf_front->view,
-			ws->fsurf_front->view->alpha, 0.4, 300,
-			focus_animation_done, ws);
-	} else if (from) {
-		weston_layer_entry_insert(&from->layer_link,
-					  &ws->fsurf_back->view->layer_link);
-		ws->focus_animation = weston_stable_fade_run(
-			ws->fsurf_front->view, 0.0,
-			ws->fsurf_back->view, 0.4,
-			focus_animation_done, ws);
-	} else if (to) {
-		weston_layer_entry_insert(&ws->layer.view_list,
-					  &ws->fsurf_back->view->layer_link);
-		ws->focus_animation = weston_stable_fade_run(
-			ws->fsurf_front->view, 0.0,
-			ws->fsurf_back->view, 0.4,
-			focus_animation_done, ws);
+		ws->focus_stable = false;
+		shell_anim_start(&ws->focus_animation,
+				 ws->fsurf_front->view->alpha, 0.4);
+	} else if (from || to) {
+		if (from)
+			weston_layer_entry_insert(&from->layer_link,
+						  &ws->fsurf_back->view->layer_link);
+		else
+			weston_layer_entry_insert(&ws->layer.view_list,
+						  &ws->fsurf_back->view->layer_link);
+
+		ws->fsurf_front->view->alpha = 0.0;
+		ws->fsurf_back->view->alpha = 0.4;
+		ws->focus_stable = true;
+		shell_anim_start(&ws->focus_animation, 0.0, 0.4);
 	}
 }
 
@@ -791,6 +1198,8 @@ static void workspace_destroy(struct workspace *ws)
 	wl_list_for_each_safe(state, next, &ws->focus_list, link)
 		focus_state_destroy(state);
 
+	shell_anim_stop(&ws->focus_animation);
+
 	if (ws->fsurf_front)
 		focus_surface_destroy(ws->fsurf_front);
 	if (ws->fsurf_back)
@@ -799,33 +1208,23 @@ static void workspace_destroy(struct workspace *ws)
 	free(ws);
 }
 
-static void seat_destroyed(struct wl_listener *listener, void *data)
-{
-	struct weston_seat *seat = data;
-	struct focus_state *state, *next;
-	struct workspace *ws = container_of(listener,
-					    struct workspace,
-					    seat_destroyed_listener);
-
-	wl_list_for_each_safe(state, next, &ws->focus_list, link)
-		if (state->seat == seat)
-			wl_list_remove(&state->link);
-}
-
-static struct workspace *workspace_create(void)
+static struct workspace *workspace_create(struct mayhem_shell *shell,
+					  unsigned int index)
 {
 	struct workspace *ws = malloc(sizeof *ws);
 	if (ws == NULL)
 		return NULL;
 
 	weston_layer_init(&ws->layer, NULL);
+	ws->index = index;
 
 	wl_list_init(&ws->focus_list);
-	wl_list_init(&ws->seat_destroyed_listener.link);
-	ws->seat_destroyed_listener.notify = seat_destroyed;
 	ws->fsurf_front = NULL;
 	ws->fsurf_back = NULL;
-	ws->focus_animation = NULL;
+	shell_anim_init(&ws->focus_animation, &shell->timeline,
+			&shell->anim_config[SHELL_ANIM_FOCUS],
+			focus_animation_frame, NULL);
+	ws->focus_stable = false;
 
 	return ws;
 }
@@ -849,6 +1248,183 @@ struct workspace *get_current_workspace(struct mayhem_shell *shell)
 	return get_workspace(shell, shell->workspaces.current);
 }
 
+static void shell_surface_placement_box(struct shell_surface *shsurf,
+					pixman_box32_t *box)
+{
+	struct weston_view *view = shsurf->view;
+	int32_t x = 0, y = 0;
+	int32_t width = shsurf->surface->width;
+	int32_t height = shsurf->surface->height;
+
+	/* client side shadows don't take up room */
+	if (shsurf->has_set_geometry) {
+		x = shsurf->geometry.x;
+		y = shsurf->geometry.y;
+		width = shsurf->geometry.width;
+		height = shsurf->geometry.height;
+	}
+
+	box->x1 = (int32_t) view->geometry.x + x;
+	box->y1 = (int32_t) view->geometry.y + y;
+	box->x2 = box->x1 + width;
+	box->y2 = box->y1 + height;
+}
+
+/* Windows coming, going, moving and resizing update the free space and
+ * snapping edges of every output in place, see
+ * shell_surface_track_placement(). Whatever changes all windows at once,
+ * like a workspace switch or an output appearing, throws both away; they
+ * are rebuilt from the current workspace when next needed. */
+static void shell_invalidate_placement(struct mayhem_shell *shell)
+{
+	struct shell_output *shell_output;
+
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		shell_placement_invalidate(&shell_output->placement);
+		shell_edges_invalidate(&shell_output->edges);
+	}
+	shell->placement_generation++;
+}
+
+static bool shell_surface_placement_tracked(struct shell_surface *shsurf)
+{
+	return shsurf->placement.tracked &&
+		shsurf->placement.generation ==
+		shsurf->shell->placement_generation;
+}
+
+static void shell_surface_set_tracked(struct shell_surface *shsurf,
+				      const pixman_box32_t *box)
+{
+	shsurf->placement.box = *box;
+	shsurf->placement.tracked = true;
+	shsurf->placement.generation = shsurf->shell->placement_generation;
+}
+
+static bool shell_surface_counts_for_placement(struct shell_surface *shsurf)
+{
+	return shsurf->type == SHELL_SURFACE_TOPLEVEL &&
+		weston_view_is_mapped(shsurf->view) &&
+		shsurf->view->layer_link.layer ==
+		&get_current_workspace(shsurf->shell)->layer;
+}
+
+static void shell_output_area(struct shell_output *shell_output,
+			      pixman_box32_t *area)
+{
+	struct weston_output *output = shell_output->output;
+
+	area->x1 = output->x;
+	area->y1 = output->y;
+	area->x2 = output->x + output->width;
+	area->y2 = output->y + output->height;
+}
+
+static void shell_output_rebuild_placement(struct shell_output *shell_output,
+					   struct weston_view *skip)
+{
+	struct workspace *ws = get_current_workspace(shell_output->shell);
+	struct shell_surface *shsurf;
+	struct weston_view *view;
+	pixman_box32_t area, box;
+
+	shell_output_area(shell_output, &area);
+	shell_placement_reset(&shell_output->placement, &area);
+
+	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
+		shsurf = get_shell_surface(view->surface);
+		if (view == skip || !shsurf ||
+		    shsurf->type != SHELL_SURFACE_TOPLEVEL ||
+		    !weston_view_is_mapped(view))
+			continue;
+
+		shell_surface_placement_box(shsurf, &box);
+		shell_placement_occupy(&shell_output->placement, &box, shsurf);
+	}
+}
+
+static void shell_output_rebuild_edges(struct shell_output *shell_output)
+{
+	struct workspace *ws = get_current_workspace(shell_output->shell);
+	struct shell_surface *shsurf;
+	struct weston_view *view;
+	pixman_box32_t area, box;
+
+	shell_output_area(shell_output, &area);
+	shell_edges_reset(&shell_output->edges, &area);
+
+	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
+		shsurf = get_shell_surface(view->surface);
+		if (!shsurf || shsurf->type != SHELL_SURFACE_TOPLEVEL ||
+		    !weston_view_is_mapped(view))
+			continue;
+
+		shell_surface_placement_box(shsurf, &box);
+		shell_edges_add(&shell_output->edges, &box, shsurf);
+
+		/* what the edges hold, for shell_surface_track_placement() */
+		shell_surface_set_tracked(shsurf, &box);
+	}
+}
+
+static void shell_surface_untrack_placement(struct shell_surface *shsurf)
+{
+	struct shell_output *shell_output;
+	bool tracked = shell_surface_placement_tracked(shsurf);
+
+	wl_list_for_each(shell_output, &shsurf->shell->output_list, link) {
+		shell_placement_vacate(&shell_output->placement, shsurf);
+		if (tracked)
+			shell_edges_remove(&shell_output->edges,
+					   &shsurf->placement.box, shsurf);
+	}
+
+	shsurf->placement.tracked = false;
+}
+
+/* Called whenever a window's transform is updated or it changes layer:
+ * its box is in the free space and edges of every output for as long as
+ * it is on the current workspace. */
+static void shell_surface_track_placement(struct shell_surface *shsurf)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct shell_output *shell_output;
+	pixman_box32_t box;
+	bool tracked;
+
+	if (!shell_surface_counts_for_placement(shsurf)) {
+		shell_surface_untrack_placement(shsurf);
+		return;
+	}
+
+	shell_surface_placement_box(shsurf, &box);
+	tracked = shell_surface_placement_tracked(shsurf);
+	if (tracked && memcmp(&box, &shsurf->placement.box, sizeof box) == 0)
+		return;
+
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		shell_placement_occupy(&shell_output->placement, &box, shsurf);
+		if (tracked)
+			shell_edges_remove(&shell_output->edges,
+					   &shsurf->placement.box, shsurf);
+		shell_edges_add(&shell_output->edges, &box, shsurf);
+	}
+
+	shell_surface_set_tracked(shsurf, &box);
+}
+
+static void workspace_set_current(struct mayhem_shell *shell,
+				  unsigned int index)
+{
+	shell->workspaces.current = index;
+	shell_invalidate_placement(shell);
+
+	/* consecutive switches reach subscribers as the last one */
+	shell_ipc_emit(&shell->ipc, SHELL_IPC_EVENT_WORKSPACE, 0,
+		       SHELL_IPC_FIELD, NULL, "%u", index);
+	shell_policy_workspace(&shell->policy, index);
+}
+
 static void activate_workspace(struct mayhem_shell *shell, unsigned int index)
 {
 	struct workspace *ws;
@@ -864,18 +1440,43 @@ static unsigned int get_output_height(struct weston_output *output)
 	return abs(output->region.extents.y1 - output->region.extents.y2);
 }
 
+/* Advance a critically damped spring by dt seconds using its closed form,
+ * which is stable for any frame interval. */
+static void spring_step(double *current, double *velocity, double target,
+			double omega, double dt)
+{
+	double x0 = *current - target;
+	double v0 = *velocity;
+	double decay = exp(-omega * dt);
+	double b = v0 + omega * x0;
+
+	*current = target + (x0 + b * dt) * decay;
+	*velocity = (v0 - omega * b * dt) * decay;
+}
+
+static struct shell_surface *
+get_black_surface_owner(struct weston_surface *surface);
+
+/* the transform a workspace slide moves the view by */
+static struct weston_transform *
+view_workspace_transform(struct weston_view *view)
+{
+	struct shell_surface *shsurf;
+
+	if (is_focus_view(view))
+		return &get_focus_surface(view->surface)->workspace_transform;
+
+	shsurf = get_black_surface_owner(view->surface);
+	if (shsurf)
+		return &shsurf->fullscreen.black_transform;
+
+	return &get_shell_surface(view->surface)->workspace_transform;
+}
+
 static void view_translate(struct workspace *ws, struct weston_view *view,
 			   double d)
 {
-	struct weston_transform *transform;
-
-	if (is_focus_view(view)) {
-		struct focus_surface *fsurf = get_focus_surface(view->surface);
-		transform = &fsurf->workspace_transform;
-	} else {
-		struct shell_surface *shsurf = get_shell_surface(view->surface);
-		transform = &shsurf->workspace_transform;
-	}
+	struct weston_transform *transform = view_workspace_transform(view);
 
 	if (wl_list_empty(&transform->link))
 		wl_list_insert(view->geometry.transformation_list.prev,
@@ -919,17 +1520,38 @@ static void workspace_translate_in(struct workspace *ws, double fraction)
 	}
 }
 
+/* anim_from and anim_to keep the roles they had when the slide started;
+ * a reversed animation simply plays backwards, so which workspace is on
+ * its way out depends on the direction the timeline is running in. */
+static struct workspace *
+workspace_anim_leaving(struct mayhem_shell *shell)
+{
+	return shell->workspaces.anim.dir > 0 ?
+		shell->workspaces.anim_from : shell->workspaces.anim_to;
+}
+
+static struct workspace *
+workspace_anim_entering(struct mayhem_shell *shell)
+{
+	return shell->workspaces.anim.dir > 0 ?
+		shell->workspaces.anim_to : shell->workspaces.anim_from;
+}
+
+static bool workspace_anim_reverses(struct mayhem_shell *shell,
+				    struct workspace *from,
+				    struct workspace *to)
+{
+	return shell->workspaces.anim_to != NULL &&
+		workspace_anim_leaving(shell) == to &&
+		workspace_anim_entering(shell) == from;
+}
+
 static void reverse_workspace_change_animation(struct mayhem_shell *shell,
-					       unsigned int index,
-					       struct workspace *from,
-					       struct workspace *to)
+					       unsigned int index)
 {
-	shell->workspaces.current = index;
+	workspace_set_current(shell, index);
 
-	shell->workspaces.anim_to = to;
-	shell->workspaces.anim_from = from;
-	shell->workspaces.anim_dir = -1 * shell->workspaces.anim_dir;
-	shell->workspaces.anim_timestamp = 0;
+	shell_anim_reverse(&shell->workspaces.anim);
 
 	weston_compositor_schedule_repaint(shell->compositor);
 }
@@ -940,14 +1562,7 @@ static void workspace_deactivate_transforms(struct workspace *ws)
 	struct weston_transform *transform;
 
 	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
-		if (is_focus_view(view)) {
-			struct focus_surface *fsurf = get_focus_surface(view->surface);
-			transform = &fsurf->workspace_transform;
-		} else {
-			struct shell_surface *shsurf = get_shell_surface(view->surface);
-			transform = &shsurf->workspace_transform;
-		}
-
+		transform = view_workspace_transform(view);
 		if (!wl_list_empty(&transform->link)) {
 			wl_list_remove(&transform->link);
 			wl_list_init(&transform->link);
@@ -956,10 +1571,14 @@ static void workspace_deactivate_transforms(struct workspace *ws)
 	}
 }
 
-static void finish_workspace_change_animation(struct mayhem_shell *shell,
-					      struct workspace *from,
-					      struct workspace *to)
+static void raise_fullscreen_layer(struct mayhem_shell *shell);
+
+static void shell_fullscreen_schedule(struct mayhem_shell *shell);
+
+static void finish_workspace_change_animation(struct mayhem_shell *shell)
 {
+	struct workspace *leaving = workspace_anim_leaving(shell);
+	struct workspace *entering = workspace_anim_entering(shell);
 	struct weston_view *view;
 
 	weston_compositor_schedule_repaint(shell->compositor);
@@ -968,66 +1587,42 @@ static void finish_workspace_change_animation(struct mayhem_shell *shell,
 	 * visible after the workspace animation ends but before its layer
 	 * is hidden. In that case, we need to damage below those views so
 	 * that the screen is properly repainted. */
-	wl_list_for_each(view, &from->layer.view_list.link, layer_link.link)
+	wl_list_for_each(view, &leaving->layer.view_list.link, layer_link.link)
 		weston_view_damage_below(view);
 
-	wl_list_remove(&shell->workspaces.animation.link);
-	workspace_deactivate_transforms(from);
-	workspace_deactivate_transforms(to);
+	shell_anim_stop(&shell->workspaces.anim);
+	workspace_deactivate_transforms(leaving);
+	workspace_deactivate_transforms(entering);
+	shell->workspaces.anim_from = NULL;
 	shell->workspaces.anim_to = NULL;
 
-	wl_list_remove(&shell->workspaces.anim_from->layer.link);
+	wl_list_remove(&leaving->layer.link);
+	raise_fullscreen_layer(shell);
 }
 
-static void animate_workspace_change_frame(struct weston_animation *animation,
-					   struct weston_output *output,
-					   uint32_t msecs)
+static void animate_workspace_change_frame(struct shell_anim *anim,
+					   double value)
 {
 	struct mayhem_shell *shell =
-		container_of(animation, struct mayhem_shell,
-			     workspaces.animation);
+		container_of(anim, struct mayhem_shell, workspaces.anim);
 	struct workspace *from = shell->workspaces.anim_from;
 	struct workspace *to = shell->workspaces.anim_to;
-	uint32_t t;
-	double x, y;
 
 	if (workspace_is_empty(from) && workspace_is_empty(to)) {
-		finish_workspace_change_animation(shell, from, to);
+		finish_workspace_change_animation(shell);
 		return;
 	}
 
-	if (shell->workspaces.anim_timestamp == 0) {
-		if (shell->workspaces.anim_current == 0.0)
-			shell->workspaces.anim_timestamp = msecs;
-		else
-			shell->workspaces.anim_timestamp =
-				msecs -
-				/* Invers of movement function 'y' below. */
-				(asin(1.0 - shell->workspaces.anim_current) *
-				 DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH *
-				 M_2_PI);
-	}
-
-	t = msecs - shell->workspaces.anim_timestamp;
-
-	/*
-	 * x = [0, π/2]
-	 * y(x) = sin(x)
-	 */
-	x = t * (1.0/DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH) * M_PI_2;
-	y = sin(x);
-
-	if (t < DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH) {
-		weston_compositor_schedule_repaint(shell->compositor);
+	workspace_translate_out(from, shell->workspaces.anim_dir * value);
+	workspace_translate_in(to, shell->workspaces.anim_dir * value);
+}
 
-		workspace_translate_out(from, shell->workspaces.anim_dir * y);
-		workspace_translate_in(to, shell->workspaces.anim_dir * y);
-		shell->workspaces.anim_current = y;
+static void animate_workspace_change_done(struct shell_anim *anim)
+{
+	struct mayhem_shell *shell =
+		container_of(anim, struct mayhem_shell, workspaces.anim);
 
-		weston_compositor_schedule_repaint(shell->compositor);
-	}
-	else
-		finish_workspace_change_animation(shell, from, to);
+	finish_workspace_change_animation(shell);
 }
 
 static void animate_workspace_change(struct mayhem_shell *shell,
@@ -1035,7 +1630,6 @@ static void animate_workspace_change(struct mayhem_shell *shell,
 				     struct workspace *from,
 				     struct workspace *to)
 {
-	struct weston_output *output;
 	int dir;
 
 	if(index == 0 && shell->workspaces.current == shell->workspaces.num-1)
@@ -1048,18 +1642,12 @@ static void animate_workspace_change(struct mayhem_shell *shell,
 	else
 		dir = 1;
 
-	shell->workspaces.current = index;
+	workspace_set_current(shell, index);
 
 	shell->workspaces.anim_dir = dir;
 	shell->workspaces.anim_from = from;
 	shell->workspaces.anim_to = to;
-	shell->workspaces.anim_current = 0.0;
-	shell->workspaces.anim_timestamp = 0;
-
-	output = container_of(shell->compositor->output_list.next,
-			      struct weston_output, link);
-	wl_list_insert(&output->animation_list,
-		       &shell->workspaces.animation.link);
+	shell_anim_start(&shell->workspaces.anim, 0.0, 1.0);
 
 	wl_list_insert(from->layer.link.prev, &to->layer.link);
 
@@ -1070,12 +1658,225 @@ static void animate_workspace_change(struct mayhem_shell *shell,
 	weston_compositor_schedule_repaint(shell->compositor);
 }
 
+/* The neighbour the gesture slides in, below or above the current
+ * workspace depending on the sign of its progress. */
+static void workspace_gesture_set_neighbour(struct mayhem_shell *shell,
+					    double progress)
+{
+	struct workspace *from = shell->workspaces.gesture.from;
+	unsigned int num = shell->workspaces.num;
+	unsigned int index = shell->workspaces.current;
+	struct workspace *to;
+
+	index = progress < 0 ? (index + 1) % num : (index + num - 1) % num;
+	to = get_workspace(shell, index);
+	if (to == from)
+		to = NULL;
+
+	if (to == shell->workspaces.gesture.to)
+		return;
+
+	if (shell->workspaces.gesture.to) {
+		workspace_deactivate_transforms(shell->workspaces.gesture.to);
+		wl_list_remove(&shell->workspaces.gesture.to->layer.link);
+	}
+
+	shell->workspaces.gesture.to = to;
+	shell->workspaces.gesture.to_index = index;
+	if (to) {
+		wl_list_insert(from->layer.link.prev, &to->layer.link);
+		workspace_translate_in(to, progress);
+	}
+}
+
+static void workspace_gesture_finish(struct mayhem_shell *shell)
+{
+	struct workspace *from = shell->workspaces.gesture.from;
+	struct workspace *to = shell->workspaces.gesture.to;
+	struct workspace *leaving = to;
+	struct weston_view *view;
+
+	if (to && shell->workspaces.gesture.target != 0.0)
+		leaving = from;
+
+	wl_list_remove(&shell->workspaces.gesture.animation.link);
+	wl_list_init(&shell->workspaces.gesture.animation.link);
+	wl_event_source_timer_update(shell->workspaces.gesture.release_timer, 0);
+	shell->workspaces.gesture.active = false;
+	shell->workspaces.gesture.from = NULL;
+	shell->workspaces.gesture.to = NULL;
+
+	workspace_deactivate_transforms(from);
+	if (to)
+		workspace_deactivate_transforms(to);
+
+	if (leaving) {
+		wl_list_for_each(view, &leaving->layer.view_list.link,
+				 layer_link.link)
+			weston_view_damage_below(view);
+		wl_list_remove(&leaving->layer.link);
+		weston_compositor_schedule_repaint(shell->compositor);
+	}
+
+	if (leaving == from) {
+		ms_menu_send_despawn(shell->child.mayhem_shell);
+		workspace_set_current(shell, shell->workspaces.gesture.to_index);
+		restore_focus_state(shell, to);
+	}
+
+	raise_fullscreen_layer(shell);
+}
+
+static void workspace_gesture_frame(struct weston_animation *animation,
+				    struct weston_output *output,
+				    uint32_t msecs)
+{
+	struct mayhem_shell *shell =
+		container_of(animation, struct mayhem_shell,
+			     workspaces.gesture.animation);
+	double dt, delta, time;
+	double *progress = &shell->workspaces.gesture.progress;
+	double *velocity = &shell->workspaces.gesture.velocity;
+
+	time = shell_timeline_frame_time(&shell->timeline, output, msecs);
+	if (shell->workspaces.gesture.timestamp == 0.0)
+		dt = 0.0;
+	else
+		dt = (time - shell->workspaces.gesture.timestamp) / 1000.0;
+	shell->workspaces.gesture.timestamp = time;
+
+	if (!shell->workspaces.gesture.released) {
+		/* everything since the last frame, one to one */
+		delta = shell->workspaces.gesture.pending /
+			get_output_height(output);
+		shell->workspaces.gesture.pending = 0.0;
+
+		*progress += delta;
+		if (*progress > 1.0)
+			*progress = 1.0;
+		else if (*progress < -1.0)
+			*progress = -1.0;
+		if (dt > 0.0)
+			*velocity = 0.5 * *velocity + 0.5 * delta / dt;
+
+		/* nothing more to do until the next input event */
+		wl_list_remove(&animation->link);
+		wl_list_init(&animation->link);
+	} else {
+		spring_step(progress, velocity,
+			    shell->workspaces.gesture.target,
+			    WORKSPACE_SPRING_OMEGA, dt);
+
+		if (fabs(*progress - shell->workspaces.gesture.target) < 0.001 &&
+		    fabs(*velocity) < 0.01) {
+			workspace_gesture_finish(shell);
+			return;
+		}
+	}
+
+	if (*progress != 0.0)
+		workspace_gesture_set_neighbour(shell, *progress);
+
+	workspace_translate_out(shell->workspaces.gesture.from, *progress);
+	if (shell->workspaces.gesture.to)
+		workspace_translate_in(shell->workspaces.gesture.to, *progress);
+
+	weston_compositor_schedule_repaint(shell->compositor);
+}
+
+static void workspace_gesture_schedule(struct mayhem_shell *shell)
+{
+	struct weston_output *output = shell->workspaces.gesture.output;
+
+	if (wl_list_empty(&shell->workspaces.gesture.animation.link))
+		wl_list_insert(&output->animation_list,
+			       &shell->workspaces.gesture.animation.link);
+	weston_output_schedule_repaint(output);
+}
+
+/* Feeds delta pixels of scroll or swipe into the slide, starting one
+ * if none is going on. Input without an end event of its own, like
+ * scrolling, is let go of after a pause. */
+static void workspace_gesture_update(struct mayhem_shell *shell, double delta,
+				     bool timeout)
+{
+	if (!shell->workspaces.gesture.active) {
+		if (shell->workspaces.num < 2 || shell->lock.locked)
+			return;
+
+		if (shell->workspaces.anim_to != NULL)
+			finish_workspace_change_animation(shell);
+		lower_fullscreen_layer(shell, NULL);
+
+		shell->workspaces.gesture.active = true;
+		shell->workspaces.gesture.output =
+			get_default_output(shell->compositor);
+		shell->workspaces.gesture.from = get_current_workspace(shell);
+		shell->workspaces.gesture.to = NULL;
+		shell->workspaces.gesture.progress = 0.0;
+		shell->workspaces.gesture.velocity = 0.0;
+		shell->workspaces.gesture.pending = 0.0;
+		shell->workspaces.gesture.timestamp = 0.0;
+	}
+
+	shell->workspaces.gesture.released = false;
+	shell->workspaces.gesture.pending += delta;
+	workspace_gesture_schedule(shell);
+
+	wl_event_source_timer_update(shell->workspaces.gesture.release_timer,
+				     timeout ? WORKSPACE_GESTURE_RELEASE_MS : 0);
+}
+
+/* Lets go of the slide: it springs on to the neighbour when it is past
+ * halfway or flicked hard enough towards it, and back otherwise. */
+static void workspace_gesture_release(struct mayhem_shell *shell)
+{
+	double projected;
+
+	if (!shell->workspaces.gesture.active ||
+	    shell->workspaces.gesture.released)
+		return;
+
+	projected = shell->workspaces.gesture.progress +
+		    shell->workspaces.gesture.velocity * 0.2;
+
+	shell->workspaces.gesture.target = 0.0;
+	if (fabs(projected) >= 0.5) {
+		workspace_gesture_set_neighbour(shell, projected);
+		if (shell->workspaces.gesture.to)
+			shell->workspaces.gesture.target =
+				projected < 0 ? -1.0 : 1.0;
+	}
+
+	shell->workspaces.gesture.released = true;
+	shell->workspaces.gesture.pending = 0.0;
+	workspace_gesture_schedule(shell);
+}
+
+static int workspace_gesture_release_timeout(void *data)
+{
+	workspace_gesture_release(data);
+
+	return 1;
+}
+
+/* Anything else switching workspace drops the slide where it started. */
+static void workspace_gesture_cancel(struct mayhem_shell *shell)
+{
+	if (!shell->workspaces.gesture.active)
+		return;
+
+	shell->workspaces.gesture.target = 0.0;
+	workspace_gesture_finish(shell);
+}
+
 static void update_workspace(struct mayhem_shell *shell, unsigned int index,
 			     struct workspace *from, struct workspace *to)
 {
-	shell->workspaces.current = index;
+	workspace_set_current(shell, index);
 	wl_list_insert(&from->layer.link, &to->layer.link);
 	wl_list_remove(&from->layer.link);
+	raise_fullscreen_layer(shell);
 }
 
 static void change_workspace(struct mayhem_shell *shell, unsigned int index)
@@ -1084,29 +1885,30 @@ static void change_workspace(struct mayhem_shell *shell, unsigned int index)
 	struct workspace *to;
 	struct focus_state *state;
 
-	if (index == shell->workspaces.current)
+	if (shell->lock.locked)
 		return;
 
-	/* Don't change workspace when there is any fullscreen surfaces. */
-	//if (!wl_list_empty(&shell->fullscreen_layer.view_list.link))
-	//	return;
+	workspace_gesture_cancel(shell);
+
+	if (index == shell->workspaces.current)
+		return;
 
 	ms_menu_send_despawn(shell->child.mayhem_shell);
 
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, index);
 
-	if (shell->workspaces.anim_from == to &&
-	    shell->workspaces.anim_to == from) {
+	if (workspace_anim_reverses(shell, from, to)) {
 		restore_focus_state(shell, to);
-		reverse_workspace_change_animation(shell, index, from, to);
+		reverse_workspace_change_animation(shell, index);
 		return;
 	}
 
 	if (shell->workspaces.anim_to != NULL)
-		finish_workspace_change_animation(shell,
-						  shell->workspaces.anim_from,
-						  shell->workspaces.anim_to);
+		finish_workspace_change_animation(shell);
+
+	/* fullscreen windows slide out with their workspace */
+	lower_fullscreen_layer(shell, NULL);
 
 	restore_focus_state(shell, to);
 
@@ -1129,43 +1931,244 @@ static void change_workspace(struct mayhem_shell *shell, unsigned int index)
 
 }
 
-static bool workspace_has_only(struct workspace *ws,
-			       struct weston_surface *surface)
+/* The lock views are made when an output appears and wait in a layer of
+ * their own, so locking only relinks layers and takes effect with the
+ * next frame. Client views leave the scene graph while locked, which
+ * stops their frame callbacks as well as their input. */
+static void lock_view_fit(struct shell_output *shell_output)
 {
-	struct wl_list *list = &ws->layer.view_list.link;
-	struct wl_list *e;
-
-	if (wl_list_empty(list))
-		return false;
-
-	e = list->next;
+	struct weston_output *output = shell_output->output;
+	struct weston_surface *surface;
 
-	if (e->next != list)
-		return false;
+	if (shell_output->lock_view == NULL)
+		return;
 
-	return container_of(e, struct weston_view, layer_link.link)->surface == surface;
+	surface = shell_output->lock_view->surface;
+	weston_surface_set_size(surface, output->width, output->height);
+	pixman_region32_fini(&surface->input);
+	pixman_region32_init_rect(&surface->input, 0, 0,
+				  output->width, output->height);
+	weston_view_set_position(shell_output->lock_view,
+				 output->x, output->y);
 }
 
-static void surface_keyboard_focus_lost(struct weston_surface *surface)
+static void lock_view_create(struct mayhem_shell *shell,
+			     struct shell_output *shell_output)
 {
-	struct weston_compositor *compositor = surface->compositor;
-	struct weston_seat *seat;
-	struct weston_surface *focus;
-
-	wl_list_for_each(seat, &compositor->seat_list, link) {
-		struct weston_keyboard *keyboard =
-			weston_seat_get_keyboard(seat);
+	uint32_t color = shell->lock.color;
+	struct weston_surface *surface;
+	struct weston_view *view;
 
-		if (!keyboard)
-			continue;
+	surface = weston_surface_create(shell->compositor);
+	if (surface == NULL)
+		return;
 
-		focus = weston_surface_get_main_surface(keyboard->focus);
-		if (focus == surface)
-			weston_keyboard_set_focus(keyboard, NULL);
+	view = weston_view_create(surface);
+	if (view == NULL) {
+		weston_surface_destroy(surface);
+		return;
 	}
+
+	weston_surface_set_color(surface,
+				 ((color >> 16) & 0xff) / 255.0,
+				 ((color >> 8) & 0xff) / 255.0,
+				 (color & 0xff) / 255.0, 1.0);
+	weston_layer_entry_insert(&shell->lock.layer.view_list,
+				  &view->layer_link);
+
+	shell_output->lock_view = view;
+	lock_view_fit(shell_output);
 }
 
-static void take_surface_to_workspace_by_seat(struct mayhem_shell *shell,
+static bool key_is_vt_switch(struct weston_seat *seat, uint32_t key)
+{
+	uint32_t mods = MODIFIER_CTRL | MODIFIER_ALT;
+
+	if ((seat->modifier_state & mods) != mods)
+		return false;
+
+	return (key >= KEY_F1 && key <= KEY_F10) ||
+		key == KEY_F11 || key == KEY_F12;
+}
+
+/* The backend's ctrl+alt+Fn bindings still run, so the VT can be
+ * switched away from a lock nothing is there to end. */
+static void lock_grab_key(struct weston_keyboard_grab *grab, uint32_t time,
+			  uint32_t key, uint32_t state)
+{
+	struct weston_keyboard *keyboard = grab->keyboard;
+
+	if (key_is_vt_switch(keyboard->seat, key))
+		weston_compositor_run_key_binding(keyboard->seat->compositor,
+						  keyboard, time, key, state);
+}
+
+static void lock_grab_modifiers(struct weston_keyboard_grab *grab,
+				uint32_t serial, uint32_t mods_depressed,
+				uint32_t mods_latched, uint32_t mods_locked,
+				uint32_t group)
+{
+}
+
+/* only unlock() ends it */
+static void lock_grab_cancel(struct weston_keyboard_grab *grab)
+{
+}
+
+/* Keeps keys, bindings other than the VT switch included, from going
+ * anywhere while locked. */
+static const struct weston_keyboard_grab_interface lock_grab_interface = {
+	lock_grab_key,
+	lock_grab_modifiers,
+	lock_grab_cancel,
+};
+
+static void lock_seat(struct shell_seat *shseat)
+{
+	struct weston_seat *seat = shseat->seat;
+	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_touch *touch = weston_seat_get_touch(seat);
+
+	if (pointer) {
+		popup_grab_end(pointer);
+		if (pointer->grab != &pointer->default_grab)
+			pointer->grab->interface->cancel(pointer->grab);
+		weston_pointer_set_focus(pointer, NULL, 0, 0);
+	}
+
+	if (touch && touch->grab != &touch->default_grab)
+		touch->grab->interface->cancel(touch->grab);
+
+	if (keyboard) {
+		if (keyboard->grab != &keyboard->default_grab)
+			keyboard->grab->interface->cancel(keyboard->grab);
+		weston_keyboard_set_focus(keyboard, NULL);
+		shseat->lock_grab.interface = &lock_grab_interface;
+		weston_keyboard_start_grab(keyboard, &shseat->lock_grab);
+	}
+}
+
+static void lock(struct mayhem_shell *shell)
+{
+	struct weston_compositor *ec = shell->compositor;
+	struct shell_output *shell_output;
+	struct weston_seat *seat;
+
+	/* with nothing to unlock it, the lock stays off */
+	if (!shell->lock.enabled || shell->lock.locked)
+		return;
+
+	workspace_gesture_cancel(shell);
+	if (shell->workspaces.anim_to != NULL)
+		finish_workspace_change_animation(shell);
+	if (shell->child.mayhem_shell)
+		ms_menu_send_despawn(shell->child.mayhem_shell);
+
+	/* outputs may have changed mode since */
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		lock_view_fit(shell_output);
+		wl_list_remove(&shell_output->fullscreen_layer.link);
+		wl_list_init(&shell_output->fullscreen_layer.link);
+	}
+
+	wl_list_remove(&shell->closing_layer.link);
+	wl_list_remove(&get_current_workspace(shell)->layer.link);
+	wl_list_remove(&shell->background_layer.link);
+	wl_list_insert(&ec->cursor_layer.link, &shell->lock.layer.link);
+	shell->lock.locked = true;
+
+	wl_list_for_each(seat, &ec->seat_list, link)
+		lock_seat(get_shell_seat(seat));
+
+	weston_compositor_damage_all(ec);
+
+	if (shell->child.mayhem_shell &&
+	    wl_resource_get_version(shell->child.mayhem_shell) >=
+	    MS_MENU_LOCKED_SINCE_VERSION)
+		ms_menu_send_locked(shell->child.mayhem_shell);
+
+	shell_log(SHELL_LOG_SHELL, SHELL_LOG_INFO, "locked");
+}
+
+static void unlock(struct mayhem_shell *shell)
+{
+	struct weston_compositor *ec = shell->compositor;
+	struct shell_output *shell_output;
+	struct weston_seat *seat;
+
+	if (!shell->lock.locked)
+		return;
+
+	/* back to cursor, closing, fullscreen, workspace, background */
+	wl_list_remove(&shell->lock.layer.link);
+	wl_list_insert(&ec->cursor_layer.link, &shell->background_layer.link);
+	wl_list_insert(&ec->cursor_layer.link,
+		       &get_current_workspace(shell)->layer.link);
+	wl_list_insert(&ec->cursor_layer.link, &shell->closing_layer.link);
+	wl_list_for_each(shell_output, &shell->output_list, link)
+		wl_list_insert(&shell->closing_layer.link,
+			       &shell_output->fullscreen_layer.link);
+	shell->lock.locked = false;
+	shell_fullscreen_schedule(shell);
+
+	wl_list_for_each(seat, &ec->seat_list, link) {
+		struct weston_keyboard *keyboard =
+			weston_seat_get_keyboard(seat);
+
+		if (keyboard && keyboard->grab == &get_shell_seat(seat)->lock_grab)
+			weston_keyboard_end_grab(keyboard);
+	}
+	restore_focus_state(shell, get_current_workspace(shell));
+
+	weston_compositor_damage_all(ec);
+
+	shell_log(SHELL_LOG_SHELL, SHELL_LOG_INFO, "unlocked");
+}
+
+static void lock_binding(struct weston_keyboard *keyboard, uint32_t time,
+			 uint32_t key, void *data)
+{
+	lock(data);
+}
+
+static bool workspace_has_only(struct workspace *ws,
+			       struct weston_surface *surface)
+{
+	struct wl_list *list = &ws->layer.view_list.link;
+	struct wl_list *e;
+
+	if (wl_list_empty(list))
+		return false;
+
+	e = list->next;
+
+	if (e->next != list)
+		return false;
+
+	return container_of(e, struct weston_view, layer_link.link)->surface == surface;
+}
+
+static void surface_keyboard_focus_lost(struct weston_surface *surface)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	struct weston_seat *seat;
+	struct weston_surface *focus;
+
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		struct weston_keyboard *keyboard =
+			weston_seat_get_keyboard(seat);
+
+		if (!keyboard)
+			continue;
+
+		focus = weston_surface_get_main_surface(keyboard->focus);
+		if (focus == surface)
+			weston_keyboard_set_focus(keyboard, NULL);
+	}
+}
+
+static void take_surface_to_workspace_by_seat(struct mayhem_shell *shell,
 					      struct weston_seat *seat,
 					      unsigned int index)
 {
@@ -1184,32 +2187,36 @@ static void take_surface_to_workspace_by_seat(struct mayhem_shell *shell,
 	    is_focus_view(view))
 		return;
 
+	workspace_gesture_cancel(shell);
+
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, index);
 
-	weston_layer_entry_remove(&view->layer_link);
-	weston_layer_entry_insert(&to->layer.view_list, &view->layer_link);
-
+	/* a window takes its parent and transients along */
 	shsurf = get_shell_surface(surface);
-	if (shsurf != NULL)
-		shell_surface_update_child_surface_layers(shsurf);
+	if (shsurf != NULL) {
+		shell_surface_stack_run(shell_surface_get_root(shsurf),
+					&to->layer.view_list);
+	} else {
+		weston_layer_entry_remove(&view->layer_link);
+		weston_layer_entry_insert(&to->layer.view_list,
+					  &view->layer_link);
+	}
 
 	replace_focus_state(shell, to, seat);
 	drop_focus_state(shell, from, surface);
 
-	if (shell->workspaces.anim_from == to &&
-	    shell->workspaces.anim_to == from) {
+	if (workspace_anim_reverses(shell, from, to)) {
 		wl_list_remove(&to->layer.link);
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
 
-		reverse_workspace_change_animation(shell, index, from, to);
+		reverse_workspace_change_animation(shell, index);
 		return;
 	}
 
 	if (shell->workspaces.anim_to != NULL)
-		finish_workspace_change_animation(shell,
-						  shell->workspaces.anim_from,
-						  shell->workspaces.anim_to);
+		finish_workspace_change_animation(shell);
+	lower_fullscreen_layer(shell, NULL);
 
 	if (workspace_is_empty(from) &&
 	    workspace_has_only(to, surface))
@@ -1228,139 +2235,650 @@ static void take_surface_to_workspace_by_seat(struct mayhem_shell *shell,
 		focus_state_set_focus(state, surface);
 }
 
-static void noop_grab_focus(struct weston_pointer_grab *grab)
+/* Moves a window to another layer without any of the focus changes and
+ * animations that go with doing so interactively; the caller settles
+ * those once for all windows it moved. */
+static bool shell_surface_move_to_layer(struct shell_surface *shsurf,
+					struct weston_layer *layer)
 {
-}
+	struct mayhem_shell *shell = shsurf->shell;
+	struct weston_view *view = shsurf->view;
+	struct workspace **pws;
 
-static void noop_grab_axis(struct weston_pointer_grab *grab,
-			   uint32_t time,
-			   struct weston_pointer_axis_event *event)
-{
+	if (view->layer_link.layer == layer)
+		return false;
+
+	shell_surface_stack_run(shsurf, &layer->view_list);
+
+	/* no workspace but the new one may give it focus back */
+	wl_array_for_each(pws, &shell->workspaces.array)
+		if (&(*pws)->layer != layer)
+			drop_focus_state(shell, *pws, shsurf->surface);
+
+	shell_surface_update_window(shsurf);
+	return true;
 }
 
-static void noop_grab_axis_source(struct weston_pointer_grab *grab,
-				  uint32_t source)
+/* Runs a committed window-list transaction. All windows are moved first;
+ * then there is one focus change, to the last window activated or else
+ * back to what the current workspace remembers, and at most one workspace
+ * switch. */
+static void shell_window_list_commit(void *data, struct shell_window_op *ops,
+				     unsigned int count)
 {
+	struct mayhem_shell *shell = data;
+	struct shell_window_op *op, *activate_op = NULL;
+	struct shell_surface *shsurf;
+	struct workspace *ws;
+	struct shell_seat *shseat;
+	struct focus_state *state;
+	struct weston_surface *old_es;
+	bool moved = false;
+	unsigned int i;
+
+	workspace_gesture_cancel(shell);
+
+	for (i = 0; i < count; i++) {
+		op = &ops[i];
+		shsurf = op->window->data;
+
+		switch (op->type) {
+		case SHELL_WINDOW_ACTIVATE:
+			activate_op = op;
+			break;
+		case SHELL_WINDOW_MINIMIZE:
+			moved |= shell_surface_move_to_layer(shsurf,
+							     &shell->minimized_layer);
+			break;
+		case SHELL_WINDOW_CLOSE:
+			/* wl_shell and X clients cannot be asked */
+			if (shell_surface_is_xdg_toplevel(shsurf))
+				xdg_toplevel_send_close(shsurf->resource);
+			break;
+		case SHELL_WINDOW_MOVE:
+			if (op->workspace >= shell->workspaces.num)
+				break;
+			ws = get_workspace(shell, op->workspace);
+			moved |= shell_surface_move_to_layer(shsurf, &ws->layer);
+			break;
+		}
+	}
+
+	if (activate_op == NULL) {
+		if (moved)
+			restore_focus_state(shell, get_current_workspace(shell));
+		return;
+	}
+
+	/* minimized windows come back where they were */
+	shsurf = activate_op->window->data;
+	ws = get_workspace(shell, activate_op->window->workspace);
+	if (shsurf->view->layer_link.layer == &shell->minimized_layer &&
+	    shell_surface_move_to_layer(shsurf, &ws->layer))
+		moved = true;
+
+	/* The window goes into what the workspace remembers first, so
+	 * handing that focus out below is the one focus change; the focus
+	 * animation and the policy still see where it came from. */
+	shseat = get_shell_seat(activate_op->seat);
+	state = shell_seat_focus_state(shseat, ws);
+	if (state == NULL)
+		state = focus_state_create(shseat, ws);
+	if (state == NULL)
+		return;
+	old_es = state->keyboard_focus;
+	focus_state_set_focus(state, shsurf->surface);
+
+	if (ws != get_current_workspace(shell))
+		change_workspace(shell, activate_op->window->workspace);
+	else if (moved)
+		restore_focus_state(shell, ws);
+
+	/* no workspace switch while locked */
+	if (ws != get_current_workspace(shell))
+		return;
+
+	activate_from(shell, shsurf->surface, activate_op->seat, state,
+		      old_es, true);
 }
 
-static void noop_grab_frame(struct weston_pointer_grab *grab)
+/* IPC events about windows, past SHELL_IPC_ADDED and _REMOVED */
+enum {
+	IPC_WINDOW_TITLE = SHELL_IPC_FIELD,
+	IPC_WINDOW_APP_ID,
+	IPC_WINDOW_WORKSPACE,
+	IPC_WINDOW_STATE,
+};
+
+static const char *window_state_string(uint32_t state)
 {
+	switch (state & (MS_WINDOW_LIST_STATE_MINIMIZED |
+			 MS_WINDOW_LIST_STATE_FOCUSED)) {
+	case MS_WINDOW_LIST_STATE_MINIMIZED:
+		return "minimized";
+	case MS_WINDOW_LIST_STATE_FOCUSED:
+		return "focused";
+	case MS_WINDOW_LIST_STATE_MINIMIZED | MS_WINDOW_LIST_STATE_FOCUSED:
+		return "minimized,focused";
+	default:
+		return "-";
+	}
 }
 
+/* The window list batches changes per frame already; IPC subscribers
+ * get the same batches. */
+static void shell_window_changed(struct wl_listener *listener, void *data)
+{
+	struct mayhem_shell *shell =
+		container_of(listener, struct mayhem_shell,
+			     window_change_listener);
+	struct shell_window *window = data;
+	struct shell_ipc *ipc = &shell->ipc;
+
+	if (window->dirty & WINDOW_REMOVED) {
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       SHELL_IPC_REMOVED, window->app_id,
+			       "removed %u", window->id);
+		return;
+	}
 
-static void constrain_position(struct weston_move_grab *move, int *cx, int *cy)
+	if (window->dirty & WINDOW_ADDED)
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       SHELL_IPC_ADDED, window->app_id,
+			       "added %u", window->id);
+	if ((window->dirty & WINDOW_TITLE) && window->title)
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       IPC_WINDOW_TITLE, window->app_id,
+			       "title %u %s", window->id, window->title);
+	if ((window->dirty & WINDOW_APP_ID) && window->app_id)
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       IPC_WINDOW_APP_ID, window->app_id,
+			       "app_id %u %s", window->id, window->app_id);
+	if (window->dirty & WINDOW_WORKSPACE)
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       IPC_WINDOW_WORKSPACE, window->app_id,
+			       "workspace %u %u", window->id,
+			       window->workspace);
+	if (window->dirty & WINDOW_STATE)
+		shell_ipc_emit(ipc, SHELL_IPC_EVENT_WINDOW, window->id,
+			       IPC_WINDOW_STATE, window->app_id,
+			       "state %u %s", window->id,
+			       window_state_string(window->state));
+}
+
+static void ipc_tree(struct mayhem_shell *shell,
+		     struct shell_ipc_client *client)
 {
-	struct weston_pointer *pointer = move->base.grab.pointer;
+	struct weston_output *output;
+	struct shell_window *window;
+	unsigned int i;
 
-	*cx = wl_fixed_to_int(pointer->x + move->dx);
-	*cy = wl_fixed_to_int(pointer->y + move->dy);
+	wl_list_for_each(output, &shell->compositor->output_list, link)
+		shell_ipc_reply(client, "output %s %d %d %d %d", output->name,
+				output->x, output->y,
+				output->width, output->height);
+
+	for (i = 0; i < shell->workspaces.num; i++)
+		shell_ipc_reply(client, "workspace %u%s", i,
+				i == shell->workspaces.current ?
+				" current" : "");
+
+	wl_list_for_each(window, &shell->window_list.window_list, link) {
+		if (window->dirty & WINDOW_REMOVED)
+			continue;
+
+		shell_ipc_reply(client, "window %u %u %s %s %s", window->id,
+				window->workspace,
+				window_state_string(window->state),
+				window->app_id ? window->app_id : "-",
+				window->title ? window->title : "");
+	}
 }
 
-static void move_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
-			     struct weston_pointer_motion_event *event)
+/* The single window commands are one-operation transactions. */
+static const char *ipc_window_op(struct mayhem_shell *shell,
+				 enum shell_window_op_type type,
+				 int argc, char **argv)
 {
-	struct weston_move_grab *move = (struct weston_move_grab *) grab;
-	struct weston_pointer *pointer = grab->pointer;
-	struct shell_surface *shsurf = move->base.shsurf;
-	int cx, cy;
+	struct shell_window_op op = { .type = type };
 
-	weston_pointer_move(pointer, event);
-	if (!shsurf)
-		return;
+	if (argc < 2)
+		return "missing window id";
 
-	constrain_position(move, &cx, &cy);
+	op.window = shell_window_list_find(&shell->window_list,
+					   strtoul(argv[1], NULL, 10));
+	if (op.window == NULL)
+		return "no such window";
 
-	weston_view_set_position(shsurf->view, cx, cy);
+	if (type == SHELL_WINDOW_MOVE) {
+		if (argc < 3)
+			return "missing workspace";
+		op.workspace = strtoul(argv[2], NULL, 10);
+		if (op.workspace >= shell->workspaces.num)
+			return "no such workspace";
+	}
 
-	weston_compositor_schedule_repaint(shsurf->surface->compositor);
+	if (type == SHELL_WINDOW_ACTIVATE) {
+		if (wl_list_empty(&shell->compositor->seat_list))
+			return "no seat";
+		op.seat = container_of(shell->compositor->seat_list.next,
+				       struct weston_seat, link);
+	}
+
+	shell_window_list_commit(shell, &op, 1);
+	return NULL;
 }
 
-static void
-move_grab_button(struct weston_pointer_grab *grab,
-		 uint32_t time, uint32_t button, uint32_t state_w)
+static const char *ipc_launch(struct mayhem_shell *shell,
+			      struct shell_ipc_client *client,
+			      int argc, char **argv)
 {
-	struct shell_grab *shell_grab = container_of(grab, struct shell_grab,
-						    grab);
-	struct weston_pointer *pointer = grab->pointer;
-	enum wl_pointer_button_state state = state_w;
+	char command[1024];
+	size_t len = 0;
+	uint32_t serial;
+	int i;
 
-	if (pointer->button_count == 0 &&
-	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
-		shell_grab_end(shell_grab);
-		free(grab);
+	if (argc < 2)
+		return "missing command";
+
+	for (i = 1; i < argc; i++) {
+		len += snprintf(command + len, sizeof command - len, "%s%s",
+				i > 1 ? " " : "", argv[i]);
+		if (len >= sizeof command)
+			return "command too long";
 	}
-}
 
-static void
-move_grab_cancel(struct weston_pointer_grab *grab)
-{
-	struct shell_grab *shell_grab =
-		container_of(grab, struct shell_grab, grab);
+	serial = shell_launcher_spawn(&shell->launcher, command);
+	if (serial == 0)
+		return "launch failed";
 
-	shell_grab_end(shell_grab);
-	free(grab);
+	shell_ipc_reply(client, "launched %u", serial);
+	return NULL;
 }
 
-static const struct weston_pointer_grab_interface move_grab_interface = {
-	noop_grab_focus,
-	move_grab_motion,
-	move_grab_button,
-	noop_grab_axis,
-	noop_grab_axis_source,
-	noop_grab_frame,
-	move_grab_cancel,
+static const char * const policy_hook_names[SHELL_POLICY_HOOK_COUNT] = {
+	[SHELL_POLICY_MAP] = "map",
+	[SHELL_POLICY_ACTIVATE] = "activate",
+	[SHELL_POLICY_WORKSPACE] = "workspace",
+	[SHELL_POLICY_BINDING] = "binding",
 };
 
-static int surface_move(struct shell_surface *shsurf, struct weston_pointer *pointer,
-			int client_initiated)
+static const char *ipc_policy(struct mayhem_shell *shell,
+			      struct shell_ipc_client *client)
 {
-	struct weston_move_grab *move;
+	struct shell_policy_stats *stats;
+	unsigned int i;
 
-	if (!shsurf)
-		return -1;
+	if (shell->policy.state == NULL)
+		return "no policy script";
 
-	if (shsurf->grabbed ||
-	    shsurf->state.fullscreen || shsurf->state.maximized)
-		return 0;
+	shell_ipc_reply(client, "memory %zu", shell->policy.memory);
+	for (i = 0; i < SHELL_POLICY_HOOK_COUNT; i++) {
+		stats = &shell->policy.stats[i];
+		shell_ipc_reply(client, "hook %s calls %u errors %u "
+				"overruns %u avg-us %llu max-us %llu",
+				policy_hook_names[i], stats->calls,
+				stats->errors, stats->overruns,
+				stats->calls ? (unsigned long long)
+				(stats->total_ns / stats->calls / 1000) : 0,
+				(unsigned long long) (stats->max_ns / 1000));
+	}
 
-	move = malloc(sizeof *move);
-	if (!move)
-		return -1;
+	return NULL;
+}
 
-	move->dx = wl_fixed_from_double(shsurf->view->geometry.x) -
-			pointer->grab_x;
-	move->dy = wl_fixed_from_double(shsurf->view->geometry.y) -
-			pointer->grab_y;
-	move->client_initiated = client_initiated;
+static const char *ipc_dump(struct mayhem_shell *shell,
+			    struct shell_ipc_client *client,
+			    int argc, char **argv)
+{
+	char path[PATH_MAX];
 
-	shell_grab_start(&move->base, &move_grab_interface, shsurf,
-			 pointer, MS_MENU_CURSOR_MOVE);
+	if (shell_dump_to(shell, argc > 1 ? argv[1] : NULL,
+			  path, sizeof path) < 0)
+		return "dump failed";
 
-	return 0;
+	shell_ipc_reply(client, "dump %s", path);
+	return NULL;
 }
 
-static void
-common_surface_move(struct wl_resource *resource,
-		    struct wl_resource *seat_resource, uint32_t serial)
+static const char *shell_ipc_command(void *data,
+				     struct shell_ipc_client *client,
+				     int argc, char **argv)
 {
-	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
-	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
-	struct weston_surface *surface;
+	struct mayhem_shell *shell = data;
+	unsigned int index;
 
-	if (pointer &&
-	    pointer->focus &&
-	    pointer->button_count > 0 &&
-	    pointer->grab_serial == serial) {
-		surface = weston_surface_get_main_surface(pointer->focus->surface);
-		if ((surface == shsurf->surface) &&
-		    (surface_move(shsurf, pointer, 1) < 0))
-			wl_resource_post_no_memory(resource);
+	if (strcmp(argv[0], "tree") == 0) {
+		ipc_tree(shell, client);
+		return NULL;
 	}
-}
 
-static void
-shell_surface_move(struct wl_client *client, struct wl_resource *resource,
+	if (strcmp(argv[0], "workspace") == 0) {
+		if (argc < 2)
+			return "missing workspace";
+		index = strtoul(argv[1], NULL, 10);
+		if (index >= shell->workspaces.num)
+			return "no such workspace";
+		change_workspace(shell, index);
+		return NULL;
+	}
+
+	if (strcmp(argv[0], "activate") == 0)
+		return ipc_window_op(shell, SHELL_WINDOW_ACTIVATE, argc, argv);
+	if (strcmp(argv[0], "minimize") == 0)
+		return ipc_window_op(shell, SHELL_WINDOW_MINIMIZE, argc, argv);
+	if (strcmp(argv[0], "close") == 0)
+		return ipc_window_op(shell, SHELL_WINDOW_CLOSE, argc, argv);
+	if (strcmp(argv[0], "move") == 0)
+		return ipc_window_op(shell, SHELL_WINDOW_MOVE, argc, argv);
+	if (strcmp(argv[0], "launch") == 0)
+		return ipc_launch(shell, client, argc, argv);
+	if (strcmp(argv[0], "policy") == 0)
+		return ipc_policy(shell, client);
+	if (strcmp(argv[0], "dump") == 0)
+		return ipc_dump(shell, client, argc, argv);
+	if (strcmp(argv[0], "lock") == 0) {
+		lock(shell);
+		return NULL;
+	}
+
+	return "unknown command";
+}
+
+/* The socket is $XDG_RUNTIME_DIR/mayhem-shell-$WAYLAND_DISPLAY unless
+ * configured otherwise, an empty ipc-socket turns it off. Clients we
+ * start find it in $MAYHEM_SHELL_SOCKET. */
+static void shell_ipc_setup(struct mayhem_shell *shell)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(shell->compositor->wl_display);
+	const char *runtime_dir, *display;
+	char *path = shell->ipc_socket;
+	size_t len;
+
+	if (path == NULL) {
+		runtime_dir = getenv("XDG_RUNTIME_DIR");
+		display = getenv("WAYLAND_DISPLAY");
+		if (display == NULL)
+			display = "wayland-0";
+
+		if (runtime_dir) {
+			len = strlen(runtime_dir) + strlen(display) + 16;
+			path = malloc(len);
+			if (path)
+				snprintf(path, len, "%s/mayhem-shell-%s",
+					 runtime_dir, display);
+		}
+		shell->ipc_socket = path;
+	}
+
+	if (path && path[0] == '\0')
+		path = NULL;
+
+	if (shell_ipc_init(&shell->ipc, loop, path, shell_ipc_command,
+			   shell) < 0 || path == NULL)
+		return;
+
+	setenv("MAYHEM_SHELL_SOCKET", path, 1);
+}
+
+static void policy_workspace(void *data, uint32_t index)
+{
+	struct mayhem_shell *shell = data;
+
+	if (index < shell->workspaces.num)
+		change_workspace(shell, index);
+}
+
+static uint32_t policy_launch(void *data, const char *command)
+{
+	struct mayhem_shell *shell = data;
+
+	return shell_launcher_spawn(&shell->launcher, command);
+}
+
+static const struct shell_policy_interface policy_interface = {
+	shell_window_list_commit,
+	policy_workspace,
+	policy_launch,
+};
+
+static void noop_grab_focus(struct weston_pointer_grab *grab)
+{
+}
+
+static void noop_grab_axis(struct weston_pointer_grab *grab,
+			   uint32_t time,
+			   struct weston_pointer_axis_event *event)
+{
+}
+
+static void noop_grab_axis_source(struct weston_pointer_grab *grab,
+				  uint32_t source)
+{
+}
+
+static void noop_grab_frame(struct weston_pointer_grab *grab)
+{
+}
+
+
+static struct shell_output *get_shell_output(struct weston_output *output);
+static struct weston_output *get_pointer_output(struct weston_pointer *pointer);
+
+/* Pulls the window's sides onto output and window edges close by, so it
+ * sticks there until the pointer or finger has moved the threshold past
+ * them. */
+static void shell_surface_snap_position(struct shell_surface *shsurf,
+					struct weston_output *output,
+					int *cx, int *cy)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct shell_output *shell_output;
+	pixman_box32_t box;
+	int32_t dx, dy;
+
+	if (!output || shell->snap_threshold <= 0 ||
+	    shsurf->type != SHELL_SURFACE_TOPLEVEL)
+		return;
+
+	shell_output = get_shell_output(output);
+	if (!shell_output->edges.valid)
+		shell_output_rebuild_edges(shell_output);
+
+	shell_surface_placement_box(shsurf, &box);
+	dx = *cx - (int32_t) shsurf->view->geometry.x;
+	dy = *cy - (int32_t) shsurf->view->geometry.y;
+	box.x1 += dx;
+	box.x2 += dx;
+	box.y1 += dy;
+	box.y2 += dy;
+
+	if (shell_edges_snap(&shell_output->edges, &box, shell->snap_threshold,
+			     shsurf, &dx, &dy)) {
+		*cx += dx;
+		*cy += dy;
+	}
+}
+
+static void constrain_position(struct weston_move_grab *move, int *cx, int *cy)
+{
+	struct weston_pointer *pointer = move->base.grab.pointer;
+
+	*cx = wl_fixed_to_int(pointer->x + move->dx);
+	*cy = wl_fixed_to_int(pointer->y + move->dy);
+
+	shell_surface_snap_position(move->base.shsurf,
+				    get_pointer_output(pointer), cx, cy);
+}
+
+/* Dropping a window with the pointer or finger at px, py against the
+ * left or right side of an output tiles it to that half, or to a quarter
+ * in the corners. */
+static void shell_surface_snap_tile(struct shell_surface *shsurf,
+				    struct weston_output *output,
+				    int32_t px, int32_t py)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	pixman_box32_t area;
+	int32_t x, y, width, height, threshold;
+
+	if (!output || !shell->snap_tiling ||
+	    shsurf->type != SHELL_SURFACE_TOPLEVEL)
+		return;
+
+	shell_output_area(get_shell_output(output), &area);
+	threshold = shell->snap_threshold > 0 ? shell->snap_threshold : 1;
+
+	width = (area.x2 - area.x1) / 2;
+	if (px < area.x1 + threshold)
+		x = area.x1;
+	else if (px >= area.x2 - threshold)
+		x = area.x1 + width;
+	else
+		return;
+
+	height = (area.y2 - area.y1) / 2;
+	if (py < area.y1 + threshold) {
+		y = area.y1;
+	} else if (py >= area.y2 - threshold) {
+		y = area.y1 + height;
+	} else {
+		y = area.y1;
+		height = area.y2 - area.y1;
+	}
+
+	/* the window geometry goes there, not the shadows around it */
+	if (shsurf->has_set_geometry) {
+		x -= shsurf->geometry.x;
+		y -= shsurf->geometry.y;
+	}
+
+	weston_view_set_position(shsurf->view, x, y);
+	shsurf->client->send_configure(shsurf->surface, width, height);
+}
+
+static void move_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
+			     struct weston_pointer_motion_event *event)
+{
+	struct weston_move_grab *move = (struct weston_move_grab *) grab;
+	struct weston_pointer *pointer = grab->pointer;
+	struct shell_surface *shsurf = move->base.shsurf;
+	int cx, cy;
+
+	weston_pointer_move(pointer, event);
+	if (!shsurf)
+		return;
+
+	constrain_position(move, &cx, &cy);
+
+	weston_view_set_position(shsurf->view, cx, cy);
+
+	weston_compositor_schedule_repaint(shsurf->surface->compositor);
+}
+
+static void
+move_grab_button(struct weston_pointer_grab *grab,
+		 uint32_t time, uint32_t button, uint32_t state_w)
+{
+	struct shell_grab *shell_grab = container_of(grab, struct shell_grab,
+						    grab);
+	struct weston_pointer *pointer = grab->pointer;
+	enum wl_pointer_button_state state = state_w;
+
+	if (pointer->button_count == 0 &&
+	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
+		if (shell_grab->shsurf)
+			shell_surface_snap_tile(shell_grab->shsurf,
+						get_pointer_output(pointer),
+						wl_fixed_to_int(pointer->x),
+						wl_fixed_to_int(pointer->y));
+		shell_grab_end(shell_grab);
+		shell_grab_free(shell_grab);
+	}
+}
+
+static void
+move_grab_cancel(struct weston_pointer_grab *grab)
+{
+	struct shell_grab *shell_grab =
+		container_of(grab, struct shell_grab, grab);
+
+	shell_grab_end(shell_grab);
+	shell_grab_free(shell_grab);
+}
+
+static const struct weston_pointer_grab_interface move_grab_interface = {
+	noop_grab_focus,
+	move_grab_motion,
+	move_grab_button,
+	noop_grab_axis,
+	noop_grab_axis_source,
+	noop_grab_frame,
+	move_grab_cancel,
+};
+
+static int surface_move(struct shell_surface *shsurf, struct weston_pointer *pointer,
+			int client_initiated)
+{
+	struct weston_move_grab *move;
+
+	if (!shsurf)
+		return -1;
+
+	if (shsurf->grabbed ||
+	    shsurf->state.fullscreen || shsurf->state.maximized)
+		return 0;
+
+	move = shell_slab_zalloc(&shsurf->shell->grab_slab);
+	if (!move)
+		return -1;
+
+	move->dx = wl_fixed_from_double(shsurf->view->geometry.x) -
+			pointer->grab_x;
+	move->dy = wl_fixed_from_double(shsurf->view->geometry.y) -
+			pointer->grab_y;
+	move->client_initiated = client_initiated;
+
+	shell_grab_start(&move->base, &move_grab_interface, shsurf,
+			 pointer, MS_MENU_CURSOR_MOVE);
+
+	return 0;
+}
+
+static int surface_touch_move(struct shell_surface *shsurf,
+			      struct weston_touch *touch);
+
+static void
+common_surface_move(struct wl_resource *resource,
+		    struct wl_resource *seat_resource, uint32_t serial)
+{
+	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_touch *touch = weston_seat_get_touch(seat);
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct weston_surface *surface;
+
+	if (pointer &&
+	    pointer->focus &&
+	    pointer->button_count > 0 &&
+	    pointer->grab_serial == serial) {
+		surface = weston_surface_get_main_surface(pointer->focus->surface);
+		if ((surface == shsurf->surface) &&
+		    (surface_move(shsurf, pointer, 1) < 0))
+			wl_resource_post_no_memory(resource);
+	} else if (touch &&
+		   touch->focus &&
+		   touch->grab_serial == serial) {
+		surface = weston_surface_get_main_surface(touch->focus->surface);
+		if ((surface == shsurf->surface) &&
+		    (surface_touch_move(shsurf, touch) < 0))
+			wl_resource_post_no_memory(resource);
+	}
+}
+
+static void
+shell_surface_move(struct wl_client *client, struct wl_resource *resource,
 		   struct wl_resource *seat_resource, uint32_t serial)
 {
 	common_surface_move(resource, seat_resource, serial);
@@ -1372,6 +2890,49 @@ struct weston_resize_grab {
 	int32_t width, height;
 };
 
+/* sizes the shared grab pool */
+union shell_any_grab {
+	struct shell_grab base;
+	struct weston_move_grab move;
+	struct weston_resize_grab resize;
+	struct rotate_grab rotate;
+	struct weston_touch_move_grab touch_move;
+	struct weston_touch_resize_grab touch_resize;
+	struct touch_swipe_grab touch_swipe;
+};
+
+/* The size a resize started at grab_x, grab_y with the window at width
+ * by height comes to with the pointer or finger now at x, y. */
+static void resize_grab_size(struct shell_surface *shsurf, uint32_t edges,
+			     int32_t *width, int32_t *height,
+			     wl_fixed_t grab_x, wl_fixed_t grab_y,
+			     wl_fixed_t x, wl_fixed_t y)
+{
+	wl_fixed_t from_x, from_y;
+	wl_fixed_t to_x, to_y;
+
+	weston_view_from_global_fixed(shsurf->view, grab_x, grab_y,
+				      &from_x, &from_y);
+	weston_view_from_global_fixed(shsurf->view, x, y, &to_x, &to_y);
+
+	if (edges & WL_SHELL_SURFACE_RESIZE_LEFT) {
+		*width += wl_fixed_to_int(from_x - to_x);
+	} else if (edges & WL_SHELL_SURFACE_RESIZE_RIGHT) {
+		*width += wl_fixed_to_int(to_x - from_x);
+	}
+
+	if (edges & WL_SHELL_SURFACE_RESIZE_TOP) {
+		*height += wl_fixed_to_int(from_y - to_y);
+	} else if (edges & WL_SHELL_SURFACE_RESIZE_BOTTOM) {
+		*height += wl_fixed_to_int(to_y - from_y);
+	}
+
+	if (*width < 1)
+		*width = 1;
+	if (*height < 1)
+		*height = 1;
+}
+
 static void
 resize_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 		   struct weston_pointer_motion_event *event)
@@ -1380,38 +2941,18 @@ resize_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 	struct weston_pointer *pointer = grab->pointer;
 	struct shell_surface *shsurf = resize->base.shsurf;
 	int32_t width, height;
-	wl_fixed_t from_x, from_y;
-	wl_fixed_t to_x, to_y;
 
 	weston_pointer_move(pointer, event);
 
 	if (!shsurf)
 		return;
 
-	weston_view_from_global_fixed(shsurf->view,
-				      pointer->grab_x, pointer->grab_y,
-				      &from_x, &from_y);
-	weston_view_from_global_fixed(shsurf->view,
-				      pointer->x, pointer->y, &to_x, &to_y);
-
 	width = resize->width;
-	if (resize->edges & WL_SHELL_SURFACE_RESIZE_LEFT) {
-		width += wl_fixed_to_int(from_x - to_x);
-	} else if (resize->edges & WL_SHELL_SURFACE_RESIZE_RIGHT) {
-		width += wl_fixed_to_int(to_x - from_x);
-	}
-
 	height = resize->height;
-	if (resize->edges & WL_SHELL_SURFACE_RESIZE_TOP) {
-		height += wl_fixed_to_int(from_y - to_y);
-	} else if (resize->edges & WL_SHELL_SURFACE_RESIZE_BOTTOM) {
-		height += wl_fixed_to_int(to_y - from_y);
-	}
+	resize_grab_size(shsurf, resize->edges, &width, &height,
+			 pointer->grab_x, pointer->grab_y,
+			 pointer->x, pointer->y);
 
-	if (width < 1)
-		width = 1;
-	if (height < 1)
-		height = 1;
 	shsurf->client->send_configure(shsurf->surface, width, height);
 }
 
@@ -1444,7 +2985,7 @@ resize_grab_button(struct weston_pointer_grab *grab,
 	if (pointer->button_count == 0 &&
 	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
 		shell_grab_end(&resize->base);
-		free(grab);
+		shell_grab_free(&resize->base);
 	}
 }
 
@@ -1454,7 +2995,7 @@ resize_grab_cancel(struct weston_pointer_grab *grab)
 	struct weston_resize_grab *resize = (struct weston_resize_grab *) grab;
 
 	shell_grab_end(&resize->base);
-	free(grab);
+	shell_grab_free(&resize->base);
 }
 
 static const struct weston_pointer_grab_interface resize_grab_interface = {
@@ -1502,28 +3043,34 @@ surface_subsurfaces_boundingbox(struct weston_surface *surface, int32_t *x,
 	pixman_region32_fini(&region);
 }
 
-static int
-surface_resize(struct shell_surface *shsurf,
-	       struct weston_pointer *pointer, uint32_t edges)
+static bool resize_edges_valid(uint32_t edges)
 {
-	struct weston_resize_grab *resize;
 	const unsigned resize_topbottom =
 		WL_SHELL_SURFACE_RESIZE_TOP | WL_SHELL_SURFACE_RESIZE_BOTTOM;
 	const unsigned resize_leftright =
 		WL_SHELL_SURFACE_RESIZE_LEFT | WL_SHELL_SURFACE_RESIZE_RIGHT;
 	const unsigned resize_any = resize_topbottom | resize_leftright;
 
+	return !(edges == WL_SHELL_SURFACE_RESIZE_NONE || edges > resize_any ||
+		 (edges & resize_topbottom) == resize_topbottom ||
+		 (edges & resize_leftright) == resize_leftright);
+}
+
+static int
+surface_resize(struct shell_surface *shsurf,
+	       struct weston_pointer *pointer, uint32_t edges)
+{
+	struct weston_resize_grab *resize;
+
 	if (shsurf->grabbed ||
 	    shsurf->state.fullscreen || shsurf->state.maximized)
 		return 0;
 
 	/* Check for invalid edge combinations. */
-	if (edges == WL_SHELL_SURFACE_RESIZE_NONE || edges > resize_any ||
-	    (edges & resize_topbottom) == resize_topbottom ||
-	    (edges & resize_leftright) == resize_leftright)
+	if (!resize_edges_valid(edges))
 		return 0;
 
-	resize = malloc(sizeof *resize);
+	resize = shell_slab_zalloc(&shsurf->shell->grab_slab);
 	if (!resize)
 		return -1;
 
@@ -1540,58 +3087,396 @@ surface_resize(struct shell_surface *shsurf,
 	return 0;
 }
 
-static void
-common_surface_resize(struct wl_resource *resource,
-		      struct wl_resource *seat_resource, uint32_t serial,
-		      uint32_t edges)
+static struct weston_output *
+get_output_at(struct weston_compositor *compositor, wl_fixed_t x, wl_fixed_t y)
 {
-	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
-	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
-	struct weston_surface *surface;
-
-	if (!pointer ||
-	    pointer->button_count == 0 ||
-	    pointer->grab_serial != serial ||
-	    pointer->focus == NULL)
-		return;
+	struct weston_output *output;
 
-	surface = weston_surface_get_main_surface(pointer->focus->surface);
-	if (surface != shsurf->surface)
-		return;
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (pixman_region32_contains_point(&output->region,
+						   wl_fixed_to_int(x),
+						   wl_fixed_to_int(y), NULL))
+			return output;
 
-	if (surface_resize(shsurf, pointer, edges) < 0)
-		wl_resource_post_no_memory(resource);
+	return NULL;
 }
 
-static void
-shell_surface_resize(struct wl_client *client, struct wl_resource *resource,
-		     struct wl_resource *seat_resource, uint32_t serial,
-		     uint32_t edges)
+/* Touch grabs only record where the finger went and apply it once per
+ * touch frame. With animation-report set, each one also logs how long
+ * its motion took to make it into a repaint. */
+static void touch_latency_unhook(struct shell_touch_grab *grab)
 {
-	common_surface_resize(resource, seat_resource, serial, edges);
+	wl_list_remove(&grab->latency.frame_listener.link);
+	wl_list_init(&grab->latency.frame_listener.link);
+	wl_list_remove(&grab->latency.output_destroy_listener.link);
+	wl_list_init(&grab->latency.output_destroy_listener.link);
 }
 
-static void busy_cursor_grab_focus(struct weston_pointer_grab *base)
+static void touch_latency_frame(struct wl_listener *listener, void *data)
 {
-	struct shell_grab *grab = (struct shell_grab *) base;
-	struct weston_pointer *pointer = base->pointer;
-	struct weston_view *view;
-	wl_fixed_t sx, sy;
+	struct shell_touch_grab *grab =
+		container_of(listener, struct shell_touch_grab,
+			     latency.frame_listener);
+	struct weston_output *output = data;
+	struct timespec ts;
+	uint32_t now, latency;
 
-	view = weston_compositor_pick_view(pointer->seat->compositor,
+	/* input event times are on the presentation clock in ms */
+	clock_gettime(output->compositor->presentation_clock, &ts);
+	now = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	latency = now - grab->latency.event_time;
+
+	if (latency < 10000) {
+		grab->latency.samples++;
+		grab->latency.total += latency;
+		if (latency > grab->latency.max)
+			grab->latency.max = latency;
+	}
+
+	grab->latency.event_time = 0;
+	touch_latency_unhook(grab);
+}
+
+static void touch_latency_output_destroy(struct wl_listener *listener,
+					 void *data)
+{
+	struct shell_touch_grab *grab =
+		container_of(listener, struct shell_touch_grab,
+			     latency.output_destroy_listener);
+
+	grab->latency.event_time = 0;
+	touch_latency_unhook(grab);
+}
+
+/* Called once the frame's motion has been applied to the window. */
+static void touch_latency_applied(struct shell_touch_grab *grab)
+{
+	struct weston_output *output = grab->shsurf->view->output;
+
+	if (!output || grab->latency.event_time == 0 ||
+	    !wl_list_empty(&grab->latency.frame_listener.link))
+		return;
+
+	wl_signal_add(&output->frame_signal, &grab->latency.frame_listener);
+	wl_signal_add(&output->destroy_signal,
+		      &grab->latency.output_destroy_listener);
+}
+
+static void destroy_shell_touch_grab_shsurf(struct wl_listener *listener,
+					    void *data)
+{
+	struct shell_touch_grab *grab =
+		container_of(listener, struct shell_touch_grab,
+			     shsurf_destroy_listener);
+
+	touch_latency_unhook(grab);
+	grab->shsurf = NULL;
+}
+
+static void touch_swipe_grab_drop(struct weston_touch *touch);
+
+static void shell_touch_grab_start(struct shell_touch_grab *grab,
+				   const struct weston_touch_grab_interface *interface,
+				   const char *name,
+				   struct shell_surface *shsurf,
+				   struct weston_touch *touch)
+{
+	grab->grab.interface = interface;
+	grab->name = name;
+	grab->shsurf = shsurf;
+	grab->shsurf_destroy_listener.notify = destroy_shell_touch_grab_shsurf;
+	wl_signal_add(&shsurf->destroy_signal,
+		      &grab->shsurf_destroy_listener);
+
+	grab->x = touch->grab_x;
+	grab->y = touch->grab_y;
+	grab->latency.frame_listener.notify = touch_latency_frame;
+	wl_list_init(&grab->latency.frame_listener.link);
+	grab->latency.output_destroy_listener.notify =
+		touch_latency_output_destroy;
+	wl_list_init(&grab->latency.output_destroy_listener.link);
+
+	shsurf->grabbed = 1;
+	touch_swipe_grab_drop(touch);
+	weston_touch_start_grab(touch, &grab->grab);
+}
+
+static void shell_touch_grab_end(struct shell_touch_grab *grab)
+{
+	struct weston_touch *touch = grab->grab.touch;
+	struct mayhem_shell *shell =
+		touch->seat->compositor->shell_interface.shell;
+
+	touch_latency_unhook(grab);
+	if (shell->timeline.report && grab->latency.samples > 0)
+		weston_log("touch %s: %u frames, latency %u ms average, "
+			   "%u ms worst\n", grab->name, grab->latency.samples,
+			   grab->latency.total / grab->latency.samples,
+			   grab->latency.max);
+
+	if (grab->shsurf) {
+		wl_list_remove(&grab->shsurf_destroy_listener.link);
+		grab->shsurf->grabbed = 0;
+
+		if (grab->shsurf->resize_edges) {
+			grab->shsurf->resize_edges = 0;
+			shell_surface_state_changed(grab->shsurf);
+		}
+	}
+
+	weston_touch_end_grab(touch);
+}
+
+static void shell_touch_grab_free(struct shell_touch_grab *grab)
+{
+	struct mayhem_shell *shell =
+		grab->grab.touch->seat->compositor->shell_interface.shell;
+
+	shell_slab_free(&shell->grab_slab, grab);
+}
+
+static void touch_grab_noop_down(struct weston_touch_grab *grab,
+				 uint32_t time, int touch_id,
+				 wl_fixed_t x, wl_fixed_t y)
+{
+}
+
+static void touch_grab_motion(struct weston_touch_grab *grab, uint32_t time,
+			      int touch_id, wl_fixed_t x, wl_fixed_t y)
+{
+	struct shell_touch_grab *shell_grab =
+		container_of(grab, struct shell_touch_grab, grab);
+
+	if (!shell_grab->shsurf || touch_id != grab->touch->grab_touch_id)
+		return;
+
+	shell_grab->x = x;
+	shell_grab->y = y;
+	shell_grab->dirty = true;
+	if (shell_grab->latency.event_time == 0)
+		shell_grab->latency.event_time = time ? time : 1;
+}
+
+static void touch_grab_cancel(struct weston_touch_grab *grab)
+{
+	struct shell_touch_grab *shell_grab =
+		container_of(grab, struct shell_touch_grab, grab);
+
+	shell_touch_grab_end(shell_grab);
+	shell_touch_grab_free(shell_grab);
+}
+
+static void touch_move_grab_frame(struct weston_touch_grab *grab)
+{
+	struct weston_touch_move_grab *move =
+		(struct weston_touch_move_grab *) grab;
+	struct shell_surface *shsurf = move->base.shsurf;
+	int cx, cy;
+
+	if (!shsurf || !move->base.dirty)
+		return;
+
+	cx = wl_fixed_to_int(move->base.x + move->dx);
+	cy = wl_fixed_to_int(move->base.y + move->dy);
+	shell_surface_snap_position(shsurf,
+				    get_output_at(shsurf->shell->compositor,
+						  move->base.x, move->base.y),
+				    &cx, &cy);
+
+	weston_view_set_position(shsurf->view, cx, cy);
+	weston_compositor_schedule_repaint(shsurf->surface->compositor);
+
+	move->base.dirty = false;
+	touch_latency_applied(&move->base);
+}
+
+static void touch_move_grab_up(struct weston_touch_grab *grab, uint32_t time,
+			       int touch_id)
+{
+	struct weston_touch_move_grab *move =
+		(struct weston_touch_move_grab *) grab;
+	struct shell_surface *shsurf = move->base.shsurf;
+
+	if (touch_id != grab->touch->grab_touch_id &&
+	    grab->touch->num_tp != 0)
+		return;
+
+	if (shsurf)
+		shell_surface_snap_tile(shsurf,
+					get_output_at(shsurf->shell->compositor,
+						      move->base.x,
+						      move->base.y),
+					wl_fixed_to_int(move->base.x),
+					wl_fixed_to_int(move->base.y));
+
+	shell_touch_grab_end(&move->base);
+	shell_touch_grab_free(&move->base);
+}
+
+static const struct weston_touch_grab_interface touch_move_grab_interface = {
+	touch_grab_noop_down,
+	touch_move_grab_up,
+	touch_grab_motion,
+	touch_move_grab_frame,
+	touch_grab_cancel,
+};
+
+static int surface_touch_move(struct shell_surface *shsurf,
+			      struct weston_touch *touch)
+{
+	struct weston_touch_move_grab *move;
+
+	if (!shsurf)
+		return -1;
+
+	if (shsurf->grabbed ||
+	    shsurf->state.fullscreen || shsurf->state.maximized)
+		return 0;
+
+	move = shell_slab_zalloc(&shsurf->shell->grab_slab);
+	if (!move)
+		return -1;
+
+	move->dx = wl_fixed_from_double(shsurf->view->geometry.x) -
+			touch->grab_x;
+	move->dy = wl_fixed_from_double(shsurf->view->geometry.y) -
+			touch->grab_y;
+
+	shell_touch_grab_start(&move->base, &touch_move_grab_interface,
+			       "move", shsurf, touch);
+
+	return 0;
+}
+
+static void touch_resize_grab_frame(struct weston_touch_grab *grab)
+{
+	struct weston_touch_resize_grab *resize =
+		(struct weston_touch_resize_grab *) grab;
+	struct shell_surface *shsurf = resize->base.shsurf;
+	int32_t width, height;
+
+	if (!shsurf || !resize->base.dirty)
+		return;
+
+	width = resize->width;
+	height = resize->height;
+	resize_grab_size(shsurf, resize->edges, &width, &height,
+			 grab->touch->grab_x, grab->touch->grab_y,
+			 resize->base.x, resize->base.y);
+
+	shsurf->client->send_configure(shsurf->surface, width, height);
+
+	resize->base.dirty = false;
+	touch_latency_applied(&resize->base);
+}
+
+static void touch_resize_grab_up(struct weston_touch_grab *grab,
+				 uint32_t time, int touch_id)
+{
+	struct shell_touch_grab *shell_grab =
+		container_of(grab, struct shell_touch_grab, grab);
+
+	if (touch_id != grab->touch->grab_touch_id &&
+	    grab->touch->num_tp != 0)
+		return;
+
+	shell_touch_grab_end(shell_grab);
+	shell_touch_grab_free(shell_grab);
+}
+
+static const struct weston_touch_grab_interface touch_resize_grab_interface = {
+	touch_grab_noop_down,
+	touch_resize_grab_up,
+	touch_grab_motion,
+	touch_resize_grab_frame,
+	touch_grab_cancel,
+};
+
+static int surface_touch_resize(struct shell_surface *shsurf,
+				struct weston_touch *touch, uint32_t edges)
+{
+	struct weston_touch_resize_grab *resize;
+
+	if (shsurf->grabbed ||
+	    shsurf->state.fullscreen || shsurf->state.maximized)
+		return 0;
+
+	if (!resize_edges_valid(edges))
+		return 0;
+
+	resize = shell_slab_zalloc(&shsurf->shell->grab_slab);
+	if (!resize)
+		return -1;
+
+	resize->edges = edges;
+	resize->width = shsurf->geometry.width;
+	resize->height = shsurf->geometry.height;
+
+	shsurf->resize_edges = edges;
+	shell_surface_state_changed(shsurf);
+	shell_touch_grab_start(&resize->base, &touch_resize_grab_interface,
+			       "resize", shsurf, touch);
+
+	return 0;
+}
+
+static void
+common_surface_resize(struct wl_resource *resource,
+		      struct wl_resource *seat_resource, uint32_t serial,
+		      uint32_t edges)
+{
+	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_touch *touch = weston_seat_get_touch(seat);
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct weston_surface *surface;
+
+	if (pointer &&
+	    pointer->button_count > 0 &&
+	    pointer->grab_serial == serial &&
+	    pointer->focus) {
+		surface = weston_surface_get_main_surface(pointer->focus->surface);
+		if (surface == shsurf->surface &&
+		    surface_resize(shsurf, pointer, edges) < 0)
+			wl_resource_post_no_memory(resource);
+	} else if (touch &&
+		   touch->focus &&
+		   touch->grab_serial == serial) {
+		surface = weston_surface_get_main_surface(touch->focus->surface);
+		if (surface == shsurf->surface &&
+		    surface_touch_resize(shsurf, touch, edges) < 0)
+			wl_resource_post_no_memory(resource);
+	}
+}
+
+static void
+shell_surface_resize(struct wl_client *client, struct wl_resource *resource,
+		     struct wl_resource *seat_resource, uint32_t serial,
+		     uint32_t edges)
+{
+	common_surface_resize(resource, seat_resource, serial, edges);
+}
+
+static void busy_cursor_grab_focus(struct weston_pointer_grab *base)
+{
+	struct shell_grab *grab = (struct shell_grab *) base;
+	struct weston_pointer *pointer = base->pointer;
+	struct weston_view *view;
+	wl_fixed_t sx, sy;
+
+	view = weston_compositor_pick_view(pointer->seat->compositor,
 					   pointer->x, pointer->y,
 					   &sx, &sy);
 	//FIXME: temporary fix
 	if(!view) {
 		shell_grab_end(grab);
-		free(grab);
+		shell_grab_free(grab);
 		return;
 	}
 
 	if(!grab->shsurf || grab->shsurf->surface != view->surface) {
 		shell_grab_end(grab);
-		free(grab);
+		shell_grab_free(grab);
 	}
 }
 
@@ -1626,7 +3511,7 @@ busy_cursor_grab_cancel(struct weston_pointer_grab *base)
 	struct shell_grab *grab = (struct shell_grab *) base;
 
 	shell_grab_end(grab);
-	free(grab);
+	shell_grab_free(grab);
 }
 
 static const struct weston_pointer_grab_interface busy_cursor_grab_interface = {
@@ -1647,7 +3532,7 @@ set_busy_cursor(struct shell_surface *shsurf, struct weston_pointer *pointer)
 	if (pointer->grab->interface == &busy_cursor_grab_interface)
 		return;
 
-	grab = malloc(sizeof *grab);
+	grab = shell_slab_zalloc(&shsurf->shell->grab_slab);
 	if (!grab)
 		return;
 
@@ -1676,13 +3561,11 @@ static void end_busy_cursor(struct weston_compositor *compositor,
 		    && wl_resource_get_client(grab->shsurf->resource) == client)
 		{
 			shell_grab_end(grab);
-			free(grab);
+			shell_grab_free(grab);
 		}
 	}
 }
 
-static void handle_shell_client_destroy(struct wl_listener *listener, void *data);
-
 static int xdg_ping_timeout_handler(void *data)
 {
 	struct shell_client *sc = data;
@@ -1732,10 +3615,11 @@ handle_xdg_ping(struct shell_surface *shsurf, uint32_t serial)
 
 	wl_event_source_timer_update(sc->ping_timer, ping_timeout);
 
-	if (shell_surface_is_xdg_surface(shsurf) ||
-	    shell_surface_is_xdg_popup(shsurf))
-		xdg_shell_send_ping(sc->resource, serial);
-	else if (shell_surface_is_wl_shell_surface(shsurf) && shsurf->resource)
+	if (shell_surface_is_xdg_toplevel(shsurf) ||
+	    shell_surface_is_xdg_popup(shsurf)) {
+		if (sc->resource)
+			xdg_wm_base_send_ping(sc->resource, serial);
+	} else if (shell_surface_is_wl_shell_surface(shsurf) && shsurf->resource)
 		wl_shell_surface_send_ping(shsurf->resource, serial);
 }
 
@@ -1772,18 +3656,68 @@ handle_pointer_focus(struct wl_listener *listener, void *data)
 	ping_handler(view->surface, serial);
 }
 
+/* Keeps the window list entry of a toplevel in line with where its view
+ * is: on a workspace, minimized, or somewhere taskbars should not show it
+ * like the scratchpad. */
+static void
+shell_surface_update_window(struct shell_surface *shsurf)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct weston_layer *layer = shsurf->view->layer_link.layer;
+	struct workspace **pws, *ws = NULL;
+	uint32_t state = 0;
+
+	if (shsurf->type == SHELL_SURFACE_TOPLEVEL && layer != NULL &&
+	    !wl_list_empty(&shsurf->view->layer_link.link)) {
+		if (layer == &shell->minimized_layer)
+			state |= MS_WINDOW_LIST_STATE_MINIMIZED;
+		else
+			wl_array_for_each(pws, &shell->workspaces.array)
+				if (&(*pws)->layer == layer)
+					ws = *pws;
+	}
+
+	if (ws == NULL && state == 0) {
+		if (shsurf->window)
+			shell_window_destroy(shsurf->window);
+		shsurf->window = NULL;
+		return;
+	}
+
+	if (shsurf->window == NULL) {
+		shsurf->window = shell_window_create(&shell->window_list);
+		if (shsurf->window == NULL)
+			return;
+		shsurf->window->data = shsurf;
+
+		shell_window_set_title(shsurf->window, shsurf->title);
+		shell_window_set_app_id(shsurf->window, shsurf->class);
+	}
+
+	if (shsurf->focus_count > 0)
+		state |= MS_WINDOW_LIST_STATE_FOCUSED;
+
+	if (ws)
+		shell_window_set_workspace(shsurf->window, ws->index);
+	shell_window_set_state(shsurf->window, state);
+}
+
 static void
 shell_surface_lose_keyboard_focus(struct shell_surface *shsurf)
 {
-	if (--shsurf->focus_count == 0)
+	if (--shsurf->focus_count == 0) {
 		shell_surface_state_changed(shsurf);
+		shell_surface_update_window(shsurf);
+	}
 }
 
 static void
 shell_surface_gain_keyboard_focus(struct shell_surface *shsurf)
 {
-	if (shsurf->focus_count++ == 0)
+	if (shsurf->focus_count++ == 0) {
 		shell_surface_state_changed(shsurf);
+		shell_surface_update_window(shsurf);
+	}
 }
 
 static void
@@ -1839,12 +3773,38 @@ set_title(struct shell_surface *shsurf, const char *title)
 	free(shsurf->title);
 	shsurf->title = strdup(title);
 	shsurf->surface->timeline.force_refresh = 1;
+
+	if (shsurf->window)
+		shell_window_set_title(shsurf->window, title);
+
+	shell_surface_match_rules(shsurf);
+}
+
+static pid_t
+shell_surface_get_pid(struct shell_surface *shsurf)
+{
+	pid_t pid;
+
+	if (shsurf->pid > 0)
+		return shsurf->pid;
+
+	if (!shsurf->surface->resource)
+		return 0;
+
+	wl_client_get_credentials(
+		wl_resource_get_client(shsurf->surface->resource),
+		&pid, NULL, NULL);
+	return pid;
 }
 
 static void
 set_pid(struct shell_surface *shsurf, pid_t pid)
 {
-	/* We have no use for it */
+	shsurf->pid = pid;
+
+	/* Xwayland may only tell us after the window got mapped */
+	if (weston_surface_is_mapped(shsurf->surface))
+		shell_launcher_client_mapped(&shsurf->shell->launcher, pid);
 }
 
 static void
@@ -1852,6 +3812,8 @@ set_type(struct shell_surface *shsurf, enum shell_surface_type t)
 {
 	shsurf->type = t;
 	shsurf->surface->timeline.force_refresh = 1;
+
+	shell_surface_match_rules(shsurf);
 }
 
 static void
@@ -1883,6 +3845,11 @@ shell_surface_set_class(struct wl_client *client,
 	free(shsurf->class);
 	shsurf->class = strdup(class);
 	shsurf->surface->timeline.force_refresh = 1;
+
+	if (shsurf->window)
+		shell_window_set_app_id(shsurf->window, class);
+
+	shell_surface_match_rules(shsurf);
 }
 
 static void
@@ -1901,118 +3868,412 @@ restore_all_output_modes(struct weston_compositor *compositor)
 		restore_output_mode(output);
 }
 
-/* The surface will be inserted into the list immediately after the link
- * returned by this function (i.e. will be stacked immediately above the
- * returned link). */
-static struct weston_layer_entry *shell_surface_calculate_layer_link(struct shell_surface *shsurf)
-{
-	struct workspace *ws;
-	struct weston_view *parent;
-
-	switch (shsurf->type) {
-	//case SHELL_SURFACE_XWAYLAND:/*used to be fullscreen, not sure if this will break */
-		//return &shsurf->shell->compositor->cursor_layer.view_list;
+/* A window and its transients, with theirs, form one run of views in its
+ * layer: each transient's run sits above the window, and children_list
+ * is in stacking order, topmost first. Restacking a window then moves its
+ * whole run with one splice. */
 
-	case SHELL_SURFACE_NONE:
-		return NULL;
+/* The topmost view of the run, found by following the topmost child
+ * that is mapped in the same layer. */
+static struct weston_view *
+shell_surface_stack_top(struct shell_surface *shsurf)
+{
+	struct weston_layer *layer = shsurf->view->layer_link.layer;
+	struct shell_surface *child, *top;
 
-	case SHELL_SURFACE_MENU:
-	case SHELL_SURFACE_XWAYLAND:
-	case SHELL_SURFACE_POPUP:
-	case SHELL_SURFACE_TOPLEVEL:
-		if (shsurf->parent) {
-			/* Move the surface to its parent layer so
-			 * that surfaces which are transient for
-			 * fullscreen surfaces don't get hidden by the
-			 * fullscreen surfaces. */
+	if (layer == NULL)
+		return shsurf->view;
 
-			/* TODO: Handle a parent with multiple views */
-			parent = get_default_view(shsurf->parent);
-			if (parent)
-				return container_of(parent->layer_link.link.prev,
-						    struct weston_layer_entry, link);
+	do {
+		top = NULL;
+		wl_list_for_each(child, &shsurf->children_list, children_link) {
+			if (child->view->layer_link.layer == layer) {
+				top = child;
+				break;
+			}
 		}
+		if (top)
+			shsurf = top;
+	} while (top);
 
-		/* Move the surface to a normal workspace layer so that surfaces
-		 * which were previously fullscreen or transient are no longer
-		 * rendered on top. */
-		ws = get_current_workspace(shsurf->shell);
-		return &ws->layer.view_list;
-	}
-
-	assert(0 && "Unknown shell surface type");
+	return shsurf->view;
 }
 
-static void
-shell_surface_update_child_surface_layers (struct shell_surface *shsurf)
+/* The bottommost view of the run: the window, or the black bars right
+ * below it while it is scaled to fullscreen. */
+static struct weston_view *
+shell_surface_stack_bottom(struct shell_surface *shsurf)
 {
-	struct shell_surface *child;
-	struct weston_layer_entry *prev;
+	struct weston_view *black = shsurf->fullscreen.black_view;
 
-	/* Move the child layers to the same workspace as shsurf. They will be
-	 * stacked above shsurf. */
-	wl_list_for_each_reverse(child, &shsurf->children_list, children_link) {
-		if (shsurf->view->layer_link.link.prev != &child->view->layer_link.link) {
-			weston_view_damage_below(child->view);
-			weston_view_geometry_dirty(child->view);
-			prev = container_of(shsurf->view->layer_link.link.prev,
-					    struct weston_layer_entry, link);
-			weston_layer_entry_remove(&child->view->layer_link);
-			weston_layer_entry_insert(prev,
-						  &child->view->layer_link);
-			weston_view_geometry_dirty(child->view);
-			weston_surface_damage(child->surface);
+	if (black && shsurf->view->layer_link.link.next ==
+		     &black->layer_link.link)
+		return black;
 
-			/* Recurse. We don’t expect this to recurse very far (if
-			 * at all) because that would imply we have transient
-			 * (or popup) children of transient surfaces, which
-			 * would be unusual. */
-			shell_surface_update_child_surface_layers(child);
-		}
-	}
+	return shsurf->view;
 }
 
-/* Update the surface’s layer. Mark both the old and new views as having dirty
- * geometry to ensure the changes are redrawn.
- *
- * If any child surfaces exist and are mapped, ensure they’re in the same layer
- * as this surface. */
-static void shell_surface_update_layer(struct shell_surface *shsurf)
-{
+/* Moves the run of shsurf right below above, which may be the head of a
+ * layer's view list, and damages its views if that restacked them.
+ * Returns whether anything moved. */
+static bool
+shell_surface_stack_run(struct shell_surface *shsurf,
+			struct weston_layer_entry *above)
+{
+	struct wl_list *first = &shell_surface_stack_top(shsurf)->layer_link.link;
+	struct wl_list *last = &shell_surface_stack_bottom(shsurf)->layer_link.link;
+	struct weston_layer *old_layer = shsurf->view->layer_link.layer;
+	struct weston_layer *layer = above->layer;
+	struct shell_surface *moved;
+	struct weston_view *view;
+	struct wl_list *e;
+
+	if (first->prev == &above->link || last == &above->link)
+		return false;
+
+	first->prev->next = last->next;
+	last->next->prev = first->prev;
+
+	first->prev = &above->link;
+	last->next = above->link.next;
+	above->link.next->prev = last;
+	above->link.next = first;
+
+	for (e = first; ; e = e->next) {
+		view = container_of(e, struct weston_view, layer_link.link);
+		view->layer_link.layer = layer;
+		weston_view_damage_below(view);
+		weston_surface_damage(view->surface);
+		if (layer != old_layer &&
+		    (moved = get_shell_surface(view->surface))) {
+			shell_surface_update_window(moved);
+			shell_surface_track_placement(moved);
+		}
+		if (e == last)
+			break;
+	}
+
+	shell_fullscreen_schedule(shsurf->shell);
+
+	return true;
+}
+
+static struct shell_surface *
+shell_surface_get_parent(struct shell_surface *shsurf)
+{
+	return shsurf->parent ? get_shell_surface(shsurf->parent) : NULL;
+}
+
+/* the window whose run holds shsurf's */
+static struct shell_surface *
+shell_surface_get_root(struct shell_surface *shsurf)
+{
+	struct shell_surface *parent;
+
+	while ((parent = shell_surface_get_parent(shsurf)))
+		shsurf = parent;
+
+	return shsurf;
+}
+
+/* The layer a fullscreen window goes in: the fullscreen layer of its
+ * output, except while a workspace slides, when it moves along with its
+ * workspace. */
+static struct weston_layer *
+shell_surface_fullscreen_layer(struct shell_surface *shsurf)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct shell_output *shell_output;
+
+	if (!shsurf->state.fullscreen || shsurf->fullscreen_output == NULL ||
+	    shsurf->fullscreen.lowered)
+		return NULL;
+
+	if (shell->workspaces.anim_to != NULL ||
+	    shell->workspaces.gesture.active)
+		return NULL;
+
+	shell_output = get_shell_output(shsurf->fullscreen_output);
+	if (shell_output == NULL)
+		return NULL;
+
+	return &shell_output->fullscreen_layer;
+}
+
+/* Whether no other window is above shsurf in the fullscreen layer of its
+ * output, so it may switch the output mode. */
+static bool shell_surface_is_top_fullscreen(struct shell_surface *shsurf)
+{
+	struct weston_layer *layer = shell_surface_fullscreen_layer(shsurf);
+	struct shell_surface *top;
+	struct weston_view *view;
+
+	if (shsurf->fullscreen_output == NULL || shsurf->fullscreen.lowered)
+		return false;
+
+	if (layer == NULL || wl_list_empty(&layer->view_list.link))
+		return true;
+
+	view = container_of(layer->view_list.link.next,
+			    struct weston_view, layer_link.link);
+	top = get_shell_surface(view->surface);
+
+	return top == NULL || shell_surface_get_root(top) == shsurf;
+}
+
+static bool fullscreen_layer_covers(struct shell_output *shell_output)
+{
+	struct weston_output *output = shell_output->output;
+	pixman_box32_t box = {
+		output->x, output->y,
+		output->x + output->width, output->y + output->height
+	};
+	struct weston_view *view;
+
+	wl_list_for_each(view, &shell_output->fullscreen_layer.view_list.link,
+			 layer_link.link) {
+		weston_view_update_transform(view);
+		if (view->alpha == 1.0f &&
+		    pixman_region32_contains_rectangle(&view->transform.opaque,
+						       &box) == PIXMAN_REGION_IN)
+			return true;
+	}
+
+	return false;
+}
+
+static void fullscreen_mask_layer(struct mayhem_shell *shell,
+				  struct weston_layer *layer, void *data)
+{
+	pixman_box32_t *mask = data;
+
+	if (mask)
+		weston_layer_set_mask(layer, mask->x1, mask->y1,
+				      mask->x2 - mask->x1,
+				      mask->y2 - mask->y1);
+	else
+		weston_layer_set_mask_infinite(layer);
+}
+
+/* Masks the background and workspaces down to the outputs no fullscreen
+ * window covers opaquely. Masked out, their views are not repainted or
+ * sent frame callbacks on the covered outputs, and their clients see
+ * those outputs leave. A layer has a single mask, so when the outputs
+ * still showing do not make up a rectangle nothing is hidden. */
+static void shell_fullscreen_update(void *data)
+{
+	struct mayhem_shell *shell = data;
+	struct shell_output *shell_output;
+	struct weston_output *output;
+	pixman_box32_t rest = { 0, 0, 0, 0 };
+	bool covered = false, showing = false, masked;
+
+	shell->fullscreen.idle = NULL;
+
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		shell_output->fullscreen_covered =
+			fullscreen_layer_covers(shell_output);
+		if (shell_output->fullscreen_covered) {
+			covered = true;
+			continue;
+		}
+
+		output = shell_output->output;
+		if (!showing) {
+			rest.x1 = output->x;
+			rest.y1 = output->y;
+			rest.x2 = output->x + output->width;
+			rest.y2 = output->y + output->height;
+			showing = true;
+			continue;
+		}
+		rest.x1 = MIN(rest.x1, output->x);
+		rest.y1 = MIN(rest.y1, output->y);
+		rest.x2 = MAX(rest.x2, output->x + output->width);
+		rest.y2 = MAX(rest.y2, output->y + output->height);
+	}
+
+	masked = covered;
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		output = shell_output->output;
+		if (showing && shell_output->fullscreen_covered &&
+		    output->x < rest.x2 && output->x + output->width > rest.x1 &&
+		    output->y < rest.y2 && output->y + output->height > rest.y1)
+			masked = false;
+	}
+
+	if (masked == shell->fullscreen.masked &&
+	    (!masked || memcmp(&rest, &shell->fullscreen.mask,
+			       sizeof rest) == 0))
+		return;
+
+	shell->fullscreen.masked = masked;
+	shell->fullscreen.mask = rest;
+	shell_for_each_layer(shell, fullscreen_mask_layer,
+			     masked ? &rest : NULL);
+	weston_compositor_schedule_repaint(shell->compositor);
+
+	shell_log(SHELL_LOG_SHELL, SHELL_LOG_DEBUG,
+		  "fullscreen: %s below fullscreen windows",
+		  masked ? "hiding layers" : "showing everything");
+}
+
+/* Once per event loop iteration, however often the fullscreen layers
+ * changed in it. */
+static void shell_fullscreen_schedule(struct mayhem_shell *shell)
+{
+	struct wl_event_loop *loop;
+
+	if (shell->fullscreen.idle)
+		return;
+
+	loop = wl_display_get_event_loop(shell->compositor->wl_display);
+	shell->fullscreen.idle =
+		wl_event_loop_add_idle(loop, shell_fullscreen_update, shell);
+}
+
+/* The surface will be inserted into the list immediately after the link
+ * returned by this function (i.e. will be stacked immediately below the
+ * returned link). */
+static struct weston_layer_entry *shell_surface_calculate_layer_link(struct shell_surface *shsurf)
+{
+	struct shell_surface *parent_shsurf;
+	struct weston_layer *fullscreen;
+	struct workspace *ws;
+	struct weston_view *parent;
+
+	switch (shsurf->type) {
+	//case SHELL_SURFACE_XWAYLAND:/*used to be fullscreen, not sure if this will break */
+		//return &shsurf->shell->compositor->cursor_layer.view_list;
+
+	case SHELL_SURFACE_NONE:
+		return NULL;
+
+	case SHELL_SURFACE_MENU:
+	case SHELL_SURFACE_XWAYLAND:
+	case SHELL_SURFACE_POPUP:
+	case SHELL_SURFACE_TOPLEVEL:
+		if (shsurf->parent) {
+			/* Move the surface to the top of its parent's run so
+			 * that surfaces which are transient for
+			 * fullscreen surfaces don't get hidden by the
+			 * fullscreen surfaces. */
+
+			/* TODO: Handle a parent with multiple views */
+			parent_shsurf = get_shell_surface(shsurf->parent);
+			if (parent_shsurf)
+				parent = shell_surface_stack_top(parent_shsurf);
+			else
+				parent = get_default_view(shsurf->parent);
+			if (parent && parent->layer_link.layer)
+				return container_of(parent->layer_link.link.prev,
+						    struct weston_layer_entry, link);
+		}
+
+		fullscreen = shell_surface_fullscreen_layer(shsurf);
+		if (fullscreen)
+			return &fullscreen->view_list;
+
+		/* Move the surface to a normal workspace layer so that surfaces
+		 * which were previously fullscreen or transient are no longer
+		 * rendered on top. */
+		ws = get_current_workspace(shsurf->shell);
+		return &ws->layer.view_list;
+	}
+
+	assert(0 && "Unknown shell surface type");
+}
+
+/* Update the surface’s layer. Its run moves along, and only views that
+ * changed place are damaged. */
+static void shell_surface_update_layer(struct shell_surface *shsurf)
+{
 	struct weston_layer_entry *new_layer_link;
+	struct shell_surface *parent;
 
 	new_layer_link = shell_surface_calculate_layer_link(shsurf);
 
 	if (new_layer_link == NULL)
 		return;
-	if (new_layer_link == &shsurf->view->layer_link)
-		return;
 
-	weston_view_geometry_dirty(shsurf->view);
-	weston_layer_entry_remove(&shsurf->view->layer_link);
-	weston_layer_entry_insert(new_layer_link, &shsurf->view->layer_link);
-	weston_view_geometry_dirty(shsurf->view);
-	weston_surface_damage(shsurf->surface);
+	shell_surface_stack_run(shsurf, new_layer_link);
 
-	shell_surface_update_child_surface_layers(shsurf);
+	/* it is now its parent's topmost child */
+	parent = shell_surface_get_parent(shsurf);
+	if (parent) {
+		wl_list_remove(&shsurf->children_link);
+		wl_list_insert(&parent->children_list,
+			       &shsurf->children_link);
+	}
+
+	shell_surface_update_window(shsurf);
+}
+
+/* Brings the window to the top of its parent's run and the parent to the
+ * top of its own, up to the window that goes on top of the workspace: a
+ * splice per ancestor. */
+static void shell_surface_raise(struct shell_surface *shsurf)
+{
+	struct shell_surface *parent = shell_surface_get_parent(shsurf);
+
+	if (parent)
+		shell_surface_raise(parent);
+
+	shell_surface_update_layer(shsurf);
 }
 
 static void
 shell_surface_set_parent(struct shell_surface *shsurf,
                          struct weston_surface *parent)
 {
+	struct shell_surface *old_parent = shell_surface_get_parent(shsurf);
+	struct shell_surface *parent_shsurf, *p;
+	struct weston_view *top;
+
+	parent_shsurf = parent ? get_shell_surface(parent) : NULL;
+
+	/* a surface can't be stacked above itself */
+	for (p = parent_shsurf; p; p = shell_surface_get_parent(p)) {
+		if (p == shsurf) {
+			parent = NULL;
+			parent_shsurf = NULL;
+			break;
+		}
+	}
+
 	shsurf->parent = parent;
 
 	wl_list_remove(&shsurf->children_link);
 	wl_list_init(&shsurf->children_link);
 
-	/* Insert into the parent surface’s child list. */
-	if (parent != NULL) {
-		struct shell_surface *parent_shsurf = get_shell_surface(parent);
-		if (parent_shsurf != NULL)
-			wl_list_insert(&parent_shsurf->children_list,
-			               &shsurf->children_link);
+	/* A mapped surface leaves the old parent's run, so that stays in
+	 * one piece, and joins the new parent's on top. */
+	if (old_parent && old_parent != parent_shsurf &&
+	    shsurf->view->layer_link.layer &&
+	    old_parent->view->layer_link.layer) {
+		top = shell_surface_stack_top(old_parent);
+		shell_surface_stack_run(shsurf,
+					container_of(top->layer_link.link.prev,
+						     struct weston_layer_entry,
+						     link));
+	}
+
+	if (parent_shsurf != NULL) {
+		if (shsurf->view->layer_link.layer &&
+		    parent_shsurf->view->layer_link.layer) {
+			top = shell_surface_stack_top(parent_shsurf);
+			shell_surface_stack_run(shsurf,
+						container_of(top->layer_link.link.prev,
+							     struct weston_layer_entry,
+							     link));
+		}
+
+		/* Insert into the parent surface’s child list. */
+		wl_list_insert(&parent_shsurf->children_list,
+			       &shsurf->children_link);
 	}
+
+	shell_surface_match_rules(shsurf);
 }
 
 static void
@@ -2107,6 +4368,7 @@ set_fullscreen(struct shell_surface *shsurf,
 	shsurf->fullscreen_output = shsurf->output;
 	shsurf->fullscreen.type = method;
 	shsurf->fullscreen.framerate = framerate;
+	shsurf->fullscreen.lowered = false;
 
 	send_configure_for_surface(shsurf);
 }
@@ -2115,6 +4377,8 @@ static void
 weston_view_set_initial_position(struct weston_view *view,
 				 struct mayhem_shell *shell);
 
+static void shell_surface_destroy_black_view(struct shell_surface *shsurf);
+
 static void
 unset_fullscreen(struct shell_surface *shsurf)
 {
@@ -2129,6 +4393,7 @@ unset_fullscreen(struct shell_surface *shsurf)
 
 	wl_list_remove(&shsurf->fullscreen.transform.link);
 	wl_list_init(&shsurf->fullscreen.transform.link);
+	shell_surface_destroy_black_view(shsurf);
 
 	if(shsurf->saved_position_valid)
 		weston_view_set_position(shsurf->view,
@@ -2242,13 +4507,13 @@ static void set_minimized(struct weston_surface *surface)
 	shsurf = get_shell_surface(surface);
 	current_ws = get_current_workspace(shsurf->shell);
 
-	weston_layer_entry_remove(&view->layer_link);
-	weston_layer_entry_insert(&shsurf->shell->minimized_layer.view_list, &view->layer_link);
+	shell_surface_stack_run(shsurf,
+				&shsurf->shell->minimized_layer.view_list);
 
 	drop_focus_state(shsurf->shell, current_ws, view->surface);
 	surface_keyboard_focus_lost(surface);
 
-	shell_surface_update_child_surface_layers(shsurf);
+	shell_surface_update_window(shsurf);
 	weston_view_damage_below(view);
 }
 
@@ -2343,6 +4608,86 @@ static void set_surface_type(struct shell_surface *shsurf)
 	shell_surface_update_layer(shsurf);
 }
 
+static int black_surface_get_label(struct weston_surface *surface,
+				   char *buf, size_t len)
+{
+	return snprintf(buf, len, "black bars of a fullscreen window");
+}
+
+/* no-op func for checking black surfaces */
+static void black_surface_configure(struct weston_surface *es,
+				    int32_t sx, int32_t sy)
+{
+}
+
+static struct shell_surface *
+get_black_surface_owner(struct weston_surface *surface)
+{
+	if (surface->configure == black_surface_configure)
+		return surface->configure_private;
+	else
+		return NULL;
+}
+
+static void shell_surface_destroy_black_view(struct shell_surface *shsurf)
+{
+	struct weston_view *view = shsurf->fullscreen.black_view;
+
+	if (view == NULL)
+		return;
+
+	shsurf->fullscreen.black_view = NULL;
+	wl_list_remove(&shsurf->fullscreen.black_transform.link);
+	wl_list_init(&shsurf->fullscreen.black_transform.link);
+	weston_surface_destroy(view->surface);
+}
+
+/* An opaque black view covering the output right below the window, so a
+ * scaled window sits in black bars and nothing behind it is drawn. */
+static void shell_surface_ensure_black_view(struct shell_surface *shsurf,
+					    struct weston_output *output)
+{
+	struct weston_view *view = shsurf->fullscreen.black_view;
+	struct weston_surface *surface;
+
+	if (view == NULL) {
+		surface = weston_surface_create(shsurf->shell->compositor);
+		if (surface == NULL)
+			return;
+
+		view = weston_view_create(surface);
+		if (view == NULL) {
+			weston_surface_destroy(surface);
+			return;
+		}
+
+		surface->configure = black_surface_configure;
+		surface->configure_private = shsurf;
+		weston_surface_set_label_func(surface, black_surface_get_label);
+		weston_surface_set_color(surface, 0.0, 0.0, 0.0, 1.0);
+		shsurf->fullscreen.black_view = view;
+	}
+
+	surface = view->surface;
+	if (surface->width != output->width ||
+	    surface->height != output->height) {
+		weston_surface_set_size(surface, output->width, output->height);
+		pixman_region32_fini(&surface->opaque);
+		pixman_region32_init_rect(&surface->opaque, 0, 0,
+					  output->width, output->height);
+	}
+	weston_view_set_position(view, output->x, output->y);
+
+	if (shsurf->view->layer_link.layer &&
+	    shell_surface_stack_bottom(shsurf) != view) {
+		weston_layer_entry_remove(&view->layer_link);
+		weston_layer_entry_insert(&shsurf->view->layer_link,
+					  &view->layer_link);
+		weston_view_damage_below(view);
+		weston_surface_damage(surface);
+	}
+}
+
 /* Create black surface and append it to the associated fullscreen surface.
  * Handle size dismatch and positioning according to the method. */
 static void shell_configure_fullscreen(struct shell_surface *shsurf)
@@ -2353,15 +4698,13 @@ static void shell_configure_fullscreen(struct shell_surface *shsurf)
 	float scale, output_aspect, surface_aspect, x, y;
 	int32_t surf_x, surf_y, surf_width, surf_height;
 
+	/* no output left, see shell_surface_move_fullscreen() */
+	if (output == NULL)
+		return;
+
 	if(shsurf->fullscreen.type != WL_SHELL_SURFACE_FULLSCREEN_METHOD_DRIVER)
 		restore_output_mode(output);
 
-	/* Reverse the effect of lower_fullscreen_layer() */
-	//weston_layer_entry_remove(&shsurf->view->layer_link);
-	//weston_layer_entry_insert(&shsurf->shell->fullscreen_layer.view_list,
-	//			  &shsurf->view->layer_link);
-
-
 	surface_subsurfaces_boundingbox(shsurf->surface, &surf_x, &surf_y,
 	                                &surf_width, &surf_height);
 
@@ -2374,12 +4717,18 @@ static void shell_configure_fullscreen(struct shell_surface *shsurf)
 		/* 1:1 mapping between surface and output dimensions */
 		if (output->width == surf_width &&
 			output->height == surf_height) {
+			wl_list_remove(&shsurf->fullscreen.transform.link);
+			wl_list_init(&shsurf->fullscreen.transform.link);
+			shell_surface_destroy_black_view(shsurf);
 			weston_view_set_position(shsurf->view,
 						 output->x - surf_x,
 						 output->y - surf_y);
 			break;
 		}
 
+		/* A plain scale with the position as the only offset, which
+		 * a backend can hand to a plane as it is. */
+		shell_surface_ensure_black_view(shsurf, output);
 		matrix = &shsurf->fullscreen.transform.matrix;
 		weston_matrix_init(matrix);
 
@@ -2430,6 +4779,9 @@ static void shell_configure_fullscreen(struct shell_surface *shsurf)
 	default:
 		break;
 	}
+
+	/* whether it still covers the output */
+	shell_fullscreen_schedule(shsurf->shell);
 }
 
 static void
@@ -2533,6 +4885,9 @@ destroy_shell_seat(struct wl_listener *listener, void *data)
 		container_of(listener,
 			     struct shell_seat, seat_destroy_listener);
 	struct shell_surface *shsurf, *next;
+	struct shell_output *sh_output;
+	struct focus_state **state;
+	struct mayhem_shell *shell;
 
 	if (shseat->popup_grab.grab.interface == &popup_grab_interface) {
 		weston_pointer_end_grab(shseat->popup_grab.grab.pointer);
@@ -2546,6 +4901,16 @@ destroy_shell_seat(struct wl_listener *listener, void *data)
 		}
 	}
 
+	shell = shseat->seat->compositor->shell_interface.shell;
+	wl_list_for_each(sh_output, &shell->output_list, link)
+		if (sh_output->zoom.seat == shseat->seat)
+			sh_output->zoom.seat = NULL;
+
+	wl_array_for_each(state, &shseat->focus_states)
+		if (*state)
+			focus_state_destroy(*state);
+	wl_array_release(&shseat->focus_states);
+
 	wl_list_remove(&shseat->seat_destroy_listener.link);
 	free(shseat);
 }
@@ -2591,6 +4956,7 @@ create_shell_seat(struct weston_seat *seat)
 
 	shseat->seat = seat;
 	wl_list_init(&shseat->popup_grab.surfaces_list);
+	wl_array_init(&shseat->focus_states);
 
 	shseat->seat_destroy_listener.notify = destroy_shell_seat;
 	wl_signal_add(&seat->destroy_signal,
@@ -2803,10 +5169,10 @@ add_popup_grab(struct shell_surface *shsurf,
 	parent = get_shell_surface(shsurf->parent);
 	top_surface = get_top_popup(shseat);
 	if (shell_surface_is_xdg_popup(shsurf) &&
-	    ((top_surface == NULL && !shell_surface_is_xdg_surface(parent)) ||
+	    ((top_surface == NULL && !shell_surface_is_xdg_toplevel(parent)) ||
 	     (top_surface != NULL && parent != top_surface))) {
 		wl_resource_post_error(shsurf->owner->resource,
-				       XDG_SHELL_ERROR_NOT_THE_TOPMOST_POPUP,
+				       XDG_WM_BASE_ERROR_NOT_THE_TOPMOST_POPUP,
 				       "xdg_popup was not created on the "
 				       "topmost popup");
 		return -1;
@@ -2848,14 +5214,13 @@ remove_popup_grab(struct shell_surface *shsurf)
 {
 	struct shell_seat *shseat = shsurf->popup.shseat;
 
-	if (shell_surface_is_xdg_popup(shsurf) &&
-	    get_top_popup(shseat) != shsurf) {
-		wl_resource_post_error(shsurf->resource,
-				       XDG_SHELL_ERROR_NOT_THE_TOPMOST_POPUP,
+	/* unlinked all the same, the client is on its way out */
+	if (shell_surface_is_xdg_popup(shsurf) && shsurf->owner &&
+	    shsurf->owner->resource && get_top_popup(shseat) != shsurf)
+		wl_resource_post_error(shsurf->owner->resource,
+				       XDG_WM_BASE_ERROR_NOT_THE_TOPMOST_POPUP,
 				       "xdg_popup was destroyed while it was "
 				       "not the topmost popup.");
-		return;
-	}
 
 	wl_list_remove(&shsurf->popup.grab_link);
 	wl_list_init(&shsurf->popup.grab_link);
@@ -2872,15 +5237,28 @@ shell_map_popup(struct shell_surface *shsurf)
 {
 	struct shell_seat *shseat = shsurf->popup.shseat;
 	struct weston_view *parent_view = get_default_view(shsurf->parent);
-	struct weston_pointer *pointer = weston_seat_get_pointer(shseat->seat);
+	struct shell_surface *parent = get_shell_surface(shsurf->parent);
+	struct weston_pointer *pointer;
+	int32_t x = shsurf->popup.x, y = shsurf->popup.y;
 
 	shsurf->surface->output = parent_view->output;
 	shsurf->view->output = parent_view->output;
 
+	/* placed between the window geometries, not the surfaces */
+	if (shell_surface_is_xdg_popup(shsurf) && parent) {
+		x += parent->geometry.x - shsurf->geometry.x;
+		y += parent->geometry.y - shsurf->geometry.y;
+	}
+
 	weston_view_set_transform_parent(shsurf->view, parent_view);
-	weston_view_set_position(shsurf->view, shsurf->popup.x, shsurf->popup.y);
+	weston_view_set_position(shsurf->view, x, y);
 	weston_view_update_transform(shsurf->view);
 
+	/* an xdg_popup without a grab */
+	if (shseat == NULL)
+		return 0;
+
+	pointer = weston_seat_get_pointer(shseat->seat);
 	if (pointer && pointer->grab_serial == shsurf->popup.serial) {
 		if (add_popup_grab(shsurf, shseat, POINTER) != 0)
 			return -1;
@@ -2912,6 +5290,15 @@ destroy_shell_surface(struct shell_surface *shsurf)
 
 	wl_signal_emit(&shsurf->destroy_signal, shsurf);
 
+	shell_anim_stop(&shsurf->effect.anim);
+
+	shell_surface_untrack_placement(shsurf);
+
+	if (shsurf->window)
+		shell_window_destroy(shsurf->window);
+
+	wl_list_remove(&shsurf->xdg.configure_link);
+
 	if (!wl_list_empty(&shsurf->popup.grab_link)) {
 		remove_popup_grab(shsurf);
 	}
@@ -2920,6 +5307,8 @@ destroy_shell_surface(struct shell_surface *shsurf)
 	    shell_surface_is_top_fullscreen(shsurf))
 		restore_output_mode (shsurf->fullscreen_output);
 
+	shell_surface_destroy_black_view(shsurf);
+
 	/* As destroy_resource() use wl_list_for_each_safe(),
 	 * we can always remove the listener.
 	 */
@@ -2935,7 +5324,8 @@ destroy_shell_surface(struct shell_surface *shsurf)
 		shell_surface_set_parent(child, NULL);
 
 	wl_list_remove(&shsurf->link);
-	free(shsurf);
+	shell_client_remove_surface(shsurf);
+	shell_slab_free(&shsurf->shell->shsurf_slab, shsurf);
 }
 
 static void
@@ -2950,60 +5340,253 @@ shell_destroy_shell_surface(struct wl_resource *resource)
 	shsurf->resource = NULL;
 }
 
+/* For a surface that is going away from under its protocol objects; the
+ * xdg_surface one would otherwise take the shell surface down with it. */
 static void
-shell_handle_surface_destroy(struct wl_listener *listener, void *data)
+shell_surface_destroy_resources(struct shell_surface *shsurf)
 {
-	struct shell_surface *shsurf = container_of(listener,
-						    struct shell_surface,
-						    surface_destroy_listener);
+	struct wl_resource *xdg_resource = shsurf->xdg.resource;
 
 	if (shsurf->resource)
 		wl_resource_destroy(shsurf->resource);
 
-	destroy_shell_surface(shsurf);
+	if (xdg_resource) {
+		shsurf->xdg.resource = NULL;
+		wl_resource_set_user_data(xdg_resource, NULL);
+		wl_resource_destroy(xdg_resource);
+	}
 }
 
 static void
-fade_out_done(struct weston_view_animation *animation, void *data)
+shell_handle_surface_destroy(struct wl_listener *listener, void *data)
 {
-	struct shell_surface *shsurf = data;
+	struct shell_surface *shsurf = container_of(listener,
+						    struct shell_surface,
+						    surface_destroy_listener);
 
-	weston_surface_destroy(shsurf->surface);
+	shell_surface_destroy_resources(shsurf);
+	destroy_shell_surface(shsurf);
 }
 
+/* A window that is fading or zooming out after its client destroyed the
+ * surface. The weston_surface is kept alive so the renderer still holds
+ * the last frame that was committed to it, and is shown through a view
+ * owned by the shell until the animation is over. */
+struct closing_window {
+	struct mayhem_shell *shell;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct shell_anim anim;
+	struct weston_transform transform;
+	enum animation_type type;
+	struct wl_list link;	/* mayhem_shell::closing_list */
+};
+
 static void
-handle_resource_destroy(struct wl_listener *listener, void *data)
+view_apply_effect(struct weston_view *view, struct weston_transform *transform,
+		  enum animation_type type, double value)
 {
-	struct shell_surface *shsurf =
-		container_of(listener, struct shell_surface,
-			     resource_destroy_listener);
+	struct weston_matrix *matrix = &transform->matrix;
+	float cx, cy, scale;
 
-	if (!weston_surface_is_mapped(shsurf->surface))
-		return;
+	view->alpha = value;
 
-	shsurf->surface->ref_count++;
+	if (type == ANIMATION_ZOOM) {
+		cx = 0.5f * view->surface->width;
+		cy = 0.5f * view->surface->height;
+		scale = 0.5f + 0.5f * value;
 
-	pixman_region32_fini(&shsurf->surface->pending.input);
-	pixman_region32_init(&shsurf->surface->pending.input);
-	pixman_region32_fini(&shsurf->surface->input);
-	pixman_region32_init(&shsurf->surface->input);
-	if (shsurf->shell->win_close_animation_type == ANIMATION_FADE) {
-		weston_fade_run(shsurf->view, 1.0, 0.0, 300.0,
-				fade_out_done, shsurf);
-	} else {
-		weston_surface_destroy(shsurf->surface);
+		weston_matrix_init(matrix);
+		weston_matrix_translate(matrix, -cx, -cy, 0);
+		weston_matrix_scale(matrix, scale, scale, 1.0);
+		weston_matrix_translate(matrix, cx, cy, 0);
+
+		if (wl_list_empty(&transform->link))
+			wl_list_insert(&view->geometry.transformation_list,
+				       &transform->link);
 	}
+
+	weston_view_geometry_dirty(view);
 }
 
 static void
-shell_surface_configure(struct weston_surface *, int32_t, int32_t);
-
-struct shell_surface *
-get_shell_surface(struct weston_surface *surface)
+shell_surface_effect_frame(struct shell_anim *anim, double value)
 {
-	if (surface->configure == shell_surface_configure)
-		return surface->configure_private;
-	else
+	struct shell_surface *shsurf =
+		container_of(anim, struct shell_surface, effect.anim);
+
+	view_apply_effect(shsurf->view, &shsurf->effect.transform,
+			  shsurf->effect.type, value);
+}
+
+static void
+shell_surface_effect_done(struct shell_anim *anim)
+{
+	struct shell_surface *shsurf =
+		container_of(anim, struct shell_surface, effect.anim);
+
+	if (!wl_list_empty(&shsurf->effect.transform.link)) {
+		wl_list_remove(&shsurf->effect.transform.link);
+		wl_list_init(&shsurf->effect.transform.link);
+		weston_view_geometry_dirty(shsurf->view);
+	}
+}
+
+static void
+shell_surface_run_effect(struct shell_surface *shsurf,
+			 enum animation_type type, double from, double to)
+{
+	shsurf->effect.type = type;
+	shsurf->view->alpha = from;
+	shell_anim_start(&shsurf->effect.anim, from, to);
+}
+
+static void
+closing_window_frame(struct shell_anim *anim, double value)
+{
+	struct closing_window *closing =
+		container_of(anim, struct closing_window, anim);
+
+	view_apply_effect(closing->view, &closing->transform,
+			  closing->type, value);
+}
+
+static void
+closing_window_destroy(struct closing_window *closing)
+{
+	shell_anim_stop(&closing->anim);
+	wl_list_remove(&closing->link);
+	closing->shell->closing_count--;
+
+	weston_view_damage_below(closing->view);
+	weston_view_destroy(closing->view);
+	/* drops the reference taken in closing_window_create() and with
+	 * it the last frame the renderer was holding on to */
+	weston_surface_destroy(closing->surface);
+	free(closing);
+}
+
+static void
+closing_window_done(struct shell_anim *anim)
+{
+	closing_window_destroy(container_of(anim, struct closing_window, anim));
+}
+
+static struct closing_window *
+closing_window_create(struct shell_surface *shsurf, enum animation_type type)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct weston_surface *surface = shsurf->surface;
+	struct closing_window *closing;
+
+	if (shell->closing_count >= MAX_CLOSING_WINDOWS)
+		return NULL;
+
+	closing = zalloc(sizeof *closing);
+	if (!closing)
+		return NULL;
+
+	closing->view = weston_view_create(surface);
+	if (!closing->view) {
+		free(closing);
+		return NULL;
+	}
+
+	surface->ref_count++;
+	closing->surface = surface;
+	closing->shell = shell;
+	closing->type = type;
+	wl_list_init(&closing->transform.link);
+	wl_list_insert(&shell->closing_list, &closing->link);
+	shell->closing_count++;
+
+	/* the snapshot must not take input while it goes away */
+	pixman_region32_fini(&surface->pending.input);
+	pixman_region32_init(&surface->pending.input);
+	pixman_region32_fini(&surface->input);
+	pixman_region32_init(&surface->input);
+
+	weston_view_set_position(closing->view, shsurf->view->geometry.x,
+				 shsurf->view->geometry.y);
+	weston_layer_entry_insert(&shell->closing_layer.view_list,
+				  &closing->view->layer_link);
+	weston_view_update_transform(closing->view);
+
+	shell_anim_init(&closing->anim, &shell->timeline,
+			&shell->anim_config[SHELL_ANIM_WINDOW],
+			closing_window_frame, closing_window_done);
+	shell_anim_start(&closing->anim, shsurf->view->alpha, 0.0);
+
+	return closing;
+}
+
+/* Hand keyboard focus on right away instead of waiting for the retained
+ * surface to be destroyed at the end of the close animation. */
+static void
+surface_focus_states_lost(struct mayhem_shell *shell,
+			  struct weston_surface *surface)
+{
+	struct focus_state *state;
+
+	/* unhook first, the surface stays alive and the handler may hook
+	 * the state onto the next surface */
+	while ((state = surface_focus_state(surface, NULL))) {
+		wl_list_remove(&state->surface_destroy_listener.link);
+		wl_list_init(&state->surface_destroy_listener.link);
+		state->surface_destroy_listener.notify(
+			&state->surface_destroy_listener, surface);
+	}
+}
+
+/* Leaves a snapshot of a window that is going away fading or zooming
+ * out, and tears the window down. Returns false, leaving the window
+ * alone, if there is nothing to animate. */
+static bool
+shell_surface_close_animated(struct shell_surface *shsurf)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+	struct weston_surface *surface = shsurf->surface;
+	enum animation_type type = shell->win_close_animation_type;
+
+	if (!weston_surface_is_mapped(surface))
+		return false;
+
+	if (type != ANIMATION_FADE && type != ANIMATION_ZOOM)
+		return false;
+
+	if (!closing_window_create(shsurf, type))
+		return false;
+
+	/* The snapshot now owns the surface, so tear the window down the
+	 * same way shell_handle_surface_destroy() would. */
+	wl_list_remove(&shsurf->resource_destroy_listener.link);
+	shell_surface_destroy_resources(shsurf);
+	destroy_shell_surface(shsurf);
+
+	surface_focus_states_lost(shell, surface);
+
+	return true;
+}
+
+static void
+handle_resource_destroy(struct wl_listener *listener, void *data)
+{
+	struct shell_surface *shsurf =
+		container_of(listener, struct shell_surface,
+			     resource_destroy_listener);
+
+	shell_surface_close_animated(shsurf);
+}
+
+static void
+shell_surface_configure(struct weston_surface *, int32_t, int32_t);
+
+struct shell_surface *
+get_shell_surface(struct weston_surface *surface)
+{
+	if (surface->configure == shell_surface_configure)
+		return surface->configure_private;
+	else
 		return NULL;
 }
 
@@ -3012,11 +5595,16 @@ create_common_surface(struct shell_client *owner, void *shell,
 		      struct weston_surface *surface,
 		      const struct weston_shell_client *client)
 {
+	struct mayhem_shell *mshell = shell;
 	struct shell_surface *shsurf;
 
 	assert(surface->configure == NULL);
 
-	shsurf = calloc(1, sizeof *shsurf);
+	if (owner && !shell_client_check_limit(owner, CLIENT_LIMIT_SURFACES,
+					       owner->usage->surfaces + 1))
+		return NULL;
+
+	shsurf = shell_slab_zalloc(&mshell->shsurf_slab);
 	if (!shsurf) {
 		weston_log("no memory to allocate shell surface\n");
 		return NULL;
@@ -3025,7 +5613,7 @@ create_common_surface(struct shell_client *owner, void *shell,
 	shsurf->view = weston_view_create(surface);
 	if (!shsurf->view) {
 		weston_log("no memory to allocate shell surface\n");
-		free(shsurf);
+		shell_slab_free(&mshell->shsurf_slab, shsurf);
 		return NULL;
 	}
 
@@ -3037,8 +5625,11 @@ create_common_surface(struct shell_client *owner, void *shell,
 	wl_resource_add_destroy_listener(surface->resource,
 					 &shsurf->resource_destroy_listener);
 	shsurf->owner = owner;
+	wl_list_init(&shsurf->owner_link);
+	if (owner)
+		shell_client_add_surface(owner, shsurf);
 
-	shsurf->shell = (struct mayhem_shell *) shell;
+	shsurf->shell = mshell;
 	shsurf->unresponsive = 0;
 	shsurf->saved_position_valid = false;
 	shsurf->saved_size_valid = false;
@@ -3047,8 +5638,11 @@ create_common_surface(struct shell_client *owner, void *shell,
 	shsurf->fullscreen.type = WL_SHELL_SURFACE_FULLSCREEN_METHOD_DEFAULT;
 	shsurf->fullscreen.framerate = 0;
 	wl_list_init(&shsurf->fullscreen.transform.link);
+	wl_list_init(&shsurf->fullscreen.black_transform.link);
+	wl_list_init(&shsurf->xdg.configure_link);
 
 	shsurf->output = get_default_output(shsurf->shell->compositor);
+	shsurf->rules.workspace = -1;
 
 	wl_signal_init(&shsurf->destroy_signal);
 	shsurf->surface_destroy_listener.notify = shell_handle_surface_destroy;
@@ -3065,6 +5659,11 @@ create_common_surface(struct shell_client *owner, void *shell,
 
 	wl_list_init(&shsurf->workspace_transform.link);
 
+	shell_anim_init(&shsurf->effect.anim, &shsurf->shell->timeline,
+			&shsurf->shell->anim_config[SHELL_ANIM_WINDOW],
+			shell_surface_effect_frame, shell_surface_effect_done);
+	wl_list_init(&shsurf->effect.transform.link);
+
 	wl_list_init(&shsurf->children_link);
 	wl_list_init(&shsurf->children_list);
 	shsurf->parent = NULL;
@@ -3136,17 +5735,163 @@ static const struct wl_shell_interface shell_implementation = {
 /****************************
  * xdg-shell implementation */
 
+/* Configures are not sent straight away. Whatever changes between two
+ * frames - a state request, the focus moving, a resize grab following
+ * the pointer - is collected and goes out as one configure sequence when
+ * the next frame is done, see shell_xdg_flush_configures(). */
 static void
-xdg_surface_destroy(struct wl_client *client,
-		    struct wl_resource *resource)
+xdg_surface_flush_configure(struct shell_surface *shsurf)
+{
+	struct wl_array states;
+	uint32_t *s, serial;
+
+	if (!shsurf->xdg.resource || !shsurf->resource)
+		return;
+
+	/* A client that doesn't keep up with its configures only gets the
+	 * latest one, once it has caught up. */
+	if (shsurf->owner && shsurf->usage.configures_pending > 0 &&
+	    shell_client_over_soft_limit(shsurf->owner,
+					 CLIENT_LIMIT_CONFIGURE_BACKLOG)) {
+		shsurf->usage.configure_deferred = true;
+		return;
+	}
+
+	if (shell_surface_is_xdg_popup(shsurf)) {
+		xdg_popup_send_configure(shsurf->resource,
+					 shsurf->popup.x, shsurf->popup.y,
+					 shsurf->popup.width,
+					 shsurf->popup.height);
+	} else {
+		wl_array_init(&states);
+		if (shsurf->requested_state.fullscreen) {
+			s = wl_array_add(&states, sizeof *s);
+			*s = XDG_TOPLEVEL_STATE_FULLSCREEN;
+		} else if (shsurf->requested_state.maximized) {
+			s = wl_array_add(&states, sizeof *s);
+			*s = XDG_TOPLEVEL_STATE_MAXIMIZED;
+		}
+		if (shsurf->resize_edges != 0) {
+			s = wl_array_add(&states, sizeof *s);
+			*s = XDG_TOPLEVEL_STATE_RESIZING;
+		}
+		if (shsurf->focus_count > 0) {
+			s = wl_array_add(&states, sizeof *s);
+			*s = XDG_TOPLEVEL_STATE_ACTIVATED;
+		}
+
+		xdg_toplevel_send_configure(shsurf->resource,
+					    shsurf->xdg.width,
+					    shsurf->xdg.height, &states);
+		wl_array_release(&states);
+	}
+
+	serial = wl_display_next_serial(shsurf->surface->compositor->wl_display);
+	xdg_surface_send_configure(shsurf->xdg.resource, serial);
+	shell_client_account_configure(shsurf, serial);
+
+	shsurf->xdg.serial = serial;
+	if (shsurf->state_requested) {
+		shsurf->xdg.state_serial = serial;
+		shsurf->xdg.state_sent = true;
+	}
+}
+
+/* Sends the configures collected since the last frame. Called when an
+ * output has finished a frame, or from a timer when none repaints. */
+static void shell_xdg_flush_configures(struct mayhem_shell *shell)
+{
+	struct wl_list *list = &shell->configures.list;
+	struct shell_surface *shsurf;
+
+	if (wl_list_empty(list))
+		return;
+
+	wl_event_source_timer_update(shell->configures.timer, 0);
+
+	while (!wl_list_empty(list)) {
+		shsurf = container_of(list->next, struct shell_surface,
+				      xdg.configure_link);
+		wl_list_remove(&shsurf->xdg.configure_link);
+		wl_list_init(&shsurf->xdg.configure_link);
+		xdg_surface_flush_configure(shsurf);
+	}
+}
+
+static int xdg_configure_timeout(void *data)
+{
+	shell_xdg_flush_configures(data);
+
+	return 0;
+}
+
+static void
+xdg_surface_schedule_configure(struct shell_surface *shsurf)
+{
+	struct mayhem_shell *shell = shsurf->shell;
+
+	/* the initial commit sends whatever piled up before it */
+	if (!wl_list_empty(&shsurf->xdg.configure_link) ||
+	    !shsurf->xdg.committed)
+		return;
+
+	if (wl_list_empty(&shell->configures.list))
+		wl_event_source_timer_update(shell->configures.timer,
+					     XDG_CONFIGURE_TIMEOUT);
+	wl_list_insert(shell->configures.list.prev,
+		       &shsurf->xdg.configure_link);
+}
+
+/* Called for every commit before anything else looks at it. Returns
+ * whether the commit is for a surface that is configured and has a
+ * buffer, rather than a step in setting one up. */
+static bool
+xdg_surface_commit(struct shell_surface *shsurf)
+{
+	if (!shsurf->xdg.has_role) {
+		wl_resource_post_error(shsurf->xdg.resource,
+				       XDG_SURFACE_ERROR_NOT_CONSTRUCTED,
+				       "xdg_surface committed without a role");
+		return false;
+	}
+
+	if (shsurf->surface->width == 0) {
+		/* A null buffer unmaps, and the client starts over with
+		 * another initial commit. */
+		if (shsurf->xdg.has_buffer) {
+			shsurf->xdg.has_buffer = false;
+			shsurf->xdg.committed = false;
+			shsurf->xdg.acked = false;
+		} else if (!shsurf->xdg.committed) {
+			shsurf->xdg.committed = true;
+			xdg_surface_schedule_configure(shsurf);
+		}
+		return false;
+	}
+
+	if (!shsurf->xdg.acked) {
+		wl_resource_post_error(shsurf->xdg.resource,
+				       XDG_SURFACE_ERROR_UNCONFIGURED_BUFFER,
+				       "buffer committed before the first "
+				       "configure was acked");
+		return false;
+	}
+
+	shsurf->xdg.has_buffer = true;
+	return true;
+}
+
+static void
+xdg_toplevel_destroy(struct wl_client *client,
+		     struct wl_resource *resource)
 {
 	wl_resource_destroy(resource);
 }
 
 static void
-xdg_surface_set_parent(struct wl_client *client,
-		       struct wl_resource *resource,
-		       struct wl_resource *parent_resource)
+xdg_toplevel_set_parent(struct wl_client *client,
+			struct wl_resource *resource,
+			struct wl_resource *parent_resource)
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 	struct shell_surface *parent;
@@ -3160,470 +5905,768 @@ xdg_surface_set_parent(struct wl_client *client,
 }
 
 static void
-xdg_surface_set_app_id(struct wl_client *client,
-		       struct wl_resource *resource,
-		       const char *app_id)
+xdg_toplevel_set_title(struct wl_client *client,
+		       struct wl_resource *resource, const char *title)
+{
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+
+	set_title(shsurf, title);
+}
+
+static void
+xdg_toplevel_set_app_id(struct wl_client *client,
+			struct wl_resource *resource,
+			const char *app_id)
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 
 	free(shsurf->class);
 	shsurf->class = strdup(app_id);
 	shsurf->surface->timeline.force_refresh = 1;
+
+	if (shsurf->window)
+		shell_window_set_app_id(shsurf->window, app_id);
+
+	shell_surface_match_rules(shsurf);
 }
 
 static void
-xdg_surface_show_window_menu(struct wl_client *client,
-			     struct wl_resource *surface_resource,
-			     struct wl_resource *seat_resource,
-			     uint32_t serial,
-			     int32_t x,
-			     int32_t y)
+xdg_toplevel_show_window_menu(struct wl_client *client,
+			      struct wl_resource *resource,
+			      struct wl_resource *seat_resource,
+			      uint32_t serial,
+			      int32_t x,
+			      int32_t y)
 {
 	/* TODO */
 }
 
 static void
-xdg_surface_set_title(struct wl_client *client,
-			struct wl_resource *resource, const char *title)
+xdg_toplevel_move(struct wl_client *client, struct wl_resource *resource,
+		  struct wl_resource *seat_resource, uint32_t serial)
 {
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
-
-	set_title(shsurf, title);
+	common_surface_move(resource, seat_resource, serial);
 }
 
 static void
-xdg_surface_move(struct wl_client *client, struct wl_resource *resource,
-		 struct wl_resource *seat_resource, uint32_t serial)
+xdg_toplevel_resize(struct wl_client *client, struct wl_resource *resource,
+		    struct wl_resource *seat_resource, uint32_t serial,
+		    uint32_t edges)
 {
-	common_surface_move(resource, seat_resource, serial);
+	common_surface_resize(resource, seat_resource, serial, edges);
 }
 
 static void
-xdg_surface_resize(struct wl_client *client, struct wl_resource *resource,
-		   struct wl_resource *seat_resource, uint32_t serial,
-		   uint32_t edges)
+xdg_toplevel_set_max_size(struct wl_client *client,
+			  struct wl_resource *resource,
+			  int32_t width, int32_t height)
 {
-	common_surface_resize(resource, seat_resource, serial, edges);
+	/* resizing is not limited, the client draws what fits */
 }
 
 static void
-xdg_surface_ack_configure(struct wl_client *client,
+xdg_toplevel_set_min_size(struct wl_client *client,
 			  struct wl_resource *resource,
-			  uint32_t serial)
+			  int32_t width, int32_t height)
+{
+}
+
+static void
+xdg_toplevel_set_maximized(struct wl_client *client,
+			   struct wl_resource *resource)
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct weston_output *output;
 
-	if (shsurf->state_requested) {
-		shsurf->next_state = shsurf->requested_state;
-		shsurf->state_changed = true;
-		shsurf->state_requested = false;
-	}
+	shsurf->state_requested = true;
+	shsurf->requested_state.maximized = true;
+
+	if (!weston_surface_is_mapped(shsurf->surface))
+		output = get_focused_output(shsurf->surface->compositor);
+	else
+		output = shsurf->surface->output;
+
+	shell_surface_set_output(shsurf, output);
+	send_configure_for_surface(shsurf);
 }
 
 static void
-xdg_surface_set_window_geometry(struct wl_client *client,
-				struct wl_resource *resource,
-				int32_t x,
-				int32_t y,
-				int32_t width,
-				int32_t height)
+xdg_toplevel_unset_maximized(struct wl_client *client,
+			     struct wl_resource *resource)
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 
-	set_window_geometry(shsurf, x, y, width, height);
+	shsurf->state_requested = true;
+	shsurf->requested_state.maximized = false;
+	send_configure_for_surface(shsurf);
 }
 
 static void
-xdg_surface_set_maximized(struct wl_client *client,
-			  struct wl_resource *resource)
+xdg_toplevel_set_fullscreen(struct wl_client *client,
+			    struct wl_resource *resource,
+			    struct wl_resource *output_resource)
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 	struct weston_output *output;
 
 	shsurf->state_requested = true;
-	shsurf->requested_state.maximized = true;
+	shsurf->requested_state.fullscreen = true;
 
-	if (!weston_surface_is_mapped(shsurf->surface))
-		output = get_focused_output(shsurf->surface->compositor);
+	if (output_resource)
+		output = wl_resource_get_user_data(output_resource);
 	else
-		output = shsurf->surface->output;
+		output = NULL;
+
+	/* handle clients launching in fullscreen */
+	if (output == NULL && !weston_surface_is_mapped(shsurf->surface)) {
+		/* Set the output to the one that has focus currently. */
+		assert(shsurf->surface);
+		output = get_focused_output(shsurf->surface->compositor);
+	}
 
 	shell_surface_set_output(shsurf, output);
- 	send_configure_for_surface(shsurf);
+	shsurf->fullscreen_output = shsurf->output;
+
+	send_configure_for_surface(shsurf);
+}
+
+static void
+xdg_toplevel_unset_fullscreen(struct wl_client *client,
+			      struct wl_resource *resource)
+{
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+
+	shsurf->state_requested = true;
+	shsurf->requested_state.fullscreen = false;
+	send_configure_for_surface(shsurf);
+}
+
+static void
+xdg_toplevel_set_minimized(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+
+	if (shsurf->type != SHELL_SURFACE_TOPLEVEL)
+		return;
+
+	 /* apply compositor's own minimization logic (hide) */
+	set_minimized(shsurf->surface);
+}
+
+static const struct xdg_toplevel_interface xdg_toplevel_implementation = {
+	xdg_toplevel_destroy,
+	xdg_toplevel_set_parent,
+	xdg_toplevel_set_title,
+	xdg_toplevel_set_app_id,
+	xdg_toplevel_show_window_menu,
+	xdg_toplevel_move,
+	xdg_toplevel_resize,
+	xdg_toplevel_set_max_size,
+	xdg_toplevel_set_min_size,
+	xdg_toplevel_set_maximized,
+	xdg_toplevel_unset_maximized,
+	xdg_toplevel_set_fullscreen,
+	xdg_toplevel_unset_fullscreen,
+	xdg_toplevel_set_minimized,
+};
+
+static void xdg_send_configure(struct weston_surface *surface, int32_t width,
+			       int32_t height)
+{
+	struct shell_surface *shsurf = get_shell_surface(surface);
+
+	assert(shsurf);
+
+	shsurf->xdg.width = width;
+	shsurf->xdg.height = height;
+
+	/* a request that is still to go out is not acked by an earlier
+	 * configure */
+	if (shsurf->state_requested)
+		shsurf->xdg.state_sent = false;
+
+	xdg_surface_schedule_configure(shsurf);
+}
+
+static const struct weston_shell_client xdg_client = {
+	xdg_send_configure,
+	NULL
+};
+
+static bool shell_surface_is_xdg_toplevel(struct shell_surface *shsurf)
+{
+	return shsurf->resource &&
+		wl_resource_instance_of(shsurf->resource,
+					&xdg_toplevel_interface,
+					&xdg_toplevel_implementation);
+}
+
+/* xdg-popup implementation */
+
+static void xdg_popup_destroy(struct wl_client *client,
+			      struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void xdg_popup_grab(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *seat_resource,
+			   uint32_t serial)
+{
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
+
+	if (weston_surface_is_mapped(shsurf->surface)) {
+		wl_resource_post_error(resource, XDG_POPUP_ERROR_INVALID_GRAB,
+				       "xdg_popup already mapped");
+		return;
+	}
+
+	/* taken when it maps, see shell_map_popup() */
+	shsurf->popup.shseat = seat ? get_shell_seat(seat) : NULL;
+	shsurf->popup.serial = serial;
+}
+
+static const struct xdg_popup_interface xdg_popup_implementation = {
+	xdg_popup_destroy,
+	xdg_popup_grab,
+};
+
+static void
+xdg_popup_send_configure_cb(struct weston_surface *surface,
+			    int32_t width, int32_t height)
+{
+}
+
+static const struct weston_shell_client xdg_popup_client = {
+	xdg_popup_send_configure_cb,
+	NULL
+};
+
+/* Where the window geometry of a popup's parent is on screen, and the
+ * output it is on. A popup that has not mapped yet is not on screen, but
+ * it does have its solved position already, so a chain of them is
+ * followed up to the first mapped surface: a whole cascade of submenus
+ * is placed and configured at once, without waiting for each level to
+ * map before the next one can be worked out. */
+static struct weston_output *
+xdg_popup_parent_origin(struct shell_surface *parent, int32_t *x, int32_t *y)
+{
+	struct shell_surface *grandparent = NULL;
+	struct weston_output *output;
+	float gx, gy;
+
+	if (weston_surface_is_mapped(parent->surface)) {
+		weston_view_to_global_float(parent->view,
+					    parent->geometry.x,
+					    parent->geometry.y, &gx, &gy);
+		*x = gx;
+		*y = gy;
+		return parent->view->output ? parent->view->output :
+			parent->output;
+	}
+
+	if (parent->parent)
+		grandparent = get_shell_surface(parent->parent);
+
+	if (shell_surface_is_xdg_popup(parent) && grandparent) {
+		output = xdg_popup_parent_origin(grandparent, x, y);
+		*x += parent->popup.x;
+		*y += parent->popup.y;
+		return output;
+	}
+
+	*x = parent->output ? parent->output->x : 0;
+	*y = parent->output ? parent->output->y : 0;
+	return parent->output;
+}
+
+static void
+xdg_popup_place(struct shell_surface *shsurf, struct shell_surface *parent,
+		const struct shell_positioner *positioner)
+{
+	struct weston_output *output;
+	struct shell_positioner_box box;
+	pixman_box32_t bounds = {
+		INT32_MIN / 2, INT32_MIN / 2, INT32_MAX / 2, INT32_MAX / 2
+	};
+	int32_t x, y;
+
+	output = xdg_popup_parent_origin(parent, &x, &y);
+	if (output) {
+		bounds.x1 = output->x;
+		bounds.y1 = output->y;
+		bounds.x2 = output->x + output->width;
+		bounds.y2 = output->y + output->height;
+	}
+
+	shell_positioner_place(positioner, x, y, &bounds, &box);
+
+	shsurf->popup.x = box.x;
+	shsurf->popup.y = box.y;
+	shsurf->popup.width = box.width;
+	shsurf->popup.height = box.height;
+}
+
+static bool shell_surface_is_xdg_popup(struct shell_surface *shsurf)
+{
+	return (shsurf->resource &&
+		wl_resource_instance_of(shsurf->resource,
+					&xdg_popup_interface,
+					&xdg_popup_implementation));
+}
+
+/* xdg-positioner implementation */
+
+static void
+xdg_positioner_destroy(struct wl_client *client,
+		       struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+xdg_positioner_destroy_resource(struct wl_resource *resource)
+{
+	free(wl_resource_get_user_data(resource));
+}
+
+static void
+xdg_positioner_set_size(struct wl_client *client,
+			struct wl_resource *resource,
+			int32_t width, int32_t height)
+{
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
+
+	if (width < 1 || height < 1) {
+		wl_resource_post_error(resource,
+				       XDG_POSITIONER_ERROR_INVALID_INPUT,
+				       "width and height must be positive");
+		return;
+	}
+
+	positioner->width = width;
+	positioner->height = height;
+}
+
+static void
+xdg_positioner_set_anchor_rect(struct wl_client *client,
+			       struct wl_resource *resource,
+			       int32_t x, int32_t y,
+			       int32_t width, int32_t height)
+{
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
+
+	if (width < 1 || height < 1) {
+		wl_resource_post_error(resource,
+				       XDG_POSITIONER_ERROR_INVALID_INPUT,
+				       "width and height must be positive");
+		return;
+	}
+
+	positioner->anchor_rect.x = x;
+	positioner->anchor_rect.y = y;
+	positioner->anchor_rect.width = width;
+	positioner->anchor_rect.height = height;
+}
+
+/* xdg_positioner.anchor and .gravity share their values */
+static int
+xdg_positioner_edges(uint32_t value)
+{
+	switch (value) {
+	case XDG_POSITIONER_ANCHOR_NONE:
+		return 0;
+	case XDG_POSITIONER_ANCHOR_TOP:
+		return SHELL_POSITIONER_EDGE_TOP;
+	case XDG_POSITIONER_ANCHOR_BOTTOM:
+		return SHELL_POSITIONER_EDGE_BOTTOM;
+	case XDG_POSITIONER_ANCHOR_LEFT:
+		return SHELL_POSITIONER_EDGE_LEFT;
+	case XDG_POSITIONER_ANCHOR_RIGHT:
+		return SHELL_POSITIONER_EDGE_RIGHT;
+	case XDG_POSITIONER_ANCHOR_TOP_LEFT:
+		return SHELL_POSITIONER_EDGE_TOP | SHELL_POSITIONER_EDGE_LEFT;
+	case XDG_POSITIONER_ANCHOR_BOTTOM_LEFT:
+		return SHELL_POSITIONER_EDGE_BOTTOM |
+			SHELL_POSITIONER_EDGE_LEFT;
+	case XDG_POSITIONER_ANCHOR_TOP_RIGHT:
+		return SHELL_POSITIONER_EDGE_TOP | SHELL_POSITIONER_EDGE_RIGHT;
+	case XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT:
+		return SHELL_POSITIONER_EDGE_BOTTOM |
+			SHELL_POSITIONER_EDGE_RIGHT;
+	default:
+		return -1;
+	}
 }
 
 static void
-xdg_surface_unset_maximized(struct wl_client *client,
-			    struct wl_resource *resource)
+xdg_positioner_set_anchor(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t anchor)
 {
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
+	int edges = xdg_positioner_edges(anchor);
 
-	shsurf->state_requested = true;
-	shsurf->requested_state.maximized = false;
-	send_configure_for_surface(shsurf);
+	if (edges < 0) {
+		wl_resource_post_error(resource,
+				       XDG_POSITIONER_ERROR_INVALID_INPUT,
+				       "invalid anchor %u", anchor);
+		return;
+	}
+
+	positioner->anchor = edges;
 }
 
-static void xdg_surface_set_fullscreen(struct wl_client *client,
-				       struct wl_resource *resource,
-				       struct wl_resource *output_resource)
+static void
+xdg_positioner_set_gravity(struct wl_client *client,
+			   struct wl_resource *resource, uint32_t gravity)
 {
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
-	struct weston_output *output;
-
-	shsurf->state_requested = true;
-	shsurf->requested_state.fullscreen = true;
-
-	if (output_resource)
-		output = wl_resource_get_user_data(output_resource);
-	else
-		output = NULL;
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
+	int edges = xdg_positioner_edges(gravity);
 
-	/* handle clients launching in fullscreen */
-	if (output == NULL && !weston_surface_is_mapped(shsurf->surface)) {
-		/* Set the output to the one that has focus currently. */
-		assert(shsurf->surface);
-		output = get_focused_output(shsurf->surface->compositor);
+	if (edges < 0) {
+		wl_resource_post_error(resource,
+				       XDG_POSITIONER_ERROR_INVALID_INPUT,
+				       "invalid gravity %u", gravity);
+		return;
 	}
 
-	shell_surface_set_output(shsurf, output);
-	shsurf->fullscreen_output = shsurf->output;
-
-	send_configure_for_surface(shsurf);
+	positioner->gravity = edges;
 }
 
 static void
-xdg_surface_unset_fullscreen(struct wl_client *client,
-			     struct wl_resource *resource)
+xdg_positioner_set_constraint_adjustment(struct wl_client *client,
+					 struct wl_resource *resource,
+					 uint32_t constraint_adjustment)
 {
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
 
-	shsurf->state_requested = true;
-	shsurf->requested_state.fullscreen = false;
-	send_configure_for_surface(shsurf);
+	positioner->adjustment = constraint_adjustment;
 }
 
-static void xdg_surface_set_minimized(struct wl_client *client,
-				      struct wl_resource *resource)
+static void
+xdg_positioner_set_offset(struct wl_client *client,
+			  struct wl_resource *resource,
+			  int32_t x, int32_t y)
 {
-	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
-
-	if (shsurf->type != SHELL_SURFACE_TOPLEVEL)
-		return;
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(resource);
 
-	 /* apply compositor's own minimization logic (hide) */
-	set_minimized(shsurf->surface);
+	positioner->offset_x = x;
+	positioner->offset_y = y;
 }
 
-static const struct xdg_surface_interface xdg_surface_implementation = {
-	xdg_surface_destroy,
-	xdg_surface_set_parent,
-	xdg_surface_set_title,
-	xdg_surface_set_app_id,
-	xdg_surface_show_window_menu,
-	xdg_surface_move,
-	xdg_surface_resize,
-	xdg_surface_ack_configure,
-	xdg_surface_set_window_geometry,
-	xdg_surface_set_maximized,
-	xdg_surface_unset_maximized,
-	xdg_surface_set_fullscreen,
-	xdg_surface_unset_fullscreen,
-	xdg_surface_set_minimized,
+static const struct xdg_positioner_interface xdg_positioner_implementation = {
+	xdg_positioner_destroy,
+	xdg_positioner_set_size,
+	xdg_positioner_set_anchor_rect,
+	xdg_positioner_set_anchor,
+	xdg_positioner_set_gravity,
+	xdg_positioner_set_constraint_adjustment,
+	xdg_positioner_set_offset,
 };
 
-static void xdg_send_configure(struct weston_surface *surface, int32_t width,
-			       int32_t height)
+/* xdg-surface implementation */
+
+static void
+xdg_surface_destroy(struct wl_client *client,
+		    struct wl_resource *resource)
 {
-	struct shell_surface *shsurf = get_shell_surface(surface);
-	uint32_t *s;
-	struct wl_array states;
-	uint32_t serial;
+	wl_resource_destroy(resource);
+}
 
-	assert(shsurf);
+/* The shell surface lives as long as its xdg_surface, so a client can
+ * give the wl_surface a new one later. */
+static void
+xdg_surface_destroy_resource(struct wl_resource *resource)
+{
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct mayhem_shell *shell;
+	struct weston_surface *surface;
 
-	if (!shsurf->resource)
+	/* gone with the wl_surface already */
+	if (shsurf == NULL)
 		return;
 
-	wl_array_init(&states);
-	if (shsurf->requested_state.fullscreen) {
-		s = wl_array_add(&states, sizeof *s);
-		*s = XDG_SURFACE_STATE_FULLSCREEN;
-	} else if (shsurf->requested_state.maximized) {
-		s = wl_array_add(&states, sizeof *s);
-		*s = XDG_SURFACE_STATE_MAXIMIZED;
-	}
-	if (shsurf->resize_edges != 0) {
-		s = wl_array_add(&states, sizeof *s);
-		*s = XDG_SURFACE_STATE_RESIZING;
-	}
-	if (shsurf->focus_count > 0) {
-		s = wl_array_add(&states, sizeof *s);
-		*s = XDG_SURFACE_STATE_ACTIVATED;
-	}
-
-	serial = wl_display_next_serial(shsurf->surface->compositor->wl_display);
-	xdg_surface_send_configure(shsurf->resource, width, height, &states, serial);
+	shsurf->xdg.resource = NULL;
+	if (shell_surface_close_animated(shsurf))
+		return;
 
-	wl_array_release(&states);
-}
+	shell = shsurf->shell;
+	surface = shsurf->surface;
 
-static const struct weston_shell_client xdg_client = {
-	xdg_send_configure,
-	NULL
-};
+	wl_list_remove(&shsurf->resource_destroy_listener.link);
+	if (shsurf->resource)
+		wl_resource_destroy(shsurf->resource);
+	destroy_shell_surface(shsurf);
 
-static void
-xdg_shell_destroy(struct wl_client *client,
-		  struct wl_resource *resource)
-{
-	wl_resource_destroy(resource);
+	surface_focus_states_lost(shell, surface);
 }
 
 static void
-xdg_use_unstable_version(struct wl_client *client,
+xdg_surface_get_toplevel(struct wl_client *client,
 			 struct wl_resource *resource,
-			 int32_t version)
+			 uint32_t id)
 {
-	if (version > 1) {
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+
+	if (shsurf->xdg.has_role) {
 		wl_resource_post_error(resource,
-				       1,
-				       "xdg-shell:: version not implemented yet.");
+				       XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED,
+				       "xdg_surface already has a role");
 		return;
 	}
-}
 
-static struct shell_surface *
-create_xdg_surface(struct shell_client *owner, void *shell,
-		   struct weston_surface *surface,
-		   const struct weston_shell_client *client)
-{
-	struct shell_surface *shsurf;
-
-	shsurf = create_common_surface(owner, shell, surface, client);
-	if (!shsurf)
-		return NULL;
+	shsurf->resource = wl_resource_create(client, &xdg_toplevel_interface,
+					      1, id);
+	if (!shsurf->resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(shsurf->resource,
+				       &xdg_toplevel_implementation,
+				       shsurf, shell_destroy_shell_surface);
 
+	shsurf->xdg.has_role = true;
 	set_type(shsurf, SHELL_SURFACE_TOPLEVEL);
-
-	return shsurf;
 }
 
 static void
-xdg_get_xdg_surface(struct wl_client *client,
-		    struct wl_resource *resource,
-		    uint32_t id,
-		    struct wl_resource *surface_resource)
+xdg_surface_get_popup(struct wl_client *client,
+		      struct wl_resource *resource,
+		      uint32_t id,
+		      struct wl_resource *parent_resource,
+		      struct wl_resource *positioner_resource)
 {
-	struct weston_surface *surface =
-		wl_resource_get_user_data(surface_resource);
-	struct shell_client *sc = wl_resource_get_user_data(resource);
-	struct mayhem_shell *shell = sc->shell;
-	struct shell_surface *shsurf;
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+	struct shell_positioner *positioner =
+		wl_resource_get_user_data(positioner_resource);
+	struct shell_surface *parent;
 
-	shsurf = get_shell_surface(surface);
-	if (shsurf && shell_surface_is_xdg_surface(shsurf)) {
-		wl_resource_post_error(resource, XDG_SHELL_ERROR_ROLE,
-				       "This wl_surface is already an "
-				       "xdg_surface");
+	if (shsurf->xdg.has_role) {
+		wl_resource_post_error(resource,
+				       XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED,
+				       "xdg_surface already has a role");
 		return;
 	}
 
-	if (weston_surface_set_role(surface, "xdg_surface",
-				    resource, XDG_SHELL_ERROR_ROLE) < 0)
+	/* there is no other protocol to give it one later */
+	parent = parent_resource ?
+		wl_resource_get_user_data(parent_resource) : NULL;
+	if (parent == NULL || !parent->xdg.has_role) {
+		wl_resource_post_error(shsurf->owner->resource,
+				       XDG_WM_BASE_ERROR_INVALID_POPUP_PARENT,
+				       "xdg_popup needs an xdg_toplevel or "
+				       "xdg_popup parent");
 		return;
+	}
 
-	shsurf = create_xdg_surface(sc, shell, surface, &xdg_client);
-	if (!shsurf) {
-		wl_resource_post_no_memory(surface_resource);
+	if (positioner->width == 0 || positioner->anchor_rect.width == 0) {
+		wl_resource_post_error(shsurf->owner->resource,
+				       XDG_WM_BASE_ERROR_INVALID_POSITIONER,
+				       "xdg_positioner has no size or no "
+				       "anchor rectangle");
 		return;
 	}
 
-	shsurf->resource =
-		wl_resource_create(client,
-				   &xdg_surface_interface, 1, id);
+	shsurf->resource = wl_resource_create(client, &xdg_popup_interface,
+					      1, id);
 	if (!shsurf->resource) {
-		wl_resource_post_no_memory(surface_resource);
+		wl_client_post_no_memory(client);
 		return;
 	}
 	wl_resource_set_implementation(shsurf->resource,
-				       &xdg_surface_implementation,
+				       &xdg_popup_implementation,
 				       shsurf, shell_destroy_shell_surface);
+
+	shsurf->xdg.has_role = true;
+	shsurf->client = &xdg_popup_client;
+	set_type(shsurf, SHELL_SURFACE_POPUP);
+	shell_surface_set_parent(shsurf, parent->surface);
+	xdg_popup_place(shsurf, parent, positioner);
 }
 
-static bool shell_surface_is_xdg_surface(struct shell_surface *shsurf)
+static void
+xdg_surface_set_window_geometry(struct wl_client *client,
+				struct wl_resource *resource,
+				int32_t x,
+				int32_t y,
+				int32_t width,
+				int32_t height)
 {
-	return shsurf->resource &&
-		wl_resource_instance_of(shsurf->resource,
-					&xdg_surface_interface,
-					&xdg_surface_implementation);
-}
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 
-/* xdg-popup implementation */
+	if (!shsurf->xdg.has_role) {
+		wl_resource_post_error(resource,
+				       XDG_SURFACE_ERROR_NOT_CONSTRUCTED,
+				       "xdg_surface has no role yet");
+		return;
+	}
 
-static void xdg_popup_destroy(struct wl_client *client,
-			      struct wl_resource *resource)
-{
-	wl_resource_destroy(resource);
-}
+	if (width < 1 || height < 1) {
+		wl_resource_post_error(shsurf->owner->resource,
+				       XDG_WM_BASE_ERROR_INVALID_SURFACE_STATE,
+				       "window geometry must not be empty");
+		return;
+	}
 
-static const struct xdg_popup_interface xdg_popup_implementation = {
-	xdg_popup_destroy,
-};
+	set_window_geometry(shsurf, x, y, width, height);
+}
 
 static void
-xdg_popup_send_configure(struct weston_surface *surface,
-			 int32_t width, int32_t height)
+xdg_surface_ack_configure(struct wl_client *client,
+			  struct wl_resource *resource,
+			  uint32_t serial)
 {
+	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
+
+	/* nothing was sent with that serial yet */
+	if (!shsurf->xdg.committed ||
+	    (int32_t) (serial - shsurf->xdg.serial) > 0)
+		return;
+
+	shsurf->xdg.acked = true;
+
+	/* only the configure that carried the requested state, or a later
+	 * one, commits to it */
+	if (shsurf->state_requested && shsurf->xdg.state_sent &&
+	    (int32_t) (serial - shsurf->xdg.state_serial) >= 0) {
+		shsurf->next_state = shsurf->requested_state;
+		shsurf->state_changed = true;
+		shsurf->state_requested = false;
+		shsurf->xdg.state_sent = false;
+	}
+
+	shell_client_account_ack(shsurf, serial);
+
+	if (shsurf->usage.configure_deferred &&
+	    shsurf->usage.configures_pending == 0) {
+		shsurf->usage.configure_deferred = false;
+		xdg_surface_schedule_configure(shsurf);
+	}
 }
 
-static const struct weston_shell_client xdg_popup_client = {
-	xdg_popup_send_configure,
-	NULL
+static const struct xdg_surface_interface xdg_surface_implementation = {
+	xdg_surface_destroy,
+	xdg_surface_get_toplevel,
+	xdg_surface_get_popup,
+	xdg_surface_set_window_geometry,
+	xdg_surface_ack_configure,
 };
 
-static struct shell_surface *
-create_xdg_popup(struct shell_client *owner, void *shell,
-		 struct weston_surface *surface,
-		 const struct weston_shell_client *client,
-		 struct weston_surface *parent,
-		 struct shell_seat *seat,
-		 uint32_t serial,
-		 int32_t x, int32_t y)
+/* xdg-wm-base implementation */
+
+static void
+xdg_wm_base_destroy(struct wl_client *client,
+		    struct wl_resource *resource)
 {
-	struct shell_surface *shsurf;
+	struct shell_client *sc = wl_resource_get_user_data(resource);
 
+	if (!wl_list_empty(&sc->surface_list)) {
+		wl_resource_post_error(resource,
+				       XDG_WM_BASE_ERROR_DEFUNCT_SURFACES,
+				       "xdg_wm_base destroyed before its "
+				       "surfaces");
+		return;
+	}
 
-	shsurf = create_common_surface(owner, shell, surface, client);
-	if (!shsurf)
-		return NULL;
+	/* the shell_client stays until the client is gone */
+	sc->resource = NULL;
+	wl_resource_destroy(resource);
+}
 
-	set_type(shsurf, SHELL_SURFACE_POPUP);
-	shsurf->popup.shseat = seat;
-	shsurf->popup.serial = serial;
-	shsurf->popup.x = x;
-	shsurf->popup.y = y;
-	shell_surface_set_parent(shsurf, parent);
+static void
+xdg_wm_base_create_positioner(struct wl_client *client,
+			      struct wl_resource *resource,
+			      uint32_t id)
+{
+	struct shell_positioner *positioner;
+	struct wl_resource *positioner_resource;
 
-	return shsurf;
+	positioner = zalloc(sizeof *positioner);
+	if (positioner == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	positioner_resource =
+		wl_resource_create(client, &xdg_positioner_interface,
+				   wl_resource_get_version(resource), id);
+	if (positioner_resource == NULL) {
+		free(positioner);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(positioner_resource,
+				       &xdg_positioner_implementation,
+				       positioner,
+				       xdg_positioner_destroy_resource);
 }
 
 static void
-xdg_get_xdg_popup(struct wl_client *client,
-		  struct wl_resource *resource,
-		  uint32_t id,
-		  struct wl_resource *surface_resource,
-		  struct wl_resource *parent_resource,
-		  struct wl_resource *seat_resource,
-		  uint32_t serial,
-		  int32_t x, int32_t y)
+xdg_wm_base_get_xdg_surface(struct wl_client *client,
+			    struct wl_resource *resource,
+			    uint32_t id,
+			    struct wl_resource *surface_resource)
 {
 	struct weston_surface *surface =
 		wl_resource_get_user_data(surface_resource);
 	struct shell_client *sc = wl_resource_get_user_data(resource);
 	struct mayhem_shell *shell = sc->shell;
 	struct shell_surface *shsurf;
-	struct weston_surface *parent;
-	struct shell_seat *seat;
 
-	shsurf = get_shell_surface(surface);
-	if (shsurf && shell_surface_is_xdg_popup(shsurf)) {
-		wl_resource_post_error(resource, XDG_SHELL_ERROR_ROLE,
+	if (get_shell_surface(surface)) {
+		wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE,
 				       "This wl_surface is already an "
-				       "xdg_popup");
+				       "xdg_surface");
 		return;
 	}
 
-	if (weston_surface_set_role(surface, "xdg_popup",
-				    resource, XDG_SHELL_ERROR_ROLE) < 0)
-		return;
-
-	if (!parent_resource) {
-		wl_resource_post_error(surface_resource,
-				       WL_DISPLAY_ERROR_INVALID_OBJECT,
-				       "xdg_shell::get_xdg_popup requires a parent shell surface");
+	if (weston_surface_set_role(surface, "xdg_surface",
+				    resource, XDG_WM_BASE_ERROR_ROLE) < 0)
 		return;
-	}
 
-	parent = wl_resource_get_user_data(parent_resource);
-	seat = get_shell_seat(wl_resource_get_user_data(seat_resource));
-
-	shsurf = create_xdg_popup(sc, shell, surface, &xdg_popup_client,
-				  parent, seat, serial, x, y);
+	/* toplevel or popup is decided by the role request */
+	shsurf = create_common_surface(sc, shell, surface, &xdg_client);
 	if (!shsurf) {
 		wl_resource_post_no_memory(surface_resource);
 		return;
 	}
 
-	shsurf->resource = wl_resource_create(client, &xdg_popup_interface,
-					      1, id);
-	if (!shsurf->resource) {
+	shsurf->xdg.resource =
+		wl_resource_create(client, &xdg_surface_interface,
+				   wl_resource_get_version(resource), id);
+	if (!shsurf->xdg.resource) {
 		wl_resource_post_no_memory(surface_resource);
 		return;
 	}
-	wl_resource_set_implementation(shsurf->resource,
-				       &xdg_popup_implementation,
-				       shsurf, shell_destroy_shell_surface);
+	wl_resource_set_implementation(shsurf->xdg.resource,
+				       &xdg_surface_implementation,
+				       shsurf, xdg_surface_destroy_resource);
 }
 
-static void xdg_pong(struct wl_client *client, struct wl_resource *resource,
-		     uint32_t serial)
+static void
+xdg_wm_base_pong(struct wl_client *client, struct wl_resource *resource,
+		 uint32_t serial)
 {
 	struct shell_client *sc = wl_resource_get_user_data(resource);
 
 	shell_client_pong(sc, serial);
 }
 
-static bool shell_surface_is_xdg_popup(struct shell_surface *shsurf)
-{
-	return (shsurf->resource &&
-		wl_resource_instance_of(shsurf->resource,
-					&xdg_popup_interface,
-					&xdg_popup_implementation));
-}
-
-static const struct xdg_shell_interface xdg_implementation = {
-	xdg_shell_destroy,
-	xdg_use_unstable_version,
-	xdg_get_xdg_surface,
-	xdg_get_xdg_popup,
-	xdg_pong
-};
-
-static int
-xdg_shell_unversioned_dispatch(const void *implementation,
-			       void *_target, uint32_t opcode,
-			       const struct wl_message *message,
-			       union wl_argument *args)
-{
-	struct wl_resource *resource = _target;
-	struct shell_client *sc = wl_resource_get_user_data(resource);
-
-	if (opcode != 1 /* XDG_SHELL_USE_UNSTABLE_VERSION */) {
-		wl_resource_post_error(resource,
-				       WL_DISPLAY_ERROR_INVALID_OBJECT,
-				       "must call use_unstable_version first");
-		return 0;
-	}
-
-#define XDG_SERVER_VERSION 5
-
-	static_assert(XDG_SERVER_VERSION == XDG_SHELL_VERSION_CURRENT,
-		      "shell implementation doesn't match protocol version");
-
-	if (args[0].i != XDG_SERVER_VERSION) {
-		wl_resource_post_error(resource,
-				       WL_DISPLAY_ERROR_INVALID_OBJECT,
-				       "incompatible version, server is %d "
-				       "client wants %d",
-				       XDG_SERVER_VERSION, args[0].i);
-		return 0;
-	}
-
-	wl_resource_set_implementation(resource, &xdg_implementation,
-				       sc, NULL);
-
-	return 1;
-}
+static const struct xdg_wm_base_interface xdg_implementation = {
+	xdg_wm_base_destroy,
+	xdg_wm_base_create_positioner,
+	xdg_wm_base_get_xdg_surface,
+	xdg_wm_base_pong,
+};
 
 /* end of xdg-shell implementation */
 /***********************************/
@@ -3661,10 +6704,12 @@ static int background_get_label(struct weston_surface *surface, char *buf, size_
 static void background_configure(struct weston_surface *es,
 				 int32_t sx, int32_t sy)
 {
-	printf("server s configuring bg\n");
 	struct mayhem_shell *shell = es->configure_private;
 	struct weston_view *view;
 
+	shell_log(SHELL_LOG_BACKGROUND, SHELL_LOG_DEBUG,
+		  "configuring background %dx%d", es->width, es->height);
+
 	view = container_of(es->views.next, struct weston_view, surface_link);
 
 	configure_static_view(view, &shell->background_layer);
@@ -3697,7 +6742,6 @@ static void ms_setbg(struct wl_client *client,
 		     struct wl_resource *output_resource,
 		     struct wl_resource *surface_resource)
 {
-	printf("server got setbg request\n");
 	struct shell_client *sc = wl_resource_get_user_data(resource);
 	struct mayhem_shell *shell = sc->shell;
 	struct weston_surface *surface =
@@ -3720,6 +6764,9 @@ static void ms_setbg(struct wl_client *client,
 	weston_surface_set_label_func(surface, background_get_label);
 	surface->output = wl_resource_get_user_data(output_resource);
 	view->output = surface->output;
+
+	shell_log(SHELL_LOG_BACKGROUND, SHELL_LOG_DEBUG,
+		  "background set for output %s", surface->output->name);
 }
 
 static void ms_setgrab(struct wl_client *client, struct wl_resource *resource,
@@ -3737,6 +6784,23 @@ static void ms_destroy(struct wl_client *client, struct wl_resource *resource)
 	wl_resource_destroy(resource);
 }
 
+/* Only the menu client we started authenticates the user, anyone else
+ * asking is ignored. */
+static void ms_unlock(struct wl_client *client, struct wl_resource *resource)
+{
+	struct shell_client *sc = wl_resource_get_user_data(resource);
+	struct mayhem_shell *shell = sc->shell;
+
+	if (client != shell->child.client) {
+		shell_log(SHELL_LOG_SHELL, SHELL_LOG_WARNING,
+			  "unlock from a client other than %s refused",
+			  shell->client);
+		return;
+	}
+
+	unlock(shell);
+}
+
 static void ms_getsurf(struct wl_client* client, struct wl_resource *resource,
 		       uint32_t id, struct wl_resource* surface_resource)
 {
@@ -3775,7 +6839,8 @@ static const struct ms_menu_interface ms_menu_implementation = {
 	.destroy = ms_destroy,
 	.set_background = ms_setbg,
 	.set_grab_surface = ms_setgrab,
-	.get_menu_surface = ms_getsurf
+	.get_menu_surface = ms_getsurf,
+	.unlock = ms_unlock
 };
 
 
@@ -3814,6 +6879,27 @@ static void move_binding(struct weston_pointer *pointer, uint32_t time,
 	surface_move(shsurf, pointer, 0);
 }
 
+static void touch_move_binding(struct weston_touch *touch, uint32_t time,
+			       void *data)
+{
+	struct weston_surface *surface;
+	struct shell_surface *shsurf;
+
+	if (touch->focus == NULL)
+		return;
+
+	surface = weston_surface_get_main_surface(touch->focus->surface);
+	if (surface == NULL)
+		return;
+
+	shsurf = get_shell_surface(surface);
+	if (shsurf == NULL || shsurf->state.fullscreen ||
+	    shsurf->state.maximized)
+		return;
+
+	surface_touch_move(shsurf, touch);
+}
+
 static void maximize_binding(struct weston_keyboard *keyboard, uint32_t time,
 			     uint32_t button, void *data)
 {
@@ -3829,7 +6915,7 @@ static void maximize_binding(struct weston_keyboard *keyboard, uint32_t time,
 	if (shsurf == NULL)
 		return;
 
-	if (!shell_surface_is_xdg_surface(shsurf))
+	if (!shell_surface_is_xdg_toplevel(shsurf))
 		return;
 
 	shsurf->state_requested = true;
@@ -3852,7 +6938,7 @@ static void fullscreen_binding(struct weston_keyboard *keyboard, uint32_t time,
 	if(shsurf == NULL)
 		return;
 
-	if(!shell_surface_is_xdg_surface(shsurf))
+	if(!shell_surface_is_xdg_toplevel(shsurf))
 		return;
 
 	shsurf->state_requested = true;
@@ -3936,12 +7022,114 @@ static void surface_opacity_binding(struct weston_pointer *pointer,
 	weston_surface_damage(surface);
 }
 
+static void handle_output_destroy(struct wl_listener *listener, void *data);
+
+static struct shell_output *get_shell_output(struct weston_output *output)
+{
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&output->destroy_signal, handle_output_destroy);
+	if (listener == NULL)
+		return NULL;
+
+	return container_of(listener, struct shell_output, destroy_listener);
+}
+
+/* Returns the output under the seat's pointer. The last hit is cached per
+ * seat so the common case is a single region test instead of a walk over
+ * every output. */
+static struct weston_output *get_pointer_output(struct weston_pointer *pointer)
+{
+	struct shell_seat *shseat = get_shell_seat(pointer->seat);
+	struct weston_output *output = shseat->pointer_output;
+	int x = wl_fixed_to_int(pointer->x);
+	int y = wl_fixed_to_int(pointer->y);
+
+	if (output &&
+	    pixman_region32_contains_point(&output->region, x, y, NULL))
+		return output;
+
+	shseat->pointer_output = NULL;
+	wl_list_for_each(output, &pointer->seat->compositor->output_list, link) {
+		if (pixman_region32_contains_point(&output->region,
+						   x, y, NULL)) {
+			shseat->pointer_output = output;
+			break;
+		}
+	}
+
+	return shseat->pointer_output;
+}
+
+static void zoom_spring_step(struct shell_output *sh_output, double dt)
+{
+	spring_step(&sh_output->zoom.current, &sh_output->zoom.velocity,
+		    sh_output->zoom.target, ZOOM_SPRING_OMEGA, dt);
+}
+
+static void zoom_frame(struct weston_animation *animation,
+		       struct weston_output *output, uint32_t msecs)
+{
+	struct shell_output *sh_output =
+		container_of(animation, struct shell_output, zoom.animation);
+	double dt, time;
+	bool settled;
+
+	/* Fold in everything the input devices sent since the last frame */
+	sh_output->zoom.target += sh_output->zoom.pending;
+	sh_output->zoom.pending = 0.0;
+	if (sh_output->zoom.target < 0.0)
+		sh_output->zoom.target = 0.0;
+	else if (sh_output->zoom.target > output->zoom.max_level)
+		sh_output->zoom.target = output->zoom.max_level;
+
+	time = shell_timeline_frame_time(&sh_output->shell->timeline, output,
+					 msecs);
+	if (sh_output->zoom.timestamp == 0.0)
+		dt = 0.0;
+	else
+		dt = (time - sh_output->zoom.timestamp) / 1000.0;
+	sh_output->zoom.timestamp = time;
+
+	zoom_spring_step(sh_output, dt);
+
+	settled = fabs(sh_output->zoom.current - sh_output->zoom.target) < 0.001 &&
+		  fabs(sh_output->zoom.velocity) < 0.001;
+	if (settled) {
+		sh_output->zoom.current = sh_output->zoom.target;
+		sh_output->zoom.velocity = 0.0;
+		wl_list_remove(&animation->link);
+		wl_list_init(&animation->link);
+	} else {
+		weston_output_schedule_repaint(output);
+	}
+
+	if (!output->zoom.active) {
+		if (sh_output->zoom.current <= 0.0 ||
+		    sh_output->zoom.seat == NULL)
+			return;
+		weston_output_activate_zoom(output, sh_output->zoom.seat);
+	}
+
+	output->zoom.level = sh_output->zoom.current;
+
+	/* The shell already smooths the level, so pin the compositor's own
+	 * spring to it. Once we settle at zero let the compositor run its
+	 * spring out so that it deactivates the zoom itself. */
+	if (!settled || output->zoom.level > 0.0) {
+		output->zoom.spring_z.current = output->zoom.level;
+		output->zoom.spring_z.target = output->zoom.level;
+	}
+
+	weston_output_update_zoom(output);
+}
+
 static void do_zoom(struct weston_seat *seat, uint32_t time, uint32_t key,
 		    uint32_t axis, wl_fixed_t value)
 {
-	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 	struct weston_output *output;
+	struct shell_output *sh_output;
 	float increment;
 
 	if (!pointer) {
@@ -3950,40 +7138,41 @@ static void do_zoom(struct weston_seat *seat, uint32_t time, uint32_t key,
 		return;
 	}
 
-	wl_list_for_each(output, &compositor->output_list, link) {
-		if (pixman_region32_contains_point(&output->region,
-						   wl_fixed_to_double(pointer->x),
-						   wl_fixed_to_double(pointer->y),
-						   NULL)) {
-			if (key == KEY_PAGEUP)
-				increment = output->zoom.increment;
-			else if (key == KEY_PAGEDOWN)
-				increment = -output->zoom.increment;
-			else if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
-				/* For every pixel zoom 20th of a step */
-				increment = output->zoom.increment *
-					    -wl_fixed_to_double(value) / 20.0;
-			else
-				increment = 0;
-
-			output->zoom.level += increment;
+	output = get_pointer_output(pointer);
+	if (!output)
+		return;
 
-			if (output->zoom.level < 0.0)
-				output->zoom.level = 0.0;
-			else if (output->zoom.level > output->zoom.max_level)
-				output->zoom.level = output->zoom.max_level;
+	sh_output = get_shell_output(output);
+	if (!sh_output)
+		return;
 
-			if (!output->zoom.active) {
-				if (output->zoom.level <= 0.0)
-					continue;
-				weston_output_activate_zoom(output, seat);
-			}
+	if (key == KEY_PAGEUP)
+		increment = output->zoom.increment;
+	else if (key == KEY_PAGEDOWN)
+		increment = -output->zoom.increment;
+	else if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+		/* For every pixel zoom 20th of a step */
+		increment = output->zoom.increment *
+			    -wl_fixed_to_double(value) / 20.0;
+	else
+		increment = 0;
 
-			output->zoom.spring_z.target = output->zoom.level;
+	/* Only accumulate here, zoom_frame() applies it once per repaint */
+	sh_output->zoom.pending += increment;
+	sh_output->zoom.seat = seat;
 
-			weston_output_update_zoom(output);
+	if (wl_list_empty(&sh_output->zoom.animation.link)) {
+		if (!output->zoom.active) {
+			sh_output->zoom.current = 0.0;
+			sh_output->zoom.target = 0.0;
+			sh_output->zoom.velocity = 0.0;
 		}
+		sh_output->zoom.timestamp = 0.0;
+		wl_list_insert(&output->animation_list,
+			       &sh_output->zoom.animation.link);
 	}
+
+	weston_output_schedule_repaint(output);
 }
 
 static void
@@ -4008,33 +7197,6 @@ static void terminate_binding(struct weston_keyboard *keyboard, uint32_t time,
 	wl_display_terminate(compositor->wl_display);
 }
 
-static void exec_binding(struct weston_keyboard *keyboard, uint32_t time,
-			 uint32_t key, void *data)
-{
-	/*
-	char *c;
-	pid_t pid;
-
-	pid = fork();
-	if (pid < 0) {
-		weston_log("fork failed: %m\n");
-		return;
-	}
-
-	if (pid)
-		return;
-
-	c = "";
-	if (execvp(data, &c) < 0) {
-		weston_log("execvp '%s' failed: %m\n", (char*)data);
-		exit(1);
-	}*/
-	char *cmd = malloc(strlen(data)+2);
-	strcpy(cmd, data);
-	strcat(cmd, " &");
-	system(cmd);
-}
-
 static void
 rotate_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 		   struct weston_pointer_motion_event *event)
@@ -4116,7 +7278,7 @@ rotate_grab_button(struct weston_pointer_grab *grab,
 			weston_matrix_multiply(&shsurf->rotation.rotation,
 					       &rotate->rotation);
 		shell_grab_end(&rotate->base);
-		free(rotate);
+		shell_grab_free(&rotate->base);
 	}
 }
 
@@ -4127,7 +7289,7 @@ rotate_grab_cancel(struct weston_pointer_grab *grab)
 		container_of(grab, struct rotate_grab, base.grab);
 
 	shell_grab_end(&rotate->base);
-	free(rotate);
+	shell_grab_free(&rotate->base);
 }
 
 static const struct weston_pointer_grab_interface rotate_grab_interface = {
@@ -4147,7 +7309,7 @@ surface_rotate(struct shell_surface *surface, struct weston_pointer *pointer)
 	float dx, dy;
 	float r;
 
-	rotate = malloc(sizeof *rotate);
+	rotate = shell_slab_zalloc(&surface->shell->grab_slab);
 	if (!rotate)
 		return;
 
@@ -4201,79 +7363,171 @@ static void rotate_binding(struct weston_pointer *pointer, uint32_t time,
 	surface_rotate(surface, pointer);
 }
 
-/* Move all fullscreen layers down to the current workspace and hide their
- * black views. The surfaces' state is set to both fullscreen and lowered,
- * and this is reversed when such a surface is re-configured, see
- * shell_configure_fullscreen() and shell_ensure_fullscreen_black_view().
+/* Move the fullscreen windows of an output, or of all outputs, down to
+ * the top of the current workspace, so whatever is activated next goes
+ * above them. A window goes back up when it is activated, see
+ * shell_surface_calculate_layer_link(), or when its workspace is entered
+ * again unless another window was activated over it, see
+ * raise_fullscreen_layer().
  *
  * This should be used when implementing shell-wide overlays, such as
  * the alt-tab switcher, which need to de-promote fullscreen layers. */
-/*
-void lower_fullscreen_layer(struct mayhem_shell *shell)
+void lower_fullscreen_layer(struct mayhem_shell *shell,
+			    struct weston_output *lowering_output)
 {
-	struct workspace *ws;
-	struct weston_view *view, *prev;
-
-	ws = get_current_workspace(shell);
-	wl_list_for_each_reverse_safe(view, prev,
-				      &shell->fullscreen_layer.view_list.link,
-				      layer_link.link) {
-		struct shell_surface *shsurf = get_shell_surface(view->surface);
+	struct workspace *ws = get_current_workspace(shell);
+	struct shell_output *shell_output;
+	struct shell_surface *shsurf;
+	struct weston_layer *layer;
+	struct weston_view *view;
 
-		if (!shsurf)
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		if (lowering_output && shell_output->output != lowering_output)
 			continue;
 
-		* We can have a non-fullscreen popup for a fullscreen surface
-		 * in the fullscreen layer. *
+		/* bottom run first, so they keep their order */
+		layer = &shell_output->fullscreen_layer;
+		while (!wl_list_empty(&layer->view_list.link)) {
+			view = container_of(layer->view_list.link.prev,
+					    struct weston_view, layer_link.link);
+			shsurf = get_black_surface_owner(view->surface);
+			if (shsurf == NULL)
+				shsurf = get_shell_surface(view->surface);
+			if (shsurf)
+				shell_surface_stack_run(shell_surface_get_root(shsurf),
+							&ws->layer.view_list);
+
+			/* not part of a run, it goes on its own */
+			if (view->layer_link.layer == layer) {
+				weston_layer_entry_remove(&view->layer_link);
+				weston_layer_entry_insert(&ws->layer.view_list,
+							  &view->layer_link);
+				weston_view_damage_below(view);
+			}
+		}
+	}
+}
 
-		* Lower the view to the workspace layer *
-		//weston_layer_entry_remove(&view->layer_link);
-		//weston_layer_entry_insert(&ws->layer.view_list, &view->layer_link);
-		weston_view_damage_below(view);
-		weston_surface_damage(view->surface);
+/* The fullscreen windows of the output another window is activated on
+ * stay below it from then on, across workspace changes too, until they
+ * are activated themselves. */
+static void fullscreen_mark_lowered(struct mayhem_shell *shell,
+				    struct shell_surface *active)
+{
+	struct workspace *ws = get_current_workspace(shell);
+	struct shell_surface *shsurf;
+	struct weston_view *view;
 
+	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
+		shsurf = get_shell_surface(view->surface);
+		if (shsurf && shsurf != active && shsurf->state.fullscreen &&
+		    shsurf->fullscreen_output == active->output)
+			shsurf->fullscreen.lowered = true;
 	}
+
+	active->fullscreen.lowered = false;
 }
-*/
 
-void activate(struct mayhem_shell *shell, struct weston_surface *es,
-	 struct weston_seat *seat, bool configure)
+/* Put the fullscreen windows of the workspace just entered back above
+ * it, bottom first so they keep their order. Those lowered by activating
+ * another window stay where they are. A raise takes a run out of
+ * the list being walked, so the walk starts over after each. */
+static void raise_fullscreen_layer(struct mayhem_shell *shell)
+{
+	struct workspace *ws = get_current_workspace(shell);
+	struct shell_surface *shsurf;
+	struct weston_view *view;
+	bool raised;
+
+	do {
+		raised = false;
+		wl_list_for_each_reverse(view, &ws->layer.view_list.link,
+					 layer_link.link) {
+			shsurf = get_shell_surface(view->surface);
+			if (shsurf == NULL || shsurf->parent ||
+			    shsurf->type != SHELL_SURFACE_TOPLEVEL ||
+			    shell_surface_fullscreen_layer(shsurf) == NULL)
+				continue;
+
+			shell_surface_update_layer(shsurf);
+			raised = view->layer_link.layer != &ws->layer;
+			break;
+		}
+	} while (raised);
+}
+
+static void shell_surface_policy_window(struct shell_surface *shsurf,
+					struct shell_policy_window *window)
+{
+	window->id = shsurf->window->id;
+	window->app_id = shsurf->class;
+	window->title = shsurf->title;
+	window->workspace = shsurf->window->workspace;
+	window->x = shsurf->view->geometry.x;
+	window->y = shsurf->view->geometry.y;
+	window->width = shsurf->surface->width;
+	window->height = shsurf->surface->height;
+}
+
+/* activate() for a surface the focus state of the current workspace may
+ * already have been handed, with the focus it had before that. */
+static void
+activate_from(struct mayhem_shell *shell, struct weston_surface *es,
+	      struct weston_seat *seat, struct focus_state *state,
+	      struct weston_surface *old_es, bool configure)
 {
 	struct weston_surface *main_surface;
-	struct focus_state *state;
 	struct workspace *ws;
-	struct weston_surface *old_es;
 	struct shell_surface *shsurf;
-
-	//lower_fullscreen_layer(shell);
+	struct shell_policy_window window;
 
 	main_surface = weston_surface_get_main_surface(es);
 
-	weston_surface_activate(es, seat);
-
-	state = ensure_focus_state(shell, seat);
-	if (state == NULL)
-		return;
+	/* while locked the focus is only remembered, unlock() hands it out */
+	if (!shell->lock.locked)
+		weston_surface_activate(es, seat);
 
-	old_es = state->keyboard_focus;
 	focus_state_set_focus(state, es);
 
 	shsurf = get_shell_surface(main_surface);
 	assert(shsurf);
 
+	/* it goes above the fullscreen windows of its output, or back up
+	 * among them if it is one */
+	lower_fullscreen_layer(shell, shsurf->output);
+	fullscreen_mark_lowered(shell, shell_surface_get_root(shsurf));
+
 	if (shsurf->state.fullscreen && configure)
 		shell_configure_fullscreen(shsurf);
 	else
 		restore_output_mode(shsurf->output);
 
-	/* Update the surface’s layer. This brings it to the top of the stacking
-	 * order as appropriate. */
-	shell_surface_update_layer(shsurf);
+	/* Update the surface’s layer. This brings it, its parents and their
+	 * transients to the top of the stacking order as appropriate. */
+	shell_surface_raise(shsurf);
 
 	if (shell->focus_animation_type != ANIMATION_NONE) {
 		ws = get_current_workspace(shell);
 		animate_focus_change(shell, ws, get_default_view(old_es), get_default_view(es));
 	}
+
+	if (old_es != es && shsurf->window) {
+		shell_surface_policy_window(shsurf, &window);
+		shell_policy_activate(&shell->policy, &window);
+	}
+}
+
+void activate(struct mayhem_shell *shell, struct weston_surface *es,
+	 struct weston_seat *seat, bool configure)
+{
+	struct focus_state *state;
+
+	state = ensure_focus_state(shell, seat);
+	if (state == NULL)
+		return;
+
+	activate_from(shell, es, seat, state, state->keyboard_focus,
+		      configure);
 }
 
 static void activate_binding(struct weston_seat *seat,
@@ -4283,9 +7537,15 @@ static void activate_binding(struct weston_seat *seat,
 	struct focus_state *state;
 	struct weston_surface *focus;
 	struct weston_surface *main_surface;
+	struct shell_surface *owner;
 
 	focus = focus_view->surface;
 
+	/* the black bars around a window stand in for it */
+	owner = get_black_surface_owner(focus);
+	if (owner)
+		focus = owner->surface;
+
 	main_surface = weston_surface_get_main_surface(focus);
 	if (get_shell_surface_type(main_surface) == SHELL_SURFACE_NONE)
 		return;
@@ -4312,11 +7572,30 @@ static void click_to_activate_binding(struct weston_pointer *pointer,
 	activate_binding(pointer->seat, data, pointer->focus);
 }
 
-static void shell_fade_done(struct weston_view_animation *animation, void *data)
+static void touch_to_activate_binding(struct weston_touch *touch,
+				      uint32_t time, void *data)
 {
-	struct mayhem_shell *shell = data;
+	if (touch->grab != &touch->default_grab)
+		return;
+	if (touch->focus == NULL)
+		return;
+
+	activate_binding(touch->seat, data, touch->focus);
+}
+
+static void shell_fade_frame(struct shell_anim *anim, double value)
+{
+	struct mayhem_shell *shell =
+		container_of(anim, struct mayhem_shell, fade.animation);
+
+	shell->fade.view->alpha = value;
+	weston_view_geometry_dirty(shell->fade.view);
+}
 
-	shell->fade.animation = NULL;
+static void shell_fade_done(struct shell_anim *anim)
+{
+	struct mayhem_shell *shell =
+		container_of(anim, struct mayhem_shell, fade.animation);
 
 	switch (shell->fade.type) {
 	case FADE_IN:
@@ -4324,7 +7603,7 @@ static void shell_fade_done(struct weston_view_animation *animation, void *data)
 		shell->fade.view = NULL;
 		break;
 	case FADE_OUT:
-		//lock(shell);
+		lock(shell);
 		break;
 	default:
 		break;
@@ -4389,15 +7668,13 @@ static void shell_fade(struct mayhem_shell *shell, enum fade_type type)
 		 * last output and we'll just cancel the fade.  This
 		 * happens when you close the last window under the
 		 * X11 or Wayland backends. */
+		shell_anim_stop(&shell->fade.animation);
 		weston_surface_destroy(shell->fade.view->surface);
 		shell->fade.view = NULL;
-	} else if (shell->fade.animation) {
-		weston_fade_update(shell->fade.animation, tint);
+	} else if (shell_anim_is_running(&shell->fade.animation)) {
+		shell_anim_retarget(&shell->fade.animation, tint);
 	} else {
-		shell->fade.animation =
-			weston_fade_run(shell->fade.view,
-					1.0 - tint, tint, 300.0,
-					shell_fade_done, shell);
+		shell_anim_start(&shell->fade.animation, 1.0 - tint, tint);
 	}
 }
 
@@ -4499,16 +7776,21 @@ transform_handler(struct wl_listener *listener, void *data)
 {
 	struct weston_surface *surface = data;
 	struct shell_surface *shsurf = get_shell_surface(surface);
-	struct weston_view *view;;
+	struct weston_view *view;
 	int x, y;
 
-	if (!shsurf || !shsurf->client->send_position)
+	if (!shsurf)
 		return;
 
 	view = shsurf->view;
 	if (!view || !weston_view_is_mapped(view))
 		return;
 
+	shell_surface_track_placement(shsurf);
+
+	if (!shsurf->client->send_position)
+		return;
+
 	x = view->geometry.x;
 	y = view->geometry.y;
 
@@ -4530,39 +7812,289 @@ center_on_output(struct weston_view *view, struct weston_output *output)
 	weston_view_set_position(view, x, y);
 }
 
+/* Puts a new window in the middle of the largest free area of the output
+ * the pointer is on, or cascades it from the top left corner when none is
+ * large enough. Menus still open at the pointer. */
 static void weston_view_set_initial_position(struct weston_view *view,
 					     struct mayhem_shell *shell)
 {
 	struct weston_compositor *compositor = shell->compositor;
+	struct shell_surface *shsurf = get_shell_surface(view->surface);
+	struct weston_pointer *pointer = NULL;
+	struct weston_output *output = NULL;
+	struct shell_output *shell_output;
 	struct weston_seat *seat;
+	pixman_box32_t box;
+	int32_t width, height;
 	int x = 0, y = 0;
 
 	wl_list_for_each(seat, &compositor->seat_list, link) {
-		struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+		pointer = weston_seat_get_pointer(seat);
+		if (pointer)
+			break;
+	}
 
+	if (!shell->smart_placement || !shsurf ||
+	    shsurf->type != SHELL_SURFACE_TOPLEVEL) {
 		if (pointer) {
 			x = wl_fixed_to_int(pointer->x);
 			y = wl_fixed_to_int(pointer->y);
-			break;
 		}
+		weston_view_set_position(view, x-20, y-20);
+		return;
 	}
-	weston_view_set_position(view, x-20, y-20);
+
+	if (pointer)
+		output = get_pointer_output(pointer);
+	if (!output)
+		output = get_default_output(compositor);
+	shell_output = get_shell_output(output);
+
+	/* a window coming back from maximized or fullscreen must not
+	 * count its old geometry against itself */
+	shell_surface_untrack_placement(shsurf);
+
+	if (!shell_output->placement.valid)
+		shell_output_rebuild_placement(shell_output, view);
+
+	/* place the window geometry, the view origin is offset from it */
+	shell_surface_placement_box(shsurf, &box);
+	width = box.x2 - box.x1;
+	height = box.y2 - box.y1;
+
+	if (!shell_placement_find(&shell_output->placement, width, height,
+				  &x, &y))
+		shell_placement_cascade(&shell_output->placement,
+					width, height, &x, &y);
+
+	weston_view_set_position(view,
+				 x - (box.x1 - (int32_t) view->geometry.x),
+				 y - (box.y1 - (int32_t) view->geometry.y));
 }
 
 static void set_maximized_position(struct mayhem_shell *shell,
 				   struct shell_surface *shsurf)
 {
-	int32_t surf_x, surf_y;
+	int32_t surf_x, surf_y;
+
+	if (shsurf->has_set_geometry) {
+		surf_x = shsurf->geometry.x;
+		surf_y = shsurf->geometry.y;
+	} else {
+		surface_subsurfaces_boundingbox(shsurf->surface, &surf_x,
+						&surf_y, NULL, NULL);
+	}
+
+	weston_view_set_position(shsurf->view, surf_x, surf_y);
+}
+
+/* A scratchpad is an application launched at startup whose window is
+ * parked in scratchpad_layer. That layer is never part of the compositor's
+ * layer list, so the window is not drawn and its frame callbacks are held
+ * back until the binding moves it onto the current workspace. */
+struct scratchpad {
+	struct mayhem_shell *shell;
+	char *command;
+	uint32_t key;
+	uint32_t serial;	/* launch the window is expected from */
+	struct shell_surface *shsurf;
+	struct wl_listener destroy_listener;
+	struct wl_list link;	/* mayhem_shell::scratchpad_list */
+};
+
+static void scratchpad_surface_destroyed(struct wl_listener *listener,
+					 void *data)
+{
+	struct scratchpad *sp =
+		container_of(listener, struct scratchpad, destroy_listener);
+
+	wl_list_remove(&sp->destroy_listener.link);
+	wl_list_init(&sp->destroy_listener.link);
+	sp->shsurf = NULL;
+}
+
+static void scratchpad_launch(struct scratchpad *sp)
+{
+	sp->serial = shell_launcher_spawn(&sp->shell->launcher, sp->command);
+}
+
+/* Takes over a freshly mapped window if it belongs to a scratchpad launch
+ * and parks it in the hidden layer. */
+static bool scratchpad_claim(struct mayhem_shell *shell,
+			     struct shell_surface *shsurf, uint32_t serial)
+{
+	struct scratchpad *sp;
+	struct weston_view *view = shsurf->view;
+
+	if (serial == 0)
+		return false;
+
+	wl_list_for_each(sp, &shell->scratchpad_list, link)
+		if (sp->serial == serial && sp->shsurf == NULL)
+			break;
+
+	if (&sp->link == &shell->scratchpad_list)
+		return false;
+
+	sp->shsurf = shsurf;
+	sp->serial = 0;
+	wl_signal_add(&shsurf->destroy_signal, &sp->destroy_listener);
+
+	/* give it an output so it counts as mapped */
+	center_on_output(view, shsurf->output);
+	shell_surface_stack_run(shsurf, &shell->scratchpad_layer.view_list);
+	weston_view_update_transform(view);
+
+	return true;
+}
+
+static void scratchpad_hide(struct scratchpad *sp)
+{
+	struct shell_surface *shsurf = sp->shsurf;
+
+	shell_surface_stack_run(shsurf, &sp->shell->scratchpad_layer.view_list);
+
+	drop_focus_state(sp->shell, get_current_workspace(sp->shell),
+			 shsurf->surface);
+	surface_keyboard_focus_lost(shsurf->surface);
+
+	shell_surface_update_window(shsurf);
+}
+
+static void scratchpad_show(struct scratchpad *sp, struct weston_seat *seat)
+{
+	struct shell_surface *shsurf = sp->shsurf;
+	struct weston_view *view = shsurf->view;
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_output *output = NULL;
+	struct workspace *ws = get_current_workspace(sp->shell);
+
+	if (pointer)
+		output = get_pointer_output(pointer);
+	if (!output)
+		output = get_default_output(sp->shell->compositor);
+
+	shell_surface_stack_run(shsurf, &ws->layer.view_list);
+
+	shsurf->output = output;
+	center_on_output(view, output);
+	weston_view_update_transform(view);
+	shell_surface_update_window(shsurf);
+
+	activate(sp->shell, shsurf->surface, seat, true);
+	weston_surface_damage(shsurf->surface);
+}
+
+static void scratchpad_binding(struct weston_keyboard *keyboard,
+			       uint32_t time, uint32_t key, void *data)
+{
+	struct scratchpad *sp = data;
+	struct workspace *ws = get_current_workspace(sp->shell);
+
+	if (sp->shsurf == NULL) {
+		/* closed by its client; start a new one, which will
+		 * be parked like the first and can be toggled from then */
+		if (sp->serial == 0)
+			scratchpad_launch(sp);
+		return;
+	}
+
+	if (sp->shsurf->view->layer_link.layer == &ws->layer)
+		scratchpad_hide(sp);
+	else
+		scratchpad_show(sp, keyboard->seat);
+}
+
+static void scratchpad_destroy(struct scratchpad *sp)
+{
+	wl_list_remove(&sp->destroy_listener.link);
+	wl_list_remove(&sp->link);
+	free(sp->command);
+	free(sp);
+}
+
+static void scratchpad_init(struct mayhem_shell *shell)
+{
+	struct weston_config_section *section = NULL;
+	struct scratchpad *sp;
+	const char *name;
+	char *command, *key;
+
+	weston_layer_init(&shell->scratchpad_layer, NULL);
+	wl_list_init(&shell->scratchpad_list);
+
+	while (weston_config_next_section(shell->compositor->config,
+					  &section, &name)) {
+		if (strcmp(name, "scratchpad"))
+			continue;
+
+		weston_config_section_get_string(section, "path",
+						 &command, NULL);
+		weston_config_section_get_string(section, "key", &key, NULL);
+
+		if (!command || !key) {
+			weston_log("scratchpad: needs both path and key\n");
+			free(command);
+			free(key);
+			continue;
+		}
+
+		sp = zalloc(sizeof *sp);
+		if (!sp) {
+			free(command);
+			free(key);
+			continue;
+		}
+
+		sp->shell = shell;
+		sp->command = command;
+		sp->key = shell_launcher_key_from_string(key);
+		sp->destroy_listener.notify = scratchpad_surface_destroyed;
+		wl_list_init(&sp->destroy_listener.link);
+		wl_list_insert(shell->scratchpad_list.prev, &sp->link);
+		free(key);
+
+		scratchpad_launch(sp);
+	}
+}
+
+/* Looks up the rules again for a window that has not mapped yet. What has
+ * to be in the first configure is sent as soon as a rule asks for it, so
+ * the client draws its first frame the right size; the workspace and
+ * focus are only used by map(). */
+static void
+shell_surface_match_rules(struct shell_surface *shsurf)
+{
+	struct shell_rule_actions *actions = &shsurf->rules;
 
-	if (shsurf->has_set_geometry) {
-		surf_x = shsurf->geometry.x;
-		surf_y = shsurf->geometry.y;
-	} else {
-		surface_subsurfaces_boundingbox(shsurf->surface, &surf_x,
-						&surf_y, NULL, NULL);
+	if (weston_surface_is_mapped(shsurf->surface))
+		return;
+
+	/* dialogs and popups go with their parent, not by the rules */
+	if (shsurf->type != SHELL_SURFACE_TOPLEVEL || shsurf->parent) {
+		memset(actions, 0, sizeof *actions);
+		actions->workspace = -1;
+		return;
 	}
 
-	weston_view_set_position(shsurf->view, surf_x, surf_y);
+	shell_rules_match(&shsurf->shell->rules, shsurf->class, shsurf->title,
+			  actions);
+
+	if (actions->maximized && !shsurf->rules_maximized_sent &&
+	    shell_surface_is_xdg_toplevel(shsurf)) {
+		shsurf->rules_maximized_sent = true;
+		shsurf->state_requested = true;
+		shsurf->requested_state.maximized = true;
+		shell_surface_set_output(shsurf,
+			get_focused_output(shsurf->surface->compositor));
+		send_configure_for_surface(shsurf);
+	} else if (actions->width > 0 && !actions->maximized &&
+		   !shsurf->rules_size_sent) {
+		shsurf->rules_size_sent = true;
+		shsurf->client->send_configure(shsurf->surface,
+					       actions->width,
+					       actions->height);
+	}
 }
 
 static void map(struct mayhem_shell *shell, struct shell_surface *shsurf,
@@ -4570,6 +8102,19 @@ static void map(struct mayhem_shell *shell, struct shell_surface *shsurf,
 {
 	struct weston_compositor *compositor = shell->compositor;
 	struct weston_seat *seat;
+	struct workspace *ws;
+	struct shell_policy_window window;
+	struct shell_policy_placement placement;
+	bool placed_away = false, no_focus = shsurf->rules.no_focus;
+	uint32_t serial;
+
+	if (shsurf->type == SHELL_SURFACE_TOPLEVEL ||
+	    shsurf->type == SHELL_SURFACE_XWAYLAND) {
+		serial = shell_launcher_client_mapped(&shell->launcher,
+						      shell_surface_get_pid(shsurf));
+		if (scratchpad_claim(shell, shsurf, serial))
+			return;
+	}
 
 	/* initial positioning, see also configure() */
 	switch (shsurf->type) {
@@ -4600,6 +8145,40 @@ static void map(struct mayhem_shell *shell, struct shell_surface *shsurf,
 
 	/* Surface stacking order, see also activate(). */
 	shell_surface_update_layer(shsurf);
+	if (shsurf->fullscreen.black_view)
+		shell_surface_ensure_black_view(shsurf,
+						shsurf->fullscreen_output);
+	shell_surface_update_window(shsurf);
+
+	if (shsurf->type == SHELL_SURFACE_TOPLEVEL &&
+	    shsurf->rules.workspace >= 0 &&
+	    (uint32_t) shsurf->rules.workspace < shell->workspaces.num &&
+	    (uint32_t) shsurf->rules.workspace != shell->workspaces.current) {
+		ws = get_workspace(shell, shsurf->rules.workspace);
+		shell_surface_move_to_layer(shsurf, &ws->layer);
+		placed_away = true;
+	}
+
+	/* the script sees the window where the rules put it */
+	if (shsurf->type == SHELL_SURFACE_TOPLEVEL && shsurf->window) {
+		shell_surface_policy_window(shsurf, &window);
+		if (shell_policy_map(&shell->policy, &window, &placement)) {
+			if (placement.position && !shsurf->state.maximized &&
+			    !shsurf->state.fullscreen)
+				weston_view_set_position(shsurf->view,
+							 placement.x,
+							 placement.y);
+			if (placement.workspace >= 0 &&
+			    (uint32_t) placement.workspace <
+			    shell->workspaces.num) {
+				ws = get_workspace(shell, placement.workspace);
+				shell_surface_move_to_layer(shsurf, &ws->layer);
+				placed_away = (uint32_t) placement.workspace !=
+					shell->workspaces.current;
+			}
+			no_focus |= placement.no_focus;
+		}
+	}
 
 	if (shsurf->type != SHELL_SURFACE_NONE) {
 		weston_view_update_transform(shsurf->view);
@@ -4620,6 +8199,9 @@ static void map(struct mayhem_shell *shell, struct shell_surface *shsurf,
 		if (shsurf->state.relative &&
 		    shsurf->transient.flags == WL_SHELL_SURFACE_TRANSIENT_INACTIVE)
 			break;
+		if (shsurf->type == SHELL_SURFACE_TOPLEVEL &&
+		    (no_focus || placed_away))
+			break;
 		wl_list_for_each(seat, &compositor->seat_list, link)
 			activate(shell, shsurf->surface, seat, true);
 		break;
@@ -4634,10 +8216,10 @@ static void map(struct mayhem_shell *shell, struct shell_surface *shsurf,
 	{
 		switch (shell->win_animation_type) {
 		case ANIMATION_FADE:
-			weston_fade_run(shsurf->view, 0.0, 1.0, 300.0, NULL, NULL);
-			break;
 		case ANIMATION_ZOOM:
-			weston_zoom_run(shsurf->view, 0.5, 1.0, NULL, NULL);
+			shell_surface_run_effect(shsurf,
+						 shell->win_animation_type,
+						 0.0, 1.0);
 			break;
 		case ANIMATION_NONE:
 		default:
@@ -4686,13 +8268,23 @@ shell_surface_configure(struct weston_surface *es, int32_t sx, int32_t sy)
 
 	shell = shsurf->shell;
 
+	shell_client_account_commit(shsurf);
+
 	if (!weston_surface_is_mapped(es) &&
 	    !wl_list_empty(&shsurf->popup.grab_link)) {
 		remove_popup_grab(shsurf);
 	}
 
-	if (es->width == 0)
+	if (shsurf->xdg.resource && !xdg_surface_commit(shsurf))
+		return;
+
+	if (es->width == 0) {
+		shell_surface_untrack_placement(shsurf);
+		shell_surface_destroy_black_view(shsurf);
+		if (shsurf->state.fullscreen)
+			shell_fullscreen_schedule(shell);
 		return;
+	}
 
 	if (shsurf->has_next_geometry) {
 		shsurf->geometry = shsurf->next_geometry;
@@ -4834,31 +8426,77 @@ launch_mayhem_shell_process(void *data)
 }
 
 static void
-handle_shell_client_destroy(struct wl_listener *listener, void *data)
+handle_shell_client_usage_destroy(struct wl_listener *listener, void *data)
 {
-	struct shell_client *sc =
-		container_of(listener, struct shell_client, destroy_listener);
+	struct shell_client_usage *usage =
+		container_of(listener, struct shell_client_usage,
+			     destroy_listener);
+	struct shell_client *sc, *sc_next;
+	struct shell_surface *shsurf, *next;
 
-	if (sc->ping_timer)
-		wl_event_source_remove(sc->ping_timer);
+	wl_list_for_each_safe(sc, sc_next, &usage->shell_clients, link) {
+		if (sc->ping_timer)
+			wl_event_source_remove(sc->ping_timer);
+
+		/* the surfaces are destroyed after the client's destroy
+		 * signal */
+		wl_list_for_each_safe(shsurf, next, &sc->surface_list,
+				      owner_link)
+			shell_client_remove_surface(shsurf);
+
+		free(sc);
+	}
+
+	free(usage);
+}
+
+/* Every binding of a client counts against the same limits. */
+static struct shell_client_usage *
+shell_client_usage_get(struct wl_client *client)
+{
+	struct shell_client_usage *usage;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+					handle_shell_client_usage_destroy);
+	if (listener)
+		return container_of(listener, struct shell_client_usage,
+				    destroy_listener);
+
+	usage = zalloc(sizeof *usage);
+	if (usage == NULL)
+		return NULL;
+
+	usage->client = client;
+	wl_list_init(&usage->shell_clients);
+	usage->window_start = weston_compositor_get_time();
+	usage->destroy_listener.notify = handle_shell_client_usage_destroy;
+	wl_client_add_destroy_listener(client, &usage->destroy_listener);
 
-	//wl_list_remove(&sc->surface_list);
-	free(sc);
+	return usage;
 }
 
 static struct shell_client *
 shell_client_create(struct wl_client *client, struct mayhem_shell *shell,
-		    const struct wl_interface *interface, uint32_t id)
+		    const struct wl_interface *interface, uint32_t version,
+		    uint32_t id)
 {
+	struct shell_client_usage *usage;
 	struct shell_client *sc;
 
+	usage = shell_client_usage_get(client);
+	if (usage == NULL) {
+		wl_client_post_no_memory(client);
+		return NULL;
+	}
+
 	sc = zalloc(sizeof *sc);
 	if (sc == NULL) {
 		wl_client_post_no_memory(client);
 		return NULL;
 	}
 
-	sc->resource = wl_resource_create(client, interface, 1, id);
+	sc->resource = wl_resource_create(client, interface, version, id);
 	if (sc->resource == NULL) {
 		free(sc);
 		wl_client_post_no_memory(client);
@@ -4867,8 +8505,9 @@ shell_client_create(struct wl_client *client, struct mayhem_shell *shell,
 
 	sc->client = client;
 	sc->shell = shell;
-	sc->destroy_listener.notify = handle_shell_client_destroy;
-	wl_client_add_destroy_listener(client, &sc->destroy_listener);
+	sc->usage = usage;
+	wl_list_insert(&usage->shell_clients, &sc->link);
+	wl_list_init(&sc->surface_list);
 
 	return sc;
 }
@@ -4879,7 +8518,7 @@ bind_wl_shell(struct wl_client *client, void *data, uint32_t version, uint32_t i
 	struct mayhem_shell *shell = data;
 	struct shell_client *sc;
 
-	sc = shell_client_create(client, shell, &wl_shell_interface, id);
+	sc = shell_client_create(client, shell, &wl_shell_interface, 1, id);
 	if (sc)
 		wl_resource_set_implementation(sc->resource,
 					       &shell_implementation,
@@ -4892,18 +8531,18 @@ static void bind_xdg_shell(struct wl_client *client, void *data,
 	struct mayhem_shell *shell = data;
 	struct shell_client *sc;
 
-	sc = shell_client_create(client, shell, &xdg_shell_interface, id);
+	sc = shell_client_create(client, shell, &xdg_wm_base_interface, 1, id);
 	if (sc)
-		wl_resource_set_dispatcher(sc->resource,
-					   xdg_shell_unversioned_dispatch,
-					   NULL, sc, NULL);
+		wl_resource_set_implementation(sc->resource,
+					       &xdg_implementation,
+					       sc, NULL);
 }
 
 static void unbind_ms_menu(struct wl_resource *resource)
 {
 	struct mayhem_shell *shell = wl_resource_get_user_data(resource);
 
-	printf("unbinding ms menu");
+	shell_log(SHELL_LOG_MENU, SHELL_LOG_DEBUG, "menu client unbound");
 
 	shell->child.mayhem_shell = NULL;
 	shell->prepare_event_sent = false;
@@ -4915,9 +8554,12 @@ static void bind_ms_menu(struct wl_client *client, void *data,
 	struct mayhem_shell *shell = data;
 	struct shell_client *sc;
 
-	sc = shell_client_create(client, shell, &ms_menu_interface, id);
+	sc = shell_client_create(client, shell, &ms_menu_interface,
+				 MIN(version, 2), id);
+	if (sc == NULL)
+		return;
 
-	printf("binding ms menu");
+	shell_log(SHELL_LOG_MENU, SHELL_LOG_DEBUG, "menu client bound");
 	// allow only our special client to use ms_menu interface
 	if (client == shell->child.client || 1) {
 		wl_resource_set_implementation(sc->resource,
@@ -4948,10 +8590,11 @@ static void switcher_next(struct switcher *switcher)
 	struct shell_surface *shsurf;
 	struct workspace *ws = get_current_workspace(switcher->shell);
 
-	 /* temporary re-display minimized surfaces */
+	 /* temporary re-display minimized surfaces, bottom first so that
+	  * windows keep their transients above them */
 	struct weston_view *tmp;
 	struct weston_view **minimized;
-	wl_list_for_each_safe(view, tmp, &switcher->shell->minimized_layer.view_list.link, layer_link.link) {
+	wl_list_for_each_reverse_safe(view, tmp, &switcher->shell->minimized_layer.view_list.link, layer_link.link) {
 		weston_layer_entry_remove(&view->layer_link);
 		weston_layer_entry_insert(&ws->layer.view_list, &view->layer_link);
 		minimized = wl_array_add(&switcher->minimized_array, sizeof *minimized);
@@ -5002,6 +8645,7 @@ switcher_handle_surface_destroy(struct wl_listener *listener, void *data)
 static void switcher_destroy(struct switcher *switcher)
 {
 	struct weston_view *view;
+	struct shell_surface *shsurf;
 	struct weston_keyboard *keyboard = switcher->grab.keyboard;
 	struct workspace *ws = get_current_workspace(switcher->shell);
 
@@ -5024,16 +8668,25 @@ static void switcher_destroy(struct switcher *switcher)
 	 /* re-hide surfaces that were temporary shown during the switch */
 	struct weston_view **minimized;
 	wl_array_for_each(minimized, &switcher->minimized_array) {
-		/* with the exception of the current selected */
-		if ((*minimized)->surface != switcher->current) {
+		shsurf = get_shell_surface((*minimized)->surface);
+
+		/* with the exception of the current selected and its
+		 * transients */
+		if ((*minimized)->surface != switcher->current &&
+		    (!shsurf ||
+		     shell_surface_get_root(shsurf)->surface != switcher->current)) {
 			weston_layer_entry_remove(&(*minimized)->layer_link);
 			weston_layer_entry_insert(&switcher->shell->minimized_layer.view_list, &(*minimized)->layer_link);
 			weston_view_damage_below(*minimized);
 		}
+
+		if (shsurf)
+			shell_surface_update_window(shsurf);
 	}
 	wl_array_release(&switcher->minimized_array);
+	shell_invalidate_placement(switcher->shell);
 
-	free(switcher);
+	shell_slab_free(&switcher->shell->switcher_slab, switcher);
 }
 
 static void
@@ -5079,7 +8732,10 @@ static void switcher_binding(struct weston_keyboard *keyboard, uint32_t time,
 	struct mayhem_shell *shell = data;
 	struct switcher *switcher;
 
-	switcher = malloc(sizeof *switcher);
+	switcher = shell_slab_zalloc(&shell->switcher_slab);
+	if (!switcher)
+		return;
+
 	switcher->shell = shell;
 	switcher->current = NULL;
 	switcher->listener.notify = switcher_handle_surface_destroy;
@@ -5087,7 +8743,7 @@ static void switcher_binding(struct weston_keyboard *keyboard, uint32_t time,
 	wl_array_init(&switcher->minimized_array);
 
 	restore_all_output_modes(shell->compositor);
-	//lower_fullscreen_layer(switcher->shell);
+	lower_fullscreen_layer(switcher->shell, NULL);
 	switcher->grab.interface = &switcher_grab;
 	weston_keyboard_start_grab(keyboard, &switcher->grab);
 	weston_keyboard_set_focus(keyboard, NULL);
@@ -5152,6 +8808,17 @@ static void workspace_axis_binding(struct weston_pointer *pointer,
 	struct mayhem_shell *shell = data;
 	int new_index = shell->workspaces.current;
 
+	/* touchpads scroll smoothly and drive the slide themselves */
+	if (!event->has_discrete) {
+		if (event->value == 0)
+			workspace_gesture_release(shell);
+		else
+			workspace_gesture_update(shell,
+						 -wl_fixed_to_double(event->value),
+						 true);
+		return;
+	}
+
 	new_index += event->value>0?1:-1;
 	if(new_index < 0)
 		new_index = shell->workspaces.num-1;
@@ -5161,6 +8828,180 @@ static void workspace_axis_binding(struct weston_pointer *pointer,
 	change_workspace(shell, new_index);
 }
 
+/* Until enough fingers are down the swipe grab hands everything on to the
+ * client; from then on the sequence is the shell's and the client gets a
+ * cancel. The vertical travel of the fingers drags the workspace below or
+ * above in, lifting the last one lets the slide settle. */
+static void touch_swipe_grab_finish(struct touch_swipe_grab *swipe)
+{
+	struct mayhem_shell *shell = swipe->shell;
+	struct weston_touch *touch = swipe->grab.touch;
+
+	weston_touch_end_grab(touch);
+	shell_slab_free(&shell->grab_slab, swipe);
+
+	workspace_gesture_release(shell);
+}
+
+static void touch_swipe_grab_down(struct weston_touch_grab *grab,
+				  uint32_t time, int touch_id,
+				  wl_fixed_t x, wl_fixed_t y)
+{
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) grab;
+	struct weston_touch *touch = grab->touch;
+	struct wl_resource *resource;
+
+	if (swipe->count < SWIPE_MAX_POINTS) {
+		swipe->points[swipe->count].id = touch_id;
+		swipe->points[swipe->count].x = x;
+		swipe->points[swipe->count].y = y;
+		swipe->count++;
+	}
+
+	if (swipe->swiping)
+		return;
+
+	touch->default_grab.interface->down(&touch->default_grab, time,
+					    touch_id, x, y);
+
+	if (touch->num_tp < swipe->shell->swipe_fingers)
+		return;
+
+	swipe->swiping = true;
+	wl_resource_for_each(resource, &touch->focus_resource_list)
+		wl_touch_send_cancel(resource);
+}
+
+static void touch_swipe_grab_up(struct weston_touch_grab *grab,
+				uint32_t time, int touch_id)
+{
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) grab;
+	struct weston_touch *touch = grab->touch;
+	int i;
+
+	for (i = 0; i < swipe->count; i++) {
+		if (swipe->points[i].id != touch_id)
+			continue;
+
+		swipe->points[i] = swipe->points[--swipe->count];
+		break;
+	}
+
+	if (!swipe->swiping)
+		touch->default_grab.interface->up(&touch->default_grab, time,
+						  touch_id);
+
+	if (touch->num_tp > 0)
+		return;
+
+	if (swipe->swiping) {
+		touch_swipe_grab_finish(swipe);
+	} else {
+		weston_touch_end_grab(touch);
+		shell_slab_free(&swipe->shell->grab_slab, swipe);
+	}
+}
+
+static void touch_swipe_grab_motion(struct weston_touch_grab *grab,
+				    uint32_t time, int touch_id,
+				    wl_fixed_t x, wl_fixed_t y)
+{
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) grab;
+	struct weston_touch *touch = grab->touch;
+	wl_fixed_t dy;
+	int i;
+
+	for (i = 0; i < swipe->count; i++) {
+		if (swipe->points[i].id != touch_id)
+			continue;
+
+		if (swipe->swiping) {
+			dy = (y - swipe->points[i].y) / swipe->count;
+			workspace_gesture_update(swipe->shell,
+						 wl_fixed_to_double(dy), false);
+		}
+		swipe->points[i].x = x;
+		swipe->points[i].y = y;
+		break;
+	}
+
+	/* The binding runs before the first finger's down is dispatched,
+	 * and that goes to the default grab, so the first finger turns up
+	 * here when it first moves. */
+	if (i == swipe->count && swipe->count < SWIPE_MAX_POINTS) {
+		swipe->points[i].id = touch_id;
+		swipe->points[i].x = x;
+		swipe->points[i].y = y;
+		swipe->count++;
+	}
+
+	if (!swipe->swiping)
+		touch->default_grab.interface->motion(&touch->default_grab,
+						      time, touch_id, x, y);
+}
+
+static void touch_swipe_grab_frame(struct weston_touch_grab *grab)
+{
+	struct weston_touch *touch = grab->touch;
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) grab;
+
+	if (!swipe->swiping)
+		touch->default_grab.interface->frame(&touch->default_grab);
+}
+
+static void touch_swipe_grab_cancel(struct weston_touch_grab *grab)
+{
+	struct weston_touch *touch = grab->touch;
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) grab;
+
+	if (!swipe->swiping)
+		touch->default_grab.interface->cancel(&touch->default_grab);
+	else
+		workspace_gesture_cancel(swipe->shell);
+
+	weston_touch_end_grab(touch);
+	shell_slab_free(&swipe->shell->grab_slab, swipe);
+}
+
+static const struct weston_touch_grab_interface touch_swipe_grab_interface = {
+	touch_swipe_grab_down,
+	touch_swipe_grab_up,
+	touch_swipe_grab_motion,
+	touch_swipe_grab_frame,
+	touch_swipe_grab_cancel,
+};
+
+/* A client asking to move or resize with the finger it is being sent
+ * takes the sequence back from a swipe that has not started. */
+static void touch_swipe_grab_drop(struct weston_touch *touch)
+{
+	struct touch_swipe_grab *swipe = (struct touch_swipe_grab *) touch->grab;
+
+	if (touch->grab->interface != &touch_swipe_grab_interface)
+		return;
+
+	weston_touch_end_grab(touch);
+	shell_slab_free(&swipe->shell->grab_slab, swipe);
+}
+
+static void touch_swipe_binding(struct weston_touch *touch, uint32_t time,
+				void *data)
+{
+	struct mayhem_shell *shell = data;
+	struct touch_swipe_grab *swipe;
+
+	if (shell->swipe_fingers < 2 || touch->grab != &touch->default_grab)
+		return;
+
+	swipe = shell_slab_zalloc(&shell->grab_slab);
+	if (!swipe)
+		return;
+
+	swipe->grab.interface = &touch_swipe_grab_interface;
+	swipe->shell = shell;
+	weston_touch_start_grab(touch, &swipe->grab);
+}
+
 static void workspace_f_binding(struct weston_keyboard *keyboard, uint32_t time,
 				uint32_t key, void *data)
 {
@@ -5268,33 +9109,117 @@ void shell_for_each_layer(struct mayhem_shell *shell,
 		func(shell, &(*ws)->layer, data);
 }
 
+/* Makes a fullscreen window fullscreen on another output, in the size of
+ * that one. With no output left it waits for the next to appear. */
+static void shell_surface_move_fullscreen(struct shell_surface *shsurf,
+					  struct weston_output *output)
+{
+	shsurf->fullscreen_output = output;
+	shsurf->saved_position_valid = false;
+	if (output == NULL)
+		return;
+
+	shsurf->output = output;
+	if (weston_surface_is_mapped(shsurf->surface))
+		shell_configure_fullscreen(shsurf);
+	send_configure_for_surface(shsurf);
+}
+
 static void shell_output_destroy_move_layer(struct mayhem_shell *shell,
 					    struct weston_layer *layer,
 					    void *data)
 {
+	struct weston_compositor *ec = shell->compositor;
 	struct weston_output *output = data;
+	struct weston_output *first_output = NULL;
+	struct shell_surface *shsurf;
 	struct weston_view *view;
 
+	if (!wl_list_empty(&ec->output_list))
+		first_output = container_of(ec->output_list.next,
+					    struct weston_output, link);
+
 	wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
-		if (view->output != output)
+		/* their window puts them on its new output */
+		if (get_black_surface_owner(view->surface))
+			continue;
+
+		shsurf = get_shell_surface(view->surface);
+		if (shsurf && shsurf->fullscreen_output == output) {
+			shell_surface_move_fullscreen(shsurf, first_output);
+			continue;
+		}
+
+		if (view->output != output || first_output == NULL)
 			continue;
 
 		shell_reposition_view_on_output_destroy(view);
 	}
 }
 
+static void shell_output_adopt_fullscreen_layer(struct mayhem_shell *shell,
+						struct weston_layer *layer,
+						void *data)
+{
+	struct weston_output *output = data;
+	struct shell_surface *shsurf;
+	struct weston_view *view;
+
+	wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
+		shsurf = get_shell_surface(view->surface);
+		if (shsurf && shsurf->state.fullscreen &&
+		    shsurf->fullscreen_output == NULL)
+			shell_surface_move_fullscreen(shsurf, output);
+	}
+}
+
 static void handle_output_destroy(struct wl_listener *listener, void *data)
 {
 	struct shell_output *output_listener =
 		container_of(listener, struct shell_output, destroy_listener);
 	struct weston_output *output = output_listener->output;
 	struct mayhem_shell *shell = output_listener->shell;
+	struct weston_seat *seat;
 
+	lower_fullscreen_layer(shell, output);
+	wl_list_remove(&output_listener->fullscreen_layer.link);
 	shell_for_each_layer(shell, shell_output_destroy_move_layer, output);
+	shell_output_destroy_move_layer(shell, &shell->minimized_layer, output);
+
+	wl_list_for_each(seat, &shell->compositor->seat_list, link) {
+		struct shell_seat *shseat = get_shell_seat(seat);
 
+		if (shseat->pointer_output == output)
+			shseat->pointer_output = NULL;
+	}
+
+	shell_timeline_output_destroyed(&shell->timeline, output);
+	if (shell->workspaces.gesture.active &&
+	    shell->workspaces.gesture.output == output)
+		workspace_gesture_cancel(shell);
+	shell_placement_release(&output_listener->placement);
+	shell_edges_release(&output_listener->edges);
+	shell_invalidate_placement(shell);
+	if (output_listener->lock_view)
+		weston_surface_destroy(output_listener->lock_view->surface);
+
+	wl_list_remove(&output_listener->zoom.animation.link);
+	wl_list_remove(&output_listener->frame_listener.link);
 	wl_list_remove(&output_listener->destroy_listener.link);
 	wl_list_remove(&output_listener->link);
 	free(output_listener);
+
+	shell_fullscreen_schedule(shell);
+}
+
+static void handle_output_frame(struct wl_listener *listener, void *data)
+{
+	struct shell_output *shell_output =
+		container_of(listener, struct shell_output, frame_listener);
+
+	/* whichever output repaints first sends the batch */
+	shell_window_list_flush(&shell_output->shell->window_list);
+	shell_xdg_flush_configures(shell_output->shell);
 }
 
 static void create_shell_output(struct mayhem_shell *shell,
@@ -5308,10 +9233,33 @@ static void create_shell_output(struct mayhem_shell *shell,
 
 	shell_output->output = output;
 	shell_output->shell = shell;
+	shell_output->zoom.animation.frame = zoom_frame;
+	wl_list_init(&shell_output->zoom.animation.link);
+	shell_placement_init(&shell_output->placement);
+	shell_edges_init(&shell_output->edges);
+	lock_view_create(shell, shell_output);
+
+	/* right below the closing windows, above whichever workspace is
+	 * shown; out of the way while locked, see unlock() */
+	weston_layer_init(&shell_output->fullscreen_layer, NULL);
+	if (shell->lock.locked)
+		wl_list_init(&shell_output->fullscreen_layer.link);
+	else
+		wl_list_insert(&shell->closing_layer.link,
+			       &shell_output->fullscreen_layer.link);
+
 	shell_output->destroy_listener.notify = handle_output_destroy;
 	wl_signal_add(&output->destroy_signal,
 		      &shell_output->destroy_listener);
+	shell_output->frame_listener.notify = handle_output_frame;
+	wl_signal_add(&output->frame_signal, &shell_output->frame_listener);
 	wl_list_insert(shell->output_list.prev, &shell_output->link);
+
+	/* fullscreen windows left behind by the last output */
+	shell_for_each_layer(shell, shell_output_adopt_fullscreen_layer, output);
+	shell_output_adopt_fullscreen_layer(shell, &shell->minimized_layer,
+					    output);
+	shell_fullscreen_schedule(shell);
 }
 
 static void handle_output_create(struct wl_listener *listener, void *data)
@@ -5343,11 +9291,23 @@ static void handle_output_move_layer(struct mayhem_shell *shell,
 static void handle_output_move(struct wl_listener *listener, void *data)
 {
 	struct mayhem_shell *shell;
+	struct shell_output *shell_output;
 
 	shell = container_of(listener, struct mayhem_shell,
 			     output_move_listener);
 
 	shell_for_each_layer(shell, handle_output_move_layer, data);
+	shell_invalidate_placement(shell);
+
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		if (shell_output->output != data)
+			continue;
+
+		handle_output_move_layer(shell, &shell_output->fullscreen_layer,
+					 data);
+		lock_view_fit(shell_output);
+	}
+	shell_fullscreen_schedule(shell);
 }
 
 static void setup_output_destroy_handler(struct weston_compositor *ec,
@@ -5367,14 +9327,305 @@ static void setup_output_destroy_handler(struct weston_compositor *ec,
 	wl_signal_add(&ec->output_moved_signal, &shell->output_move_listener);
 }
 
+static const char * const shell_surface_type_names[] = {
+	[SHELL_SURFACE_NONE] = "none",
+	[SHELL_SURFACE_TOPLEVEL] = "toplevel",
+	[SHELL_SURFACE_POPUP] = "popup",
+	[SHELL_SURFACE_XWAYLAND] = "xwayland",
+	[SHELL_SURFACE_MENU] = "menu",
+};
+
+static void dump_shell_surface(struct shell_json *json,
+			       struct shell_surface *shsurf)
+{
+	shell_json_begin_object(json, "shell_surface");
+	shell_json_string(json, "type", shell_surface_type_names[shsurf->type]);
+	shell_json_string(json, "title", shsurf->title);
+	shell_json_string(json, "app_id", shsurf->class);
+	shell_json_int(json, "pid", shell_surface_get_pid(shsurf));
+	if (shsurf->window)
+		shell_json_int(json, "window", shsurf->window->id);
+	shell_json_bool(json, "maximized", shsurf->state.maximized);
+	shell_json_bool(json, "fullscreen", shsurf->state.fullscreen);
+	shell_json_bool(json, "relative", shsurf->state.relative);
+	shell_json_bool(json, "unresponsive", shsurf->unresponsive);
+	shell_json_bool(json, "grabbed", shsurf->grabbed);
+	shell_json_int(json, "focus_count", shsurf->focus_count);
+	shell_json_string(json, "output",
+			  shsurf->output ? shsurf->output->name : NULL);
+	shell_json_bool(json, "workspace_transform",
+			!wl_list_empty(&shsurf->workspace_transform.link));
+	shell_json_bool(json, "effect_running",
+			shell_anim_is_running(&shsurf->effect.anim));
+	shell_json_int(json, "children", wl_list_length(&shsurf->children_list));
+	shell_json_int(json, "configures_pending",
+		       shsurf->usage.configures_pending);
+	shell_json_int(json, "buffer_bytes", shsurf->usage.buffer_bytes);
+	shell_json_end_object(json);
+}
+
+static void dump_view(struct shell_json *json, struct weston_view *view)
+{
+	struct weston_surface *surface = view->surface;
+	struct shell_surface *shsurf = get_shell_surface(surface);
+	char label[128];
+
+	if (surface->get_label == NULL ||
+	    surface->get_label(surface, label, sizeof label) < 0)
+		snprintf(label, sizeof label, "unlabelled");
+
+	shell_json_begin_object(json, NULL);
+	shell_json_string(json, "surface", label);
+	shell_json_double(json, "x", view->geometry.x);
+	shell_json_double(json, "y", view->geometry.y);
+	shell_json_int(json, "width", surface->width);
+	shell_json_int(json, "height", surface->height);
+	shell_json_double(json, "alpha", view->alpha);
+	shell_json_string(json, "output",
+			  view->output ? view->output->name : NULL);
+	shell_json_bool(json, "mapped", weston_view_is_mapped(view));
+	shell_json_bool(json, "transformed", view->transform.enabled);
+	shell_json_int(json, "transforms",
+		       wl_list_length(&view->geometry.transformation_list));
+	if (shsurf)
+		dump_shell_surface(json, shsurf);
+	shell_json_end_object(json);
+}
+
+static void dump_layer(struct shell_json *json, const char *name,
+		       struct weston_layer *layer)
+{
+	struct weston_view *view;
+
+	shell_json_begin_object(json, NULL);
+	shell_json_string(json, "name", name);
+	shell_json_bool(json, "shown", !wl_list_empty(&layer->link));
+	shell_json_int(json, "count",
+		       wl_list_length(&layer->view_list.link));
+	shell_json_begin_array(json, "views");
+	wl_list_for_each(view, &layer->view_list.link, layer_link.link)
+		dump_view(json, view);
+	shell_json_end_array(json);
+	shell_json_end_object(json);
+}
+
+static const char *dump_anim_owner(struct mayhem_shell *shell,
+				   struct shell_anim *anim)
+{
+	struct workspace **pws;
+
+	if (anim == &shell->workspaces.anim)
+		return "workspace";
+	if (anim == &shell->fade.animation)
+		return "fade";
+	wl_array_for_each(pws, &shell->workspaces.array)
+		if (anim == &(*pws)->focus_animation)
+			return "focus";
+
+	return "window";
+}
+
+static const char *dump_pointer_grab(struct weston_pointer *pointer)
+{
+	const struct weston_pointer_grab_interface *interface =
+		pointer->grab->interface;
+
+	if (pointer->grab == &pointer->default_grab)
+		return NULL;
+	if (interface == &move_grab_interface)
+		return "move";
+	if (interface == &resize_grab_interface)
+		return "resize";
+	if (interface == &busy_cursor_grab_interface)
+		return "busy";
+	if (interface == &popup_grab_interface)
+		return "popup";
+	if (interface == &rotate_grab_interface)
+		return "rotate";
+
+	return "other";
+}
+
+static const char *dump_touch_grab(struct weston_touch *touch)
+{
+	const struct weston_touch_grab_interface *interface =
+		touch->grab->interface;
+
+	if (touch->grab == &touch->default_grab)
+		return NULL;
+	if (interface == &touch_move_grab_interface)
+		return "move";
+	if (interface == &touch_resize_grab_interface)
+		return "resize";
+	if (interface == &touch_swipe_grab_interface)
+		return "swipe";
+
+	return "other";
+}
+
+static void dump_seat(struct shell_json *json, struct mayhem_shell *shell,
+		      struct weston_seat *seat)
+{
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+	struct weston_touch *touch = weston_seat_get_touch(seat);
+	struct shell_seat *shseat = get_shell_seat(seat);
+	struct focus_state *state;
+	unsigned int i;
+	char label[128];
+
+	shell_json_begin_object(json, NULL);
+	shell_json_string(json, "name", seat->seat_name);
+	if (pointer)
+		shell_json_string(json, "pointer_grab",
+				  dump_pointer_grab(pointer));
+	if (keyboard)
+		shell_json_string(json, "keyboard_grab",
+				  keyboard->grab == &keyboard->default_grab ?
+				  NULL : keyboard->grab->interface ==
+				  &switcher_grab ? "switcher" : "other");
+	if (touch)
+		shell_json_string(json, "touch_grab", dump_touch_grab(touch));
+
+	/* what each workspace gives the focus back to */
+	shell_json_begin_array(json, "focus");
+	for (i = 0; shseat && i < shell->workspaces.num; i++) {
+		state = shell_seat_focus_state(shseat, get_workspace(shell, i));
+		if (state == NULL || state->keyboard_focus == NULL)
+			continue;
+
+		if (state->keyboard_focus->get_label == NULL ||
+		    state->keyboard_focus->get_label(state->keyboard_focus,
+						     label, sizeof label) < 0)
+			snprintf(label, sizeof label, "unlabelled");
+
+		shell_json_begin_object(json, NULL);
+		shell_json_int(json, "workspace", i);
+		shell_json_string(json, "surface", label);
+		shell_json_end_object(json);
+	}
+	shell_json_end_array(json);
+	shell_json_end_object(json);
+}
+
+/* One walk over everything into memory; it is writing the result out
+ * that takes time, and that happens a chunk at a time. */
+static void shell_dump_state(struct mayhem_shell *shell,
+			     struct shell_json *json)
+{
+	struct weston_compositor *ec = shell->compositor;
+	struct shell_output *shell_output;
+	struct weston_output *output;
+	struct weston_seat *seat;
+	struct shell_anim *anim;
+	struct workspace **pws;
+	char name[32];
+
+	shell_json_begin_object(json, NULL);
+	shell_json_int(json, "time", weston_compositor_get_time());
+	shell_json_int(json, "current_workspace", shell->workspaces.current);
+	shell_json_bool(json, "locked", shell->lock.locked);
+
+	shell_json_begin_array(json, "outputs");
+	wl_list_for_each(output, &ec->output_list, link) {
+		shell_json_begin_object(json, NULL);
+		shell_json_string(json, "name", output->name);
+		shell_json_int(json, "x", output->x);
+		shell_json_int(json, "y", output->y);
+		shell_json_int(json, "width", output->width);
+		shell_json_int(json, "height", output->height);
+		shell_json_int(json, "animations",
+			       wl_list_length(&output->animation_list));
+		shell_output = get_shell_output(output);
+		shell_json_bool(json, "fullscreen_covered",
+				shell_output && shell_output->fullscreen_covered);
+		shell_json_end_object(json);
+	}
+	shell_json_end_array(json);
+
+	shell_json_begin_array(json, "layers");
+	wl_list_for_each(shell_output, &shell->output_list, link) {
+		snprintf(name, sizeof name, "fullscreen %s",
+			 shell_output->output->name);
+		dump_layer(json, name, &shell_output->fullscreen_layer);
+	}
+	wl_array_for_each(pws, &shell->workspaces.array) {
+		snprintf(name, sizeof name, "workspace %u", (*pws)->index);
+		dump_layer(json, name, &(*pws)->layer);
+	}
+	dump_layer(json, "background", &shell->background_layer);
+	dump_layer(json, "minimized", &shell->minimized_layer);
+	dump_layer(json, "scratchpad", &shell->scratchpad_layer);
+	dump_layer(json, "closing", &shell->closing_layer);
+	shell_json_end_array(json);
+
+	shell_json_begin_array(json, "seats");
+	wl_list_for_each(seat, &ec->seat_list, link)
+		dump_seat(json, shell, seat);
+	shell_json_end_array(json);
+
+	shell_json_begin_array(json, "animations");
+	wl_list_for_each(anim, &shell->timeline.active, link) {
+		shell_json_begin_object(json, NULL);
+		shell_json_string(json, "owner", dump_anim_owner(shell, anim));
+		shell_json_int(json, "duration", anim->duration);
+		shell_json_double(json, "from", anim->from);
+		shell_json_double(json, "to", anim->to);
+		shell_json_double(json, "progress", anim->progress);
+		shell_json_int(json, "direction", anim->dir);
+		shell_json_end_object(json);
+	}
+	shell_json_end_array(json);
+
+	shell_json_begin_object(json, "gesture");
+	shell_json_bool(json, "active", shell->workspaces.gesture.active);
+	shell_json_double(json, "progress", shell->workspaces.gesture.progress);
+	shell_json_double(json, "velocity", shell->workspaces.gesture.velocity);
+	shell_json_end_object(json);
+
+	shell_json_end_object(json);
+}
+
+/* $XDG_RUNTIME_DIR/mayhem-shell-dump-<time>.json unless given a path */
+static int shell_dump_to(struct mayhem_shell *shell, const char *path,
+			 char *buf, size_t len)
+{
+	struct shell_json json;
+	const char *dir;
+
+	if (path == NULL) {
+		dir = getenv("XDG_RUNTIME_DIR");
+		snprintf(buf, len, "%s/mayhem-shell-dump-%u.json",
+			 dir ? dir : "/tmp", weston_compositor_get_time());
+		path = buf;
+	} else {
+		snprintf(buf, len, "%s", path);
+	}
+
+	shell_json_init(&json);
+	shell_dump_state(shell, &json);
+	return shell_dump_save(&shell->dump, &json, path);
+}
+
+static void dump_binding(struct weston_keyboard *keyboard, uint32_t time,
+			 uint32_t key, void *data)
+{
+	char path[PATH_MAX];
+
+	shell_dump_to(data, NULL, path, sizeof path);
+}
+
 static void shell_destroy(struct wl_listener *listener, void *data)
 {
 	struct mayhem_shell *shell =
 		container_of(listener, struct mayhem_shell, destroy_listener);
 	struct workspace **ws;
 	struct shell_output *shell_output, *tmp;
+	struct closing_window *closing, *next;
+	struct scratchpad *sp, *sp_next;
 
 	/* Force state to unlocked so we don't try to fade */
+	unlock(shell);
 
 	if (shell->child.client) {
 		/* disable respawn */
@@ -5386,26 +9637,64 @@ static void shell_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&shell->wake_listener.link);
 	wl_list_remove(&shell->transform_listener.link);
 
+	if (shell->fullscreen.idle)
+		wl_event_source_remove(shell->fullscreen.idle);
+	if (shell->configures.timer)
+		wl_event_source_remove(shell->configures.timer);
+
 	wl_list_for_each_safe(shell_output, tmp, &shell->output_list, link) {
+		wl_list_remove(&shell_output->fullscreen_layer.link);
+		wl_list_remove(&shell_output->zoom.animation.link);
 		wl_list_remove(&shell_output->destroy_listener.link);
 		wl_list_remove(&shell_output->link);
+		shell_placement_release(&shell_output->placement);
+		shell_edges_release(&shell_output->edges);
+		if (shell_output->lock_view)
+			weston_surface_destroy(shell_output->lock_view->surface);
 		free(shell_output);
 	}
 
 	wl_list_remove(&shell->output_create_listener.link);
 	wl_list_remove(&shell->output_move_listener.link);
 
+	wl_list_remove(&shell->workspaces.gesture.animation.link);
+	if (shell->workspaces.gesture.release_timer)
+		wl_event_source_remove(shell->workspaces.gesture.release_timer);
+
 	wl_array_for_each(ws, &shell->workspaces.array)
 		workspace_destroy(*ws);
 	wl_array_release(&shell->workspaces.array);
 
+	wl_list_for_each_safe(closing, next, &shell->closing_list, link)
+		closing_window_destroy(closing);
+
+	wl_list_for_each_safe(sp, sp_next, &shell->scratchpad_list, link)
+		scratchpad_destroy(sp);
+
+	shell_timeline_release(&shell->timeline);
+	shell_launcher_release(&shell->launcher);
+	shell_ipc_release(&shell->ipc);
+	shell_policy_release(&shell->policy);
+	shell_dump_release(&shell->dump);
+	shell_window_list_release(&shell->window_list);
+	shell_rules_release(&shell->rules);
+
+	shell_slab_release(&shell->shsurf_slab);
+	shell_slab_release(&shell->focus_slab);
+	shell_slab_release(&shell->grab_slab);
+	shell_slab_release(&shell->switcher_slab);
+
+	free(shell->ipc_socket);
 	free(shell->client);
 	free(shell);
+
+	shell_log_release();
 }
 
 static void shell_add_bindings(struct weston_compositor *ec,
 			       struct mayhem_shell *shell)
 {
+	struct scratchpad *sp;
 	uint32_t mod;
 	int i, num_workspace_bindings;
 
@@ -5419,6 +9708,9 @@ static void shell_add_bindings(struct weston_compositor *ec,
 	weston_compositor_add_button_binding(ec, BTN_RIGHT, 0,
 					     click_to_activate_binding,
 					     shell);
+	weston_compositor_add_touch_binding(ec, 0, touch_to_activate_binding,
+					    shell);
+	weston_compositor_add_touch_binding(ec, 0, touch_swipe_binding, shell);
 	weston_compositor_add_axis_binding(ec, WL_POINTER_AXIS_VERTICAL_SCROLL,
 				           MODIFIER_SUPER | MODIFIER_CTRL,
 				           surface_opacity_binding, NULL);
@@ -5431,8 +9723,13 @@ static void shell_add_bindings(struct weston_compositor *ec,
 
 	/* configurable bindings */
 	mod = shell->binding_modifier;
-	weston_compositor_add_key_binding(ec, KEY_ENTER, mod, exec_binding,
-					  "weston-terminal");
+	shell_launcher_add_bindings(&shell->launcher, mod);
+	shell_policy_add_bindings(&shell->policy, mod);
+	wl_list_for_each(sp, &shell->scratchpad_list, link)
+		if (sp->key)
+			weston_compositor_add_key_binding(ec, sp->key, mod,
+							  scratchpad_binding,
+							  sp);
 	weston_compositor_add_key_binding(ec, KEY_PAGEUP, mod,
 					  zoom_key_binding, NULL);
 	weston_compositor_add_key_binding(ec, KEY_PAGEDOWN, mod,
@@ -5444,6 +9741,7 @@ static void shell_add_bindings(struct weston_compositor *ec,
 
 	weston_compositor_add_button_binding(ec, BTN_LEFT, mod,
 					     move_binding, shell);
+	weston_compositor_add_touch_binding(ec, mod, touch_move_binding, shell);
 	weston_compositor_add_button_binding(ec, BTN_MIDDLE, mod,
 					     rotate_binding, shell);
 	weston_compositor_add_button_binding(ec, BTN_RIGHT, mod,
@@ -5453,6 +9751,10 @@ static void shell_add_bindings(struct weston_compositor *ec,
 					  shell);
 	weston_compositor_add_key_binding(ec, KEY_K, mod,
 				          force_kill_binding, shell);
+	weston_compositor_add_key_binding(ec, KEY_D, mod | MODIFIER_SHIFT,
+					  dump_binding, shell);
+	weston_compositor_add_key_binding(ec, KEY_L, mod,
+					  lock_binding, shell);
 	weston_compositor_add_key_binding(ec, KEY_UP, mod,
 					  workspace_up_binding, shell);
 	weston_compositor_add_key_binding(ec, KEY_DOWN, mod,
@@ -5501,6 +9803,15 @@ WL_EXPORT int module_init(struct weston_compositor *ec, int *argc, char *argv[])
 		return -1;
 
 	shell->compositor = ec;
+
+	shell_slab_init(&shell->shsurf_slab, "shell_surface",
+			sizeof(struct shell_surface), 32);
+	shell_slab_init(&shell->focus_slab, "focus_state",
+			sizeof(struct focus_state), 32);
+	shell_slab_init(&shell->grab_slab, "grab",
+			sizeof(union shell_any_grab), 8);
+	shell_slab_init(&shell->switcher_slab, "switcher",
+			sizeof(struct switcher), 2);
 	//printf("repeat: %i, delay: %i", ec->kb_repeat_rate, ec->kb_repeat_delay);
 
 	shell->destroy_listener.notify = shell_destroy;
@@ -5530,37 +9841,76 @@ WL_EXPORT int module_init(struct weston_compositor *ec, int *argc, char *argv[])
 	wl_array_init(&shell->workspaces.array);
 	wl_list_init(&shell->workspaces.client_list);
 
+	shell_timeline_init(&shell->timeline, ec);
+	shell_log_init(wl_display_get_event_loop(ec->wl_display), ec->config);
+	shell_dump_init(&shell->dump, wl_display_get_event_loop(ec->wl_display));
+	shell_policy_init(&shell->policy, ec, &shell->window_list,
+			  &policy_interface, shell);
 	shell_configuration(shell);
+	shell_ipc_setup(shell);
+
+	shell_launcher_init(&shell->launcher, ec);
+	shell_launcher_configure(&shell->launcher, ec->config);
+	scratchpad_init(shell);
 
 	for (i = 0; i < shell->workspaces.num; i++) {
 		pws = wl_array_add(&shell->workspaces.array, sizeof *pws);
 		if (pws == NULL)
 			return -1;
 
-		*pws = workspace_create();
+		*pws = workspace_create(shell, i);
 		if (*pws == NULL)
 			return -1;
 	}
 	activate_workspace(shell, 0);
 
 	weston_layer_init(&shell->minimized_layer, NULL);
+	weston_layer_init(&shell->lock.layer, NULL);
+
+	/* right below the cursor, above whichever workspace is shown */
+	weston_layer_init(&shell->closing_layer, &ec->cursor_layer.link);
+	wl_list_init(&shell->closing_list);
+
+	wl_list_init(&shell->configures.list);
+	shell->configures.timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+					xdg_configure_timeout, shell);
 
 	wl_list_init(&shell->workspaces.anim_sticky_list);
-	wl_list_init(&shell->workspaces.animation.link);
-	shell->workspaces.animation.frame = animate_workspace_change_frame;
+	shell->workspaces.gesture.animation.frame = workspace_gesture_frame;
+	wl_list_init(&shell->workspaces.gesture.animation.link);
+	shell->workspaces.gesture.release_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+					workspace_gesture_release_timeout,
+					shell);
+	shell_anim_init(&shell->workspaces.anim, &shell->timeline,
+			&shell->anim_config[SHELL_ANIM_WORKSPACE],
+			animate_workspace_change_frame,
+			animate_workspace_change_done);
+	shell_anim_init(&shell->fade.animation, &shell->timeline,
+			&shell->anim_config[SHELL_ANIM_FADE],
+			shell_fade_frame, shell_fade_done);
 
 	if (wl_global_create(ec->wl_display, &wl_shell_interface, 1,
 				  shell, bind_wl_shell) == NULL)
 		return -1;
 
-	if (wl_global_create(ec->wl_display, &xdg_shell_interface, 1,
+	if (wl_global_create(ec->wl_display, &xdg_wm_base_interface, 1,
 				  shell, bind_xdg_shell) == NULL)
 		return -1;
 
-	if(wl_global_create(ec->wl_display, &ms_menu_interface, 1,
+	if(wl_global_create(ec->wl_display, &ms_menu_interface, 2,
 			    shell, bind_ms_menu) == NULL)
 		return -1;
 
+	if (shell_window_list_init(&shell->window_list, ec->wl_display,
+				   shell_window_list_commit, shell) < 0)
+		return -1;
+	shell->window_change_listener.notify = shell_window_changed;
+	wl_signal_add(&shell->window_list.change_signal,
+		      &shell->window_change_listener);
+	shell_policy_configure(&shell->policy, ec->config);
+
 	shell->child.deathstamp = weston_compositor_get_time();
 
 	setup_output_destroy_handler(ec, shell);
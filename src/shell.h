@@ -28,6 +28,18 @@
 #include <weston/compositor.h>
 
 #include "mayhem-server.h"
+#include "animation.h"
+#include "dump.h"
+#include "edges.h"
+#include "ipc.h"
+#include "launcher.h"
+#include "log.h"
+#include "placement.h"
+#include "policy.h"
+#include "positioner.h"
+#include "rules.h"
+#include "slab.h"
+#include "window-list.h"
 
 enum animation_type {
 	ANIMATION_NONE,
@@ -37,6 +49,17 @@ enum animation_type {
 	ANIMATION_DIM_LAYER,
 };
 
+/* Every shell animation belongs to one of these, each has its own
+ * configurable duration and curve. */
+enum shell_anim_kind {
+	SHELL_ANIM_WINDOW,
+	SHELL_ANIM_WORKSPACE,
+	SHELL_ANIM_FOCUS,
+	SHELL_ANIM_FADE,
+
+	SHELL_ANIM_KIND_COUNT
+};
+
 enum fade_type {
 	FADE_IN,
 	FADE_OUT
@@ -50,20 +73,56 @@ struct focus_surface {
 
 struct workspace {
 	struct weston_layer layer;
+	unsigned int index;		/* in mayhem_shell::workspaces.array */
 
 	struct wl_list focus_list;
-	struct wl_listener seat_destroyed_listener;
 
 	struct focus_surface *fsurf_front;
 	struct focus_surface *fsurf_back;
-	struct weston_view_animation *focus_animation;
+	struct shell_anim focus_animation;
+	bool focus_stable;
 };
 
 struct shell_output {
 	struct mayhem_shell  *shell;
 	struct weston_output  *output;
 	struct wl_listener    destroy_listener;
+	struct wl_listener    frame_listener;
 	struct wl_list        link;
+
+	struct {
+		struct weston_animation animation;
+		struct weston_seat *seat;
+		float pending;		/* input accumulated since last frame */
+		double current, velocity, target;
+		double timestamp;
+	} zoom;
+
+	struct shell_placement placement;
+	struct shell_edges edges;
+
+	struct weston_view *lock_view;	/* in the shell's lock layer */
+
+	/* the fullscreen windows of the current workspace on this output,
+	 * right above the workspace */
+	struct weston_layer fullscreen_layer;
+	bool fullscreen_covered;	/* by one of them, opaquely */
+};
+
+enum shell_client_limit {
+	CLIENT_LIMIT_SURFACES,
+	CLIENT_LIMIT_BUFFER_MB,
+	CLIENT_LIMIT_COMMIT_RATE,		/* commits per second */
+	CLIENT_LIMIT_CONFIGURE_BACKLOG,		/* configures not acked yet */
+	CLIENT_LIMIT_COUNT
+};
+
+/* 0 disables a limit. Past the soft limit a client is warned about and,
+ * where that makes sense, throttled; past the hard one it is
+ * disconnected. */
+struct shell_client_limits {
+	uint32_t soft;
+	uint32_t hard;
 };
 
 struct mayhem_shell {
@@ -102,18 +161,31 @@ struct mayhem_shell {
 
 		struct wl_list client_list;
 
-		struct weston_animation animation;
+		struct shell_anim anim;
 		struct wl_list anim_sticky_list;
 		int anim_dir;
-		uint32_t anim_timestamp;
-		double anim_current;
 		struct workspace *anim_from;
 		struct workspace *anim_to;
+
+		/* slide that follows scroll or swipe input one to one;
+		 * progress < 0 heads for the next workspace, > 0 for the
+		 * previous one */
+		struct {
+			struct weston_animation animation;
+			struct weston_output *output;
+			struct wl_event_source *release_timer;
+			struct workspace *from, *to;
+			unsigned int to_index;
+			double pending;		/* pixels since the last frame */
+			double progress, velocity, target;
+			double timestamp;
+			bool active, released;
+		} gesture;
 	} workspaces;
 
 	struct {
 		struct weston_view *view;
-		struct weston_view_animation *animation;
+		struct shell_anim animation;
 		enum fade_type type;
 		struct wl_event_source *startup_timer;
 	} fade;
@@ -123,9 +195,69 @@ struct mayhem_shell {
 	enum animation_type win_close_animation_type;
 	enum animation_type startup_animation_type;
 	enum animation_type focus_animation_type;
+	bool smart_placement;	/* else new windows open at the pointer */
+	uint32_t placement_generation;	/* bumped by every invalidation */
+	int32_t snap_threshold;
+	bool snap_tiling;
+	uint32_t swipe_fingers;		/* for a workspace swipe, 0 disables */
+
+	struct shell_timeline timeline;
+	struct shell_anim_config anim_config[SHELL_ANIM_KIND_COUNT];
+
+	struct shell_launcher launcher;
+
+	struct shell_client_limits client_limits[CLIENT_LIMIT_COUNT];
+
+	struct shell_window_list window_list;
+	struct wl_listener window_change_listener;
+
+	struct shell_ipc ipc;
+	char *ipc_socket;	/* NULL when disabled */
+
+	struct shell_rules rules;
+	struct shell_policy policy;
+	struct shell_dump dump;		/* state dumps being written */
+
+	/* pools for the objects that come and go all the time */
+	struct shell_slab shsurf_slab;
+	struct shell_slab focus_slab;
+	struct shell_slab grab_slab;
+	struct shell_slab switcher_slab;
+
+	/* pre-launched windows kept off screen until their binding */
+	struct weston_layer scratchpad_layer;
+	struct wl_list scratchpad_list;
 
 	struct weston_layer minimized_layer;
 
+	/* linked in place of the workspace while locked */
+	struct {
+		struct weston_layer layer;
+		bool enabled;		/* lock once the fade to idle is done */
+		bool locked;
+		uint32_t color;
+	} lock;
+
+	/* the mask of the background and workspace layers, hiding them
+	 * from outputs a fullscreen window covers */
+	struct {
+		struct wl_event_source *idle;
+		pixman_box32_t mask;
+		bool masked;
+	} fullscreen;
+
+	/* xdg surfaces with a configure to send, see
+	 * shell_xdg_flush_configures() */
+	struct {
+		struct wl_list list;	/* shell_surface::xdg.configure_link */
+		struct wl_event_source *timer;
+	} configures;
+
+	/* snapshots of windows whose client surface is already gone */
+	struct weston_layer closing_layer;
+	struct wl_list closing_list;
+	unsigned int closing_count;
+
 	struct wl_listener seat_create_listener;
 	struct wl_listener output_create_listener;
 	struct wl_listener output_move_listener;
@@ -147,6 +279,9 @@ struct workspace *get_current_workspace(struct mayhem_shell *shell);
 void activate(struct mayhem_shell *shell, struct weston_surface *es,
 	      struct weston_seat *seat, bool configure);
 
+void lower_fullscreen_layer(struct mayhem_shell *shell,
+			    struct weston_output *lowering_output);
+
 typedef void (*shell_for_each_layer_func_t)(struct mayhem_shell *,
 					    struct weston_layer *, void *);
 
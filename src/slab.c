@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <weston/compositor.h>
+
+#include "slab.h"
+
+#define SLAB_ALIGN 16
+#define ALIGN_UP(n) (((n) + SLAB_ALIGN - 1) & ~((size_t) SLAB_ALIGN - 1))
+
+struct slab_chunk {
+	struct wl_list link;
+};
+
+void shell_slab_init(struct shell_slab *slab, const char *name,
+		     size_t size, unsigned int chunk_objects)
+{
+	memset(slab, 0, sizeof *slab);
+	slab->name = name;
+	slab->size = ALIGN_UP(size < sizeof(void *) ? sizeof(void *) : size);
+	slab->chunk_objects = chunk_objects;
+	wl_list_init(&slab->chunks);
+}
+
+static int slab_grow(struct shell_slab *slab)
+{
+	struct slab_chunk *chunk;
+	char *object;
+	unsigned int i;
+
+	chunk = malloc(ALIGN_UP(sizeof *chunk) +
+		       slab->size * slab->chunk_objects);
+	if (!chunk)
+		return -1;
+
+	wl_list_insert(&slab->chunks, &chunk->link);
+	slab->stats.chunks++;
+
+	object = (char *) chunk + ALIGN_UP(sizeof *chunk);
+	for (i = 0; i < slab->chunk_objects; i++) {
+		*(void **) object = slab->free_list;
+		slab->free_list = object;
+		object += slab->size;
+	}
+
+	weston_log("slab %s: grew to %u chunks of %u, %u live, "
+		   "%llu allocations so far\n", slab->name,
+		   slab->stats.chunks, slab->chunk_objects, slab->stats.live,
+		   (unsigned long long) slab->stats.allocs);
+
+	return 0;
+}
+
+void *shell_slab_zalloc(struct shell_slab *slab)
+{
+	void *object;
+
+	if (!slab->free_list && slab_grow(slab) < 0)
+		return NULL;
+
+	object = slab->free_list;
+	slab->free_list = *(void **) object;
+	memset(object, 0, slab->size);
+
+	slab->stats.allocs++;
+	if (++slab->stats.live > slab->stats.peak)
+		slab->stats.peak = slab->stats.live;
+
+	return object;
+}
+
+void shell_slab_free(struct shell_slab *slab, void *object)
+{
+	if (!object)
+		return;
+
+#ifdef DEBUG
+	/* make use after free show up */
+	memset(object, 0x5a, slab->size);
+#endif
+	*(void **) object = slab->free_list;
+	slab->free_list = object;
+
+	slab->stats.frees++;
+	slab->stats.live--;
+}
+
+void shell_slab_report(struct shell_slab *slab)
+{
+	weston_log("slab %s: %llu allocations, %llu frees, %u live, "
+		   "peak %u, %u chunks of %u x %zu bytes\n", slab->name,
+		   (unsigned long long) slab->stats.allocs,
+		   (unsigned long long) slab->stats.frees,
+		   slab->stats.live, slab->stats.peak, slab->stats.chunks,
+		   slab->chunk_objects, slab->size);
+}
+
+void shell_slab_release(struct shell_slab *slab)
+{
+	struct slab_chunk *chunk, *next;
+
+	shell_slab_report(slab);
+
+	/* objects still in use keep their chunks alive */
+	if (slab->stats.live > 0)
+		return;
+
+	wl_list_for_each_safe(chunk, next, &slab->chunks, link)
+		free(chunk);
+
+	wl_list_init(&slab->chunks);
+	slab->free_list = NULL;
+	slab->stats.chunks = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-util.h>
+
+/* Fixed-size object pool. Objects are carved out of chunks that are only
+ * given back when the pool is released, so objects that come and go all
+ * the time (grabs, focus states) reuse the same memory instead of
+ * fragmenting the heap over long sessions. */
+struct shell_slab {
+	const char *name;
+	size_t size;
+	unsigned int chunk_objects;
+	void *free_list;
+	struct wl_list chunks;
+
+	struct {
+		uint64_t allocs;
+		uint64_t frees;
+		uint32_t live;
+		uint32_t peak;
+		uint32_t chunks;
+	} stats;
+};
+
+void shell_slab_init(struct shell_slab *slab, const char *name,
+		     size_t size, unsigned int chunk_objects);
+
+void shell_slab_release(struct shell_slab *slab);
+
+void *shell_slab_zalloc(struct shell_slab *slab);
+
+void shell_slab_free(struct shell_slab *slab, void *object);
+
+void shell_slab_report(struct shell_slab *slab);
+
+#endif
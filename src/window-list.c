@@ -0,0 +1,443 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <weston/compositor.h>
+
+#include "mayhem-window-list-server.h"
+#include "window-list.h"
+
+/* changes are sent this late at most when no output repaints */
+#define WINDOW_LIST_FLUSH_TIMEOUT 50
+
+static void window_send(struct wl_resource *resource,
+			struct shell_window *window, uint32_t fields)
+{
+	if (fields & WINDOW_REMOVED) {
+		ms_window_list_send_removed(resource, window->id);
+		return;
+	}
+
+	if (fields & WINDOW_ADDED)
+		ms_window_list_send_added(resource, window->id);
+	if ((fields & WINDOW_TITLE) && window->title)
+		ms_window_list_send_title(resource, window->id, window->title);
+	if ((fields & WINDOW_APP_ID) && window->app_id)
+		ms_window_list_send_app_id(resource, window->id,
+					   window->app_id);
+	if (fields & WINDOW_WORKSPACE)
+		ms_window_list_send_workspace(resource, window->id,
+					      window->workspace);
+	if (fields & WINDOW_STATE)
+		ms_window_list_send_state(resource, window->id, window->state);
+}
+
+static void window_free(struct shell_window *window)
+{
+	wl_list_remove(&window->link);
+	wl_list_remove(&window->dirty_link);
+	free(window->title);
+	free(window->app_id);
+	free(window);
+}
+
+static void window_mark_dirty(struct shell_window *window, uint32_t fields)
+{
+	struct shell_window_list *list = window->list;
+
+	if (wl_list_empty(&list->dirty_list))
+		wl_event_source_timer_update(list->flush_timer,
+					     WINDOW_LIST_FLUSH_TIMEOUT);
+
+	if (window->dirty == 0)
+		wl_list_insert(list->dirty_list.prev, &window->dirty_link);
+	window->dirty |= fields;
+}
+
+/* Sends every window and property changed since the last flush, as one
+ * batch per client. */
+void shell_window_list_flush(struct shell_window_list *list)
+{
+	struct shell_window *window, *next;
+	struct wl_resource *resource;
+
+	if (wl_list_empty(&list->dirty_list))
+		return;
+
+	wl_event_source_timer_update(list->flush_timer, 0);
+
+	wl_list_for_each(window, &list->dirty_list, dirty_link)
+		wl_signal_emit(&list->change_signal, window);
+
+	wl_resource_for_each(resource, &list->resource_list) {
+		wl_list_for_each(window, &list->dirty_list, dirty_link)
+			window_send(resource, window, window->dirty);
+		ms_window_list_send_done(resource);
+	}
+
+	wl_list_for_each_safe(window, next, &list->dirty_list, dirty_link) {
+		if (window->dirty & WINDOW_REMOVED) {
+			window_free(window);
+			continue;
+		}
+
+		window->dirty = 0;
+		wl_list_remove(&window->dirty_link);
+		wl_list_init(&window->dirty_link);
+	}
+}
+
+/* Windows on their way out are not found any more. */
+struct shell_window *shell_window_list_find(struct shell_window_list *list,
+					    uint32_t id)
+{
+	struct shell_window *window;
+
+	wl_list_for_each(window, &list->window_list, link) {
+		if (window->id != id)
+			continue;
+
+		if (window->dirty & WINDOW_REMOVED)
+			return NULL;
+		return window;
+	}
+
+	return NULL;
+}
+
+static int flush_timeout(void *data)
+{
+	shell_window_list_flush(data);
+
+	return 0;
+}
+
+/* Operations are queued by id and only resolved on commit, so windows
+ * that went away in between are simply skipped. */
+struct window_transaction {
+	struct shell_window_list *list;
+	struct wl_array ops;	/* struct transaction_op */
+};
+
+struct transaction_op {
+	enum shell_window_op_type type;
+	uint32_t id;
+	struct weston_seat *seat;
+	uint32_t workspace;
+};
+
+static void transaction_queue(struct wl_resource *resource,
+			      enum shell_window_op_type type, uint32_t id,
+			      struct weston_seat *seat, uint32_t workspace)
+{
+	struct window_transaction *transaction =
+		wl_resource_get_user_data(resource);
+	struct transaction_op *op;
+
+	op = wl_array_add(&transaction->ops, sizeof *op);
+	if (!op) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	op->type = type;
+	op->id = id;
+	op->seat = seat;
+	op->workspace = workspace;
+}
+
+static void transaction_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void transaction_activate(struct wl_client *client,
+				 struct wl_resource *resource, uint32_t id,
+				 struct wl_resource *seat_resource)
+{
+	struct weston_seat *seat = wl_resource_get_user_data(seat_resource);
+
+	/* a seat that went away has nothing to hand the focus to */
+	if (seat == NULL)
+		return;
+
+	transaction_queue(resource, SHELL_WINDOW_ACTIVATE, id, seat, 0);
+}
+
+static void transaction_minimize(struct wl_client *client,
+				 struct wl_resource *resource, uint32_t id)
+{
+	transaction_queue(resource, SHELL_WINDOW_MINIMIZE, id, NULL, 0);
+}
+
+static void transaction_close(struct wl_client *client,
+			      struct wl_resource *resource, uint32_t id)
+{
+	transaction_queue(resource, SHELL_WINDOW_CLOSE, id, NULL, 0);
+}
+
+static void transaction_move_to_workspace(struct wl_client *client,
+					  struct wl_resource *resource,
+					  uint32_t id, uint32_t workspace)
+{
+	transaction_queue(resource, SHELL_WINDOW_MOVE, id, NULL, workspace);
+}
+
+static void transaction_commit(struct wl_client *client,
+			       struct wl_resource *resource)
+{
+	struct window_transaction *transaction =
+		wl_resource_get_user_data(resource);
+	struct shell_window_list *list = transaction->list;
+	struct transaction_op *op;
+	struct shell_window_op *ops;
+	unsigned int count = 0;
+
+	ops = calloc(transaction->ops.size / sizeof *op + 1, sizeof *ops);
+	if (!ops) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_array_for_each(op, &transaction->ops) {
+		ops[count].window = shell_window_list_find(list, op->id);
+		if (!ops[count].window)
+			continue;
+
+		ops[count].type = op->type;
+		ops[count].seat = op->seat;
+		ops[count].workspace = op->workspace;
+		count++;
+	}
+
+	if (count > 0 && list->commit)
+		list->commit(list->commit_data, ops, count);
+	free(ops);
+
+	wl_resource_destroy(resource);
+}
+
+static const struct ms_window_transaction_interface transaction_implementation = {
+	transaction_destroy,
+	transaction_activate,
+	transaction_minimize,
+	transaction_close,
+	transaction_move_to_workspace,
+	transaction_commit,
+};
+
+static void transaction_free(struct wl_resource *resource)
+{
+	struct window_transaction *transaction =
+		wl_resource_get_user_data(resource);
+
+	wl_array_release(&transaction->ops);
+	free(transaction);
+}
+
+static void window_list_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void window_list_create_transaction(struct wl_client *client,
+					   struct wl_resource *resource,
+					   uint32_t id)
+{
+	struct window_transaction *transaction;
+	struct wl_resource *transaction_resource;
+
+	transaction = zalloc(sizeof *transaction);
+	if (!transaction) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	transaction->list = wl_resource_get_user_data(resource);
+	wl_array_init(&transaction->ops);
+
+	transaction_resource =
+		wl_resource_create(client, &ms_window_transaction_interface,
+				   1, id);
+	if (!transaction_resource) {
+		free(transaction);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(transaction_resource,
+				       &transaction_implementation,
+				       transaction, transaction_free);
+}
+
+static const struct ms_window_list_interface window_list_implementation = {
+	window_list_destroy,
+	window_list_create_transaction,
+};
+
+static void unbind_window_list(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void bind_window_list(struct wl_client *client, void *data,
+			     uint32_t version, uint32_t id)
+{
+	struct shell_window_list *list = data;
+	struct shell_window *window;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &ms_window_list_interface, 1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &window_list_implementation,
+				       list, unbind_window_list);
+	wl_list_insert(&list->resource_list, wl_resource_get_link(resource));
+
+	/* Windows not announced yet come with the next flush like for
+	 * everybody else, the rest are sent as they are now; what changed
+	 * about them since is sent again then, which is harmless. */
+	wl_list_for_each(window, &list->window_list, link) {
+		if (window->dirty & WINDOW_ADDED)
+			continue;
+
+		window_send(resource, window, WINDOW_ALL);
+	}
+	ms_window_list_send_done(resource);
+}
+
+int shell_window_list_init(struct shell_window_list *list,
+			   struct wl_display *display,
+			   shell_window_commit_func_t commit, void *data)
+{
+	memset(list, 0, sizeof *list);
+	list->display = display;
+	list->commit = commit;
+	list->commit_data = data;
+	list->next_id = 1;
+	wl_list_init(&list->resource_list);
+	wl_list_init(&list->window_list);
+	wl_list_init(&list->dirty_list);
+	wl_signal_init(&list->change_signal);
+
+	list->flush_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(display),
+					flush_timeout, list);
+	if (!list->flush_timer)
+		return -1;
+
+	list->global = wl_global_create(display, &ms_window_list_interface, 1,
+					list, bind_window_list);
+	if (!list->global) {
+		wl_event_source_remove(list->flush_timer);
+		list->flush_timer = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void shell_window_list_release(struct shell_window_list *list)
+{
+	struct shell_window *window, *next;
+	struct wl_resource *resource, *tmp;
+
+	if (list->global)
+		wl_global_destroy(list->global);
+	if (list->flush_timer)
+		wl_event_source_remove(list->flush_timer);
+
+	/* the clients may outlive the shell */
+	wl_resource_for_each_safe(resource, tmp, &list->resource_list) {
+		wl_list_remove(wl_resource_get_link(resource));
+		wl_list_init(wl_resource_get_link(resource));
+	}
+
+	wl_list_for_each_safe(window, next, &list->window_list, link)
+		window_free(window);
+}
+
+struct shell_window *shell_window_create(struct shell_window_list *list)
+{
+	struct shell_window *window;
+
+	window = zalloc(sizeof *window);
+	if (!window)
+		return NULL;
+
+	window->list = list;
+	window->id = list->next_id++;
+	wl_list_insert(list->window_list.prev, &window->link);
+	wl_list_init(&window->dirty_link);
+	window_mark_dirty(window, WINDOW_ALL);
+
+	return window;
+}
+
+void shell_window_destroy(struct shell_window *window)
+{
+	/* nobody has heard of it yet */
+	if (window->dirty & WINDOW_ADDED) {
+		window_free(window);
+		return;
+	}
+
+	/* whatever else changed does not matter any more */
+	if (window->dirty)
+		window->dirty = WINDOW_REMOVED;
+	else
+		window_mark_dirty(window, WINDOW_REMOVED);
+}
+
+static bool string_update(char **field, const char *value)
+{
+	char *copy;
+
+	if (*field && value && strcmp(*field, value) == 0)
+		return false;
+	if (!*field && !value)
+		return false;
+
+	copy = value ? strdup(value) : NULL;
+	if (value && !copy)
+		return false;
+
+	free(*field);
+	*field = copy;
+	return true;
+}
+
+void shell_window_set_title(struct shell_window *window, const char *title)
+{
+	if (string_update(&window->title, title))
+		window_mark_dirty(window, WINDOW_TITLE);
+}
+
+void shell_window_set_app_id(struct shell_window *window, const char *app_id)
+{
+	if (string_update(&window->app_id, app_id))
+		window_mark_dirty(window, WINDOW_APP_ID);
+}
+
+void shell_window_set_workspace(struct shell_window *window,
+				uint32_t workspace)
+{
+	if (window->workspace == workspace)
+		return;
+
+	window->workspace = workspace;
+	window_mark_dirty(window, WINDOW_WORKSPACE);
+}
+
+void shell_window_set_state(struct shell_window *window, uint32_t state)
+{
+	if (window->state == state)
+		return;
+
+	window->state = state;
+	window_mark_dirty(window, WINDOW_STATE);
+}
@@ -0,0 +1,106 @@
+#ifndef WINDOW_LIST_H
+#define WINDOW_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-server.h>
+
+struct shell_window;
+struct weston_seat;
+
+enum shell_window_op_type {
+	SHELL_WINDOW_ACTIVATE,
+	SHELL_WINDOW_MINIMIZE,
+	SHELL_WINDOW_CLOSE,
+	SHELL_WINDOW_MOVE,
+};
+
+struct shell_window_op {
+	enum shell_window_op_type type;
+	struct shell_window *window;
+	struct weston_seat *seat;	/* SHELL_WINDOW_ACTIVATE */
+	uint32_t workspace;		/* SHELL_WINDOW_MOVE */
+};
+
+/* What changed about a window since the last flush. */
+enum shell_window_field {
+	WINDOW_ADDED = 1 << 0,
+	WINDOW_REMOVED = 1 << 1,
+	WINDOW_TITLE = 1 << 2,
+	WINDOW_APP_ID = 1 << 3,
+	WINDOW_WORKSPACE = 1 << 4,
+	WINDOW_STATE = 1 << 5,
+
+	WINDOW_ALL = WINDOW_ADDED | WINDOW_TITLE | WINDOW_APP_ID |
+		WINDOW_WORKSPACE | WINDOW_STATE
+};
+
+/* Carries out the operations of a committed transaction, in order. */
+typedef void (*shell_window_commit_func_t)(void *data,
+					   struct shell_window_op *ops,
+					   unsigned int count);
+
+/* The ms_window_list global. The shell reports every change to a window
+ * as it happens; only the windows marked dirty are sent, once per frame,
+ * and only what changed about them. */
+struct shell_window_list {
+	struct wl_display *display;
+	struct wl_global *global;
+	struct wl_list resource_list;
+
+	struct wl_list window_list;	/* struct shell_window, oldest first */
+	struct wl_list dirty_list;	/* struct shell_window::dirty_link */
+	uint32_t next_id;
+
+	shell_window_commit_func_t commit;
+	void *commit_data;
+
+	/* emitted on flush for every window that changed, with its dirty
+	 * fields still set */
+	struct wl_signal change_signal;
+
+	/* flushes when no output repaints for a while */
+	struct wl_event_source *flush_timer;
+};
+
+struct shell_window {
+	struct shell_window_list *list;
+	struct wl_list link;
+	struct wl_list dirty_link;
+	uint32_t id;
+	void *data;		/* the owner's */
+
+	char *title;
+	char *app_id;
+	uint32_t workspace;
+	uint32_t state;		/* enum ms_window_list_state */
+
+	uint32_t dirty;		/* fields not sent yet */
+};
+
+int shell_window_list_init(struct shell_window_list *list,
+			   struct wl_display *display,
+			   shell_window_commit_func_t commit, void *data);
+
+void shell_window_list_release(struct shell_window_list *list);
+
+void shell_window_list_flush(struct shell_window_list *list);
+
+struct shell_window *shell_window_list_find(struct shell_window_list *list,
+					    uint32_t id);
+
+struct shell_window *shell_window_create(struct shell_window_list *list);
+
+void shell_window_destroy(struct shell_window *window);
+
+void shell_window_set_title(struct shell_window *window, const char *title);
+
+void shell_window_set_app_id(struct shell_window *window, const char *app_id);
+
+void shell_window_set_workspace(struct shell_window *window,
+				uint32_t workspace);
+
+void shell_window_set_state(struct shell_window *window, uint32_t state);
+
+#endif